@@ -0,0 +1,882 @@
+﻿/*
+ * SPDX-FileCopyrightText: 2018 seri14
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+// Measures the encoders save_image uses on synthetic frames and on raw images recorded with the raw image format, and prints one result per encoder setting as CSV or JSON.
+// Settings are picked with --filter matching e.g. "libpng", "format=6", "level=9", "tiff=5" or "backend=libdeflate" in the label of a run.
+// With --kernels the pixel conversion kernels are measured instead, once for every instruction set the processor supports, e.g. "--kernels --filter avx2".
+// With --paths the expansion of screenshot path templates is measured instead, which happens for every saved image.
+// Usage: screenshot_benchmark [--resolutions 1080p,1440p,4k,8k] [--iterations N] [--grid] [--hdr] [--kernels] [--paths] [--threads N] [--filter TEXT] [--output DIRECTORY] [--json] [FILE.raw ...]
+
+#include "pixel_convert.hpp"
+#include "screenshot_encoder.hpp"
+#include "screenshot_output.hpp"
+#include "screenshot_path.hpp"
+#include "screenshot_raw.hpp"
+#include "std_string_ext.hpp"
+
+#include <fpng.h>
+#include <png.h>
+#include <tiff.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Values of screenshot_kind and reshade::api::format, which are not available without the add-on
+constexpr uint32_t kind_depth = 5;
+constexpr uint32_t format_r16g16b16a16_unorm = 11;
+
+struct frame
+{
+    std::string name;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    /// <summary>
+    /// 8 or 16 for RGBA pixels, 32 for floating-point depth.
+    /// </summary>
+    unsigned int bit_depth = 8;
+    std::vector<uint8_t> pixels;
+};
+
+struct settings
+{
+    unsigned int image_format = 0;
+    int png_filters = PNG_ALL_FILTERS;
+    int compression_level = Z_BEST_COMPRESSION;
+    int compression_strategy = Z_RLE;
+    int tiff_compression = COMPRESSION_LZW;
+    uint32_t tiff_tile_size = 0;
+    screenshot_deflate_backend deflate_backend = screenshot_deflate_backend::zlib;
+};
+
+struct options
+{
+    std::vector<std::pair<uint32_t, uint32_t>> resolutions;
+    std::vector<std::filesystem::path> files;
+    std::filesystem::path output_directory = std::filesystem::temp_directory_path() / "screenshot_benchmark";
+    std::string filter;
+    unsigned int iterations = 3;
+    unsigned int threads = std::max(1u, std::thread::hardware_concurrency());
+    bool grid = false;
+    bool hdr = false;
+    bool kernels = false;
+    bool paths = false;
+    bool json = false;
+};
+
+static uint32_t next_random(uint32_t &state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+/// <summary>
+/// Builds a frame that compresses roughly like a rendered scene: smooth gradients for sky and lighting, flat panels like a user interface, detailed texture and a little noise everywhere.
+/// </summary>
+static frame make_synthetic_frame(uint32_t width, uint32_t height, unsigned int bit_depth)
+{
+    frame f;
+    f.name = std::format("synthetic-%ux%u", width, height);
+    f.width = width;
+    f.height = height;
+    f.bit_depth = bit_depth;
+    f.pixels.resize(static_cast<size_t>(width) * height * (bit_depth / 8) * 4);
+
+    uint32_t random = 0x9E3779B9;
+
+    for (uint32_t y = 0; y < height; ++y)
+    {
+        for (uint32_t x = 0; x < width; ++x)
+        {
+            const float u = static_cast<float>(x) / width, v = static_cast<float>(y) / height;
+
+            float rgb[3];
+            if (v < 0.4f)
+            {
+                // Sky
+                rgb[0] = 0.35f + 0.3f * v;
+                rgb[1] = 0.55f + 0.2f * v;
+                rgb[2] = 0.9f - 0.1f * u;
+            }
+            else
+            {
+                // Ground with a repeating pattern, to give the filters and the matcher something to find
+                const float detail = 0.5f + 0.25f * std::sin(x * 0.21f) * std::cos(y * 0.17f) + 0.25f * std::sin((x + y) * 0.043f);
+                rgb[0] = 0.3f * detail + 0.2f * u;
+                rgb[1] = 0.45f * detail;
+                rgb[2] = 0.2f * detail + 0.1f * v;
+            }
+
+            // Panels along the bottom and in a corner, like a user interface
+            const bool panel = (v > 0.88f && u > 0.05f && u < 0.6f) || (u > 0.8f && v < 0.15f);
+            if (panel)
+                rgb[0] = rgb[1] = rgb[2] = 0.08f;
+
+            const size_t index = (static_cast<size_t>(y) * width + x) * 4;
+            for (int c = 0; c < 3; ++c)
+            {
+                const float noise = panel ? 0.0f : ((next_random(random) & 0xFF) / 255.0f - 0.5f) * (1.0f / 64);
+                const float value = std::clamp(rgb[c] + noise, 0.0f, 1.0f);
+
+                if (bit_depth == 16)
+                    reinterpret_cast<uint16_t *>(f.pixels.data())[index + c] = static_cast<uint16_t>(value * 65535.0f + 0.5f);
+                else
+                    f.pixels[index + c] = static_cast<uint8_t>(value * 255.0f + 0.5f);
+            }
+
+            if (bit_depth == 16)
+                reinterpret_cast<uint16_t *>(f.pixels.data())[index + 3] = 0xFFFF;
+            else
+                f.pixels[index + 3] = 0xFF;
+        }
+    }
+
+    return f;
+}
+
+/// <summary>
+/// Builds a depth buffer with a floor that recedes towards the horizon and a few objects in front of it.
+/// </summary>
+static frame make_synthetic_depth(uint32_t width, uint32_t height)
+{
+    frame f;
+    f.name = std::format("synthetic-depth-%ux%u", width, height);
+    f.width = width;
+    f.height = height;
+    f.bit_depth = 32;
+    f.pixels.resize(static_cast<size_t>(width) * height * sizeof(float));
+
+    float *const depth = reinterpret_cast<float *>(f.pixels.data());
+
+    for (uint32_t y = 0; y < height; ++y)
+    {
+        for (uint32_t x = 0; x < width; ++x)
+        {
+            const float u = static_cast<float>(x) / width, v = static_cast<float>(y) / height;
+
+            float value = v < 0.4f ? 1.0f : 1.0f - (v - 0.4f) * 1.5f;
+            for (int i = 0; i < 4; ++i)
+            {
+                const float cx = 0.15f + i * 0.22f, cy = 0.6f + (i % 2) * 0.1f;
+                if (std::abs(u - cx) < 0.06f && std::abs(v - cy) < 0.12f)
+                    value = std::min(value, 0.2f + i * 0.1f + (v - cy) * 0.05f);
+            }
+
+            depth[static_cast<size_t>(y) * width + x] = value;
+        }
+    }
+
+    return f;
+}
+
+/// <summary>
+/// Loads an image written with the raw image format, which keeps the pixels exactly as they were captured.
+/// </summary>
+static bool load_raw_frame(const std::filesystem::path &path, frame &f)
+{
+    std::ifstream file(path, std::ios::binary);
+
+    screenshot_raw_header header{};
+    if (!file.read(reinterpret_cast<char *>(&header), sizeof(header)) || header.spill.magic != screenshot_raw_magic || header.spill.captures != 1)
+        return false;
+
+    f.name = path.filename().u8string();
+    f.width = header.spill.width;
+    f.height = header.spill.height;
+    f.bit_depth = header.capture.kind == kind_depth ? 32 : header.capture.texture_format == format_r16g16b16a16_unorm ? 16 : 8;
+
+    const size_t size = static_cast<size_t>(f.width) * f.height * (f.bit_depth == 32 ? 4 : (f.bit_depth / 8) * 4);
+    if (sizeof(uint32_t) * header.capture.size < size)
+        return false;
+
+    f.pixels.resize(size);
+    return static_cast<bool>(file.read(reinterpret_cast<char *>(f.pixels.data()), size));
+}
+
+static const char *get_encoder_name(unsigned int image_format, const frame &f)
+{
+    if (f.bit_depth == 32)
+        return "depth-tiff";
+
+    switch (image_format)
+    {
+    case 0:
+    case 1:
+        return "libpng";
+    case 2:
+    case 3:
+        return "fpng";
+    case 4:
+    case 5:
+        return "tiff";
+    case 6:
+    case 7:
+        return "parallel-png";
+    case 8:
+        return "raw";
+    default:
+        return "unknown";
+    }
+}
+
+static bool uses_zlib(unsigned int image_format)
+{
+    return image_format <= 1 || image_format == 6 || image_format == 7;
+}
+
+/// <summary>
+/// Backends the benchmark was built with, so that each of them is measured against zlib.
+/// </summary>
+static std::vector<screenshot_deflate_backend> get_deflate_backends()
+{
+    std::vector<screenshot_deflate_backend> result;
+    for (const screenshot_deflate_backend backend : { screenshot_deflate_backend::zlib, screenshot_deflate_backend::libdeflate })
+        if (screenshot_deflate::is_available(backend))
+            result.push_back(backend);
+    return result;
+}
+
+static void add_tiff_settings(std::vector<settings> &result, unsigned int image_format)
+{
+    for (const int tiff_compression : { COMPRESSION_NONE, COMPRESSION_LZW })
+    {
+        settings &s = result.emplace_back();
+        s.image_format = image_format;
+        s.tiff_compression = tiff_compression;
+    }
+    for (const screenshot_deflate_backend backend : get_deflate_backends())
+    {
+        settings &s = result.emplace_back();
+        s.image_format = image_format;
+        s.compression_level = Z_DEFAULT_COMPRESSION;
+        s.tiff_compression = COMPRESSION_ADOBE_DEFLATE;
+        s.deflate_backend = backend;
+    }
+
+    // Tiles instead of strips, to see what the padding at the edges and the shorter rows cost
+    settings &s = result.emplace_back();
+    s.image_format = image_format;
+    s.tiff_compression = COMPRESSION_LZW;
+    s.tiff_tile_size = 256;
+}
+
+/// <summary>
+/// Runs a parallel_for on a new set of threads each time, which is close enough to the worker threads of the add-on for images of this size.
+/// </summary>
+static screenshot_encoder::parallel_for_fn make_parallel_for(unsigned int threads)
+{
+    if (threads <= 1)
+        return {};
+
+    return [threads](size_t count, const std::function<void(size_t)> &fn) {
+        std::atomic<size_t> next = 0;
+        const auto run = [&]() {
+            for (size_t index; (index = next.fetch_add(1)) < count;)
+                fn(index);
+        };
+
+        std::vector<std::thread> pool;
+        for (unsigned int i = 1; i < std::min<size_t>(threads, count); ++i)
+            pool.emplace_back(run);
+        run();
+        for (std::thread &thread : pool)
+            thread.join();
+    };
+}
+
+static bool encode(const settings &s, const frame &f, std::vector<uint8_t> &pixels, const std::filesystem::path &file, unsigned int threads, uint64_t &output_size)
+{
+    screenshot_encoder encoder;
+    encoder.png_filters = s.png_filters;
+    encoder.compression_level = s.compression_level;
+    encoder.compression_strategy = s.compression_strategy;
+    encoder.deflate_backend = s.deflate_backend;
+    encoder.tiff_compression = s.tiff_compression;
+    encoder.tiff_tile_size = s.tiff_tile_size;
+
+    const unsigned int channels = s.image_format % 2 == 0 ? 3 : 4;
+    const time_t mod_time = time(nullptr);
+
+    std::error_code ec;
+    screenshot_output output;
+    if (!output.open(file, 1024 * 768, ec))
+        return false;
+
+    bool encoded = false;
+    if (f.bit_depth == 32)
+        encoded = encoder.write_depth_tiff(output, reinterpret_cast<const float *>(pixels.data()), f.width, f.height, mod_time, make_parallel_for(threads));
+    else if (s.image_format == 0 || s.image_format == 1)
+        encoded = encoder.write_png(output, pixels.data(), f.width, f.height, channels, f.bit_depth, mod_time);
+    else if (s.image_format == 2 || s.image_format == 3)
+        encoded = screenshot_encoder::write_fpng(output, pixels.data(), f.width, f.height, channels);
+    else if (s.image_format == 4 || s.image_format == 5)
+        encoded = encoder.write_tiff(output, pixels.data(), f.width, f.height, channels, f.bit_depth, mod_time, make_parallel_for(threads));
+    else if (s.image_format == 6 || s.image_format == 7)
+        encoded = encoder.write_parallel_png(output, pixels.data(), f.width, f.height, channels, f.bit_depth, mod_time, make_parallel_for(threads));
+    else if (s.image_format == 8)
+        encoded = output.write(pixels.data(), pixels.size());
+
+    if (!encoded || !output.commit(std::chrono::system_clock::now(), ec))
+        return false;
+
+    output_size = output.size();
+    return true;
+}
+
+/// <summary>
+/// Converts the frame into what the encoder of <paramref name="image_format"/> is given in save_image, which is not part of the measurement.
+/// </summary>
+static std::vector<uint8_t> convert_for(unsigned int image_format, const frame &f)
+{
+    std::vector<uint8_t> pixels = f.pixels;
+    if (f.bit_depth == 32 || image_format == 8)
+        return pixels;
+
+    const size_t count = static_cast<size_t>(f.width) * f.height;
+
+    if (image_format == 2 || image_format == 3)
+    {
+        if (f.bit_depth == 16)
+        {
+            pixel_convert::rgba16_to_rgba8(pixels.data(), reinterpret_cast<const uint16_t *>(pixels.data()), count);
+            pixels.resize(count * 4);
+        }
+        if (image_format == 2)
+            pixel_convert::rgba_to_rgb(pixels.data(), pixels.data(), count);
+    }
+    else if (image_format % 2 == 0)
+    {
+        if (f.bit_depth == 16)
+            pixel_convert::rgba16_to_rgb16(reinterpret_cast<uint16_t *>(pixels.data()), reinterpret_cast<const uint16_t *>(pixels.data()), count);
+        else
+            pixel_convert::rgba_to_rgb(pixels.data(), pixels.data(), count);
+    }
+
+    return pixels;
+}
+
+/// <summary>
+/// Lists the settings to measure for a frame. Without <paramref name="grid"/> the zlib settings are varied one at a time around the defaults and the presets of the Settings window, with it every combination is measured.
+/// </summary>
+static std::vector<settings> make_settings(const frame &f, bool grid)
+{
+    std::vector<settings> result;
+
+    if (f.bit_depth == 32)
+    {
+        add_tiff_settings(result, 4);
+        return result;
+    }
+
+    static const int filters[] = { PNG_NO_FILTERS, PNG_FILTER_NONE, PNG_FILTER_SUB, PNG_FILTER_UP, PNG_FILTER_AVG, PNG_FILTER_PAETH, PNG_FAST_FILTERS, PNG_ALL_FILTERS };
+    static const int levels[] = { Z_DEFAULT_COMPRESSION, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 };
+    static const int strategies[] = { Z_DEFAULT_STRATEGY, Z_FILTERED, Z_HUFFMAN_ONLY, Z_RLE, Z_FIXED };
+
+    std::vector<settings> zlib_settings;
+    const auto add_zlib = [&zlib_settings](int png_filters, int compression_level, int compression_strategy) {
+        for (const settings &s : zlib_settings)
+            if (s.png_filters == png_filters && s.compression_level == compression_level && s.compression_strategy == compression_strategy)
+                return;
+        settings &s = zlib_settings.emplace_back();
+        s.png_filters = png_filters;
+        s.compression_level = compression_level;
+        s.compression_strategy = compression_strategy;
+    };
+
+    if (grid)
+    {
+        for (const int png_filters : filters)
+            for (const int compression_level : levels)
+                for (const int compression_strategy : strategies)
+                    add_zlib(png_filters, compression_level, compression_strategy);
+    }
+    else
+    {
+        // Presets of the Settings window
+        add_zlib(PNG_ALL_FILTERS, Z_BEST_COMPRESSION, Z_RLE);
+        add_zlib(PNG_FAST_FILTERS, Z_BEST_SPEED, Z_HUFFMAN_ONLY);
+        add_zlib(PNG_NO_FILTERS, Z_BEST_COMPRESSION, Z_RLE);
+
+        for (const int png_filters : filters)
+            add_zlib(png_filters, Z_BEST_COMPRESSION, Z_RLE);
+        for (const int compression_level : levels)
+            add_zlib(PNG_ALL_FILTERS, compression_level, Z_RLE);
+        for (const int compression_strategy : strategies)
+            add_zlib(PNG_ALL_FILTERS, Z_BEST_COMPRESSION, compression_strategy);
+    }
+
+    for (unsigned int image_format = 0; image_format <= 8; ++image_format)
+    {
+        if (uses_zlib(image_format))
+        {
+            for (const screenshot_deflate_backend backend : get_deflate_backends())
+            {
+                for (settings s : zlib_settings)
+                {
+                    s.image_format = image_format;
+                    s.deflate_backend = backend;
+                    result.push_back(s);
+                }
+            }
+        }
+        else if (image_format == 4 || image_format == 5)
+        {
+            add_tiff_settings(result, image_format);
+        }
+        else
+        {
+            result.emplace_back().image_format = image_format;
+        }
+    }
+
+    return result;
+}
+
+static std::string escape_json(const std::string &value)
+{
+    std::string result;
+    for (const char c : value)
+    {
+        if (c == '"' || c == '\\')
+            result += '\\';
+        if (static_cast<unsigned char>(c) < 0x20)
+            result += std::format("\\u%04x", c);
+        else
+            result += c;
+    }
+    return result;
+}
+
+static bool parse_options(int argc, char *argv[], options &opts)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        const std::string arg = argv[i];
+        const bool has_value = i + 1 < argc;
+
+        if (arg == "--resolutions" && has_value)
+        {
+            opts.resolutions.clear();
+            for (std::string list = argv[++i]; !list.empty();)
+            {
+                const size_t end = list.find(',');
+                const std::string name = list.substr(0, end);
+                list = end == std::string::npos ? std::string() : list.substr(end + 1);
+
+                if (name == "1080p")
+                    opts.resolutions.emplace_back(1920, 1080);
+                else if (name == "1440p")
+                    opts.resolutions.emplace_back(2560, 1440);
+                else if (name == "4k")
+                    opts.resolutions.emplace_back(3840, 2160);
+                else if (name == "8k")
+                    opts.resolutions.emplace_back(7680, 4320);
+                else if (unsigned int width = 0, height = 0; sscanf(name.c_str(), "%ux%u", &width, &height) == 2 && width != 0 && height != 0)
+                    opts.resolutions.emplace_back(width, height);
+                else
+                    return false;
+            }
+        }
+        else if (arg == "--iterations" && has_value)
+            opts.iterations = std::max(1, atoi(argv[++i]));
+        else if (arg == "--threads" && has_value)
+            opts.threads = std::max(1, atoi(argv[++i]));
+        else if (arg == "--filter" && has_value)
+            opts.filter = argv[++i];
+        else if (arg == "--output" && has_value)
+            opts.output_directory = argv[++i];
+        else if (arg == "--grid")
+            opts.grid = true;
+        else if (arg == "--hdr")
+            opts.hdr = true;
+        else if (arg == "--kernels")
+            opts.kernels = true;
+        else if (arg == "--paths")
+            opts.paths = true;
+        else if (arg == "--json")
+            opts.json = true;
+        else if (arg.size() > 2 && arg.compare(0, 2, "--") == 0)
+            return false;
+        else
+            opts.files.emplace_back(arg);
+    }
+
+    return true;
+}
+
+struct kernel
+{
+    const char *name;
+    /// <summary>
+    /// Bytes per pixel the kernel reads, which the throughput is computed from.
+    /// </summary>
+    unsigned int pixel_size;
+    void (*run)(uint8_t *dst, uint8_t *src, uint32_t width, uint32_t height);
+};
+
+// The kernels save_image and the duplicate check use, with arguments like the ones they are given there
+static const kernel kernels[] = {
+    { "rgba_to_rgb", 4, [](uint8_t *dst, uint8_t *src, uint32_t width, uint32_t height) {
+        pixel_convert::rgba_to_rgb(dst, src, static_cast<size_t>(width) * height); } },
+    { "rgba_to_rgb in place", 4, [](uint8_t *, uint8_t *src, uint32_t width, uint32_t height) {
+        pixel_convert::rgba_to_rgb(src, src, static_cast<size_t>(width) * height); } },
+    { "swap_red_blue", 4, [](uint8_t *, uint8_t *src, uint32_t width, uint32_t height) {
+        pixel_convert::swap_red_blue(reinterpret_cast<uint32_t *>(src), static_cast<size_t>(width) * height); } },
+    { "force_opaque", 4, [](uint8_t *, uint8_t *src, uint32_t width, uint32_t height) {
+        pixel_convert::force_opaque(reinterpret_cast<uint32_t *>(src), static_cast<size_t>(width) * height); } },
+    { "r10g10b10a2_to_rgba16", 4, [](uint8_t *dst, uint8_t *src, uint32_t width, uint32_t height) {
+        pixel_convert::r10g10b10a2_to_rgba16(reinterpret_cast<uint16_t *>(dst), reinterpret_cast<const uint32_t *>(src), static_cast<size_t>(width) * height, false, pixel_convert::transfer_function::none, 0.0f); } },
+    { "r10g10b10a2_to_rgba16 pq", 4, [](uint8_t *dst, uint8_t *src, uint32_t width, uint32_t height) {
+        pixel_convert::r10g10b10a2_to_rgba16(reinterpret_cast<uint16_t *>(dst), reinterpret_cast<const uint32_t *>(src), static_cast<size_t>(width) * height, false, pixel_convert::transfer_function::pq, 1000.0f); } },
+    { "rgba16f_to_rgba16", 8, [](uint8_t *dst, uint8_t *src, uint32_t width, uint32_t height) {
+        pixel_convert::rgba16f_to_rgba16(reinterpret_cast<uint16_t *>(dst), reinterpret_cast<const uint16_t *>(src), static_cast<size_t>(width) * height, pixel_convert::transfer_function::none, 0.0f); } },
+    { "rgba16f_to_rgba16 scrgb", 8, [](uint8_t *dst, uint8_t *src, uint32_t width, uint32_t height) {
+        pixel_convert::rgba16f_to_rgba16(reinterpret_cast<uint16_t *>(dst), reinterpret_cast<const uint16_t *>(src), static_cast<size_t>(width) * height, pixel_convert::transfer_function::scrgb, 1000.0f); } },
+    { "rgba16_to_rgb16", 8, [](uint8_t *, uint8_t *src, uint32_t width, uint32_t height) {
+        pixel_convert::rgba16_to_rgb16(reinterpret_cast<uint16_t *>(src), reinterpret_cast<const uint16_t *>(src), static_cast<size_t>(width) * height); } },
+    { "rgba16_to_rgba8", 8, [](uint8_t *, uint8_t *src, uint32_t width, uint32_t height) {
+        pixel_convert::rgba16_to_rgba8(src, reinterpret_cast<const uint16_t *>(src), static_cast<size_t>(width) * height); } },
+    { "byte_swap16", 8, [](uint8_t *, uint8_t *src, uint32_t width, uint32_t height) {
+        pixel_convert::byte_swap16(reinterpret_cast<uint16_t *>(src), static_cast<size_t>(width) * height * 4); } },
+    { "hash", 4, [](uint8_t *dst, uint8_t *src, uint32_t width, uint32_t height) {
+        // Stored, so that the compiler cannot drop the call
+        const uint64_t hash = pixel_convert::hash(src, static_cast<size_t>(width) * height * 4);
+        std::memcpy(dst, &hash, sizeof(hash)); } },
+    // Two identical frames, which is the slowest case since every row has to be compared
+    { "find_changed_rect", 4, [](uint8_t *dst, uint8_t *src, uint32_t width, uint32_t height) {
+        uint32_t x, y, rect_width, rect_height;
+        pixel_convert::find_changed_rect(src, dst, width, height, static_cast<size_t>(width) * 4, 4, x, y, rect_width, rect_height); } },
+};
+
+/// <summary>
+/// Measures every pixel conversion kernel with every instruction set the processor supports on frames of each resolution, and prints one result per kernel and instruction set.
+/// </summary>
+static int run_kernels(const options &opts)
+{
+    const pixel_convert::instruction_set previous = pixel_convert::current_instruction_set();
+
+    if (opts.json)
+        printf("{\"results\":[");
+    else
+        printf("kernel,instruction_set,width,height,iterations,ms_per_frame,mb_per_s\n");
+
+    bool first = true;
+
+    for (const auto &[width, height] : opts.resolutions)
+    {
+        // Random pixels, so that no kernel gets to skip work, with space for the largest pixel size
+        std::vector<uint8_t> input(static_cast<size_t>(width) * height * 8);
+        uint32_t random = 0x9E3779B9;
+        for (size_t i = 0; i < input.size(); i += sizeof(uint32_t))
+        {
+            const uint32_t value = next_random(random);
+            std::memcpy(input.data() + i, &value, sizeof(value));
+        }
+
+        std::vector<uint8_t> src(input.size()), dst(input.size());
+
+        for (const kernel &k : kernels)
+        {
+            for (const pixel_convert::instruction_set set : { pixel_convert::instruction_set::scalar, pixel_convert::instruction_set::sse2, pixel_convert::instruction_set::avx2, pixel_convert::instruction_set::neon })
+            {
+                const char *const set_name = pixel_convert::get_instruction_set_name(set);
+
+                const std::string label = std::format("%s %s %ux%u", k.name, set_name, width, height);
+                if (!opts.filter.empty() && label.find(opts.filter) == std::string::npos)
+                    continue;
+                if (!pixel_convert::select_instruction_set(set))
+                    continue;
+
+                std::vector<double> durations;
+
+                for (unsigned int i = 0; i < opts.iterations; ++i)
+                {
+                    // Kernels that work in place change their input, so each run starts from a fresh copy
+                    std::memcpy(src.data(), input.data(), input.size());
+                    std::memcpy(dst.data(), input.data(), input.size());
+
+                    const auto begin = std::chrono::steady_clock::now();
+                    k.run(dst.data(), src.data(), width, height);
+                    const auto end = std::chrono::steady_clock::now();
+
+                    durations.push_back(std::chrono::duration<double, std::milli>(end - begin).count());
+                }
+
+                std::sort(durations.begin(), durations.end());
+                const double ms = durations[durations.size() / 2];
+                const double mb_per_s = static_cast<double>(width) * height * k.pixel_size / 1e6 / (ms / 1e3);
+
+                if (opts.json)
+                    printf("%s\n{\"kernel\":\"%s\",\"instruction_set\":\"%s\",\"width\":%u,\"height\":%u,\"iterations\":%zu,\"ms_per_frame\":%.3f,\"mb_per_s\":%.2f}",
+                        first ? "" : ",", k.name, set_name, width, height, durations.size(), ms, mb_per_s);
+                else
+                    printf("\"%s\",%s,%u,%u,%zu,%.3f,%.2f\n", k.name, set_name, width, height, durations.size(), ms, mb_per_s);
+                fflush(stdout);
+
+                first = false;
+            }
+        }
+    }
+
+    if (opts.json)
+        printf("\n]}\n");
+
+    pixel_convert::select_instruction_set(previous);
+    return 0;
+}
+
+/// <summary>
+/// Measures parsing and expanding the default screenshot paths and a few longer ones, and prints one result for each.
+/// </summary>
+static int run_paths(const options &opts)
+{
+    const char *const paths[] = {
+        "Screenshots/<APP> <DATE>.png",
+        "Screenshots/<APP>/<DATE:%Y-%m-%d>/<APP> <DATE> <MYSETFRAME:D6>_<INDEX:D3> original.png",
+        "<PRESET>_<TOTALFRAME:5>_<TOTALTAKE:d2>_<MYSETTAKE>_<INDEX:D9>.ini",
+        "D:/Captures/A folder name without any macros in it/and another one/screenshot.png",
+    };
+
+    // Enough expansions per iteration that the clock resolution does not matter
+    constexpr unsigned int count = 100000;
+
+    screenshot_path_template::values values;
+    values.app = "Game";
+    values.preset = "MyPreset";
+    values.total_frame = 12345;
+    values.myset_frame = 42;
+    values.total_take = 7;
+    values.myset_take = 3;
+    values.index = 5;
+    values.time = std::chrono::system_clock::now();
+
+    if (opts.json)
+        printf("{\"results\":[");
+    else
+        printf("path,operation,iterations,ns_per_path\n");
+
+    bool first = true;
+
+    for (const char *path : paths)
+    {
+        for (const char *operation : { "parse", "expand" })
+        {
+            const std::string label = std::format("%s %s", operation, path);
+            if (!opts.filter.empty() && label.find(opts.filter) == std::string::npos)
+                continue;
+
+            const bool parse = std::strcmp(operation, "parse") == 0;
+            screenshot_path_template parsed(path);
+
+            std::vector<double> durations;
+
+            for (unsigned int i = 0; i < opts.iterations; ++i)
+            {
+                std::string result;
+
+                const auto begin = std::chrono::steady_clock::now();
+                for (unsigned int k = 0; k < count; ++k)
+                {
+                    if (parse)
+                        parsed = screenshot_path_template(path);
+                    else
+                        parsed.expand(values, result);
+                }
+                const auto end = std::chrono::steady_clock::now();
+
+                durations.push_back(std::chrono::duration<double, std::nano>(end - begin).count() / count);
+            }
+
+            std::sort(durations.begin(), durations.end());
+            const double ns = durations[durations.size() / 2];
+
+            if (opts.json)
+                printf("%s\n{\"path\":\"%s\",\"operation\":\"%s\",\"iterations\":%zu,\"ns_per_path\":%.1f}",
+                    first ? "" : ",", escape_json(path).c_str(), operation, durations.size(), ns);
+            else
+                printf("\"%s\",%s,%zu,%.1f\n", path, operation, durations.size(), ns);
+            fflush(stdout);
+
+            first = false;
+        }
+    }
+
+    if (opts.json)
+        printf("\n]}\n");
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    options opts;
+    opts.resolutions = { { 1920, 1080 }, { 2560, 1440 }, { 3840, 2160 }, { 7680, 4320 } };
+
+    if (!parse_options(argc, argv, opts))
+    {
+        fprintf(stderr, "Usage: %s [--resolutions 1080p,1440p,4k,8k,WxH] [--iterations N] [--grid] [--hdr] [--kernels] [--paths] [--threads N] [--filter TEXT] [--output DIRECTORY] [--json] [FILE.raw ...]\n", argv[0]);
+        return 2;
+    }
+
+    if (opts.kernels)
+        return run_kernels(opts);
+    if (opts.paths)
+        return run_paths(opts);
+
+    fpng::fpng_init();
+
+    std::error_code ec;
+    std::filesystem::create_directories(opts.output_directory, ec);
+
+    std::vector<frame> frames;
+    if (opts.files.empty())
+    {
+        for (const auto &[width, height] : opts.resolutions)
+        {
+            frames.push_back(make_synthetic_frame(width, height, 8));
+            if (opts.hdr)
+                frames.emplace_back(make_synthetic_frame(width, height, 16)).name += "-hdr";
+            frames.push_back(make_synthetic_depth(width, height));
+        }
+    }
+    else
+    {
+        for (const std::filesystem::path &path : opts.files)
+        {
+            if (frame &f = frames.emplace_back(); !load_raw_frame(path, f))
+            {
+                fprintf(stderr, "Failed to load raw image \"%s\"\n", path.u8string().c_str());
+                return 1;
+            }
+        }
+    }
+
+    const char *const instruction_set = pixel_convert::get_instruction_set_name(pixel_convert::current_instruction_set());
+
+    if (opts.json)
+        printf("{\"instruction_set\":\"%s\",\"threads\":%u,\"results\":[", instruction_set, opts.threads);
+    else
+        printf("frame,width,height,image_format,encoder,channels,bit_depth,png_filters,zlib_level,zlib_strategy,tiff_compression,tiff_tile_size,deflate_backend,threads,iterations,ms_per_frame,mb_per_s,compression_ratio,output_bytes\n");
+
+    bool first = true;
+    int failures = 0;
+
+    for (const frame &f : frames)
+    {
+        for (const settings &s : make_settings(f, opts.grid))
+        {
+            const char *const encoder_name = get_encoder_name(s.image_format, f);
+            const unsigned int channels = f.bit_depth == 32 ? 1 : s.image_format % 2 == 0 && s.image_format != 8 ? 3 : 4;
+            const unsigned int bit_depth = s.image_format == 2 || s.image_format == 3 ? 8 : f.bit_depth;
+            const bool zlib = f.bit_depth != 32 && uses_zlib(s.image_format);
+            const bool tiff = f.bit_depth == 32 || s.image_format == 4 || s.image_format == 5;
+            const bool deflate = zlib || (tiff && s.tiff_compression == COMPRESSION_ADOBE_DEFLATE);
+            const char *const backend_name = screenshot_deflate::get_backend_name(s.deflate_backend);
+
+            std::string label = std::format("%s %s format=%u", f.name.c_str(), encoder_name, s.image_format);
+            if (zlib)
+                label += std::format(" filters=0x%02x level=%d strategy=%d", s.png_filters, s.compression_level, s.compression_strategy);
+            if (tiff)
+                label += std::format(" tiff=%d", s.tiff_compression);
+            if (tiff && s.tiff_tile_size != 0)
+                label += std::format(" tile=%u", s.tiff_tile_size);
+            if (deflate)
+                label += std::format(" backend=%s", backend_name);
+            if (!opts.filter.empty() && label.find(opts.filter) == std::string::npos)
+                continue;
+
+            const std::vector<uint8_t> converted = convert_for(s.image_format, f);
+            const std::filesystem::path file = opts.output_directory / std::format("%s.%s", f.name.c_str(), tiff ? "tiff" : s.image_format == 8 ? "raw" : "png");
+
+            std::vector<double> durations;
+            uint64_t output_size = 0;
+
+            for (unsigned int i = 0; i < opts.iterations; ++i)
+            {
+                // Encoders may convert in place, so each run starts from a fresh copy
+                std::vector<uint8_t> pixels = converted;
+
+                const auto begin = std::chrono::steady_clock::now();
+                const bool succeeded = encode(s, f, pixels, file, opts.threads, output_size);
+                const auto end = std::chrono::steady_clock::now();
+
+                if (!succeeded)
+                {
+                    durations.clear();
+                    break;
+                }
+
+                durations.push_back(std::chrono::duration<double, std::milli>(end - begin).count());
+            }
+
+            std::filesystem::remove(file, ec);
+
+            if (durations.empty())
+            {
+                fprintf(stderr, "Failed: %s\n", label.c_str());
+                failures++;
+                continue;
+            }
+
+            std::sort(durations.begin(), durations.end());
+            const double ms = durations[durations.size() / 2];
+            const uint64_t input_size = static_cast<uint64_t>(f.width) * f.height * channels * (bit_depth / 8);
+            const double mb_per_s = input_size / 1e6 / (ms / 1e3);
+            const double ratio = output_size != 0 ? static_cast<double>(input_size) / output_size : 0.0;
+
+            const unsigned int threads = s.image_format == 6 || s.image_format == 7 || tiff ? opts.threads : 1;
+
+            if (opts.json)
+            {
+                printf("%s\n{\"frame\":\"%s\",\"width\":%u,\"height\":%u,\"image_format\":%u,\"encoder\":\"%s\",\"channels\":%u,\"bit_depth\":%u,",
+                    first ? "" : ",", escape_json(f.name).c_str(), f.width, f.height, s.image_format, encoder_name, channels, bit_depth);
+                if (zlib)
+                    printf("\"png_filters\":%d,\"zlib_level\":%d,\"zlib_strategy\":%d,", s.png_filters, s.compression_level, s.compression_strategy);
+                if (tiff)
+                    printf("\"tiff_compression\":%d,\"tiff_tile_size\":%u,", s.tiff_compression, s.tiff_tile_size);
+                if (deflate)
+                    printf("\"deflate_backend\":\"%s\",", backend_name);
+                printf("\"threads\":%u,\"iterations\":%zu,\"ms_per_frame\":%.3f,\"mb_per_s\":%.2f,\"compression_ratio\":%.4f,\"output_bytes\":%llu}",
+                    threads, durations.size(), ms, mb_per_s, ratio, static_cast<unsigned long long>(output_size));
+            }
+            else
+            {
+                printf("\"%s\",%u,%u,%u,%s,%u,%u,", f.name.c_str(), f.width, f.height, s.image_format, encoder_name, channels, bit_depth);
+                if (zlib)
+                    printf("%d,%d,%d,", s.png_filters, s.compression_level, s.compression_strategy);
+                else
+                    printf(",,,");
+                if (tiff)
+                    printf("%d,%u,", s.tiff_compression, s.tiff_tile_size);
+                else
+                    printf(",,");
+                if (deflate)
+                    printf("%s,", backend_name);
+                else
+                    printf(",");
+                printf("%u,%zu,%.3f,%.2f,%.4f,%llu\n", threads, durations.size(), ms, mb_per_s, ratio, static_cast<unsigned long long>(output_size));
+            }
+            fflush(stdout);
+
+            first = false;
+        }
+    }
+
+    if (opts.json)
+        printf("\n]}\n");
+
+    return failures == 0 ? 0 : 1;
+}
@@ -1,4 +1,4 @@
-/*
+﻿/*
  * SPDX-FileCopyrightText: 2018 seri14
  * SPDX-License-Identifier: BSD-3-Clause
  */
@@ -40,6 +40,84 @@ void screenshot_context::save()
 {
     config.save(ini_file::load_cache(environment.addon_screenshot_config_path), false);
 }
+void screenshot_context::update_preroll()
+{
+    preroll_screenshot = nullptr;
+    for (screenshot_myset &screenshot_myset : config.screenshot_mysets)
+    {
+        if (screenshot_myset.preroll_length != 0 && screenshot_myset.screenshot_key_data[0] != 0)
+        {
+            preroll_screenshot = &screenshot_myset;
+            break;
+        }
+    }
+
+    // New frames get a copy of the edited settings, while the ones in the ring keep the copy they were captured with, like any other queued screenshot
+    preroll_screenshot_snapshot.reset();
+
+    screenshot_preroll_settings settings;
+    if (preroll_screenshot != nullptr)
+    {
+        settings.myset = preroll_screenshot;
+        settings.length = preroll_screenshot->preroll_length;
+        settings.unit = preroll_screenshot->preroll_unit;
+        settings.repeat_interval = preroll_screenshot->repeat_interval;
+        settings.memory_budget = preroll_screenshot->memory_budget;
+        settings.downscale = preroll_screenshot->preroll_downscale;
+        settings.animated = preroll_screenshot->is_animated();
+        for (const screenshot_kind kind : { screenshot_kind::original, screenshot_kind::before, screenshot_kind::after, screenshot_kind::overlay, screenshot_kind::depth })
+            settings.kinds |= preroll_screenshot->is_enable(kind) ? 1u << kind : 0u;
+    }
+
+    // Frames captured with other pre-roll settings would not match the ones captured after the shortcut key is pressed, but other settings do not affect them
+    if (settings == preroll_settings)
+        return;
+
+    preroll_settings = settings;
+    screenshot_state.preroll.clear();
+
+    if (preroll_screenshot == nullptr)
+        return;
+
+    const bool seconds = preroll_screenshot->preroll_unit == decltype(screenshot_myset::preroll_unit)::preroll_seconds;
+    screenshot_state.preroll.configure(
+        seconds ? 0 : preroll_screenshot->preroll_length,
+        seconds ? std::chrono::seconds(preroll_screenshot->preroll_length) : std::chrono::system_clock::duration::zero(),
+        static_cast<uint64_t>(preroll_screenshot->memory_budget) * 1024 * 1024 * 1);
+
+    // Enough staging textures for every image of all frames still in flight, so that capturing every frame does not stall
+    size_t images = 0;
+    for (const screenshot_kind kind : { screenshot_kind::original, screenshot_kind::before, screenshot_kind::after, screenshot_kind::overlay, screenshot_kind::depth })
+        images += preroll_screenshot->is_enable(kind) ? 1 : 0;
+    screenshot_state.readback.reserve(images * static_cast<size_t>(screenshot_state.readback.latency() + 1));
+}
+void screenshot_context::flush_preroll()
+{
+    std::list<screenshot> frames;
+    screenshot_state.preroll.take(frames);
+
+    // Number the frames in capture order and count them now, as if they were captured after the activation
+    screenshot_repeat_offset = 0;
+    const auto renumber = [this](screenshot &screenshot) {
+        screenshot.preroll = false;
+        screenshot.repeat_index = screenshot_repeat_offset++;
+        screenshot.total_counts = statistics.get_total_counter().load();
+        screenshot.myset_counts = active_counter->load();
+        statistics.add_frame(*active_counter);
+        };
+
+    for (auto it = frames.rbegin(); it != frames.rend(); ++it)
+        renumber(*it);
+
+    // Frames still waiting for their readbacks are newer than those in the ring, and go to the workers once ready like all others
+    for (auto it = screenshots.rbegin(); it != screenshots.rend(); ++it)
+    {
+        if (it->preroll)
+            renumber(*it);
+    }
+
+    worker_pool.submit(frames);
+}
 inline bool screenshot_context::is_screenshot_active() const noexcept
 {
     if (active_screenshot == nullptr)
@@ -66,6 +144,10 @@ inline bool screenshot_context::is_screenshot_frame() const noexcept
 }
 inline bool screenshot_context::is_screenshot_frame(screenshot_kind kind) const noexcept
 {
+    // The preset belongs to the take, so is only saved once the shortcut key is pressed
+    if (is_preroll_frame())
+        return kind != preset && preroll_screenshot->is_enable(kind);
+
     if (!is_screenshot_frame())
         return false;
     if (!active_screenshot->is_enable(kind))
@@ -75,6 +157,68 @@ inline bool screenshot_context::is_screenshot_frame(screenshot_kind kind) const
 
     return true;
 }
+inline bool screenshot_context::is_preroll_frame() const noexcept
+{
+    if (active_screenshot != nullptr || preroll_screenshot == nullptr)
+        return false;
+    if (preroll_screenshot->repeat_interval != 0 && current_frame % preroll_screenshot->repeat_interval)
+        return false;
+
+    return true;
+}
+
+static uint64_t estimate_capture_size(reshade::api::effect_runtime *runtime, const screenshot_myset &myset)
+{
+    uint32_t width = 0, height = 0;
+    runtime->get_screenshot_width_and_height(&width, &height);
+
+    const reshade::api::format format = runtime->get_device()->get_resource_desc(runtime->get_current_back_buffer()).texture.format;
+    const uint64_t color_size = static_cast<uint64_t>(reshade::api::format_row_pitch(format, width)) * height;
+    const uint64_t depth_size = static_cast<uint64_t>(sizeof(float)) * width * height;
+
+    uint64_t size = 0;
+    for (screenshot_kind kind : { screenshot_kind::original, screenshot_kind::before, screenshot_kind::after, screenshot_kind::overlay })
+        size += myset.is_enable(kind) ? color_size : 0;
+    size += myset.is_enable(screenshot_kind::depth) ? depth_size : 0;
+
+    return size;
+}
+
+static screenshot_encoder_tuner::settings get_encoder_settings(const screenshot_myset &myset)
+{
+    screenshot_encoder_tuner::settings settings;
+    settings.image_format = myset.image_format;
+    settings.png_filters = myset.libpng_png_filters;
+    settings.compression_level = myset.zlib_compression_level;
+    settings.compression_strategy = myset.zlib_compression_strategy;
+    settings.deflate_backend = screenshot_deflate::is_available(myset.deflate_backend) ? myset.deflate_backend : screenshot_deflate_backend::zlib;
+    // Archives only hold zlib based PNG images
+    settings.allow_fpng = !myset.archive_takes;
+    return settings;
+}
+static bool deflate_backend_combo(const char *label, screenshot_deflate_backend &backend)
+{
+    const bool modified = ImGui::Combo(label, reinterpret_cast<int *>(&backend), "zlib\0libdeflate\0");
+    if (ImGui::IsItemHovered(ImGuiHoveredFlags_ForTooltip))
+    {
+        if (ImGui::BeginTooltip())
+        {
+            ImGui::TextUnformatted(_("libdeflate compresses faster and smaller than zlib at the same compression level, but ignores the compression strategy and compresses each PNG image as a whole on one thread. PNG rows are still filtered in parallel, and TIFF strips are compressed in parallel either way."));
+            ImGui::EndTooltip();
+        }
+    }
+    return modified;
+}
+
+static void finish_encoder_tuning(screenshot_context &ctx)
+{
+    // The tuned settings only ever lived in the snapshot of the take, so the myset still has its own
+    if (ctx.screenshot_state.tuner.changes() == 0)
+        return;
+
+    reshade::log::message(reshade::log::level::info, std::format("Encoder settings are back to %s after the take.", screenshot_encoder_tuner::describe(ctx.screenshot_state.tuner.initial()).c_str()).c_str());
+    ctx.screenshot_state.tuner.reset(ctx.screenshot_state.tuner.initial(), nullptr);
+}
 
 static void on_init(reshade::api::effect_runtime *runtime)
 {
@@ -84,10 +228,14 @@ static void on_init(reshade::api::effect_runtime *runtime)
     screenshot_context *ctx = device->create_private_data<screenshot_context>();
 
     ctx->active_screenshot = nullptr;
+    ctx->screenshot_state.workers = &ctx->worker_pool;
 
     ctx->environment.load(runtime);
+    ctx->environment_snapshot = std::make_shared<const screenshot_environment>(ctx->environment);
     ctx->config.load(ini_file::load_cache(ctx->environment.addon_screenshot_config_path));
-    ctx->statistics.load(ini_file::load_cache(ctx->environment.addon_screenshot_statistics_path));
+    ctx->statistics.load(ctx->environment.addon_screenshot_statistics_path);
+    ctx->screenshot_state.transcoder.load(ctx->environment.addon_screenshot_transcode_path, ctx->config.screenshot_mysets);
+    ctx->update_preroll();
 
     ctx->screenshot_begin_frame = std::numeric_limits<decltype(ctx->screenshot_begin_frame)>::max();
 }
@@ -95,6 +243,25 @@ static void on_destroy(reshade::api::device *device)
 {
     ini_file::flush_cache();
 
+    if (screenshot_context *pctx = device->get_private_data<screenshot_context>(); pctx != nullptr)
+    {
+        // Frames of the pre-roll were never asked for, so their readbacks are not waited for either
+        for (const screenshot &screenshot : pctx->screenshots)
+            if (screenshot.preroll)
+                for (const screenshot_capture &capture : screenshot.captures)
+                    pctx->screenshot_state.readback.cancel(capture);
+        pctx->screenshots.remove_if([](const screenshot &screenshot) { return screenshot.preroll; });
+
+        pctx->screenshot_state.readback.resolve(device, true);
+        pctx->screenshot_state.readback.destroy(device);
+
+        // Conversions run on the workers as well, so the transcoder has to be done before they shut down
+        pctx->screenshot_state.transcoder.stop();
+
+        pctx->worker_pool.submit(pctx->screenshots);
+        pctx->worker_pool.shutdown();
+    }
+
     device->destroy_private_data<screenshot_context>();
 }
 
@@ -112,21 +279,100 @@ static void on_device_present(reshade::api::command_queue *, reshade::api::swapc
         return;
     screenshot_context &ctx = *pctx;
 
+    if (ctx.screenshot_state.trace.is_recording())
+        ctx.screenshot_state.trace.set_thread_name("Render thread");
+    screenshot_trace::span span(ctx.screenshot_state.trace, "Present");
+
     ctx.current_frame++;
     ctx.present_time = std::chrono::system_clock::now();
 
-    if (ctx.screenshot_frame = ctx.is_screenshot_frame() ? &ctx.screenshots.emplace_front(ctx.environment, *ctx.active_screenshot, ctx.screenshot_state, ctx.present_time, ctx.statistics) : nullptr;
+    bool capture_frame = ctx.is_screenshot_frame();
+    bool over_budget = false;
+
+    if (capture_frame && ctx.active_screenshot->memory_budget != 0)
+    {
+        const uint64_t budget = static_cast<uint64_t>(ctx.active_screenshot->memory_budget) * 1024 * 1024 * 1;
+        const uint64_t required = estimate_capture_size(runtime, *ctx.active_screenshot);
+        const uint64_t max_used_bytes = budget > required ? budget - required : 0;
+
+        // Always let a frame through when nothing else is held, even if it alone exceeds the budget
+        const auto is_over_budget = [&ctx, max_used_bytes]() {
+            const uint64_t used_bytes = ctx.screenshot_state.buffers.used_bytes();
+            return used_bytes != 0 && used_bytes > max_used_bytes;
+            };
+
+        if (over_budget = is_over_budget(); over_budget)
+        {
+            switch (ctx.active_screenshot->backpressure_policy)
+            {
+                case decltype(screenshot_myset::backpressure_policy)::backpressure_block:
+                {
+                    screenshot_trace::span wait_span(ctx.screenshot_state.trace, "Wait for memory budget");
+
+                    // Only wait while workers are running, since buffers of screenshots still waiting for a readback are only released by this thread
+                    while (is_over_budget() && (ctx.worker_pool.queued() != 0 || ctx.worker_pool.active() != 0))
+                        ctx.screenshot_state.buffers.wait_for_release(max_used_bytes, std::chrono::milliseconds(100));
+                    break;
+                }
+                case decltype(screenshot_myset::backpressure_policy)::backpressure_drop_oldest:
+                    while (is_over_budget() && ctx.worker_pool.drop_oldest())
+                        ctx.screenshot_state.dropped_frames++;
+                    // Drop this frame instead when there is nothing older left to make room
+                    if (is_over_budget())
+                        capture_frame = false;
+                    break;
+                case decltype(screenshot_myset::backpressure_policy)::backpressure_drop_newest:
+                    capture_frame = false;
+                    break;
+                default:
+                    // Downscaling and spilling happen once all images of the frame were captured
+                    break;
+            }
+
+            if (!capture_frame)
+                ctx.screenshot_state.dropped_frames++;
+        }
+    }
+
+    if (capture_frame && ctx.active_screenshot_snapshot == nullptr)
+    {
+        ctx.active_screenshot_snapshot = std::make_shared<const screenshot_myset>(*ctx.active_screenshot);
+
+        finish_encoder_tuning(ctx);
+        ctx.screenshot_state.tuner.reset(get_encoder_settings(*ctx.active_screenshot), ctx.active_screenshot_snapshot.get());
+    }
+    else if (capture_frame && ctx.active_screenshot->auto_tune_encoder && ctx.capture_time != std::numeric_limits<decltype(ctx.capture_time)>::max())
+    {
+        // Frames captured from now on are saved with lower settings, while those already queued keep the snapshot they hold on to
+        if (screenshot_encoder_tuner::settings settings = get_encoder_settings(*ctx.active_screenshot_snapshot); screenshot_encoder_tuner::is_tunable(settings))
+        {
+            if (std::string change; ctx.screenshot_state.tuner.update(ctx.present_time - ctx.capture_time, ctx.worker_pool.concurrency(), settings, ctx.active_screenshot_snapshot.get(), change))
+            {
+                auto tuned = std::make_shared<screenshot_myset>(*ctx.active_screenshot_snapshot);
+                tuned->image_format = settings.image_format;
+                tuned->libpng_png_filters = settings.png_filters;
+                tuned->zlib_compression_level = settings.compression_level;
+                tuned->zlib_compression_strategy = settings.compression_strategy;
+
+                ctx.active_screenshot_snapshot = std::move(tuned);
+                ctx.screenshot_state.tuner.track(ctx.active_screenshot_snapshot.get());
+
+                reshade::log::message(reshade::log::level::warning, std::format("Myset '%s': %s", ctx.active_screenshot->name.c_str(), change.c_str()).c_str());
+            }
+        }
+    }
+
+    if (ctx.screenshot_frame = capture_frame ? &ctx.screenshots.emplace_front(ctx.environment_snapshot, ctx.active_screenshot_snapshot, ctx.screenshot_state, ctx.present_time, ctx.statistics.get_total_counter().load(), ctx.active_counter->load()) : nullptr;
         ctx.screenshot_frame)
     {
-        ctx.screenshot_frame->repeat_index = ctx.screenshot_repeat_index;
+        ctx.screenshot_frame->repeat_index = ctx.screenshot_repeat_offset + ctx.screenshot_repeat_index;
+        ctx.screenshot_frame->over_budget = over_budget;
 
         ctx.capture_last = ctx.capture_time;
         ctx.capture_time = ctx.present_time;
 
-        if (ctx.statistics.capture_counts.try_emplace({}).first->second.total_frame++; ctx.active_screenshot != nullptr)
-            ctx.statistics.capture_counts.try_emplace(ctx.active_screenshot->name).first->second.total_frame++;
-
-        ctx.statistics.save(ini_file::load_cache(ctx.environment.addon_screenshot_statistics_path));
+        // Persisted by a background thread, so that counting a frame does not touch the file system here
+        ctx.statistics.add_frame(*ctx.active_counter);
 
         if (ctx.is_screenshot_frame(screenshot_kind::original))
             ctx.screenshot_frame->capture(runtime, screenshot_kind::original);
@@ -134,6 +380,20 @@ static void on_device_present(reshade::api::command_queue *, reshade::api::swapc
         if (ctx.is_screenshot_frame(screenshot_kind::preset))
             ctx.screenshot_frame->save_preset(runtime);
     }
+    else if (ctx.is_preroll_frame())
+    {
+        if (ctx.preroll_screenshot_snapshot == nullptr)
+            ctx.preroll_screenshot_snapshot = std::make_shared<const screenshot_myset>(*ctx.preroll_screenshot);
+
+        // Counts and index are assigned once the shortcut key is pressed, since most of these frames are dropped again before that
+        ctx.screenshot_frame = &ctx.screenshots.emplace_front(ctx.environment_snapshot, ctx.preroll_screenshot_snapshot, ctx.screenshot_state, ctx.present_time, screenshot_statistics_scoped_data{}, screenshot_statistics_scoped_data{});
+        ctx.screenshot_frame->preroll = true;
+        // Frames of an animation all have to be the same size
+        ctx.screenshot_frame->pending_downscale = ctx.preroll_screenshot->preroll_downscale && !ctx.preroll_screenshot->is_animated();
+
+        if (ctx.is_screenshot_frame(screenshot_kind::original))
+            ctx.screenshot_frame->capture(runtime, screenshot_kind::original);
+    }
 
     if (reshade::api::effect_technique technique = runtime->find_technique("__Addon_ScreenshotDepth_Seri14.addonfx", "__Addon_Technique_ScreenshotDepth_Seri14"); technique.handle != 0)
     {
@@ -144,7 +404,7 @@ static void on_device_present(reshade::api::command_queue *, reshade::api::swapc
     }
 
     if (ctx.config.turn_on_effects == decltype(screenshot_config::turn_on_effects)::turn_on_while_myset_is_active &&
-        ctx.is_screenshot_frame(screenshot_kind::after) &&
+        ctx.active_screenshot != nullptr && ctx.is_screenshot_frame(screenshot_kind::after) &&
         !runtime->get_effects_state())
         runtime->set_effects_state(true);
 }
@@ -156,6 +416,8 @@ static void on_begin_effects(reshade::api::effect_runtime *runtime, reshade::api
         return;
     screenshot_context &ctx = *pctx;
 
+    screenshot_trace::span span(ctx.screenshot_state.trace, "Begin effects");
+
     if (ctx.is_screenshot_frame(screenshot_kind::before) && ctx.screenshot_frame)
         ctx.screenshot_frame->capture(runtime, screenshot_kind::before);
 }
@@ -167,6 +429,8 @@ static void on_finish_effects(reshade::api::effect_runtime *runtime, reshade::ap
         return;
     screenshot_context &ctx = *pctx;
 
+    screenshot_trace::span span(ctx.screenshot_state.trace, "Finish effects");
+
     if (ctx.is_screenshot_frame(screenshot_kind::after) && ctx.screenshot_frame)
         ctx.screenshot_frame->capture(runtime, screenshot_kind::after);
 
@@ -181,30 +445,87 @@ static void on_reshade_present(reshade::api::effect_runtime *runtime)
         return;
     screenshot_context &ctx = *pctx;
 
+    screenshot_trace::span span(ctx.screenshot_state.trace, "ReShade present");
+
     if (ctx.is_screenshot_frame(screenshot_kind::overlay) && ctx.screenshot_frame)
         ctx.screenshot_frame->capture(runtime, screenshot_kind::overlay);
 
+    {
+        screenshot_trace::span resolve_span(ctx.screenshot_state.trace, "Resolve readbacks");
+        ctx.screenshot_state.readback.resolve(device);
+    }
+
     if (!ctx.screenshots.empty())
     {
-        for (size_t remain = std::min(ctx.screenshots.size(), ctx.screenshot_worker_threads - ctx.screenshot_active_threads);
-            remain > 0;
-            remain--)
+        // Screenshots are ready once all of their readbacks were resolved, which happens in capture order
+        std::list<screenshot> ready;
+        while (!ctx.screenshots.empty() && ctx.screenshots.back().pending_readbacks == 0)
+            ready.splice(ready.begin(), ctx.screenshots, std::prev(ctx.screenshots.end()));
+
+        // Everything between the first capture and now that was not spent capturing was waiting for readbacks
+        const auto resolve_time = std::chrono::steady_clock::now();
+
+        std::list<screenshot> preroll;
+        for (auto it = ready.begin(); it != ready.end();)
         {
-            ctx.screenshot_active_threads++;
+            it->timing[screenshot_stage::readback] = resolve_time - it->capture_begin - it->timing[screenshot_stage::capture];
 
-            std::thread screenshot_thread = std::thread(
-               [&ctx, screenshot = std::move(ctx.screenshots.back())]() mutable
-               {
-                   screenshot.save_image();
-                   ctx.screenshot_active_threads--;
-               });
+            if (it->preroll)
+                preroll.splice(preroll.end(), ready, it++);
+            else
+                ++it;
+        }
 
-            ctx.screenshots.pop_back();
-            screenshot_thread.detach();
+        // Frames captured before the pre-roll was disabled are simply dropped
+        if (ctx.preroll_screenshot != nullptr)
+            ctx.screenshot_state.preroll.push(preroll);
 
-            if (ctx.screenshots.empty())
-                break;
+        // Only marked here, the worker pool downscales or spills them in the background while they wait in the queue
+        for (screenshot &screenshot : ready)
+        {
+            if (!screenshot.over_budget)
+                continue;
+
+            switch (screenshot.myset.backpressure_policy)
+            {
+                case decltype(screenshot_myset::backpressure_policy)::backpressure_downscale:
+                    if (screenshot.myset.is_animated())
+                        break;
+                    screenshot.pending_downscale = true;
+                    ctx.screenshot_state.downscaled_frames++;
+                    break;
+                case decltype(screenshot_myset::backpressure_policy)::backpressure_spill_to_disk:
+                    screenshot.pending_spill = true;
+                    break;
+            }
         }
+
+        screenshot_trace::span submit_span(ctx.screenshot_state.trace, "Submit");
+        ctx.worker_pool.submit(ready);
+        ctx.screenshot_frame = nullptr;
+    }
+    else if (ctx.active_screenshot == nullptr && ctx.screenshot_state.buffers.cached_bytes() != 0 && ctx.worker_pool.queued() == 0 && ctx.worker_pool.active() == 0)
+    {
+        // Give memory back once all shots were saved
+        ctx.screenshot_state.buffers.trim();
+    }
+
+    if (ctx.active_screenshot == nullptr)
+        finish_encoder_tuning(ctx);
+
+    // Raw images of a burst are only converted after it is over and all of it was written
+    ctx.screenshot_state.transcoder.pause(ctx.active_screenshot != nullptr || ctx.worker_pool.queued() != 0 || ctx.worker_pool.active() != 0);
+
+    // Archives, animations and duplicate lists are complete once no frame of their takes waits for its readback or a worker anymore
+    if (ctx.active_screenshot == nullptr && (ctx.screenshot_state.archives.size() != 0 || ctx.screenshot_state.animations.size() != 0 || ctx.screenshot_state.duplicates.size() != 0) && ctx.worker_pool.queued() == 0 && ctx.worker_pool.active() == 0 &&
+        std::all_of(ctx.screenshots.begin(), ctx.screenshots.end(), [](const screenshot &screenshot) { return screenshot.preroll; }))
+    {
+        ctx.screenshot_state.archives.close();
+        ctx.screenshot_state.duplicates.clear();
+
+        // Leftover frames are encoded and the animation control chunk is rewritten on closing, so that is left to a worker
+        if (ctx.screenshot_state.animations.size() != 0)
+            ctx.worker_pool.submit([&animations = ctx.screenshot_state.animations]() { animations.close(); });
     }
 
     if (ctx.is_screenshot_frame()) // Update ctx to ctx-> for consistency
@@ -244,6 +565,7 @@ static void on_reshade_present(reshade::api::effect_runtime *runtime)
             runtime->set_effects_state(false);
 
         ctx.active_screenshot = nullptr; // Update ctx to ctx-> for consistency
+        ctx.active_screenshot_snapshot.reset();
     }
 
     if (!ctx.ignore_shortcuts) // Update ctx to ctx-> for consistency
@@ -267,11 +589,10 @@ static void on_reshade_present(reshade::api::effect_runtime *runtime)
                     ctx.playsound_flags = 0; // Update ctx to ctx-> for consistency
                 }
 
-                ctx.statistics.save(ini_file::load_cache(ctx.environment.addon_screenshot_statistics_path)); // Update ctx to ctx-> for consistency
-
                 if (ctx.active_screenshot == &screenshot_myset)
                 {
                     ctx.active_screenshot = nullptr;
+                    ctx.active_screenshot_snapshot.reset();
 
                     if (ctx.effects_state_activated) // Update ctx to ctx-> for consistency
                     {
@@ -282,23 +603,43 @@ static void on_reshade_present(reshade::api::effect_runtime *runtime)
                 else
                 {
                     ctx.active_screenshot = &screenshot_myset; // Update ctx to ctx-> for consistency
+                    ctx.active_screenshot_snapshot.reset();
                     ctx.capture_time = std::numeric_limits<decltype(ctx.capture_time)>::max(); // Update ctx to ctx-> for consistency
                     ctx.capture_last = std::numeric_limits<decltype(ctx.capture_last)>::max(); // Update ctx to ctx-> for consistency
 
+                    finish_encoder_tuning(ctx);
                     ctx.screenshot_state.reset(); // Update ctx to ctx-> for consistency
 
+                    // Each activation starts a new timing log
+                    if (ctx.config.write_stage_timings)
+                    {
+                        struct tm tm = {};
+                        const std::time_t t = std::chrono::system_clock::to_time_t(ctx.present_time);
+                        localtime_s(&tm, &t);
+
+                        const std::string file_name = std::format("%s %04d-%02d-%02d %02d-%02d-%02d.csv", screenshot_myset.name.c_str(), 1900 + tm.tm_year, 1 + tm.tm_mon, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
+                        if (!ctx.screenshot_state.timings.open_log(ctx.environment.reshade_base_path / L"ReShade_Addon_Screenshot_Timings" / std::filesystem::u8path(file_name)))
+                            reshade::log::message(reshade::log::level::warning, std::format("Failed to open timing log \"%s\"!", file_name.c_str()).c_str());
+                    }
+                    else
+                    {
+                        ctx.screenshot_state.timings.close_log();
+                    }
+
                     ctx.screenshot_begin_frame = ctx.current_frame + 1; // Update ctx to ctx-> for consistency
                     ctx.screenshot_repeat_index = 0; // Update ctx to ctx-> for consistency
+                    ctx.screenshot_repeat_offset = 0;
 
-                    if (ctx.statistics.capture_counts.try_emplace({}).first->second.total_take++; ctx.active_screenshot != nullptr) // Update ctx to ctx-> for consistency
-                        ctx.statistics.capture_counts.try_emplace(ctx.active_screenshot->name).first->second.total_take++; // Update ctx to ctx-> for consistency
+                    ctx.active_counter = &ctx.statistics.get_counter(screenshot_myset.name); // Update ctx to ctx-> for consistency
+                    ctx.statistics.add_take(*ctx.active_counter); // Update ctx to ctx-> for consistency
 
-                    ctx.statistics.save(ini_file::load_cache(ctx.environment.addon_screenshot_statistics_path)); // Update ctx to ctx-> for consistency
+                    ctx.worker_pool.resize(screenshot_myset.worker_threads);
 
-                    if (screenshot_myset.worker_threads != 0)
-                        ctx.screenshot_worker_threads = screenshot_myset.worker_threads; // Update ctx to ctx-> for consistency
+                    // Frames of the pre-roll only lead up to the myset they were captured with
+                    if (&screenshot_myset == ctx.preroll_screenshot)
+                        ctx.flush_preroll();
                     else
-                        ctx.screenshot_worker_threads = std::thread::hardware_concurrency(); // Update ctx to ctx-> for consistency
+                        ctx.screenshot_state.preroll.clear();
 
                     switch (ctx.config.turn_on_effects) // Update ctx to ctx-> for consistency
                     {
@@ -354,7 +695,7 @@ static void draw_osd_window(reshade::api::effect_runtime *runtime)
             hide_osd = false;
             break;
         case decltype(screenshot_config::show_osd)::show_osd_while_myset_is_active:
-            hide_osd = ctx.active_screenshot == nullptr && ctx.screenshot_state.error_occurs == 0 && ctx.screenshots.empty(); // Update ctx to ctx-> for consistency 
+            hide_osd = ctx.active_screenshot == nullptr && ctx.screenshot_state.error_occurs == 0 && ctx.worker_pool.queued() == 0 && ctx.worker_pool.active() == 0 && ctx.screenshot_state.transcoder.remaining() == 0; // Update ctx to ctx-> for consistency 
             break;
         case decltype(screenshot_config::show_osd)::show_osd_while_myset_is_active_ignore_errors:
             hide_osd = ctx.active_screenshot == nullptr; // Update ctx to ctx-> for consistency    
@@ -377,6 +718,11 @@ static void draw_osd_window(reshade::api::effect_runtime *runtime)
             fraction = (float)((ctx.current_frame - ctx.screenshot_begin_frame) % ctx.active_screenshot->repeat_interval) / ctx.active_screenshot->repeat_interval;
             str = std::format(ctx.active_screenshot->repeat_count != 0 ? _("%u of %u") : _("%u times (Infinite mode)"), ctx.screenshot_repeat_index, ctx.active_screenshot->repeat_count);
         }
+        else if (ctx.preroll_screenshot != nullptr)
+        {
+            fraction = 1.0f;
+            str = std::format(_("Pre-roll: %u frames (%.3lf MiB)"), ctx.screenshot_state.preroll.size(), static_cast<double>(ctx.screenshot_state.preroll.memory_usage()) / (1024 * 1024 * 1));
+        }
         else
         {
             fraction = 1.0f;
@@ -386,23 +732,62 @@ static void draw_osd_window(reshade::api::effect_runtime *runtime)
         ImGui::SameLine(15);
         ImGui::Text("%*s", str.size(), str.c_str());
 
-        if (!ctx.screenshots.empty()) // Update ctx to ctx-> for consistency
+        if (const size_t queued = ctx.worker_pool.queued(); queued != 0) // Update ctx to ctx-> for consistency
         {
-            uint64_t using_bytes = 0;
-            std::for_each(ctx.screenshots.cbegin(), ctx.screenshots.cend(),
-                [&using_bytes](const screenshot &screenshot) {
-                    for (const screenshot_capture &capture : screenshot.captures)
-                        using_bytes += sizeof(uint32_t) * capture.pixels.size();
-                });
-            str = std::format(_("%u shots in queue (%.3lf MiB)"), ctx.screenshots.size(), static_cast<double>(using_bytes) / (1024 * 1024 * 1)); // Update ctx to ctx-> for consistency
+            str = std::format(_("%u shots in queue (%.3lf MiB)"), queued, static_cast<double>(ctx.worker_pool.queued_bytes()) / (1024 * 1024 * 1)); // Update ctx to ctx-> for consistency
             ImGui::Text("%*s", str.size(), str.c_str());
         }
+        if (const size_t threads = ctx.worker_pool.threads(); threads != 0)
+        {
+            str = std::format(_("%u of %u workers busy (%llu shots saved)"), ctx.worker_pool.active(), ctx.worker_pool.concurrency(), ctx.worker_pool.completed());
+            ImGui::Text("%*s", str.size(), str.c_str());
+        }
+        if (const size_t remaining = ctx.screenshot_state.transcoder.remaining(); remaining != 0)
+        {
+            const uint64_t completed = ctx.screenshot_state.transcoder.completed();
+            ImGui::ProgressBar(static_cast<float>(completed) / (completed + remaining), ImVec2(ImGui::GetContentRegionAvail().x, 0), "");
+            ImGui::SameLine(15);
+            str = std::format(_("%u shots left to transcode (%.3lf MiB)"), remaining, static_cast<double>(ctx.screenshot_state.transcoder.remaining_bytes()) / (1024 * 1024 * 1));
+            ImGui::Text("%*s", str.size(), str.c_str());
+        }
+        if (const unsigned int dropped = ctx.screenshot_state.dropped_frames, downscaled = ctx.screenshot_state.downscaled_frames, spilled = ctx.screenshot_state.spilled_frames;
+            dropped != 0 || downscaled != 0 || spilled != 0)
+        {
+            str = std::format(_("Over memory budget: %u dropped, %u downscaled, %u spilled to disk"), dropped, downscaled, spilled);
+            ImGui::TextColored(COLOR_YELLOW, "%*s", str.size(), str.c_str());
+        }
+        if (const unsigned int duplicates = ctx.screenshot_state.duplicate_frames; duplicates != 0)
+        {
+            str = std::format(_("%u identical frames not encoded again"), duplicates);
+            ImGui::Text("%*s", str.size(), str.c_str());
+        }
+        if (const unsigned int changes = ctx.screenshot_state.tuner.changes(); changes != 0)
+        {
+            str = std::format(_("Encoder settings lowered %u times to keep up"), changes);
+            ImGui::TextColored(COLOR_YELLOW, "%*s", str.size(), str.c_str());
+        }
+        if (ctx.config.show_stage_timings)
+        {
+            const char *const stage_names[] = { _("Capture"), _("Readback"), _("Queue"), _("Convert"), _("Encode"), _("Write"), _("Metadata") };
+            static_assert(std::size(stage_names) == static_cast<size_t>(screenshot_stage::_max));
+
+            for (size_t stage = 0; stage < std::size(stage_names); stage++)
+            {
+                const screenshot_histogram &histogram = ctx.screenshot_state.timings.histogram(static_cast<screenshot_stage>(stage));
+                if (histogram.count() == 0)
+                    continue;
+
+                str = std::format(_("%s: %.2lf / %.2lf / %.2lf ms (p50 / p95 / p99)"), stage_names[stage],
+                    histogram.percentile(0.50).count() / 1000.0, histogram.percentile(0.95).count() / 1000.0, histogram.percentile(0.99).count() / 1000.0);
+                ImGui::Text("%*s", str.size(), str.c_str());
+            }
+        }
     }
 
     if (!hide_osd)
     {
         if (ctx.active_screenshot != nullptr &&
-            static_cast<long>(ctx.screenshot_state.last_elapsed / std::max<size_t>(1, ctx.screenshot_worker_threads)) > (ctx.capture_time - ctx.capture_last).count())
+            static_cast<long>(ctx.screenshot_state.last_elapsed / std::max<size_t>(1, ctx.worker_pool.concurrency())) > (ctx.capture_time - ctx.capture_last).count())
             ImGui::TextColored(COLOR_YELLOW, "%s", _("Processing of screenshots is too slow!"));
 
         if (ctx.screenshot_state.error_occurs > 0) // Update ctx to ctx-> for consistency
@@ -440,6 +825,53 @@ static void draw_setting_window(reshade::api::effect_runtime *runtime)
         std::replace(turn_on_effects_items.begin(), turn_on_effects_items.end(), '\n', '\0');
         modified |= ImGui::Combo(_("Show OSD"), reinterpret_cast<int *>(&ctx.config.show_osd), show_osd_items.c_str()); // Update ctx to ctx-> for consistency
         modified |= ImGui::Combo(_("Turn On Effects"), reinterpret_cast<int *>(&ctx.config.turn_on_effects), turn_on_effects_items.c_str()); // Update ctx to ctx-> for consistency
+        modified |= ImGui::Checkbox(_("Show stage timings"), &ctx.config.show_stage_timings);
+        if (ImGui::IsItemHovered(ImGuiHoveredFlags_ForTooltip))
+        {
+            if (ImGui::BeginTooltip())
+            {
+                ImGui::TextUnformatted(_("Shows the median, 95th and 99th percentile of the time each shot spends in each stage, from capturing on the render thread to updating the file time stamps, in the OSD."));
+                ImGui::EndTooltip();
+            }
+        }
+        modified |= ImGui::Checkbox(_("Write stage timings to file"), &ctx.config.write_stage_timings);
+        if (ImGui::IsItemHovered(ImGuiHoveredFlags_ForTooltip))
+        {
+            if (ImGui::BeginTooltip())
+            {
+                ImGui::TextUnformatted(_("Writes the stage timings of every saved image to a CSV file in the \"ReShade_Addon_Screenshot_Timings\" folder next to ReShade.ini, starting a new file each time a myset is activated."));
+                ImGui::EndTooltip();
+            }
+        }
+        // Recording is not saved in the configuration, since a trace is only useful for the session it was started in
+        if (bool recording = ctx.screenshot_state.trace.is_recording(); ImGui::Checkbox(_("Record trace"), &recording))
+        {
+            if (recording)
+            {
+                struct tm tm = {};
+                const std::time_t t = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+                localtime_s(&tm, &t);
+
+                const std::string file_name = std::format("Trace %04d-%02d-%02d %02d-%02d-%02d.json", 1900 + tm.tm_year, 1 + tm.tm_mon, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
+                ctx.screenshot_state.trace.start(ctx.environment.reshade_base_path / L"ReShade_Addon_Screenshot_Timings" / std::filesystem::u8path(file_name));
+            }
+            else if (ctx.screenshot_state.trace.stop())
+            {
+                reshade::log::message(reshade::log::level::info, std::format("Saved trace to \"%s\".", ctx.screenshot_state.trace.file().u8string().c_str()).c_str());
+            }
+            else
+            {
+                reshade::log::message(reshade::log::level::error, std::format("Failed to save trace to \"%s\"!", ctx.screenshot_state.trace.file().u8string().c_str()).c_str());
+            }
+        }
+        if (ImGui::IsItemHovered(ImGuiHoveredFlags_ForTooltip))
+        {
+            if (ImGui::BeginTooltip())
+            {
+                ImGui::TextUnformatted(_("Records what the render thread and the workers are doing until unchecked, and saves it as a trace to the \"ReShade_Addon_Screenshot_Timings\" folder.\nOpen the file in ui.perfetto.dev or chrome://tracing to see how saving overlaps the game's frames."));
+                ImGui::EndTooltip();
+            }
+        }
 
         char buf[4096] = "";
         std::string playback_mode_items = _("Play sound only when first frame is captured\nPlay sound each time a frame is captured\nPlay sound continuously while capturing frames\n");
@@ -451,7 +883,8 @@ static void draw_setting_window(reshade::api::effect_runtime *runtime)
                 if (status.clear(); image.empty() || image.native().front() == L'-')
                     return;
 
-                screenshot dummy(ctx.environment, screenshot_myset, ctx.screenshot_state, ctx.present_time, ctx.statistics); // Update ctx to ctx-> for consistency
+                // Only lives within this scope, so the myset does not need to be copied
+                screenshot dummy(ctx.environment_snapshot, std::shared_ptr<const class screenshot_myset>(std::shared_ptr<void>(), &screenshot_myset), ctx.screenshot_state, ctx.present_time, ctx.statistics.get({}), ctx.statistics.get(screenshot_myset.name)); // Update ctx to ctx-> for consistency
                 std::filesystem::path expanded = std::filesystem::u8path(dummy.expand_macro_string(image.u8string()));
                 expanded = ctx.environment.reshade_base_path / expanded;
 
@@ -740,6 +1173,78 @@ static void draw_setting_window(reshade::api::effect_runtime *runtime)
                         ImGui::EndTooltip();
                     }
                 }
+                modified |= ImGui::Checkbox(_("Lower compression automatically"), &screenshot_myset.auto_tune_encoder);
+                if (ImGui::IsItemHovered(ImGuiHoveredFlags_ForTooltip))
+                {
+                    if (ImGui::BeginTooltip())
+                    {
+                        ImGui::TextUnformatted(_("When saving cannot keep up with the repeat interval during a take, lower the zlib level, then use RLE, then only the SUB filter and finally fpng unless takes are archived. The settings of the myset stay unchanged and apply again to the next take. Every change is written to the log."));
+                        ImGui::EndTooltip();
+                    }
+                }
+                if (ImGui::SliderInt(_("Memory budget"), reinterpret_cast<int *>(&screenshot_myset.memory_budget), 0, 16384, screenshot_myset.memory_budget == 0 ? _("unlimited") : "%d MiB"))
+                {
+                    if (static_cast<int>(screenshot_myset.memory_budget) < 0)
+                        screenshot_myset.memory_budget = 0;
+
+                    modified = true;
+                }
+                if (ImGui::IsItemHovered(ImGuiHoveredFlags_ForTooltip))
+                {
+                    if (ImGui::BeginTooltip())
+                    {
+                        ImGui::TextUnformatted(_("Specify the maximum amount of memory held by captured frames that wait to be saved. The following policy applies when a new frame would exceed it."));
+                        ImGui::EndTooltip();
+                    }
+                }
+                std::string backpressure_policy_items = _("Wait for workers\nDrop oldest frame\nDrop newest frame\nHalve resolution\nSpill to disk\n");
+                std::replace(backpressure_policy_items.begin(), backpressure_policy_items.end(), '\n', '\0');
+                ImGui::BeginDisabled(screenshot_myset.memory_budget == 0);
+                modified |= ImGui::Combo(_("Over budget"), reinterpret_cast<int *>(&screenshot_myset.backpressure_policy), backpressure_policy_items.c_str());
+                ImGui::EndDisabled();
+                if (ImGui::IsItemHovered(ImGuiHoveredFlags_ForTooltip | ImGuiHoveredFlags_AllowWhenDisabled))
+                {
+                    if (ImGui::BeginTooltip())
+                    {
+                        ImGui::TextUnformatted(_("Wait for workers: Stall the game until enough frames were saved.\n"
+                            "Drop oldest frame: Discard the oldest frame that was not saved yet.\n"
+                            "Drop newest frame: Skip capturing the current frame.\n"
+                            "Halve resolution: Save the current frame at half width and height.\n"
+                            "Spill to disk: Move the current frame to a temporary file until it can be saved."));
+                        ImGui::EndTooltip();
+                    }
+                }
+                const bool preroll_seconds = screenshot_myset.preroll_unit == decltype(screenshot_myset::preroll_unit)::preroll_seconds;
+                if (ImGui::SliderInt(_("Pre-roll"), reinterpret_cast<int *>(&screenshot_myset.preroll_length), 0, preroll_seconds ? 60 : 600, screenshot_myset.preroll_length == 0 ? _("disabled") : preroll_seconds ? _("last %d seconds") : _("last %d frames")))
+                {
+                    if (static_cast<int>(screenshot_myset.preroll_length) < 0)
+                        screenshot_myset.preroll_length = 0;
+
+                    modified = true;
+                }
+                if (ImGui::IsItemHovered(ImGuiHoveredFlags_ForTooltip))
+                {
+                    if (ImGui::BeginTooltip())
+                    {
+                        ImGui::TextUnformatted(_("Keep capturing at the repeat interval while no set is active, and save the captured frames in front of the others when pressing the screenshot shortcut key.\n"
+                            "Only the first set with a pre-roll and a shortcut key does so. The memory budget limits the frames kept as well."));
+                        ImGui::EndTooltip();
+                    }
+                }
+                std::string preroll_unit_items = _("Frames\nSeconds\n");
+                std::replace(preroll_unit_items.begin(), preroll_unit_items.end(), '\n', '\0');
+                ImGui::BeginDisabled(screenshot_myset.preroll_length == 0);
+                modified |= ImGui::Combo(_("Pre-roll unit"), reinterpret_cast<int *>(&screenshot_myset.preroll_unit), preroll_unit_items.c_str());
+                modified |= ImGui::Checkbox(_("Halve pre-roll resolution"), &screenshot_myset.preroll_downscale);
+                ImGui::EndDisabled();
+                if (ImGui::IsItemHovered(ImGuiHoveredFlags_ForTooltip | ImGuiHoveredFlags_AllowWhenDisabled))
+                {
+                    if (ImGui::BeginTooltip())
+                    {
+                        ImGui::TextUnformatted(_("Keep the frames of the pre-roll at half width and height, which takes a quarter of the memory."));
+                        ImGui::EndTooltip();
+                    }
+                }
                 uint32_t width = 0, height = 0;
                 runtime->get_screenshot_width_and_height(&width, &height);
                 int enables = 0, depths = 0;
@@ -763,16 +1268,94 @@ static void draw_setting_window(reshade::api::effect_runtime *runtime)
                     "[fpng] 32-bit PNG\0"
                     "[libtiff] 24-bit TIFF\0"
                     "[libtiff] 32-bit TIFF\0"
+                    "[parallel] 24-bit PNG\0"
+                    "[parallel] 32-bit PNG\0"
+                    "[raw] Transcode later\0"
+                    "[APNG] 24-bit animated PNG\0"
+                    "[APNG] 32-bit animated PNG\0"
                 );
                 if (ImGui::IsItemHovered(ImGuiHoveredFlags_ForTooltip))
                 {
                     if (ImGui::BeginTooltip())
                     {
                         ImGui::TextUnformatted(_("Select the image file format.\nNote: Depth is always saved in TIFF format regardless of this selection."));
+                        ImGui::TextUnformatted(_("APNG: Each take is saved as one animated PNG per kind, whose frames only hold what changed since the frame before.\n"
+                            "Frames are kept at full resolution for it, even with the pre-roll or the memory budget set to downscale."));
                         ImGui::EndTooltip();
                     }
                 }
-                if (screenshot_myset.image_format == 0 || screenshot_myset.image_format == 1)
+                if (screenshot_myset.image_format == 0 || screenshot_myset.image_format == 1 || screenshot_myset.image_format == 6 || screenshot_myset.image_format == 7)
+                {
+                    modified |= ImGui::Checkbox(_("Archive takes"), &screenshot_myset.archive_takes);
+                    if (ImGui::IsItemHovered(ImGuiHoveredFlags_ForTooltip))
+                    {
+                        if (ImGui::BeginTooltip())
+                        {
+                            ImGui::TextUnformatted(_("Append all images of a take to one .ssar file per kind instead of a file for each frame, which keeps long bursts contiguous on hard disks.\n"
+                                "Extract the PNG files with extract_archive.ps1 from the tools folder. Depth is still saved as separate TIFF files."));
+                            ImGui::EndTooltip();
+                        }
+                    }
+                }
+                if (screenshot_myset.image_format < 8)
+                {
+                    std::string duplicate_frames_items = _("Save anyway\nSkip\nHard link to the first\nList in a text file\n");
+                    std::replace(duplicate_frames_items.begin(), duplicate_frames_items.end(), '\n', '\0');
+                    ImGui::BeginDisabled(screenshot_myset.is_archived(screenshot_kind::after));
+                    modified |= ImGui::Combo(_("Duplicate frames"), reinterpret_cast<int *>(&screenshot_myset.duplicate_frames), duplicate_frames_items.c_str());
+                    ImGui::EndDisabled();
+                    if (ImGui::IsItemHovered(ImGuiHoveredFlags_ForTooltip | ImGuiHoveredFlags_AllowWhenDisabled))
+                    {
+                        if (ImGui::BeginTooltip())
+                        {
+                            ImGui::TextUnformatted(_("What to do with an image that is exactly the same as one saved before in the same take, e.g. while the game is paused, or before and after without active effects.\n"
+                                "Skip: Do not save it at all.\n"
+                                "Hard link to the first: Add its file name as another link to the same file, which takes no space.\n"
+                                "List in a text file: Write its file name and the one of the same image into a list next to it.\n"
+                                "Images are saved anyway if they cannot be linked or listed. Archived takes are not checked."));
+                            ImGui::EndTooltip();
+                        }
+                    }
+                }
+                if (screenshot_myset.image_format == 8)
+                {
+                    modified |= ImGui::Combo(_("Transcode to"), reinterpret_cast<int *>(&screenshot_myset.transcode_image_format),
+                        "[libpng] 24-bit PNG\0"
+                        "[libpng] 32-bit PNG\0"
+                        "[fpng] 24-bit PNG\0"
+                        "[fpng] 32-bit PNG\0"
+                        "[libtiff] 24-bit TIFF\0"
+                        "[libtiff] 32-bit TIFF\0"
+                        "[parallel] 24-bit PNG\0"
+                        "[parallel] 32-bit PNG\0"
+                    );
+                    if (ImGui::IsItemHovered(ImGuiHoveredFlags_ForTooltip))
+                    {
+                        if (ImGui::BeginTooltip())
+                        {
+                            ImGui::TextUnformatted(_("Frames are written unencoded while the set is active, and converted to this format in the background once it is done, using the compression settings below."));
+                            ImGui::EndTooltip();
+                        }
+                    }
+                }
+                modified |= ImGui::Checkbox(_("Tone map HDR"), &screenshot_myset.hdr_tone_mapping);
+                if (ImGui::IsItemHovered(ImGuiHoveredFlags_ForTooltip))
+                {
+                    if (ImGui::BeginTooltip())
+                    {
+                        ImGui::TextUnformatted(_("Applies when the game renders in HDR, where images are saved with 16 bits per channel (fpng: 8 bits).\n"
+                            "Enabled: Convert HDR10 and scRGB to sRGB, rolling off highlights towards the peak luminance.\n"
+                            "Disabled: Keep 10-bit values as they are and clip scRGB values brighter than SDR white."));
+                        ImGui::EndTooltip();
+                    }
+                }
+                ImGui::BeginDisabled(!screenshot_myset.hdr_tone_mapping);
+                if (ImGui::SliderInt(_("Peak luminance"), reinterpret_cast<int *>(&screenshot_myset.hdr_peak_luminance), 203, 10000, _("%d nits"), ImGuiSliderFlags_AlwaysClamp))
+                    modified = true;
+                ImGui::EndDisabled();
+                // Raw images are encoded later with the same settings
+                const unsigned int encoder_format = screenshot_myset.image_format == 8 ? screenshot_myset.transcode_image_format : screenshot_myset.image_format;
+                if (encoder_format == 0 || encoder_format == 1 || encoder_format == 6 || encoder_format == 7 || encoder_format == 9 || encoder_format == 10)
                 {
                     if (ImGui::TreeNodeEx(_("libpng settings###AdvancedSettingsLibpng"), ImGuiTreeNodeFlags_NoTreePushOnOpen))
                     {
@@ -855,9 +1438,10 @@ static void draw_setting_window(reshade::api::effect_runtime *runtime)
                                 *c = '\0';
                         }
                         modified |= reshade::imgui::radio_list(_("[zlib] Compression strategy"), compression_strategy_items, screenshot_myset.zlib_compression_strategy);
+                        modified |= deflate_backend_combo(_("Deflate backend###LibpngDeflateBackend"), screenshot_myset.deflate_backend);
                     }
                 }
-                if (screenshot_myset.image_format == 4 || screenshot_myset.image_format == 5 || screenshot_myset.is_enable(screenshot_kind::depth))
+                if (encoder_format == 4 || encoder_format == 5 || screenshot_myset.is_enable(screenshot_kind::depth))
                 {
                     if (ImGui::TreeNodeEx(_("LibTIFF settings###AdvancedSettingsLibtiff"), ImGuiTreeNodeFlags_NoTreePushOnOpen))
                     {
@@ -870,6 +1454,9 @@ static void draw_setting_window(reshade::api::effect_runtime *runtime)
                             case COMPRESSION_LZW:
                                 preview_value = _("LZW");
                                 break;
+                            case COMPRESSION_ADOBE_DEFLATE:
+                                preview_value = _("Deflate");
+                                break;
                             default:
                                 preview_value = _("Unknown");
                                 break;
@@ -886,8 +1473,50 @@ static void draw_setting_window(reshade::api::effect_runtime *runtime)
                                 screenshot_myset.tiff_compression_algorithm = COMPRESSION_LZW;
                                 modified = true;
                             }
+                            if (ImGui::Selectable(_("Deflate"), screenshot_myset.tiff_compression_algorithm == COMPRESSION_ADOBE_DEFLATE))
+                            {
+                                screenshot_myset.tiff_compression_algorithm = COMPRESSION_ADOBE_DEFLATE;
+                                modified = true;
+                            }
                             ImGui::EndCombo();
                         }
+                        if (screenshot_myset.tiff_compression_algorithm == COMPRESSION_ADOBE_DEFLATE)
+                        {
+                            // Same settings as for PNG images
+                            modified |= ImGui::SliderInt(_("[zlib] Compression level###LibtiffCompressionLevel"), &screenshot_myset.zlib_compression_level, Z_DEFAULT_COMPRESSION, Z_BEST_COMPRESSION,
+                                screenshot_myset.zlib_compression_level == Z_DEFAULT_COMPRESSION ? _("Default compression") :
+                                screenshot_myset.zlib_compression_level == Z_NO_COMPRESSION ? _("No compression") :
+                                screenshot_myset.zlib_compression_level == Z_BEST_SPEED ? _("Best speed") :
+                                screenshot_myset.zlib_compression_level == Z_BEST_COMPRESSION ? _("Best compression") : "%d", ImGuiSliderFlags_AlwaysClamp);
+                            modified |= deflate_backend_combo(_("Deflate backend###LibtiffDeflateBackend"), screenshot_myset.deflate_backend);
+                        }
+
+                        bool tiled = screenshot_myset.tiff_tile_size != 0;
+                        if (ImGui::Checkbox(_("Write tiles###LibtiffTiled"), &tiled))
+                        {
+                            screenshot_myset.tiff_tile_size = tiled ? 256 : 0;
+                            modified = true;
+                        }
+                        ImGui::SetItemTooltip(_("Splits the image into square tiles instead of strips of rows, which some viewers load faster for very large images. Either way they are compressed in parallel."));
+                        if (tiled)
+                        {
+                            if (ImGui::SliderInt(_("Tile size###LibtiffTileSize"), &screenshot_myset.tiff_tile_size, 16, 1024, "%d px", ImGuiSliderFlags_AlwaysClamp))
+                            {
+                                // TIFF requires tiles that are a multiple of 16 pixels wide and high
+                                screenshot_myset.tiff_tile_size = (screenshot_myset.tiff_tile_size + 8) / 16 * 16;
+                                modified = true;
+                            }
+                        }
+                        else
+                        {
+                            int tiff_strip_size = screenshot_myset.tiff_strip_size / (1024 * 1);
+                            if (ImGui::SliderInt(_("Strip size###LibtiffStripSize"), &tiff_strip_size, 16, 1024 * 4, "%d KiB", ImGuiSliderFlags_AlwaysClamp))
+                            {
+                                screenshot_myset.tiff_strip_size = tiff_strip_size * (1024 * 1);
+                                modified = true;
+                            }
+                            ImGui::SetItemTooltip(_("Amount of uncompressed data per strip. Smaller strips spread better across the worker threads, larger ones compress slightly better."));
+                        }
                     }
                 }
             }
@@ -905,7 +1534,14 @@ static void draw_setting_window(reshade::api::effect_runtime *runtime)
     }
 
     if (modified)
+    {
+        for (screenshot_myset &screenshot_myset : ctx.config.screenshot_mysets)
+            screenshot_myset.compile_path_templates();
+
+        ctx.active_screenshot_snapshot.reset();
+        ctx.update_preroll();
         ctx.save();
+    }
 }
 
 BOOL APIENTRY DllMain(HMODULE hModule, DWORD fdwReason, LPVOID)
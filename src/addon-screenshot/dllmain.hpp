@@ -7,6 +7,7 @@
 
 #include "res\version.h"
 #include "screenshot.hpp"
+#include "screenshot_worker.hpp"
 
 #include <reshade.hpp>
 
@@ -22,11 +23,34 @@ extern "C" __declspec(dllexport) const char *ISSUES = "https://github.com/cot6/r
 
 constexpr uint8_t s_runtime_id[16] = { 0x02, 0x82, 0xFF, 0x77, /**/ 0xEC, 0x5B, /**/ 0xAD, 0x42, /**/ 0x8C, 0xE0, 0x39, 0x7F, 0x3E, 0x84, 0xEA, 0xA6 };
 
+/// <summary>
+/// Settings of the pre-roll myset that decide which frames are kept in the pre-roll ring and what they contain.
+/// </summary>
+struct screenshot_preroll_settings
+{
+    const screenshot_myset *myset = nullptr;
+    unsigned int length = 0;
+    unsigned int unit = 0;
+    unsigned int repeat_interval = 0;
+    unsigned int memory_budget = 0;
+    bool downscale = false;
+    bool animated = false;
+    // Bit for every kind of image that is captured
+    unsigned int kinds = 0;
+
+    bool operator==(const screenshot_preroll_settings &other) const noexcept
+    {
+        return myset == other.myset && length == other.length && unit == other.unit && repeat_interval == other.repeat_interval &&
+            memory_budget == other.memory_budget && downscale == other.downscale && animated == other.animated && kinds == other.kinds;
+    }
+};
+
 class __declspec(uuid("a722aa89-f8e3-43f2-84f2-72fe0122b715")) screenshot_context
 {
 public:
     screenshot_config config;
     screenshot_environment environment;
+    std::shared_ptr<const screenshot_environment> environment_snapshot;
     screenshot_statistics statistics;
 
     uint64_t current_frame = 0;
@@ -36,14 +60,29 @@ public:
     std::chrono::system_clock::time_point capture_time, capture_last;
 
     screenshot_myset *active_screenshot = nullptr;
+    /// <summary>
+    /// Copy of the active myset shared by all screenshots taken with it, created on the first capture and dropped whenever the settings change.
+    /// </summary>
+    std::shared_ptr<const screenshot_myset> active_screenshot_snapshot;
+    screenshot_statistics_counter *active_counter = nullptr;
+    /// <summary>
+    /// First myset with a pre-roll, which keeps capturing into the pre-roll ring while no myset is active.
+    /// </summary>
+    screenshot_myset *preroll_screenshot = nullptr;
+    std::shared_ptr<const screenshot_myset> preroll_screenshot_snapshot;
+    /// <summary>
+    /// Settings the pre-roll ring was configured with, so that editing anything else keeps the frames in it.
+    /// </summary>
+    screenshot_preroll_settings preroll_settings;
     screenshot_state screenshot_state;
 
     uint64_t screenshot_begin_frame = std::numeric_limits<decltype(screenshot_begin_frame)>::max();
     unsigned int screenshot_repeat_index = 0;
+    // Number of frames from the pre-roll ring in front of the current take
+    unsigned int screenshot_repeat_offset = 0;
 
     std::list<screenshot> screenshots;
-    std::atomic<size_t> screenshot_active_threads;
-    size_t screenshot_worker_threads = 0;
+    screenshot_worker_pool worker_pool;
 
     bool ignore_shortcuts = false;
     bool effects_state_activated = false;
@@ -51,9 +90,19 @@ public:
     DWORD playsound_flags = 0;
 
     void save();
+    /// <summary>
+    /// Picks the myset that captures into the pre-roll ring again. Has to be called whenever the settings changed.
+    /// The frames in the ring are only discarded when a setting changed that they depend on.
+    /// </summary>
+    void update_preroll();
+    /// <summary>
+    /// Hands the frames of the pre-roll ring over to the workers as the first frames of the take that was just started.
+    /// </summary>
+    void flush_preroll();
 
     inline bool is_screenshot_active() const noexcept;
     inline bool is_screenshot_enable(screenshot_kind kind) const noexcept;
     inline bool is_screenshot_frame() const noexcept;
     inline bool is_screenshot_frame(screenshot_kind kind) const noexcept;
+    inline bool is_preroll_frame() const noexcept;
 };
@@ -0,0 +1,1227 @@
+﻿/*
+ * SPDX-FileCopyrightText: 2018 seri14
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "pixel_convert.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <initializer_list>
+#include <utility>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define PIXEL_CONVERT_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define PIXEL_CONVERT_TARGET(isa)
+#else
+#define PIXEL_CONVERT_TARGET(isa) __attribute__((target(isa)))
+#endif
+#elif defined(_M_ARM64) || defined(__aarch64__)
+#define PIXEL_CONVERT_NEON 1
+#include <arm_neon.h>
+#endif
+
+// Scalar kernels, which are the reference for all others and also handle the remainder that does not fill a whole vector
+
+static void rgba_to_rgb_scalar(uint8_t *dst, const uint8_t *src, size_t count)
+{
+    for (size_t i = 0; i < count; i++, dst += 3, src += 4)
+    {
+        dst[0] = src[0];
+        dst[1] = src[1];
+        dst[2] = src[2];
+    }
+}
+static void swap_red_blue_scalar(uint32_t *pixels, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        const uint32_t v = pixels[i];
+        pixels[i] = (v & 0xFF00FF00) | ((v >> 16) & 0x000000FF) | ((v << 16) & 0x00FF0000);
+    }
+}
+static void force_opaque_scalar(uint32_t *pixels, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        pixels[i] |= 0xFF000000;
+}
+
+#if PIXEL_CONVERT_X86
+
+static inline __m128i pack_rgb_sse2(__m128i x)
+{
+    // Without byte shuffles, join each pair of pixels in a 64-bit lane first and then close the gap between the two lanes
+    const __m128i first_mask = _mm_set_epi32(0, 0x00FFFFFF, 0, 0x00FFFFFF);
+    const __m128i second_mask = _mm_set_epi32(0x0000FFFF, static_cast<int>(0xFF000000), 0x0000FFFF, static_cast<int>(0xFF000000));
+    const __m128i low_lane = _mm_set_epi32(0, 0, -1, -1);
+
+    const __m128i pairs = _mm_or_si128(_mm_and_si128(x, first_mask), _mm_and_si128(_mm_srli_epi64(x, 8), second_mask));
+    return _mm_or_si128(_mm_and_si128(pairs, low_lane), _mm_srli_si128(_mm_andnot_si128(low_lane, pairs), 2));
+}
+
+static void rgba_to_rgb_sse2(uint8_t *dst, const uint8_t *src, size_t count)
+{
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16, dst += 48, src += 64)
+    {
+        // All loads happen before the stores, so that converting in place never overwrites pixels that were not read yet
+        const __m128i a = pack_rgb_sse2(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src)));
+        const __m128i b = pack_rgb_sse2(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 16)));
+        const __m128i c = pack_rgb_sse2(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 32)));
+        const __m128i d = pack_rgb_sse2(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 48)));
+
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_or_si128(a, _mm_slli_si128(b, 12)));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 16), _mm_or_si128(_mm_srli_si128(b, 4), _mm_slli_si128(c, 8)));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 32), _mm_or_si128(_mm_srli_si128(c, 8), _mm_slli_si128(d, 4)));
+    }
+
+    rgba_to_rgb_scalar(dst, src, count - i);
+}
+static void swap_red_blue_sse2(uint32_t *pixels, size_t count)
+{
+    const __m128i green_alpha = _mm_set1_epi32(static_cast<int>(0xFF00FF00));
+    const __m128i low_byte = _mm_set1_epi32(0x000000FF);
+    const __m128i third_byte = _mm_set1_epi32(0x00FF0000);
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pixels + i));
+        const __m128i r = _mm_or_si128(_mm_and_si128(v, green_alpha), _mm_or_si128(_mm_and_si128(_mm_srli_epi32(v, 16), low_byte), _mm_and_si128(_mm_slli_epi32(v, 16), third_byte)));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(pixels + i), r);
+    }
+
+    swap_red_blue_scalar(pixels + i, count - i);
+}
+static void force_opaque_sse2(uint32_t *pixels, size_t count)
+{
+    const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xFF000000));
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pixels + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(pixels + i), _mm_or_si128(v, alpha));
+    }
+
+    force_opaque_scalar(pixels + i, count - i);
+}
+
+PIXEL_CONVERT_TARGET("avx2")
+static void rgba_to_rgb_avx2(uint8_t *dst, const uint8_t *src, size_t count)
+{
+    // Compact each 128-bit half to 12 bytes, then move the two halves next to each other
+    const __m256i shuffle = _mm256_setr_epi8(
+        0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+        0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    const __m256i permute = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16, dst += 48, src += 64)
+    {
+        const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src));
+        const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + 32));
+
+        const __m256i packed_a = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(a, shuffle), permute);
+        const __m256i packed_b = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(b, shuffle), permute);
+
+        // Store exactly 24 bytes per half, so that nothing past the converted pixels is touched
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm256_castsi256_si128(packed_a));
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(dst + 16), _mm256_extracti128_si256(packed_a, 1));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 24), _mm256_castsi256_si128(packed_b));
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(dst + 40), _mm256_extracti128_si256(packed_b, 1));
+    }
+
+    rgba_to_rgb_scalar(dst, src, count - i);
+}
+PIXEL_CONVERT_TARGET("avx2")
+static void swap_red_blue_avx2(uint32_t *pixels, size_t count)
+{
+    const __m256i shuffle = _mm256_setr_epi8(
+        2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+        2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pixels + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(pixels + i), _mm256_shuffle_epi8(v, shuffle));
+    }
+
+    swap_red_blue_scalar(pixels + i, count - i);
+}
+PIXEL_CONVERT_TARGET("avx2")
+static void force_opaque_avx2(uint32_t *pixels, size_t count)
+{
+    const __m256i alpha = _mm256_set1_epi32(static_cast<int>(0xFF000000));
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pixels + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(pixels + i), _mm256_or_si256(v, alpha));
+    }
+
+    force_opaque_scalar(pixels + i, count - i);
+}
+
+static bool is_avx2_supported()
+{
+#if defined(_MSC_VER)
+    int info[4] = {};
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+
+    // The operating system has to save the upper halves of the vector registers as well
+    __cpuid(info, 1);
+    if ((info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0 || (_xgetbv(0) & 0x6) != 0x6)
+        return false;
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif
+
+#if PIXEL_CONVERT_NEON
+
+static void rgba_to_rgb_neon(uint8_t *dst, const uint8_t *src, size_t count)
+{
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16, dst += 48, src += 64)
+    {
+        const uint8x16x4_t rgba = vld4q_u8(src);
+        const uint8x16x3_t rgb = { { rgba.val[0], rgba.val[1], rgba.val[2] } };
+        vst3q_u8(dst, rgb);
+    }
+
+    rgba_to_rgb_scalar(dst, src, count - i);
+}
+static void swap_red_blue_neon(uint32_t *pixels, size_t count)
+{
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16)
+    {
+        uint8x16x4_t v = vld4q_u8(reinterpret_cast<const uint8_t *>(pixels + i));
+        const uint8x16_t red = v.val[0];
+        v.val[0] = v.val[2];
+        v.val[2] = red;
+        vst4q_u8(reinterpret_cast<uint8_t *>(pixels + i), v);
+    }
+
+    swap_red_blue_scalar(pixels + i, count - i);
+}
+static void force_opaque_neon(uint32_t *pixels, size_t count)
+{
+    const uint32x4_t alpha = vdupq_n_u32(0xFF000000);
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+        vst1q_u32(pixels + i, vorrq_u32(vld1q_u32(pixels + i), alpha));
+
+    force_opaque_scalar(pixels + i, count - i);
+}
+
+#endif
+
+// High dynamic range conversions
+
+namespace
+{
+    /// <summary>
+    /// Decoding parameters shared by all high dynamic range kernels, derived once per call.
+    /// </summary>
+    struct hdr_params
+    {
+        pixel_convert::transfer_function transfer;
+        // Factor that brings decoded values to units of reference white
+        float scale;
+        // Inverse of the squared peak relative to reference white, which is what the extended Reinhard curve maps to 1.0
+        float inv_white_sq;
+        bool tone_map;
+    };
+
+    struct hdr_tables
+    {
+        float pq_to_nits[1024];
+        uint16_t srgb_encode[65536];
+
+        hdr_tables()
+        {
+            // SMPTE ST 2084 electro-optical transfer function
+            constexpr double m1 = 2610.0 / 16384.0, m2 = 2523.0 / 4096.0 * 128.0;
+            constexpr double c1 = 3424.0 / 4096.0, c2 = 2413.0 / 4096.0 * 32.0, c3 = 2392.0 / 4096.0 * 32.0;
+            for (unsigned int i = 0; i < 1024; i++)
+            {
+                const double e = std::pow(i / 1023.0, 1.0 / m2);
+                pq_to_nits[i] = static_cast<float>(10000.0 * std::pow(std::max(e - c1, 0.0) / (c2 - c3 * e), 1.0 / m1));
+            }
+
+            for (unsigned int i = 0; i < 65536; i++)
+            {
+                const double c = i / 65535.0;
+                srgb_encode[i] = static_cast<uint16_t>(std::lround(65535.0 * (c <= 0.0031308 ? c * 12.92 : 1.055 * std::pow(c, 1.0 / 2.4) - 0.055)));
+            }
+        }
+    };
+
+    const hdr_tables &get_hdr_tables()
+    {
+        static const hdr_tables tables;
+        return tables;
+    }
+
+    // Reference white of SDR content inside an HDR signal, as recommended by ITU-R BT.2408
+    constexpr float reference_white_nits = 203.0f;
+    // BT.2020 to BT.709 primaries, for linear light
+    constexpr float bt2020_to_bt709[3][3] = {
+        {  1.660491f, -0.587641f, -0.072850f },
+        { -0.124550f,  1.132900f, -0.008349f },
+        { -0.018151f, -0.100579f,  1.118730f },
+    };
+}
+
+// Same results as the MAXPS and MINPS instructions, including which operand wins when one is not a number
+static inline float max_ps(float a, float b)
+{
+    return a > b ? a : b;
+}
+static inline float min_ps(float a, float b)
+{
+    return a < b ? a : b;
+}
+
+static inline float decode_half(uint16_t value)
+{
+    // Rebias the exponent with a multiplication, which also turns denormals into normals. Infinity and not-a-number saturate to large finite values instead.
+    const uint32_t magnitude = static_cast<uint32_t>(value & 0x7FFF) << 13;
+    float result;
+    std::memcpy(&result, &magnitude, sizeof(result));
+    result *= 0x1p112f;
+
+    uint32_t bits;
+    std::memcpy(&bits, &result, sizeof(bits));
+    bits |= static_cast<uint32_t>(value & 0x8000) << 16;
+    std::memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+static inline uint16_t tone_map_encode_scalar(float c, const hdr_tables &tables)
+{
+    c = min_ps(max_ps(c, 0.0f), 1.0f);
+    return tables.srgb_encode[static_cast<int32_t>(c * 65535.0f + 0.5f)];
+}
+static inline void tone_map_scalar(float r, float g, float b, const hdr_params &params, const hdr_tables &tables, uint16_t *dst)
+{
+    r *= params.scale;
+    g *= params.scale;
+    b *= params.scale;
+
+    if (params.tone_map)
+    {
+        // Extended Reinhard on the largest channel, scaling all three by the same factor to keep the hue
+        const float m = max_ps(r, max_ps(g, b));
+        if (m > 0.0f)
+        {
+            const float f = (1.0f + m * params.inv_white_sq) / (1.0f + m);
+            r *= f;
+            g *= f;
+            b *= f;
+        }
+    }
+
+    dst[0] = tone_map_encode_scalar(r, tables);
+    dst[1] = tone_map_encode_scalar(g, tables);
+    dst[2] = tone_map_encode_scalar(b, tables);
+}
+
+static void r10g10b10a2_to_rgba16_scalar(uint16_t *dst, const uint32_t *src, size_t count, bool bgra, const hdr_params &params)
+{
+    const hdr_tables &tables = get_hdr_tables();
+
+    for (size_t i = 0; i < count; i++, dst += 4)
+    {
+        const uint32_t v = src[i];
+        uint32_t r = v & 0x3FF, g = (v >> 10) & 0x3FF, b = (v >> 20) & 0x3FF;
+        if (bgra)
+            std::swap(r, b);
+
+        if (params.transfer == pixel_convert::transfer_function::pq)
+        {
+            const float lr = tables.pq_to_nits[r], lg = tables.pq_to_nits[g], lb = tables.pq_to_nits[b];
+            tone_map_scalar(
+                bt2020_to_bt709[0][0] * lr + bt2020_to_bt709[0][1] * lg + bt2020_to_bt709[0][2] * lb,
+                bt2020_to_bt709[1][0] * lr + bt2020_to_bt709[1][1] * lg + bt2020_to_bt709[1][2] * lb,
+                bt2020_to_bt709[2][0] * lr + bt2020_to_bt709[2][1] * lg + bt2020_to_bt709[2][2] * lb,
+                params, tables, dst);
+        }
+        else
+        {
+            // Replicate the top bits into the bottom ones, so that 0x3FF becomes 0xFFFF
+            dst[0] = static_cast<uint16_t>((r << 6) | (r >> 4));
+            dst[1] = static_cast<uint16_t>((g << 6) | (g >> 4));
+            dst[2] = static_cast<uint16_t>((b << 6) | (b >> 4));
+        }
+
+        dst[3] = static_cast<uint16_t>((v >> 30) * 0x5555);
+    }
+}
+static void rgba16f_to_rgba16_scalar(uint16_t *dst, const uint16_t *src, size_t count, const hdr_params &params)
+{
+    const hdr_tables &tables = get_hdr_tables();
+
+    for (size_t i = 0; i < count; i++, dst += 4, src += 4)
+    {
+        const float a = min_ps(max_ps(decode_half(src[3]), 0.0f), 1.0f);
+        tone_map_scalar(decode_half(src[0]), decode_half(src[1]), decode_half(src[2]), params, tables, dst);
+        dst[3] = static_cast<uint16_t>(static_cast<int32_t>(a * 65535.0f + 0.5f));
+    }
+}
+static void rgba16_to_rgb16_scalar(uint16_t *dst, const uint16_t *src, size_t count)
+{
+    for (size_t i = 0; i < count; i++, dst += 3, src += 4)
+    {
+        dst[0] = src[0];
+        dst[1] = src[1];
+        dst[2] = src[2];
+    }
+}
+static void rgba16_to_rgba8_scalar(uint8_t *dst, const uint16_t *src, size_t count)
+{
+    // Rounds to nearest, which is the same as dividing by 257 with rounding
+    for (size_t i = 0; i < count * 4; i++)
+        dst[i] = static_cast<uint8_t>((src[i] * 255u + 32895u) >> 16);
+}
+static void byte_swap16_scalar(uint16_t *values, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        values[i] = static_cast<uint16_t>((values[i] << 8) | (values[i] >> 8));
+}
+
+#if PIXEL_CONVERT_X86
+
+static inline __m128i pack_u16_sse2(__m128i a, __m128i b)
+{
+    // There is no unsigned saturating pack from 32 to 16 bits in SSE2, so move the range into signed and back
+    const __m128i bias32 = _mm_set1_epi32(0x8000);
+    const __m128i bias16 = _mm_set1_epi16(static_cast<short>(0x8000));
+    return _mm_xor_si128(_mm_packs_epi32(_mm_sub_epi32(a, bias32), _mm_sub_epi32(b, bias32)), bias16);
+}
+static inline void store_rgba16_sse2(uint16_t *dst, __m128i r, __m128i g, __m128i b, __m128i a)
+{
+    const __m128i rg = pack_u16_sse2(r, g);
+    const __m128i ba = pack_u16_sse2(b, a);
+    const __m128i rb = _mm_unpacklo_epi16(rg, ba);
+    const __m128i ga = _mm_unpackhi_epi16(rg, ba);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_unpacklo_epi16(rb, ga));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 8), _mm_unpackhi_epi16(rb, ga));
+}
+
+static inline __m128i tone_map_encode_sse2(__m128 c, const hdr_tables &tables)
+{
+    c = _mm_min_ps(_mm_max_ps(c, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+
+    // Table lookups have no vector equivalent before AVX2, and even there only for 32-bit elements
+    alignas(16) int32_t index[4];
+    _mm_store_si128(reinterpret_cast<__m128i *>(index), _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(c, _mm_set1_ps(65535.0f)), _mm_set1_ps(0.5f))));
+    return _mm_setr_epi32(tables.srgb_encode[index[0]], tables.srgb_encode[index[1]], tables.srgb_encode[index[2]], tables.srgb_encode[index[3]]);
+}
+static inline void tone_map_sse2(__m128 r, __m128 g, __m128 b, const hdr_params &params, const hdr_tables &tables, __m128i &r16, __m128i &g16, __m128i &b16)
+{
+    const __m128 scale = _mm_set1_ps(params.scale);
+    r = _mm_mul_ps(r, scale);
+    g = _mm_mul_ps(g, scale);
+    b = _mm_mul_ps(b, scale);
+
+    if (params.tone_map)
+    {
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 m = _mm_max_ps(r, _mm_max_ps(g, b));
+        const __m128 f = _mm_div_ps(_mm_add_ps(one, _mm_mul_ps(m, _mm_set1_ps(params.inv_white_sq))), _mm_add_ps(one, m));
+        const __m128 positive = _mm_cmpgt_ps(m, _mm_setzero_ps());
+        const __m128 factor = _mm_or_ps(_mm_and_ps(positive, f), _mm_andnot_ps(positive, one));
+        r = _mm_mul_ps(r, factor);
+        g = _mm_mul_ps(g, factor);
+        b = _mm_mul_ps(b, factor);
+    }
+
+    r16 = tone_map_encode_sse2(r, tables);
+    g16 = tone_map_encode_sse2(g, tables);
+    b16 = tone_map_encode_sse2(b, tables);
+}
+
+static void r10g10b10a2_to_rgba16_sse2(uint16_t *dst, const uint32_t *src, size_t count, bool bgra, const hdr_params &params)
+{
+    const hdr_tables &tables = get_hdr_tables();
+    const __m128i mask = _mm_set1_epi32(0x3FF);
+    const __m128i alpha_scale = _mm_set1_epi32(0x5555);
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4, dst += 16)
+    {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        __m128i r = _mm_and_si128(v, mask);
+        __m128i g = _mm_and_si128(_mm_srli_epi32(v, 10), mask);
+        __m128i b = _mm_and_si128(_mm_srli_epi32(v, 20), mask);
+        if (bgra)
+            std::swap(r, b);
+
+        // Alpha is at most three, so the low 16 bits of the product are the whole result
+        const __m128i a = _mm_mullo_epi16(_mm_srli_epi32(v, 30), alpha_scale);
+
+        if (params.transfer == pixel_convert::transfer_function::pq)
+        {
+            alignas(16) int32_t ri[4], gi[4], bi[4];
+            _mm_store_si128(reinterpret_cast<__m128i *>(ri), r);
+            _mm_store_si128(reinterpret_cast<__m128i *>(gi), g);
+            _mm_store_si128(reinterpret_cast<__m128i *>(bi), b);
+            const __m128 lr = _mm_setr_ps(tables.pq_to_nits[ri[0]], tables.pq_to_nits[ri[1]], tables.pq_to_nits[ri[2]], tables.pq_to_nits[ri[3]]);
+            const __m128 lg = _mm_setr_ps(tables.pq_to_nits[gi[0]], tables.pq_to_nits[gi[1]], tables.pq_to_nits[gi[2]], tables.pq_to_nits[gi[3]]);
+            const __m128 lb = _mm_setr_ps(tables.pq_to_nits[bi[0]], tables.pq_to_nits[bi[1]], tables.pq_to_nits[bi[2]], tables.pq_to_nits[bi[3]]);
+
+            __m128 c[3];
+            for (int k = 0; k < 3; k++)
+                c[k] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(bt2020_to_bt709[k][0]), lr), _mm_mul_ps(_mm_set1_ps(bt2020_to_bt709[k][1]), lg)), _mm_mul_ps(_mm_set1_ps(bt2020_to_bt709[k][2]), lb));
+
+            tone_map_sse2(c[0], c[1], c[2], params, tables, r, g, b);
+        }
+        else
+        {
+            r = _mm_or_si128(_mm_slli_epi32(r, 6), _mm_srli_epi32(r, 4));
+            g = _mm_or_si128(_mm_slli_epi32(g, 6), _mm_srli_epi32(g, 4));
+            b = _mm_or_si128(_mm_slli_epi32(b, 6), _mm_srli_epi32(b, 4));
+        }
+
+        store_rgba16_sse2(dst, r, g, b, a);
+    }
+
+    r10g10b10a2_to_rgba16_scalar(dst, src + i, count - i, bgra, params);
+}
+static void rgba16f_to_rgba16_sse2(uint16_t *dst, const uint16_t *src, size_t count, const hdr_params &params)
+{
+    const hdr_tables &tables = get_hdr_tables();
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i magnitude_mask = _mm_set1_epi32(0x7FFF);
+    const __m128i sign_mask = _mm_set1_epi32(0x8000);
+    const __m128 exponent_bias = _mm_set1_ps(0x1p112f);
+
+    const auto decode = [&](__m128i h) {
+        const __m128 magnitude = _mm_mul_ps(_mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(h, magnitude_mask), 13)), exponent_bias);
+        return _mm_or_ps(magnitude, _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(h, sign_mask), 16)));
+    };
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4, dst += 16, src += 16)
+    {
+        // Transpose four pixels into one vector per channel, so the loads all happen before the stores and converting in place works
+        const __m128i x0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+        const __m128i x1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 8));
+        const __m128i t0 = _mm_unpacklo_epi16(x0, x1);
+        const __m128i t1 = _mm_unpackhi_epi16(x0, x1);
+        const __m128i rg = _mm_unpacklo_epi16(t0, t1);
+        const __m128i ba = _mm_unpackhi_epi16(t0, t1);
+
+        const __m128 alpha = _mm_min_ps(_mm_max_ps(decode(_mm_unpackhi_epi16(ba, zero)), _mm_setzero_ps()), _mm_set1_ps(1.0f));
+        const __m128i a = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(alpha, _mm_set1_ps(65535.0f)), _mm_set1_ps(0.5f)));
+
+        __m128i r, g, b;
+        tone_map_sse2(decode(_mm_unpacklo_epi16(rg, zero)), decode(_mm_unpackhi_epi16(rg, zero)), decode(_mm_unpacklo_epi16(ba, zero)), params, tables, r, g, b);
+
+        store_rgba16_sse2(dst, r, g, b, a);
+    }
+
+    rgba16f_to_rgba16_scalar(dst, src, count - i, params);
+}
+static void rgba16_to_rgb16_sse2(uint16_t *dst, const uint16_t *src, size_t count)
+{
+    // Same approach as for 8-bit pixels, with one pixel per 64-bit lane
+    const __m128i channels = _mm_set_epi32(0x0000FFFF, -1, 0x0000FFFF, -1);
+    const __m128i low_lane = _mm_set_epi32(0, 0, -1, -1);
+
+    const auto pack = [&](const uint16_t *p) {
+        const __m128i x = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p)), channels);
+        return _mm_or_si128(_mm_and_si128(x, low_lane), _mm_srli_si128(_mm_andnot_si128(low_lane, x), 2));
+    };
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8, dst += 24, src += 32)
+    {
+        const __m128i a = pack(src);
+        const __m128i b = pack(src + 8);
+        const __m128i c = pack(src + 16);
+        const __m128i d = pack(src + 24);
+
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_or_si128(a, _mm_slli_si128(b, 12)));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 8), _mm_or_si128(_mm_srli_si128(b, 4), _mm_slli_si128(c, 8)));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 16), _mm_or_si128(_mm_srli_si128(c, 8), _mm_slli_si128(d, 4)));
+    }
+
+    rgba16_to_rgb16_scalar(dst, src, count - i);
+}
+static void rgba16_to_rgba8_sse2(uint8_t *dst, const uint16_t *src, size_t count)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i rounding = _mm_set1_epi32(32895);
+
+    // Multiplying by 255 is a shift and a subtraction, which avoids the 32-bit multiplication SSE2 does not have
+    const auto narrow = [&](__m128i v) {
+        return _mm_srli_epi32(_mm_add_epi32(_mm_sub_epi32(_mm_slli_epi32(v, 8), v), rounding), 16);
+    };
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4, dst += 16, src += 16)
+    {
+        const __m128i x0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+        const __m128i x1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 8));
+        const __m128i lo = _mm_packs_epi32(narrow(_mm_unpacklo_epi16(x0, zero)), narrow(_mm_unpackhi_epi16(x0, zero)));
+        const __m128i hi = _mm_packs_epi32(narrow(_mm_unpacklo_epi16(x1, zero)), narrow(_mm_unpackhi_epi16(x1, zero)));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), _mm_packus_epi16(lo, hi));
+    }
+
+    rgba16_to_rgba8_scalar(dst, src, count - i);
+}
+static void byte_swap16_sse2(uint16_t *values, size_t count)
+{
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(values + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(values + i), _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8)));
+    }
+
+    byte_swap16_scalar(values + i, count - i);
+}
+
+#endif
+
+#if PIXEL_CONVERT_NEON
+
+static void rgba16_to_rgb16_neon(uint16_t *dst, const uint16_t *src, size_t count)
+{
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8, dst += 24, src += 32)
+    {
+        const uint16x8x4_t rgba = vld4q_u16(src);
+        const uint16x8x3_t rgb = { { rgba.val[0], rgba.val[1], rgba.val[2] } };
+        vst3q_u16(dst, rgb);
+    }
+
+    rgba16_to_rgb16_scalar(dst, src, count - i);
+}
+static void rgba16_to_rgba8_neon(uint8_t *dst, const uint16_t *src, size_t count)
+{
+    const uint32x4_t rounding = vdupq_n_u32(32895);
+
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2, dst += 8, src += 8)
+    {
+        const uint16x8_t v = vld1q_u16(src);
+        const uint32x4_t lo = vmlal_u16(rounding, vget_low_u16(v), vdup_n_u16(255));
+        const uint32x4_t hi = vmlal_u16(rounding, vget_high_u16(v), vdup_n_u16(255));
+        vst1_u8(dst, vmovn_u16(vcombine_u16(vshrn_n_u32(lo, 16), vshrn_n_u32(hi, 16))));
+    }
+
+    rgba16_to_rgba8_scalar(dst, src, count - i);
+}
+static void byte_swap16_neon(uint16_t *values, size_t count)
+{
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+        vst1q_u16(values + i, vreinterpretq_u16_u8(vrev16q_u8(vreinterpretq_u8_u16(vld1q_u16(values + i)))));
+
+    byte_swap16_scalar(values + i, count - i);
+}
+
+#endif
+
+// Comparisons, which only look at bytes and are the same for every pixel format
+
+static size_t equal_prefix_scalar(const uint8_t *a, const uint8_t *b, size_t size)
+{
+    size_t i = 0;
+    while (i < size && a[i] == b[i])
+        i++;
+    return i;
+}
+static size_t equal_suffix_scalar(const uint8_t *a, const uint8_t *b, size_t size)
+{
+    size_t i = size;
+    while (i != 0 && a[i - 1] == b[i - 1])
+        i--;
+    return size - i;
+}
+
+#if PIXEL_CONVERT_X86
+
+// Skip whole vectors that are equal, and let the scalar kernel find the exact byte in the one that is not
+static size_t equal_prefix_sse2(const uint8_t *a, const uint8_t *b, size_t size)
+{
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16)
+    {
+        const __m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i)), _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i)));
+        if (_mm_movemask_epi8(eq) != 0xFFFF)
+            break;
+    }
+
+    return i + equal_prefix_scalar(a + i, b + i, size - i);
+}
+static size_t equal_suffix_sse2(const uint8_t *a, const uint8_t *b, size_t size)
+{
+    size_t i = size;
+    for (; i >= 16; i -= 16)
+    {
+        const __m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i - 16)), _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i - 16)));
+        if (_mm_movemask_epi8(eq) != 0xFFFF)
+            break;
+    }
+
+    return size - i + equal_suffix_scalar(a, b, i);
+}
+
+PIXEL_CONVERT_TARGET("avx2")
+static size_t equal_prefix_avx2(const uint8_t *a, const uint8_t *b, size_t size)
+{
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32)
+    {
+        const __m256i eq = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i)), _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i)));
+        if (_mm256_movemask_epi8(eq) != -1)
+            break;
+    }
+
+    return i + equal_prefix_scalar(a + i, b + i, size - i);
+}
+PIXEL_CONVERT_TARGET("avx2")
+static size_t equal_suffix_avx2(const uint8_t *a, const uint8_t *b, size_t size)
+{
+    size_t i = size;
+    for (; i >= 32; i -= 32)
+    {
+        const __m256i eq = _mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i - 32)), _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i - 32)));
+        if (_mm256_movemask_epi8(eq) != -1)
+            break;
+    }
+
+    return size - i + equal_suffix_scalar(a, b, i);
+}
+
+#endif
+
+#if PIXEL_CONVERT_NEON
+
+static size_t equal_prefix_neon(const uint8_t *a, const uint8_t *b, size_t size)
+{
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16)
+    {
+        if (vminvq_u8(vceqq_u8(vld1q_u8(a + i), vld1q_u8(b + i))) != 0xFF)
+            break;
+    }
+
+    return i + equal_prefix_scalar(a + i, b + i, size - i);
+}
+static size_t equal_suffix_neon(const uint8_t *a, const uint8_t *b, size_t size)
+{
+    size_t i = size;
+    for (; i >= 16; i -= 16)
+    {
+        if (vminvq_u8(vceqq_u8(vld1q_u8(a + i - 16), vld1q_u8(b + i - 16))) != 0xFF)
+            break;
+    }
+
+    return size - i + equal_suffix_scalar(a, b, i);
+}
+
+#endif
+
+// Hashing, with the same structure as the long input loop of XXH3: eight 64-bit lanes each add the product of the two 32-bit halves of a 64-bit word mixed with a key,
+// where the key moves on with every stripe of 64 bytes so that reordered stripes do not cancel out, and the lanes are scrambled after every block of 16 stripes
+
+namespace
+{
+    constexpr size_t hash_stripe_size = 64;
+    constexpr size_t hash_block_stripes = 16;
+    constexpr size_t hash_block_size = hash_stripe_size * hash_block_stripes;
+
+    struct hash_secret
+    {
+        // Keys for the stripes of a block at 8 byte steps, followed by the key for the scramble
+        alignas(64) uint8_t bytes[192];
+
+        constexpr hash_secret() : bytes()
+        {
+            uint64_t state = 0x9E3779B97F4A7C15;
+            for (size_t i = 0; i < sizeof(bytes); i += 8)
+            {
+                // SplitMix64
+                uint64_t z = (state += 0x9E3779B97F4A7C15);
+                z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+                z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+                z ^= z >> 31;
+                for (size_t k = 0; k < 8; k++)
+                    bytes[i + k] = static_cast<uint8_t>(z >> (k * 8));
+            }
+        }
+    };
+
+    constexpr hash_secret s_hash_secret;
+    constexpr size_t hash_scramble_key_offset = sizeof(s_hash_secret.bytes) - hash_stripe_size;
+    constexpr uint64_t hash_prime32 = 0x9E3779B1;
+}
+
+static inline uint64_t load_le64(const uint8_t *p)
+{
+    uint64_t value = 0;
+    for (size_t k = 0; k < 8; k++)
+        value |= static_cast<uint64_t>(p[k]) << (k * 8);
+    return value;
+}
+
+static inline void hash_stripe_scalar(uint64_t *acc, const uint8_t *data, const uint8_t *key)
+{
+    for (size_t lane = 0; lane < 8; lane++)
+    {
+        const uint64_t value = load_le64(data + lane * 8);
+        const uint64_t keyed = value ^ load_le64(key + lane * 8);
+        acc[lane ^ 1] += value;
+        acc[lane] += (keyed & 0xFFFFFFFF) * (keyed >> 32);
+    }
+}
+static inline void hash_scramble_scalar(uint64_t *acc)
+{
+    for (size_t lane = 0; lane < 8; lane++)
+    {
+        uint64_t value = acc[lane];
+        value ^= value >> 47;
+        value ^= load_le64(s_hash_secret.bytes + hash_scramble_key_offset + lane * 8);
+        acc[lane] = value * hash_prime32;
+    }
+}
+static void hash_blocks_scalar(uint64_t *acc, const uint8_t *data, size_t blocks)
+{
+    for (size_t block = 0; block < blocks; block++, data += hash_block_size)
+    {
+        for (size_t stripe = 0; stripe < hash_block_stripes; stripe++)
+            hash_stripe_scalar(acc, data + stripe * hash_stripe_size, s_hash_secret.bytes + stripe * 8);
+        hash_scramble_scalar(acc);
+    }
+}
+
+#if PIXEL_CONVERT_X86
+
+// _mm_mul_epu32 multiplies the low 32 bits of each 64-bit lane, so the high half is shuffled down next to it, and shuffling the words swaps the lanes for the data that goes to the neighbouring accumulator
+static void hash_blocks_sse2(uint64_t *acc, const uint8_t *data, size_t blocks)
+{
+    __m128i lanes[4];
+    for (size_t i = 0; i < 4; i++)
+        lanes[i] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(acc) + i);
+
+    const __m128i prime = _mm_set1_epi32(static_cast<int>(hash_prime32));
+
+    for (size_t block = 0; block < blocks; block++, data += hash_block_size)
+    {
+        for (size_t stripe = 0; stripe < hash_block_stripes; stripe++)
+        {
+            const uint8_t *const stripe_data = data + stripe * hash_stripe_size;
+            const uint8_t *const key = s_hash_secret.bytes + stripe * 8;
+
+            for (size_t i = 0; i < 4; i++)
+            {
+                const __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i *>(stripe_data) + i);
+                const __m128i keyed = _mm_xor_si128(value, _mm_loadu_si128(reinterpret_cast<const __m128i *>(key) + i));
+                const __m128i product = _mm_mul_epu32(keyed, _mm_shuffle_epi32(keyed, _MM_SHUFFLE(0, 3, 0, 1)));
+                lanes[i] = _mm_add_epi64(lanes[i], _mm_add_epi64(product, _mm_shuffle_epi32(value, _MM_SHUFFLE(1, 0, 3, 2))));
+            }
+        }
+
+        for (size_t i = 0; i < 4; i++)
+        {
+            __m128i value = _mm_xor_si128(lanes[i], _mm_srli_epi64(lanes[i], 47));
+            value = _mm_xor_si128(value, _mm_load_si128(reinterpret_cast<const __m128i *>(s_hash_secret.bytes + hash_scramble_key_offset) + i));
+            // 64-bit multiplication by a 32-bit constant from two 32-bit ones
+            const __m128i low = _mm_mul_epu32(value, prime);
+            const __m128i high = _mm_mul_epu32(_mm_srli_epi64(value, 32), prime);
+            lanes[i] = _mm_add_epi64(low, _mm_slli_epi64(high, 32));
+        }
+    }
+
+    for (size_t i = 0; i < 4; i++)
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(acc) + i, lanes[i]);
+}
+
+PIXEL_CONVERT_TARGET("avx2")
+static void hash_blocks_avx2(uint64_t *acc, const uint8_t *data, size_t blocks)
+{
+    __m256i lanes[2];
+    for (size_t i = 0; i < 2; i++)
+        lanes[i] = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(acc) + i);
+
+    const __m256i prime = _mm256_set1_epi32(static_cast<int>(hash_prime32));
+
+    for (size_t block = 0; block < blocks; block++, data += hash_block_size)
+    {
+        for (size_t stripe = 0; stripe < hash_block_stripes; stripe++)
+        {
+            const uint8_t *const stripe_data = data + stripe * hash_stripe_size;
+            const uint8_t *const key = s_hash_secret.bytes + stripe * 8;
+
+            for (size_t i = 0; i < 2; i++)
+            {
+                const __m256i value = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(stripe_data) + i);
+                const __m256i keyed = _mm256_xor_si256(value, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(key) + i));
+                const __m256i product = _mm256_mul_epu32(keyed, _mm256_shuffle_epi32(keyed, _MM_SHUFFLE(0, 3, 0, 1)));
+                lanes[i] = _mm256_add_epi64(lanes[i], _mm256_add_epi64(product, _mm256_shuffle_epi32(value, _MM_SHUFFLE(1, 0, 3, 2))));
+            }
+        }
+
+        for (size_t i = 0; i < 2; i++)
+        {
+            __m256i value = _mm256_xor_si256(lanes[i], _mm256_srli_epi64(lanes[i], 47));
+            value = _mm256_xor_si256(value, _mm256_load_si256(reinterpret_cast<const __m256i *>(s_hash_secret.bytes + hash_scramble_key_offset) + i));
+            const __m256i low = _mm256_mul_epu32(value, prime);
+            const __m256i high = _mm256_mul_epu32(_mm256_srli_epi64(value, 32), prime);
+            lanes[i] = _mm256_add_epi64(low, _mm256_slli_epi64(high, 32));
+        }
+    }
+
+    for (size_t i = 0; i < 2; i++)
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(acc) + i, lanes[i]);
+}
+
+#endif
+
+#if PIXEL_CONVERT_NEON
+
+static void hash_blocks_neon(uint64_t *acc, const uint8_t *data, size_t blocks)
+{
+    uint64x2_t lanes[4];
+    for (size_t i = 0; i < 4; i++)
+        lanes[i] = vld1q_u64(acc + i * 2);
+
+    for (size_t block = 0; block < blocks; block++, data += hash_block_size)
+    {
+        for (size_t stripe = 0; stripe < hash_block_stripes; stripe++)
+        {
+            const uint8_t *const stripe_data = data + stripe * hash_stripe_size;
+            const uint8_t *const key = s_hash_secret.bytes + stripe * 8;
+
+            for (size_t i = 0; i < 4; i++)
+            {
+                const uint64x2_t value = vreinterpretq_u64_u8(vld1q_u8(stripe_data + i * 16));
+                const uint64x2_t keyed = veorq_u64(value, vreinterpretq_u64_u8(vld1q_u8(key + i * 16)));
+                const uint64x2_t product = vmull_u32(vmovn_u64(keyed), vshrn_n_u64(keyed, 32));
+                lanes[i] = vaddq_u64(lanes[i], vaddq_u64(product, vextq_u64(value, value, 1)));
+            }
+        }
+
+        for (size_t i = 0; i < 4; i++)
+        {
+            uint64x2_t value = veorq_u64(lanes[i], vshrq_n_u64(lanes[i], 47));
+            value = veorq_u64(value, vreinterpretq_u64_u8(vld1q_u8(s_hash_secret.bytes + hash_scramble_key_offset + i * 16)));
+            const uint64x2_t low = vmull_n_u32(vmovn_u64(value), static_cast<uint32_t>(hash_prime32));
+            const uint64x2_t high = vmull_n_u32(vshrn_n_u64(value, 32), static_cast<uint32_t>(hash_prime32));
+            lanes[i] = vaddq_u64(low, vshlq_n_u64(high, 32));
+        }
+    }
+
+    for (size_t i = 0; i < 4; i++)
+        vst1q_u64(acc + i * 2, lanes[i]);
+}
+
+#endif
+
+namespace
+{
+    struct kernels
+    {
+        pixel_convert::instruction_set set;
+        void(*rgba_to_rgb)(uint8_t *dst, const uint8_t *src, size_t count);
+        void(*swap_red_blue)(uint32_t *pixels, size_t count);
+        void(*force_opaque)(uint32_t *pixels, size_t count);
+        void(*r10g10b10a2_to_rgba16)(uint16_t *dst, const uint32_t *src, size_t count, bool bgra, const hdr_params &params);
+        void(*rgba16f_to_rgba16)(uint16_t *dst, const uint16_t *src, size_t count, const hdr_params &params);
+        void(*rgba16_to_rgb16)(uint16_t *dst, const uint16_t *src, size_t count);
+        void(*rgba16_to_rgba8)(uint8_t *dst, const uint16_t *src, size_t count);
+        void(*byte_swap16)(uint16_t *values, size_t count);
+        size_t(*equal_prefix)(const uint8_t *a, const uint8_t *b, size_t size);
+        size_t(*equal_suffix)(const uint8_t *a, const uint8_t *b, size_t size);
+        void(*hash_blocks)(uint64_t *acc, const uint8_t *data, size_t blocks);
+    };
+
+    const kernels s_scalar_kernels = { pixel_convert::instruction_set::scalar, rgba_to_rgb_scalar, swap_red_blue_scalar, force_opaque_scalar,
+        r10g10b10a2_to_rgba16_scalar, rgba16f_to_rgba16_scalar, rgba16_to_rgb16_scalar, rgba16_to_rgba8_scalar, byte_swap16_scalar,
+        equal_prefix_scalar, equal_suffix_scalar, hash_blocks_scalar };
+#if PIXEL_CONVERT_X86
+    const kernels s_sse2_kernels = { pixel_convert::instruction_set::sse2, rgba_to_rgb_sse2, swap_red_blue_sse2, force_opaque_sse2,
+        r10g10b10a2_to_rgba16_sse2, rgba16f_to_rgba16_sse2, rgba16_to_rgb16_sse2, rgba16_to_rgba8_sse2, byte_swap16_sse2,
+        equal_prefix_sse2, equal_suffix_sse2, hash_blocks_sse2 };
+    // The high dynamic range conversions are bound by their table lookups, which wider vectors do not speed up
+    const kernels s_avx2_kernels = { pixel_convert::instruction_set::avx2, rgba_to_rgb_avx2, swap_red_blue_avx2, force_opaque_avx2,
+        r10g10b10a2_to_rgba16_sse2, rgba16f_to_rgba16_sse2, rgba16_to_rgb16_sse2, rgba16_to_rgba8_sse2, byte_swap16_sse2,
+        equal_prefix_avx2, equal_suffix_avx2, hash_blocks_avx2 };
+#endif
+#if PIXEL_CONVERT_NEON
+    const kernels s_neon_kernels = { pixel_convert::instruction_set::neon, rgba_to_rgb_neon, swap_red_blue_neon, force_opaque_neon,
+        r10g10b10a2_to_rgba16_scalar, rgba16f_to_rgba16_scalar, rgba16_to_rgb16_neon, rgba16_to_rgba8_neon, byte_swap16_neon,
+        equal_prefix_neon, equal_suffix_neon, hash_blocks_neon };
+#endif
+
+    std::atomic<const kernels *> s_selected_kernels = nullptr;
+
+    const kernels *find_kernels(pixel_convert::instruction_set set)
+    {
+        switch (set)
+        {
+            case pixel_convert::instruction_set::scalar:
+                return &s_scalar_kernels;
+#if PIXEL_CONVERT_X86
+            case pixel_convert::instruction_set::sse2:
+                // Part of every x64 processor, and of every x86 processor Windows still runs on
+                return &s_sse2_kernels;
+            case pixel_convert::instruction_set::avx2:
+                return is_avx2_supported() ? &s_avx2_kernels : nullptr;
+#endif
+#if PIXEL_CONVERT_NEON
+            case pixel_convert::instruction_set::neon:
+                return &s_neon_kernels;
+#endif
+            default:
+                return nullptr;
+        }
+    }
+
+    const kernels &selected_kernels()
+    {
+        // Selecting more than once on concurrent first use is harmless, since every thread comes to the same result
+        if (const kernels *selected = s_selected_kernels.load(std::memory_order_relaxed); selected != nullptr)
+            return *selected;
+
+        const kernels *selected = &s_scalar_kernels;
+        for (pixel_convert::instruction_set set : { pixel_convert::instruction_set::avx2, pixel_convert::instruction_set::sse2, pixel_convert::instruction_set::neon })
+        {
+            if (const kernels *candidate = find_kernels(set); candidate != nullptr)
+            {
+                selected = candidate;
+                break;
+            }
+        }
+
+        s_selected_kernels.store(selected, std::memory_order_relaxed);
+        return *selected;
+    }
+}
+
+pixel_convert::instruction_set pixel_convert::current_instruction_set()
+{
+    return selected_kernels().set;
+}
+bool pixel_convert::select_instruction_set(instruction_set set)
+{
+    const kernels *const selected = find_kernels(set);
+    if (selected == nullptr)
+        return false;
+
+    s_selected_kernels.store(selected, std::memory_order_relaxed);
+    return true;
+}
+const char *pixel_convert::get_instruction_set_name(instruction_set set)
+{
+    switch (set)
+    {
+        case instruction_set::scalar:
+            return "scalar";
+        case instruction_set::sse2:
+            return "SSE2";
+        case instruction_set::avx2:
+            return "AVX2";
+        case instruction_set::neon:
+            return "NEON";
+        default:
+            return "unknown";
+    }
+}
+
+void pixel_convert::rgba_to_rgb(uint8_t *dst, const uint8_t *src, size_t count)
+{
+    selected_kernels().rgba_to_rgb(dst, src, count);
+}
+void pixel_convert::swap_red_blue(uint32_t *pixels, size_t count)
+{
+    selected_kernels().swap_red_blue(pixels, count);
+}
+void pixel_convert::force_opaque(uint32_t *pixels, size_t count)
+{
+    selected_kernels().force_opaque(pixels, count);
+}
+
+static hdr_params make_hdr_params(pixel_convert::transfer_function transfer, float peak_luminance)
+{
+    hdr_params params = {};
+    params.transfer = transfer;
+    params.scale = 1.0f;
+    params.inv_white_sq = 1.0f;
+    params.tone_map = transfer != pixel_convert::transfer_function::none;
+
+    if (transfer == pixel_convert::transfer_function::pq)
+        params.scale = 1.0f / reference_white_nits;
+    else if (transfer == pixel_convert::transfer_function::scrgb)
+        params.scale = 80.0f / reference_white_nits;
+
+    const float white = std::max(peak_luminance, reference_white_nits) / reference_white_nits;
+    params.inv_white_sq = 1.0f / (white * white);
+    return params;
+}
+
+void pixel_convert::r10g10b10a2_to_rgba16(uint16_t *dst, const uint32_t *src, size_t count, bool bgra, transfer_function transfer, float peak_luminance)
+{
+    // Only the perceptual quantizer is defined for integer input
+    if (transfer != transfer_function::pq)
+        transfer = transfer_function::none;
+
+    selected_kernels().r10g10b10a2_to_rgba16(dst, src, count, bgra, make_hdr_params(transfer, peak_luminance));
+}
+void pixel_convert::rgba16f_to_rgba16(uint16_t *dst, const uint16_t *src, size_t count, transfer_function transfer, float peak_luminance)
+{
+    // Only linear encodings are defined for floating-point input
+    if (transfer != transfer_function::scrgb)
+        transfer = transfer_function::none;
+
+    selected_kernels().rgba16f_to_rgba16(dst, src, count, make_hdr_params(transfer, peak_luminance));
+}
+void pixel_convert::rgba16_to_rgb16(uint16_t *dst, const uint16_t *src, size_t count)
+{
+    selected_kernels().rgba16_to_rgb16(dst, src, count);
+}
+void pixel_convert::rgba16_to_rgba8(uint8_t *dst, const uint16_t *src, size_t count)
+{
+    selected_kernels().rgba16_to_rgba8(dst, src, count);
+}
+void pixel_convert::byte_swap16(uint16_t *values, size_t count)
+{
+    selected_kernels().byte_swap16(values, count);
+}
+
+bool pixel_convert::find_changed_rect(const uint8_t *a, const uint8_t *b, uint32_t width, uint32_t height, size_t pitch, unsigned int bytes_per_pixel, uint32_t &x, uint32_t &y, uint32_t &rect_width, uint32_t &rect_height)
+{
+    const kernels &selected = selected_kernels();
+
+    const size_t row_size = static_cast<size_t>(width) * bytes_per_pixel;
+    const auto is_row_equal = [&](uint32_t row) { return selected.equal_prefix(a + pitch * row, b + pitch * row, row_size) == row_size; };
+
+    uint32_t top = 0;
+    while (top < height && is_row_equal(top))
+        top++;
+    if (top == height)
+        return false;
+
+    uint32_t bottom = height;
+    while (is_row_equal(bottom - 1))
+        bottom--;
+
+    // Columns in bytes, with the right one past the last difference
+    size_t left = row_size, right = 0;
+    for (uint32_t row = top; row < bottom; row++)
+    {
+        const uint8_t *const row_a = a + pitch * row;
+        const uint8_t *const row_b = b + pitch * row;
+
+        // Only what is outside of the rectangle found so far can make it wider
+        if (left != 0)
+            left = selected.equal_prefix(row_a, row_b, left);
+        if (right != row_size)
+            right = row_size - selected.equal_suffix(row_a + right, row_b + right, row_size - right);
+    }
+
+    x = static_cast<uint32_t>(left / bytes_per_pixel);
+    y = top;
+    rect_width = static_cast<uint32_t>((right + bytes_per_pixel - 1) / bytes_per_pixel) - x;
+    rect_height = bottom - top;
+    return true;
+}
+
+uint64_t pixel_convert::hash(const void *data, size_t size, uint64_t seed)
+{
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+
+    uint64_t acc[8] = {
+        hash_prime32 + seed, 0x9E3779B185EBCA87 - seed, 0xC2B2AE3D27D4EB4F + seed, 0x165667B19E3779F9 - seed,
+        0x85EBCA77C2B2AE63 + seed, 0x27D4EB2F165667C5 - seed, 0x61C8864E7A143579 + seed, 0xC2B2AE3D - seed };
+
+    const size_t blocks = size / hash_block_size;
+    selected_kernels().hash_blocks(acc, bytes, blocks);
+    bytes += blocks * hash_block_size;
+    size_t remaining = size - blocks * hash_block_size;
+
+    // The rest is less than a block and goes through the scalar code, with the last partial stripe padded with zeros
+    size_t stripe = 0;
+    for (; remaining >= hash_stripe_size; stripe++, bytes += hash_stripe_size, remaining -= hash_stripe_size)
+        hash_stripe_scalar(acc, bytes, s_hash_secret.bytes + stripe * 8);
+    if (remaining != 0)
+    {
+        uint8_t last[hash_stripe_size] = {};
+        std::memcpy(last, bytes, remaining);
+        hash_stripe_scalar(acc, last, s_hash_secret.bytes + stripe * 8);
+    }
+
+    // Fold the lanes together with the size, so that the padding is not the same as data that is zero, and finish with the SplitMix64 finalizer
+    uint64_t result = size * 0x9E3779B185EBCA87;
+    for (size_t lane = 0; lane < 8; lane++)
+    {
+        result ^= acc[lane] ^ load_le64(s_hash_secret.bytes + lane * 8);
+        result = ((result << 31) | (result >> 33)) * 0x9E3779B185EBCA87;
+    }
+
+    result = (result ^ (result >> 30)) * 0xBF58476D1CE4E5B9;
+    result = (result ^ (result >> 27)) * 0x94D049BB133111EB;
+    return result ^ (result >> 31);
+}
+
+float pixel_convert::half_to_float(uint16_t value)
+{
+    if ((value & 0x7C00) != 0x7C00)
+        return decode_half(value);
+
+    const uint32_t bits = (static_cast<uint32_t>(value & 0x8000) << 16) | 0x7F800000 | (static_cast<uint32_t>(value & 0x3FF) << 13);
+    float result;
+    std::memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+uint16_t pixel_convert::float_to_half(float value)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+
+    const uint16_t sign = static_cast<uint16_t>((bits >> 16) & 0x8000);
+    bits &= 0x7FFFFFFF;
+
+    // Infinity and not-a-number, keeping the latter quiet
+    if (bits >= 0x7F800000)
+        return sign | (bits > 0x7F800000 ? 0x7E00 : 0x7C00);
+    // Values that round past the largest finite half
+    if (bits >= 0x477FF000)
+        return sign | 0x7C00;
+
+    // Denormals, where adding 0.5 lets the floating-point unit round the mantissa into the right place
+    if (bits < 0x38800000)
+    {
+        float f;
+        std::memcpy(&f, &bits, sizeof(f));
+        f += 0.5f;
+        std::memcpy(&bits, &f, sizeof(bits));
+        return sign | static_cast<uint16_t>(bits - 0x3F000000);
+    }
+
+    // Rebias the exponent and round to nearest even on the dropped mantissa bits
+    bits += 0xC8000FFF + ((bits >> 13) & 1);
+    return sign | static_cast<uint16_t>(bits >> 13);
+}
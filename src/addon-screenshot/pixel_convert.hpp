@@ -0,0 +1,102 @@
+﻿/*
+ * SPDX-FileCopyrightText: 2018 seri14
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/// <summary>
+/// Pixel format conversions and comparisons used before encoding, with kernels for the instruction sets available on the running processor.
+/// The best supported kernel is picked on first use. All kernels produce exactly the same output as the scalar one.
+/// </summary>
+namespace pixel_convert
+{
+    enum class instruction_set
+    {
+        scalar,
+        sse2,
+        avx2,
+        neon,
+    };
+
+    /// <summary>
+    /// Instruction set the conversions currently run with.
+    /// </summary>
+    instruction_set current_instruction_set();
+    /// <summary>
+    /// Overrides the automatically selected instruction set, e.g. to compare kernels against each other.
+    /// </summary>
+    /// <returns><see langword="false"/> if the processor does not support <paramref name="set"/>, in which case the selection is not changed.</returns>
+    bool select_instruction_set(instruction_set set);
+    const char *get_instruction_set_name(instruction_set set);
+
+    /// <summary>
+    /// Packs 8-bit RGBA pixels into 8-bit RGB by dropping the alpha channel.
+    /// <paramref name="dst"/> may be the same as <paramref name="src"/> to convert in place.
+    /// </summary>
+    void rgba_to_rgb(uint8_t *dst, const uint8_t *src, size_t count);
+    /// <summary>
+    /// Swaps the first and third channel of 8-bit four channel pixels in place, which converts between BGRA and RGBA.
+    /// </summary>
+    void swap_red_blue(uint32_t *pixels, size_t count);
+    /// <summary>
+    /// Sets the alpha channel of 8-bit RGBA or BGRA pixels to fully opaque in place, e.g. for formats with an undefined X channel.
+    /// </summary>
+    void force_opaque(uint32_t *pixels, size_t count);
+
+    /// <summary>
+    /// Encoding of high dynamic range pixels, which decides how they are tone mapped to sRGB.
+    /// </summary>
+    enum class transfer_function
+    {
+        /// <summary>Values are kept as they are, only clamped to the displayable range.</summary>
+        none,
+        /// <summary>SMPTE ST 2084 with BT.2020 primaries, as used by HDR10 swap chains with 10-bit formats.</summary>
+        pq,
+        /// <summary>Linear with BT.709 primaries and 1.0 at 80 nits, as used by swap chains with 16-bit floating-point formats.</summary>
+        scrgb,
+    };
+
+    /// <summary>
+    /// Converts 10-bit RGBA or BGRA pixels with 2-bit alpha to 16-bit RGBA.
+    /// Without a transfer function the bits are only expanded, with <see cref="transfer_function::pq"/> the pixels are tone mapped to sRGB with a roll-off towards <paramref name="peak_luminance"/> nits.
+    /// </summary>
+    void r10g10b10a2_to_rgba16(uint16_t *dst, const uint32_t *src, size_t count, bool bgra, transfer_function transfer, float peak_luminance);
+    /// <summary>
+    /// Converts 16-bit floating-point RGBA pixels to sRGB encoded 16-bit RGBA, tone mapping them towards <paramref name="peak_luminance"/> nits with <see cref="transfer_function::scrgb"/>.
+    /// <paramref name="dst"/> may be the same as <paramref name="src"/> to convert in place.
+    /// </summary>
+    void rgba16f_to_rgba16(uint16_t *dst, const uint16_t *src, size_t count, transfer_function transfer, float peak_luminance);
+    /// <summary>
+    /// Packs 16-bit RGBA pixels into 16-bit RGB by dropping the alpha channel. Converts in place when <paramref name="dst"/> is the same as <paramref name="src"/>.
+    /// </summary>
+    void rgba16_to_rgb16(uint16_t *dst, const uint16_t *src, size_t count);
+    /// <summary>
+    /// Rounds 16-bit RGBA pixels to 8-bit RGBA. Converts in place when <paramref name="dst"/> is the same memory as <paramref name="src"/>.
+    /// </summary>
+    void rgba16_to_rgba8(uint8_t *dst, const uint16_t *src, size_t count);
+    /// <summary>
+    /// Swaps the bytes of each 16-bit value in place, e.g. to store samples in big-endian order.
+    /// </summary>
+    void byte_swap16(uint16_t *values, size_t count);
+
+    /// <summary>
+    /// Finds the smallest rectangle that holds all pixels which differ between two images of the same size, with rows <paramref name="pitch"/> bytes apart.
+    /// Rows are compared a vector at a time, and once a difference was found only the parts of the remaining rows outside the rectangle so far are compared.
+    /// </summary>
+    /// <returns><see langword="false"/> if the images are identical.</returns>
+    bool find_changed_rect(const uint8_t *a, const uint8_t *b, uint32_t width, uint32_t height, size_t pitch, unsigned int bytes_per_pixel, uint32_t &x, uint32_t &y, uint32_t &rect_width, uint32_t &rect_height);
+    /// <summary>
+    /// Computes a 64-bit hash of <paramref name="size"/> bytes, which is fast enough to run on every captured frame to tell whether it is the same as one before.
+    /// </summary>
+    uint64_t hash(const void *data, size_t size, uint64_t seed = 0);
+
+    float half_to_float(uint16_t value);
+    /// <summary>
+    /// Converts to a 16-bit floating-point value, rounding to nearest even.
+    /// </summary>
+    uint16_t float_to_half(float value);
+}
@@ -12,17 +12,22 @@
 #include "std_string_ext.hpp"
 
 #include "runtime_config.hpp"
+#include "pixel_convert.hpp"
 #include "screenshot.hpp"
+#include "screenshot_encoder.hpp"
+#include "screenshot_output.hpp"
+#include "screenshot_png.hpp"
+#include "screenshot_raw.hpp"
+#include "screenshot_worker.hpp"
 
 #include <time.h>
 
-#include <fpng.h>
 #include <png.h>
-#include <tiffio.h>
 #include <zlib.h>
 
+#include <algorithm>
+#include <cstring>
 #include <functional>
-#include <list>
 #include <string>
 #include <vector>
 
@@ -35,6 +40,10 @@ void screenshot_config::load(const ini_file &config)
         show_osd = decltype(show_osd)::show_osd_while_myset_is_active;
     if (!config.get("SCREENSHOT", "TurnOnEffects", reinterpret_cast<unsigned int &>(turn_on_effects)))
         turn_on_effects = decltype(turn_on_effects)::ignore;
+    if (!config.get("OVERLAY", "ShowStageTimings", show_stage_timings))
+        show_stage_timings = false;
+    if (!config.get("SCREENSHOT", "WriteStageTimings", write_stage_timings))
+        write_stage_timings = false;
 
     for (size_t seek = 0; seek < preset_names.size();)
     {
@@ -64,6 +73,8 @@ void screenshot_config::save(ini_file &config, bool header_only)
     config.set("SCREENSHOT", "PresetNames", preset_names);
     config.set("OVERLAY", "ShowOSD", static_cast<unsigned int>(show_osd));
     config.set("SCREENSHOT", "TurnOnEffects", static_cast<unsigned int>(turn_on_effects));
+    config.set("OVERLAY", "ShowStageTimings", show_stage_timings);
+    config.set("SCREENSHOT", "WriteStageTimings", write_stage_timings);
 }
 
 void screenshot_myset::load(const ini_file &config)
@@ -80,6 +91,12 @@ void screenshot_myset::load(const ini_file &config)
         image_freelimits[screenshot_kind::before] = 0;
     if (!config.get(section, "ImageFormat", image_format))
         image_format = 0;
+    if (!config.get(section, "TranscodeImageFormat", transcode_image_format) || transcode_image_format >= 8)
+        transcode_image_format = 0;
+    if (!config.get(section, "ArchiveTakes", archive_takes))
+        archive_takes = false;
+    if (!config.get(section, "DuplicateFrames", reinterpret_cast<unsigned int &>(duplicate_frames)) || duplicate_frames > duplicate_list)
+        duplicate_frames = duplicate_save;
     if (!config.get(section, "KeyScreenshot", screenshot_key_data))
         std::memset(screenshot_key_data, 0, sizeof(screenshot_key_data));
     if (!config.get(section, "OriginalImage", image_paths[screenshot_kind::original]))
@@ -102,6 +119,18 @@ void screenshot_myset::load(const ini_file &config)
         repeat_interval = 60;
     if (!config.get(section, "WorkerThreads", worker_threads))
         worker_threads = 0;
+    if (!config.get(section, "AutoTuneEncoder", auto_tune_encoder))
+        auto_tune_encoder = false;
+    if (!config.get(section, "MemoryBudget", memory_budget))
+        memory_budget = 0;
+    if (!config.get(section, "BackpressurePolicy", reinterpret_cast<unsigned int &>(backpressure_policy)))
+        backpressure_policy = backpressure_block;
+    if (!config.get(section, "PrerollLength", preroll_length))
+        preroll_length = 0;
+    if (!config.get(section, "PrerollUnit", reinterpret_cast<unsigned int &>(preroll_unit)))
+        preroll_unit = preroll_frames;
+    if (!config.get(section, "PrerollDownscale", preroll_downscale))
+        preroll_downscale = true;
     if (!config.get(section, "SoundPath", playsound_path))
         playsound_path.clear();
     if (!config.get(section, "PlaybackMode", reinterpret_cast<unsigned int &>(playback_mode)))
@@ -120,6 +149,26 @@ void screenshot_myset::load(const ini_file &config)
         zlib_compression_strategy = Z_RLE;
     if (!config.get(section, "TiffCompressionAlgorithm", tiff_compression_algorithm))
         tiff_compression_algorithm = COMPRESSION_LZW;
+    if (!config.get(section, "TiffStripSize", tiff_strip_size))
+        tiff_strip_size = 1024 * 256;
+    if (!config.get(section, "TiffTileSize", tiff_tile_size))
+        tiff_tile_size = 0;
+    if (!config.get(section, "DeflateBackend", reinterpret_cast<unsigned int &>(deflate_backend)))
+        deflate_backend = screenshot_deflate_backend::zlib;
+    if (!config.get(section, "HdrToneMapping", hdr_tone_mapping))
+        hdr_tone_mapping = false;
+    if (!config.get(section, "HdrPeakLuminance", hdr_peak_luminance))
+        hdr_peak_luminance = 1000;
+
+    compile_path_templates();
+}
+void screenshot_myset::compile_path_templates()
+{
+    for (size_t i = 0; i < image_paths.size(); i++)
+    {
+        if (std::string source = image_paths[i].u8string(); path_templates[i] == nullptr || path_templates[i]->source() != source)
+            path_templates[i] = std::make_shared<const screenshot_path_template>(source);
+    }
 }
 void screenshot_myset::save(ini_file &config) const
 {
@@ -130,6 +179,9 @@ void screenshot_myset::save(ini_file &config) const
     config.set(section, "BeforeImage", image_paths[screenshot_kind::before]);
     config.set(section, "BeforeImageDiskFreeLimit", image_freelimits[screenshot_kind::before]);
     config.set(section, "ImageFormat", image_format);
+    config.set(section, "TranscodeImageFormat", transcode_image_format);
+    config.set(section, "ArchiveTakes", archive_takes);
+    config.set(section, "DuplicateFrames", static_cast<unsigned int>(duplicate_frames));
     config.set(section, "KeyScreenshot", screenshot_key_data);
     config.set(section, "OriginalImage", image_paths[screenshot_kind::original]);
     config.set(section, "OriginalImageDiskFreeLimit", image_freelimits[screenshot_kind::original]);
@@ -141,6 +193,12 @@ void screenshot_myset::save(ini_file &config) const
     config.set(section, "RepeatCount", repeat_count);
     config.set(section, "RepeatInterval", repeat_interval);
     config.set(section, "WorkerThreads", worker_threads);
+    config.set(section, "AutoTuneEncoder", auto_tune_encoder);
+    config.set(section, "MemoryBudget", memory_budget);
+    config.set(section, "BackpressurePolicy", static_cast<unsigned int>(backpressure_policy));
+    config.set(section, "PrerollLength", preroll_length);
+    config.set(section, "PrerollUnit", static_cast<unsigned int>(preroll_unit));
+    config.set(section, "PrerollDownscale", preroll_downscale);
     config.set(section, "SoundPath", playsound_path);
     config.set(section, "PlaybackMode", static_cast<unsigned int>(playback_mode));
     config.set(section, "PlayDefaultIfNotExist", playsound_force);
@@ -150,33 +208,11 @@ void screenshot_myset::save(ini_file &config) const
     config.set(section, "ZlibCompressionLevel", zlib_compression_level);
     config.set(section, "ZlibCompressionStrategy", zlib_compression_strategy);
     config.set(section, "TiffCompressionAlgorithm", tiff_compression_algorithm);
-}
-void screenshot_statistics::load(const ini_file &config)
-{
-    static const std::string section = "COUNT";
-
-    ini_data::keys keys;
-    config.get(section, keys);
-
-    for (const auto &key : keys)
-    {
-        if (uint64_t value[2]{}; config.get(section, key, value))
-            capture_counts.try_emplace(key, screenshot_statistics_scoped_data{ value[0], value[1] });
-    }
-
-    capture_counts.try_emplace({});
-}
-void screenshot_statistics::save(ini_file &config) const
-{
-    static const std::string section = "COUNT";
-
-    config.erase(section);
-
-    for (const auto &capture_count : capture_counts)
-    {
-        uint64_t value[2]{ capture_count.second.total_take, capture_count.second.total_frame };
-        config.set(section, capture_count.first, value);
-    }
+    config.set(section, "TiffStripSize", tiff_strip_size);
+    config.set(section, "TiffTileSize", tiff_tile_size);
+    config.set(section, "DeflateBackend", static_cast<unsigned int>(deflate_backend));
+    config.set(section, "HdrToneMapping", hdr_tone_mapping);
+    config.set(section, "HdrPeakLuminance", hdr_peak_luminance);
 }
 
 void screenshot_environment::load(reshade::api::effect_runtime *runtime)
@@ -246,6 +282,7 @@ void screenshot_environment::load(reshade::api::effect_runtime *runtime)
     }
 
     addon_screenshot_statistics_path = reshade_base_path / L"ReShade_Addon_Screenshot.stats";
+    addon_screenshot_transcode_path = reshade_base_path / L"ReShade_Addon_Screenshot.transcode";
 }
 void screenshot_environment::init()
 {
@@ -358,7 +395,24 @@ void screenshot_environment::init()
     }
 }
 
+static bool is_high_dynamic_range_format(reshade::api::format format)
+{
+    return format == reshade::api::format::r10g10b10a2_unorm || format == reshade::api::format::b10g10r10a2_unorm || format == reshade::api::format::r16g16b16a16_float;
+}
+
 bool screenshot::capture(reshade::api::effect_runtime *const runtime, screenshot_kind kind)
+{
+    screenshot_trace::span span(state.trace, "Capture", get_screenshot_kind_name(kind));
+
+    timing.last = std::chrono::steady_clock::now();
+
+    const bool captured = capture_image(runtime, kind);
+
+    timing.lap(screenshot_stage::capture);
+
+    return captured;
+}
+bool screenshot::capture_image(reshade::api::effect_runtime *const runtime, screenshot_kind kind)
 {
     if (runtime == nullptr)
         return false;
@@ -377,78 +431,43 @@ bool screenshot::capture(reshade::api::effect_runtime *const runtime, screenshot
         case screenshot_kind::after:
         case screenshot_kind::overlay:
         {
-            reshade::api::resource_desc desc = device->get_resource_desc(runtime->get_current_back_buffer());
+            const reshade::api::resource back_buffer = runtime->get_current_back_buffer();
+            reshade::api::resource_desc desc = device->get_resource_desc(back_buffer);
             capture.texture_format = desc.texture.format;
 
+            // ReShade reduces high dynamic range back buffers to 8-bit when capturing them, so copy those as they are and convert them on a worker later
+            // Mysets with a pre-roll capture continuously, so their 8-bit back buffers are copied the same way instead of waiting for the GPU every frame
+            if (const reshade::api::format format = reshade::api::format_to_default_typed(desc.texture.format, 0);
+                (is_high_dynamic_range_format(format) || myset.preroll_length != 0) && desc.texture.samples <= 1)
+            {
+                capture.texture_format = format;
+
+                // The back buffer is only a render target while effects are rendered, all other captures happen around present
+                const reshade::api::resource_usage usage = kind == screenshot_kind::before || kind == screenshot_kind::after ? reshade::api::resource_usage::render_target : reshade::api::resource_usage::present;
+                return state.readback.enqueue(device, runtime->get_command_queue(), back_buffer, usage, capture, pending_readbacks, state.buffers);
+            }
+
             const size_t pixels_row_pitch = reshade::api::format_row_pitch(capture.texture_format, width);
             assert(pixels_row_pitch != 0);
 
-            capture.pixels.resize(pixels_row_pitch * height);
+            capture.pixels = state.buffers.acquire(width, height, capture.texture_format, (pixels_row_pitch * height + sizeof(uint32_t) - 1) / sizeof(uint32_t));
+
+            if (runtime->capture_screenshot(capture.pixels.data()))
+            {
+                // Whatever the back buffer format, the captured pixels are 8-bit RGBA
+                capture.texture_format = reshade::api::format::r8g8b8a8_unorm;
+
+                return true;
+            }
 
-            return runtime->capture_screenshot(capture.pixels.data());
+            capture.pixels.reset();
+            return false;
         }
         default:
         case screenshot_kind::depth:
         {
             if (runtime->find_technique("__Addon_ScreenshotDepth_Seri14.addonfx", "__Addon_Technique_ScreenshotDepth_Seri14").handle != 0)
             {
-                auto get_texture_data = [runtime, device](reshade::api::resource resource, reshade::api::resource_usage state, screenshot_capture &capture) -> bool
-                    {
-                        const reshade::api::resource_desc desc = device->get_resource_desc(resource);
-                        capture.texture_format = reshade::api::format_to_default_typed(desc.texture.format, 0);
-
-                        if (capture.texture_format != reshade::api::format::r32_float)
-                        {
-                            reshade::log::message(reshade::log::level::error, std::format("Screenshots are not supported for format %u!", desc.texture.format).c_str());
-                            return false;
-                        }
-
-                        // Copy back buffer data into system memory buffer
-                        reshade::api::resource intermediate;
-                        if (!device->create_resource(reshade::api::resource_desc(desc.texture.width, desc.texture.height, 1, 1, capture.texture_format, 1, reshade::api::memory_heap::gpu_to_cpu, reshade::api::resource_usage::copy_dest), nullptr, reshade::api::resource_usage::copy_dest, &intermediate))
-                        {
-                            reshade::log::message(reshade::log::level::error, "Failed to create system memory texture for screenshot capture!");
-                            return false;
-                        }
-
-                        device->set_resource_name(intermediate, "ReShade Screenshot Add-on Texture");
-
-                        reshade::api::command_list *const cmd_list = runtime->get_command_queue()->get_immediate_command_list();
-                        cmd_list->barrier(resource, state, reshade::api::resource_usage::copy_source);
-                        cmd_list->copy_texture_region(resource, 0, nullptr, intermediate, 0, nullptr);
-                        cmd_list->barrier(resource, reshade::api::resource_usage::copy_source, state);
-
-                        // Wait for any rendering by the application finish before submitting
-                        // It may have submitted that to a different queue, so simply wait for all to idle here
-                        runtime->get_command_queue()->wait_idle();
-
-                        // Copy data from intermediate image into output buffer
-                        reshade::api::subresource_data mapped_data = {};
-                        if (device->map_texture_region(intermediate, 0, nullptr, reshade::api::map_access::read_only, &mapped_data))
-                        {
-                            const uint8_t *mapped_pixels = static_cast<const uint8_t *>(mapped_data.data);
-                            const size_t bytes_row_pitch = 4LLU * desc.texture.width;
-                            capture.pixels.resize(desc.texture.width * desc.texture.height);
-
-                            uint32_t *pixels = capture.pixels.data();
-                            if (bytes_row_pitch == mapped_data.row_pitch)
-                            {
-                                std::memcpy(pixels, mapped_pixels, bytes_row_pitch * desc.texture.height);
-                            }
-                            else
-                            {
-                                for (uint32_t y = 0; y < desc.texture.height; ++y, pixels += desc.texture.width, mapped_pixels += mapped_data.row_pitch)
-                                    std::memcpy(pixels, mapped_pixels, bytes_row_pitch);
-                            }
-
-                            device->unmap_texture_region(intermediate, 0);
-                        }
-
-                        device->destroy_resource(intermediate);
-
-                        return mapped_data.data != nullptr;
-                    };
-
                 if (reshade::api::effect_texture_variable texture = runtime->find_texture_variable("__Addon_ScreenshotDepth_Seri14.addonfx", "__Addon_Texture_ScreenshotDepth_Seri14"); texture.handle != 0)
                 {
                     reshade::api::resource_view rsv{}, rsv_srgb{};
@@ -456,7 +475,16 @@ bool screenshot::capture(reshade::api::effect_runtime *const runtime, screenshot
                     {
                         if (reshade::api::resource resource = device->get_resource_from_view(rsv); resource.handle != 0)
                         {
-                            return get_texture_data(resource, reshade::api::resource_usage::shader_resource, capture);
+                            capture.texture_format = reshade::api::format_to_default_typed(device->get_resource_desc(resource).texture.format, 0);
+
+                            if (capture.texture_format != reshade::api::format::r32_float)
+                            {
+                                reshade::log::message(reshade::log::level::error, std::format("Screenshots are not supported for format %u!", capture.texture_format).c_str());
+                                return false;
+                            }
+
+                            // Copy depth data into a staging texture now and read it back a few frames later, once the GPU is done with it
+                            return state.readback.enqueue(device, runtime->get_command_queue(), resource, reshade::api::resource_usage::shader_resource, capture, pending_readbacks, state.buffers);
                         }
                     }
                 }
@@ -468,13 +496,59 @@ bool screenshot::capture(reshade::api::effect_runtime *const runtime, screenshot
     return false;
 }
 
+void screenshot::convert_high_dynamic_range(screenshot_capture &capture)
+{
+    const uint32_t capture_width = capture.pixels.key().width;
+    const uint32_t capture_height = capture.pixels.key().height;
+    const size_t count = static_cast<size_t>(capture_width) * capture_height;
+
+    screenshot_buffer converted = state.buffers.acquire(capture_width, capture_height, reshade::api::format::r16g16b16a16_unorm, count * 2);
+    uint16_t *const dst = reinterpret_cast<uint16_t *>(converted.data());
+
+    if (capture.texture_format == reshade::api::format::r16g16b16a16_float)
+        pixel_convert::rgba16f_to_rgba16(dst, reinterpret_cast<const uint16_t *>(capture.pixels.data()), count,
+            myset.hdr_tone_mapping ? pixel_convert::transfer_function::scrgb : pixel_convert::transfer_function::none, static_cast<float>(myset.hdr_peak_luminance));
+    else
+        pixel_convert::r10g10b10a2_to_rgba16(dst, capture.pixels.data(), count, capture.texture_format == reshade::api::format::b10g10r10a2_unorm,
+            myset.hdr_tone_mapping ? pixel_convert::transfer_function::pq : pixel_convert::transfer_function::none, static_cast<float>(myset.hdr_peak_luminance));
+
+    capture.pixels = std::move(converted);
+    capture.texture_format = reshade::api::format::r16g16b16a16_unorm;
+}
+
+void screenshot::convert_standard_dynamic_range(screenshot_capture &capture)
+{
+    const size_t count = static_cast<size_t>(capture.pixels.key().width) * capture.pixels.key().height;
+
+    switch (capture.texture_format)
+    {
+        case reshade::api::format::b8g8r8a8_unorm:
+            pixel_convert::swap_red_blue(capture.pixels.data(), count);
+            break;
+        case reshade::api::format::b8g8r8x8_unorm:
+            pixel_convert::swap_red_blue(capture.pixels.data(), count);
+            pixel_convert::force_opaque(capture.pixels.data(), count);
+            break;
+        case reshade::api::format::r8g8b8x8_unorm:
+            pixel_convert::force_opaque(capture.pixels.data(), count);
+            break;
+        default:
+            return;
+    }
+
+    capture.texture_format = reshade::api::format::r8g8b8a8_unorm;
+}
+
 void screenshot::save_preset(reshade::api::effect_runtime *runtime)
 {
     if (runtime == nullptr)
         return;
 
     std::error_code ec;
-    preset_file = expand_macro_string(myset.image_paths[preset].u8string());
+    std::string expanded;
+    expand_path(myset.get_path_template(preset), expanded);
+
+    preset_file = std::filesystem::u8path(expanded);
     preset_file.replace_extension() += L".ini";
     preset_file = std::filesystem::weakly_canonical(environment.reshade_base_path / preset_file, ec);
 
@@ -482,46 +556,120 @@ void screenshot::save_preset(reshade::api::effect_runtime *runtime)
         runtime->export_current_preset(preset_file.u8string().c_str());
 }
 
+static void pack_rgb(screenshot_capture &capture, size_t count)
+{
+    if (capture.texture_format == reshade::api::format::r16g16b16a16_unorm)
+        pixel_convert::rgba16_to_rgb16(reinterpret_cast<uint16_t *>(capture.pixels.data()), reinterpret_cast<const uint16_t *>(capture.pixels.data()), count);
+    else
+        pixel_convert::rgba_to_rgb(reinterpret_cast<uint8_t *>(capture.pixels.data()), reinterpret_cast<const uint8_t *>(capture.pixels.data()), count);
+}
+
+static screenshot_png_writer::parallel_for_fn make_parallel_for(screenshot_state &state)
+{
+    if (state.workers == nullptr)
+        return {};
+
+    return [workers = state.workers, &trace = state.trace](size_t count, const std::function<void(size_t)> &fn) {
+        workers->parallel_for(count, [&trace, &fn](size_t index) {
+            if (trace.is_recording())
+                trace.set_thread_name("Screenshot worker");
+            screenshot_trace::span span(trace, "Encode band");
+            fn(index);
+        });
+    };
+}
+
 void screenshot::save_image()
 {
+    timing[screenshot_stage::queue] = std::chrono::steady_clock::now() - enqueue_time;
+
+    state.timings.record_frame(timing);
+
+    if (state.trace.is_recording())
+        state.trace.set_thread_name("Screenshot worker");
+    screenshot_trace::span span(state.trace, "Save frame");
+
+    const auto begin = std::chrono::steady_clock::now();
+
+    if (!spill_file.empty() && !restore())
+    {
+        state.error_occurs++;
+        return;
+    }
+
+    // Frames taken out of the pre-roll ring or the queue before they got to them, which are saved right away instead of spilled
+    pending_spill = false;
+    if (pending_downscale)
+    {
+        downscale();
+        pending_downscale = false;
+    }
+
     for (size_t i = 0; i < captures.size(); i++)
     {
-        if (const screenshot_capture &capture = captures[i]; !capture.pixels.empty())
-            save_image(static_cast<screenshot_kind>(i));
+        if (screenshot_capture &capture = captures[i]; capture.failed)
+        {
+            message = std::format("Skipped saving '%s' screenshot because it could not be read back from the GPU!", get_screenshot_kind_name(static_cast<screenshot_kind>(i)));
+            reshade::log::message(reshade::log::level::error, message.c_str());
+
+            state.error_occurs++;
+        }
+        else if (!capture.pixels.empty())
+        {
+            // Bands are encoded by the worker threads, which pass on what they throw, and that only fails this image
+            try
+            {
+                save_image(static_cast<screenshot_kind>(i));
+            }
+            catch (const std::exception &e)
+            {
+                message = std::format("Failed to save '%s' screenshot with exception '%s'! \"%s\"", get_screenshot_kind_name(static_cast<screenshot_kind>(i)), e.what(), image_file.u8string().c_str());
+                reshade::log::message(reshade::log::level::error, message.c_str());
+
+                state.error_occurs++;
+            }
+
+            // Hand the pixel buffer back to the pool as soon as the image is written, so that the render thread can reuse it for the next capture
+            capture.pixels.reset();
+        }
     }
+
+    state.tuner.add_sample(_myset.get(), std::chrono::steady_clock::now() - begin);
 }
 void screenshot::save_image(screenshot_kind kind)
 {
-    const auto begin = std::chrono::system_clock::now();
+    screenshot_trace::span span(state.trace, "Save image", get_screenshot_kind_name(kind));
+
+    // Stages of the frame are repeated for each image in the timing log
+    screenshot_timing image_timing{ timing.durations };
 
     std::error_code ec{};
-    enum { ok, open_error, write_error } result = ok;
 
     const uint64_t freelimit = myset.image_freelimits[kind];
 
-    image_file = myset.image_paths[kind];
-    image_file = std::filesystem::u8path(expand_macro_string(image_file.u8string()));
-    image_file = std::filesystem::weakly_canonical(environment.reshade_base_path / image_file, ec);
+    // Workers save many images in a row, so keep the buffer around between them
+    static thread_local std::string expanded;
+    expand_path(myset.get_path_template(kind), expanded);
+
+    // Only normalize the path here, the directory is resolved against the file system below and cached
+    image_file = (environment.reshade_base_path / std::filesystem::u8path(expanded)).lexically_normal();
 
     if (!image_file.has_filename())
     {
         message = std::format("Skipped saving '%s' screenshot because the path has no file name! \"%s\"", get_screenshot_kind_name(kind), image_file.u8string().c_str());
         reshade::log::message(reshade::log::level::error, message.c_str());
 
-        result = open_error;
-
         state.error_occurs++;
         return;
     }
 
     const std::filesystem::path parent_path = image_file.parent_path();
-    if (std::filesystem::create_directories(parent_path, ec), ec)
+    image_file = state.directories.create_directories(parent_path, ec) / image_file.filename();
+    if (ec)
     {
         message = std::format("Failed to create '%s' screenshot directory with error code %d! '%s' \"%s\"", get_screenshot_kind_name(kind), ec.value(), format_message(ec.value()).c_str(), parent_path.u8string().c_str());
         reshade::log::message(reshade::log::level::error, message.c_str());
 
-        result = open_error;
-
         state.error_occurs++;
         return;
     }
@@ -529,7 +677,7 @@ void screenshot::save_image(screenshot_kind kind)
     if (freelimit != 0)
     {
         if (ULARGE_INTEGER diskBytes{}, freeBytes{};
-            GetDiskFreeSpaceExW(parent_path.c_str(), &freeBytes, &diskBytes, nullptr))
+            state.directories.get_free_space(parent_path, freeBytes.QuadPart, diskBytes.QuadPart))
         {
             const float free_ratio = static_cast<float>((double)freeBytes.QuadPart / diskBytes.QuadPart);
             bool limit_exceeded = false;
@@ -551,8 +699,6 @@ void screenshot::save_image(screenshot_kind kind)
                     diskBytesStr.size(), diskBytesStr.c_str(), free_ratio * 100, freelimit);
                 reshade::log::message(reshade::log::level::error, message.c_str());
 
-                result = open_error;
-
                 state.error_occurs++;
                 return;
             }
@@ -571,553 +717,672 @@ void screenshot::save_image(screenshot_kind kind)
         }
     }
 
-    screenshot_capture &capture = captures[kind];
+    image_timing.lap(screenshot_stage::metadata);
 
-    if (kind == screenshot_kind::depth)
+    // Hash what was captured before it is converted, which is the same for equal images and leaves the pixels untouched for encoding
+    const bool deduplicate = myset.is_deduplicated(kind);
+    uint64_t content_hash = 0;
+    if (deduplicate)
     {
-        int tif_ec = 0;
-        image_file.replace_extension() += L".tiff";
+        screenshot_trace::span hash_span(state.trace, "Hash image");
 
-        if (TIFF *tif = TIFFOpenW(image_file.c_str(), "wl");
-            tif != nullptr)
-        {
-            TIFFWriteBufferSetup(tif, nullptr, std::min<tmsize_t>(static_cast<size_t>(myset.file_write_buffer_size), sizeof(uint32_t) * capture.pixels.size()));
+        const screenshot_capture &capture = captures[kind];
+        const uint64_t seed = (static_cast<uint64_t>(width) << 32 | height) ^ static_cast<uint64_t>(capture.texture_format) * 0x9E3779B185EBCA87;
+        content_hash = pixel_convert::hash(capture.pixels.data(), capture.pixels.size() * sizeof(uint32_t), seed);
 
-            // 256 - 259
-            TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, static_cast<uint16_t>(width));
-            TIFFSetField(tif, TIFFTAG_IMAGELENGTH, static_cast<uint16_t>(height));
-            TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, (uint16_t)32);
-            TIFFSetField(tif, TIFFTAG_COMPRESSION, (uint16_t)myset.tiff_compression_algorithm);
+        if (std::filesystem::path original;
+            state.duplicates.find(myset.name, myset_counts.total_take, content_hash, original) && write_duplicate(kind, original, image_timing))
+            return;
+    }
 
-            // 262
-            TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, (uint16_t)PHOTOMETRIC_MINISBLACK);
+    if (write_image(kind, parent_path, image_timing) && deduplicate)
+        state.duplicates.add(myset.name, myset_counts.total_take, content_hash, image_file);
+}
+bool screenshot::write_image(screenshot_kind kind, const std::filesystem::path &directory, screenshot_timing &image_timing)
+{
+    const auto begin = std::chrono::system_clock::now();
 
-            // 263
-            TIFFSetField(tif, TIFFTAG_THRESHHOLDING, (uint16_t)THRESHHOLD_BILEVEL);
+    std::error_code ec{};
+    enum { ok, open_error, write_error } result = ok;
 
-            // 266
-            TIFFSetField(tif, TIFFTAG_FILLORDER, (uint16_t)FILLORDER_MSB2LSB);
+    uint64_t written_bytes = 0;
 
-            // 274
-            TIFFSetField(tif, TIFFTAG_ORIENTATION, (uint16_t)ORIENTATION_TOPLEFT);
+    screenshot_capture &capture = captures[kind];
 
-            // 277 - 278
-            TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, (uint16_t)1);
-            TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, static_cast<uint16_t>(height));
+    if (kind != screenshot_kind::depth && is_high_dynamic_range_format(capture.texture_format))
+        convert_high_dynamic_range(capture);
+    else if (kind != screenshot_kind::depth)
+        convert_standard_dynamic_range(capture);
 
-            // 282-284
-            TIFFSetField(tif, TIFFTAG_XRESOLUTION, (uint16_t)96);
-            TIFFSetField(tif, TIFFTAG_YRESOLUTION, (uint16_t)96);
-            TIFFSetField(tif, TIFFTAG_PLANARCONFIG, (uint16_t)PLANARCONFIG_CONTIG);
+    image_timing.lap(screenshot_stage::convert);
 
-            // 296
-            TIFFSetField(tif, TIFFTAG_RESOLUTIONUNIT, (uint16_t)RESUNIT_INCH);
+    // High dynamic range images are written with 16 bits per channel, all others with 8
+    const unsigned int bytes_per_channel = capture.texture_format == reshade::api::format::r16g16b16a16_unorm ? 2 : 1;
 
-            // 305
-            TIFFSetField(tif, TIFFTAG_SOFTWARE, "ReShade Screenshot Add-on");
+    if (myset.image_format == 8)
+    {
+        image_file.replace_extension() += L".raw";
 
-            // 306
-            const time_t timestamp = std::chrono::system_clock::to_time_t(frame_time);
-            if (tm utc; _gmtime64_s(&utc, &timestamp) == 0)
-                tif_ec = TIFFSetField(tif, TIFFTAG_DATETIME, std::format("%04d:%02d:%02d %02d:%02d:%02d", 1900 + utc.tm_year, 1 + utc.tm_mon, utc.tm_mday, utc.tm_hour, utc.tm_min, utc.tm_sec).c_str());
+        if (write_raw(kind, written_bytes))
+        {
+            image_timing.lap(screenshot_stage::write);
 
-            // 317
-            TIFFSetField(tif, TIFFTAG_PREDICTOR, (uint16_t)PREDICTOR_FLOATINGPOINT);
+            state.transcoder.enqueue(image_file, _myset, written_bytes);
+        }
+        else
+        {
+            result = open_error;
+        }
+    }
+    else if (myset.is_archived(kind))
+    {
+        image_file.replace_extension() += L".png";
 
-            // 339
-            TIFFSetField(tif, TIFFTAG_SAMPLEFORMAT, (uint16_t)SAMPLEFORMAT_IEEEFP);
+        const unsigned int channels = myset.image_format == 0 || myset.image_format == 6 ? 3 : 4;
+        const unsigned int size = width * height;
 
-            const size_t row_strip_length = static_cast<size_t>(4) * width;
-            uint8_t *buf = reinterpret_cast<uint8_t *>(capture.pixels.data());
-            for (uint32_t row = 0; row < height; ++row, buf += row_strip_length)
-                TIFFWriteScanline(tif, buf, row, static_cast<uint16_t>(row_strip_length));
+        uint8_t *pixel = reinterpret_cast<uint8_t *>(capture.pixels.data());
+        if (channels == 3)
+            pack_rgb(capture, size);
+        if (bytes_per_channel == 2)
+            pixel_convert::byte_swap16(reinterpret_cast<uint16_t *>(pixel), static_cast<size_t>(size) * channels);
 
-            TIFFClose(tif);
+        image_timing.lap(screenshot_stage::convert);
 
-            enum class condition { none, open, create, blocked };
-            auto condition = condition::none;
+        screenshot_png_writer writer;
+        writer.filters = myset.libpng_png_filters;
+        writer.compression_level = myset.zlib_compression_level;
+        writer.compression_strategy = myset.zlib_compression_strategy;
+        writer.bit_depth = 8 * bytes_per_channel;
+        writer.deflate_backend = myset.deflate_backend;
 
-            const HANDLE meta = CreateFileW(image_file.c_str(), FILE_GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_ARCHIVE | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
-            ec = std::error_code(GetLastError(), std::system_category());
+        // Workers encode many images in a row, so keep the buffer around between them
+        static thread_local std::vector<uint8_t> encoded_pixels;
+        encoded_pixels.clear();
 
-            if (meta == INVALID_HANDLE_VALUE)
-                condition = condition::blocked;
-            else if (ec.value() == ERROR_SUCCESS)
-                condition = condition::open;
+        if (writer.write(encoded_pixels, pixel, width, height, channels, std::chrono::system_clock::to_time_t(frame_time), make_parallel_for(state)))
+        {
+            image_timing.lap(screenshot_stage::encode);
 
-            if (condition == condition::open)
-            {
-                const uint64_t date_time = std::chrono::duration_cast<std::chrono::nanoseconds>(frame_time.time_since_epoch()).count() / 100 + 116444736000000000;
-                FILETIME ft{};
-                ft.dwLowDateTime = date_time & 0xFFFFFFFF;
-                ft.dwHighDateTime = date_time >> 32;
-                SetFileTime(meta, nullptr, nullptr, &ft);
-            }
+            // Named after the image of the take that arrives first, which is usually the first one
+            std::filesystem::path archive_file = image_file;
+            archive_file.replace_extension(L".ssar");
 
-            if (meta != INVALID_HANDLE_VALUE)
+            if (state.archives.append(myset.name, myset_counts.total_take, kind, archive_file, image_file.filename().u8string(), frame_time, repeat_index, encoded_pixels, ec))
             {
-                CloseHandle(meta);
+                written_bytes = encoded_pixels.size();
             }
             else
             {
-                message = std::format("Failed to save '%s' screenshot with error code %d! '%s' \"%s\"", get_screenshot_kind_name(kind), ec.value(), format_message(ec.value()).c_str(), image_file.u8string().c_str());
+                message = std::format("Failed to append '%s' screenshot to archive with error code %d! '%s' \"%s\"", get_screenshot_kind_name(kind), ec.value(), format_message(ec.value()).c_str(), archive_file.u8string().c_str());
                 reshade::log::message(reshade::log::level::error, message.c_str());
 
-                result = condition == condition::open ? write_error : open_error;
+                result = open_error;
             }
+
+            image_timing.lap(screenshot_stage::write);
+        }
+        else
+        {
+            message = std::format("Failed to save '%s' screenshot! \"%s\"", get_screenshot_kind_name(kind), image_file.u8string().c_str());
+            reshade::log::message(reshade::log::level::error, message.c_str());
+
+            result = open_error;
         }
     }
-    else if (myset.image_format == 0 || myset.image_format == 1)
+    else if (myset.is_animated(kind))
     {
         image_file.replace_extension() += L".png";
 
-        FILE *file = nullptr;
-        if (errno_t fopen_error = _wfopen_s(&file, image_file.c_str(), L"wb");
-            file != nullptr)
-        {
-            const unsigned int channels = myset.image_format == 0 ? 3 : 4;
-            const unsigned int size = width * height;
+        const unsigned int channels = myset.image_format == 9 ? 3 : 4;
+        const unsigned int size = width * height;
 
-            uint8_t *pixel = reinterpret_cast<uint8_t *>(capture.pixels.data());
-            if (channels == 3)
-            {
-                for (size_t i = 0; i < size; i++)
-                    *((uint32_t *)&pixel[3 * i]) =
-                    *((uint32_t *)&pixel[4 * i]);
-            }
+        uint8_t *pixel = reinterpret_cast<uint8_t *>(capture.pixels.data());
+        if (channels == 3)
+            pack_rgb(capture, size);
+        if (bytes_per_channel == 2)
+            pixel_convert::byte_swap16(reinterpret_cast<uint16_t *>(pixel), static_cast<size_t>(size) * channels);
 
-            png_structp write_ptr = nullptr;
-            png_infop info_ptr = nullptr;
+        image_timing.lap(screenshot_stage::convert);
 
-            if (write_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, this, user_error_fn, user_warning_fn);
-                write_ptr != nullptr)
-            {
-#pragma warning(disable:4611)
-                if (setjmp(*png_set_longjmp_fn(write_ptr, longjmp, sizeof(jmp_buf))) == 0)
-                {
-#pragma warning(default:4611)
-                    setvbuf(file, nullptr, _IOFBF, myset.file_write_buffer_size);
+        screenshot_png_writer writer;
+        writer.filters = myset.libpng_png_filters;
+        writer.compression_level = myset.zlib_compression_level;
+        writer.compression_strategy = myset.zlib_compression_strategy;
+        writer.bit_depth = 8 * bytes_per_channel;
+        writer.deflate_backend = myset.deflate_backend;
 
-                    png_init_io(write_ptr, file);
-                    png_set_filter(write_ptr, PNG_FILTER_TYPE_BASE, myset.libpng_png_filters);
+        // Named after the frame of the take that arrives first, which is usually the first one, and keeps the pixels until the next frame was compared with them
+        if (state.animations.append(myset.name, myset_counts.total_take, kind, image_file, repeat_index, frame_time, width, height, channels, std::move(capture.pixels), writer, make_parallel_for(state), written_bytes, ec))
+        {
+            image_timing.lap(screenshot_stage::encode);
+        }
+        else
+        {
+            if (ec == std::errc::invalid_argument)
+                message = std::format("Skipped '%s' screenshot because its size differs from the animation it belongs to! \"%s\"", get_screenshot_kind_name(kind), image_file.u8string().c_str());
+            else
+                message = std::format("Failed to add '%s' screenshot to animation with error code %d! '%s' \"%s\"", get_screenshot_kind_name(kind), ec.value(), format_message(ec.value()).c_str(), image_file.u8string().c_str());
+            reshade::log::message(reshade::log::level::error, message.c_str());
 
-                    png_set_compression_mem_level(write_ptr, MAX_MEM_LEVEL);
-                    png_set_compression_buffer_size(write_ptr, 65536);
+            result = open_error;
+        }
+    }
+    else
+    {
+        image_file.replace_extension() += kind == screenshot_kind::depth || myset.image_format == 4 || myset.image_format == 5 ? L".tiff" : L".png";
 
-                    png_set_compression_level(write_ptr, myset.zlib_compression_level);
-                    png_set_compression_strategy(write_ptr, myset.zlib_compression_strategy);
+        screenshot_output output;
+        if (output.open(image_file, myset.file_write_buffer_size, ec))
+        {
+            image_timing.lap(screenshot_stage::metadata);
 
-                    if (info_ptr = png_create_info_struct(write_ptr);
-                        info_ptr != nullptr)
-                    {
-                        png_set_IHDR(write_ptr, info_ptr, width, height, 8, myset.image_format == 0 ? PNG_COLOR_TYPE_RGB : PNG_COLOR_TYPE_RGBA, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+            const unsigned int channels = myset.image_format % 2 == 0 ? 3 : 4;
+            const unsigned int size = width * height;
 
-                        png_time mod_time{};
-                        png_convert_from_time_t(&mod_time, std::chrono::system_clock::to_time_t(frame_time));
-                        png_set_tIME(write_ptr, info_ptr, &mod_time);
+            uint8_t *const pixel = reinterpret_cast<uint8_t *>(capture.pixels.data());
+            // Depth is written as the floating-point values it was captured with
+            if (kind != screenshot_kind::depth)
+            {
+                if (myset.image_format == 2 || myset.image_format == 3)
+                {
+                    // fpng only writes 8-bit images
+                    if (bytes_per_channel == 2)
+                        pixel_convert::rgba16_to_rgba8(pixel, reinterpret_cast<const uint16_t *>(pixel), size);
+                    if (channels == 3)
+                        pixel_convert::rgba_to_rgb(pixel, pixel, size);
+                }
+                else if (channels == 3)
+                {
+                    pack_rgb(capture, size);
+                }
+            }
 
-                        png_write_info(write_ptr, info_ptr);
+            image_timing.lap(screenshot_stage::convert);
+
+            screenshot_encoder encoder;
+            encoder.png_filters = myset.libpng_png_filters;
+            encoder.compression_level = myset.zlib_compression_level;
+            encoder.compression_strategy = myset.zlib_compression_strategy;
+            encoder.deflate_backend = myset.deflate_backend;
+            encoder.tiff_compression = myset.tiff_compression_algorithm;
+            encoder.tiff_strip_size = std::max(myset.tiff_strip_size, 1);
+            encoder.tiff_tile_size = std::max(myset.tiff_tile_size, 0);
+            encoder.png_message_context = this;
+            encoder.png_error_fn = user_error_fn;
+            encoder.png_warning_fn = user_warning_fn;
+
+            const time_t mod_time = std::chrono::system_clock::to_time_t(frame_time);
+
+            bool encoded = false;
+            if (kind == screenshot_kind::depth)
+                encoded = encoder.write_depth_tiff(output, reinterpret_cast<const float *>(pixel), width, height, mod_time, make_parallel_for(state));
+            else if (myset.image_format == 0 || myset.image_format == 1)
+                encoded = encoder.write_png(output, pixel, width, height, channels, 8 * bytes_per_channel, mod_time);
+            else if (myset.image_format == 2 || myset.image_format == 3)
+                encoded = screenshot_encoder::write_fpng(output, pixel, width, height, channels);
+            else if (myset.image_format == 4 || myset.image_format == 5)
+                encoded = encoder.write_tiff(output, pixel, width, height, channels, 8 * bytes_per_channel, mod_time, make_parallel_for(state));
+            else if (myset.image_format == 6 || myset.image_format == 7)
+                encoded = encoder.write_parallel_png(output, pixel, width, height, channels, 8 * bytes_per_channel, mod_time, make_parallel_for(state));
+
+            if (!encoded)
+            {
+                message = std::format("Failed to save '%s' screenshot! \"%s\"", get_screenshot_kind_name(kind), image_file.u8string().c_str());
+                reshade::log::message(reshade::log::level::error, message.c_str());
 
-                        std::vector<png_bytep> rows(height);
-                        for (size_t y = 0; y < height; y++)
-                            rows[y] = pixel + static_cast<size_t>(channels) * width * y;
+                result = write_error;
+            }
 
-                        png_write_image(write_ptr, rows.data());
+            image_timing.lap(screenshot_stage::encode);
 
-                        png_write_end(write_ptr, info_ptr);
-                    }
+            if (result == ok)
+            {
+                if (output.commit(frame_time, ec))
+                {
+                    written_bytes = output.size();
                 }
                 else
                 {
-                    message = std::format("Failed to save '%s' screenshot! \"%s\"", get_screenshot_kind_name(kind), image_file.u8string().c_str());
+                    message = std::format("Failed to save '%s' screenshot with error code %d! '%s' \"%s\"", get_screenshot_kind_name(kind), ec.value(), format_message(ec.value()).c_str(), image_file.u8string().c_str());
                     reshade::log::message(reshade::log::level::error, message.c_str());
 
                     result = write_error;
                 }
-
-                png_destroy_info_struct(write_ptr, &info_ptr);
-                png_destroy_write_struct(&write_ptr, &info_ptr);
             }
 
-            fclose(file);
+            image_timing.lap(screenshot_stage::write);
+        }
+        else
+        {
+            message = std::format("Failed to save '%s' screenshot with error code %d! '%s' \"%s\"", get_screenshot_kind_name(kind), ec.value(), format_message(ec.value()).c_str(), image_file.u8string().c_str());
+            reshade::log::message(reshade::log::level::error, message.c_str());
 
-            enum class condition { none, open, create, blocked };
-            auto condition = condition::none;
+            result = open_error;
+        }
+    }
 
-            const HANDLE meta = CreateFileW(image_file.c_str(), FILE_GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_ARCHIVE | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
-            ec = std::error_code(GetLastError(), std::system_category());
+    image_timing.lap(screenshot_stage::metadata);
 
-            if (meta == INVALID_HANDLE_VALUE)
-                condition = condition::blocked;
-            else if (ec.value() == ERROR_SUCCESS)
-                condition = condition::open;
+    if (result == ok)
+    {
+        const auto elapsed = std::chrono::system_clock::now() - begin;
+        state.last_elapsed = elapsed.count();
 
-            if (condition == condition::open)
-            {
-                const uint64_t date_time = std::chrono::duration_cast<std::chrono::nanoseconds>(frame_time.time_since_epoch()).count() / 100 + 116444736000000000;
-                FILETIME ft{};
-                ft.dwLowDateTime = date_time & 0xFFFFFFFF;
-                ft.dwHighDateTime = date_time >> 32;
-                SetFileTime(meta, nullptr, nullptr, &ft);
-            }
+        state.directories.add_written_bytes(directory, written_bytes);
+        state.timings.record(image_timing, get_screenshot_kind_name(kind), repeat_index, written_bytes);
+    }
+    else
+    {
+        // Images that failed to write were never renamed to their final name, and their temporary file is already deleted
+        state.error_occurs++;
+    }
 
-            if (meta != INVALID_HANDLE_VALUE)
-            {
-                CloseHandle(meta);
-            }
-            else
-            {
-                message = std::format("Failed to save '%s' screenshot with error code %d! '%s' \"%s\"", get_screenshot_kind_name(kind), ec.value(), format_message(ec.value()).c_str(), image_file.u8string().c_str());
-                reshade::log::message(reshade::log::level::error, message.c_str());
+    return result == ok;
+}
 
-                result = write_error;
+bool screenshot::write_duplicate(screenshot_kind kind, const std::filesystem::path &original, screenshot_timing &image_timing)
+{
+    std::error_code ec{};
+
+    // Same format as the original, since only images captured in the same texture format can have the same hash
+    image_file.replace_extension() += original.extension().native();
+
+    switch (myset.duplicate_frames)
+    {
+        case screenshot_myset::duplicate_skip:
+            break;
+        case screenshot_myset::duplicate_hard_link:
+            // A path without a counter names the original again, which already is what would be written
+            if (image_file == original)
+                break;
+
+            // Replace an existing file like writing the image would
+            DeleteFileW(image_file.c_str());
+
+            if (CreateHardLinkW(image_file.c_str(), original.c_str(), nullptr) == FALSE)
+            {
+                // E.g. on another volume, on a file system without hard links, or past the limit of links per file
+                ec = std::error_code(GetLastError(), std::system_category());
+                message = std::format("Failed to link '%s' screenshot with error code %d, saving it instead! '%s' \"%s\"", get_screenshot_kind_name(kind), ec.value(), format_message(ec.value()).c_str(), image_file.u8string().c_str());
+                reshade::log::message(reshade::log::level::warning, message.c_str());
+                return false;
             }
-        }
-        else
-        {
-            char buffer[BUFSIZ]{};
-            if (strerror_s(buffer, fopen_error) == 0)
+            break;
+        case screenshot_myset::duplicate_list:
+            if (!state.duplicates.record(myset.name, myset_counts.total_take, image_file, original, ec))
             {
-                message = std::format("Failed to save '%s' screenshot with error code %d! '%s' \"%s\"", get_screenshot_kind_name(kind), fopen_error, buffer, image_file.u8string().c_str());
-                reshade::log::message(reshade::log::level::error, message.c_str());
+                message = std::format("Failed to list '%s' screenshot as duplicate with error code %d, saving it instead! \"%s\"", get_screenshot_kind_name(kind), ec.value(), image_file.u8string().c_str());
+                reshade::log::message(reshade::log::level::warning, message.c_str());
+                return false;
             }
-
-            result = open_error;
-        }
+            break;
+        default:
+            return false;
     }
-    else if (myset.image_format == 2 || myset.image_format == 3)
-    {
-        image_file.replace_extension() += L".png";
 
-        const unsigned int channels = myset.image_format == 2 ? 3 : 4;
-        const unsigned int size = width * height;
+    image_timing.lap(screenshot_stage::write);
 
-        uint8_t *const pixel = reinterpret_cast<uint8_t *>(capture.pixels.data());
-        if (channels == 3)
-        {
-            for (size_t i = 0; i < size; i++)
-                *((uint32_t *)&pixel[3 * i]) =
-                *((uint32_t *)&pixel[4 * i]);
-        }
+    state.duplicate_frames++;
+    state.timings.record(image_timing, get_screenshot_kind_name(kind), repeat_index, 0);
 
-        if (std::vector<uint8_t> encoded_pixels;
-            fpng::fpng_encode_image_to_memory(pixel, width, height, channels, encoded_pixels))
-        {
-            enum class condition { none, open, create, blocked };
-            auto condition = condition::none;
+    return true;
+}
 
-            const HANDLE meta = CreateFileW(image_file.c_str(), FILE_GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_ARCHIVE | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
-            ec = std::error_code(GetLastError(), std::system_category());
+void screenshot::downscale()
+{
+    screenshot_trace::span span(state.trace, "Downscale");
 
-            if (meta == INVALID_HANDLE_VALUE)
-                condition = condition::blocked;
-            else if (ec.value() == ERROR_ALREADY_EXISTS)
-                condition = condition::open;
-            else
-                condition = condition::create;
+    const unsigned int scaled_width = width / 2;
+    const unsigned int scaled_height = height / 2;
+    if (scaled_width == 0 || scaled_height == 0)
+        return;
 
-            if (condition == condition::open || condition == condition::create)
+    for (size_t i = 0; i < captures.size(); i++)
+    {
+        screenshot_capture &capture = captures[i];
+        if (capture.pixels.empty())
+            continue;
+
+        const uint32_t source_width = capture.pixels.key().width;
+        const uint32_t source_height = capture.pixels.key().height;
+        const uint32_t target_width = source_width / 2;
+        const uint32_t target_height = source_height / 2;
+
+        // Color images are stored as 8-bit RGBA or 10-bit RGBA and depth as 32-bit float, so there is one element per pixel, except for 16-bit floating-point RGBA with two
+        const uint32_t elements_per_pixel = capture.texture_format == reshade::api::format::r16g16b16a16_float ? 2 : 1;
+
+        screenshot_buffer scaled = state.buffers.acquire(target_width, target_height, capture.texture_format, static_cast<size_t>(target_width) * target_height * elements_per_pixel);
+
+        for (uint32_t y = 0; y < target_height; y++)
+        {
+            const uint32_t *row0 = capture.pixels.data() + static_cast<size_t>(source_width) * elements_per_pixel * (2 * y);
+            const uint32_t *row1 = row0 + static_cast<size_t>(source_width) * elements_per_pixel;
+            uint32_t *dst = scaled.data() + static_cast<size_t>(target_width) * elements_per_pixel * y;
+
+            if (capture.texture_format == reshade::api::format::r16g16b16a16_float)
             {
-                if (DWORD _; WriteFile(meta, encoded_pixels.data(), static_cast<DWORD>(encoded_pixels.size()), &_, NULL) != 0)
-                    SetEndOfFile(meta);
-
-                const uint64_t date_time = std::chrono::duration_cast<std::chrono::nanoseconds>(frame_time.time_since_epoch()).count() / 100 + 116444736000000000;
-                FILETIME ft{};
-                ft.dwLowDateTime = date_time & 0xFFFFFFFF;
-                ft.dwHighDateTime = date_time >> 32;
-                SetFileTime(meta, nullptr, nullptr, &ft);
+                const uint16_t *const half0 = reinterpret_cast<const uint16_t *>(row0);
+                const uint16_t *const half1 = reinterpret_cast<const uint16_t *>(row1);
+                uint16_t *const half_dst = reinterpret_cast<uint16_t *>(dst);
+
+                for (uint32_t x = 0; x < target_width * 4; x++)
+                {
+                    const uint32_t c = (x / 4) * 8 + x % 4;
+                    const float average = (pixel_convert::half_to_float(half0[c]) + pixel_convert::half_to_float(half0[c + 4]) + pixel_convert::half_to_float(half1[c]) + pixel_convert::half_to_float(half1[c + 4])) * 0.25f;
+                    half_dst[x] = pixel_convert::float_to_half(average);
+                }
             }
+            else if (capture.texture_format == reshade::api::format::r10g10b10a2_unorm || capture.texture_format == reshade::api::format::b10g10r10a2_unorm)
+            {
+                for (uint32_t x = 0; x < target_width; x++)
+                {
+                    const uint32_t p0 = row0[2 * x], p1 = row0[2 * x + 1], p2 = row1[2 * x], p3 = row1[2 * x + 1];
+
+                    uint32_t result = 0;
+                    for (const uint32_t shift : { 0, 10, 20 })
+                        result |= ((((p0 >> shift) & 0x3FF) + ((p1 >> shift) & 0x3FF) + ((p2 >> shift) & 0x3FF) + ((p3 >> shift) & 0x3FF) + 2) >> 2) << shift;
+                    result |= (((p0 >> 30) + (p1 >> 30) + (p2 >> 30) + (p3 >> 30) + 2) >> 2) << 30;
 
-            if (meta != INVALID_HANDLE_VALUE)
+                    dst[x] = result;
+                }
+            }
+            else if (i == screenshot_kind::depth)
             {
-                CloseHandle(meta);
+                for (uint32_t x = 0; x < target_width; x++)
+                {
+                    float p[4];
+                    std::memcpy(&p[0], &row0[2 * x], sizeof(float) * 2);
+                    std::memcpy(&p[2], &row1[2 * x], sizeof(float) * 2);
+
+                    const float average = (p[0] + p[1] + p[2] + p[3]) * 0.25f;
+                    std::memcpy(&dst[x], &average, sizeof(float));
+                }
             }
             else
             {
-                message = std::format("Failed to save '%s' screenshot with error code %d! '%s' \"%s\"", get_screenshot_kind_name(kind), ec.value(), format_message(ec.value()).c_str(), image_file.u8string().c_str());
-                reshade::log::message(reshade::log::level::error, message.c_str());
+                for (uint32_t x = 0; x < target_width; x++)
+                {
+                    const uint32_t p0 = row0[2 * x], p1 = row0[2 * x + 1], p2 = row1[2 * x], p3 = row1[2 * x + 1];
 
-                result = condition == condition::create ? write_error : open_error;
+                    // Sum even and odd channels in separate 16-bit lanes, so that all four channels are averaged at once without overflowing into each other
+                    const uint32_t even = ((p0 & 0x00FF00FF) + (p1 & 0x00FF00FF) + (p2 & 0x00FF00FF) + (p3 & 0x00FF00FF) + 0x00020002) >> 2;
+                    const uint32_t odd = (((p0 >> 8) & 0x00FF00FF) + ((p1 >> 8) & 0x00FF00FF) + ((p2 >> 8) & 0x00FF00FF) + ((p3 >> 8) & 0x00FF00FF) + 0x00020002) >> 2;
+
+                    dst[x] = (even & 0x00FF00FF) | ((odd & 0x00FF00FF) << 8);
+                }
             }
         }
+
+        capture.pixels = std::move(scaled);
     }
-    else if (myset.image_format == 4 || myset.image_format == 5)
-    {
-        int tif_ec = 0;
-        image_file.replace_extension() += L".tiff";
 
-        const unsigned int channels = myset.image_format == 4 ? 3 : 4;
-        const unsigned int size = width * height;
+    width = scaled_width;
+    height = scaled_height;
+}
 
-        uint8_t *const pixel = reinterpret_cast<uint8_t *>(capture.pixels.data());
-        if (channels == 3)
-        {
-            for (size_t i = 0; i < size; i++)
-                *((uint32_t *)&pixel[3 * i]) =
-                *((uint32_t *)&pixel[4 * i]);
-        }
+static bool write_file(HANDLE file, const void *data, size_t size)
+{
+    for (const uint8_t *p = static_cast<const uint8_t *>(data); size != 0;)
+    {
+        DWORD written = 0;
+        if (!WriteFile(file, p, static_cast<DWORD>(std::min<size_t>(size, 1 << 30)), &written, NULL) || written == 0)
+            return false;
+        p += written;
+        size -= written;
+    }
+    return true;
+}
+static bool read_file(HANDLE file, void *data, size_t size)
+{
+    for (uint8_t *p = static_cast<uint8_t *>(data); size != 0;)
+    {
+        DWORD read = 0;
+        if (!ReadFile(file, p, static_cast<DWORD>(std::min<size_t>(size, 1 << 30)), &read, NULL) || read == 0)
+            return false;
+        p += read;
+        size -= read;
+    }
+    return true;
+}
+static bool is_valid_capture(const screenshot_spill_capture &entry)
+{
+    // Sizes come from a file, so they are only trusted when they match what an image of these dimensions and format takes up, like the readback stored it
+    const uint64_t row_pitch = entry.width <= 65536 ? reshade::api::format_row_pitch(static_cast<reshade::api::format>(entry.texture_format), entry.width) : 0;
+    if (row_pitch == 0 || entry.height == 0 || entry.height > 65536 || entry.size != (row_pitch * entry.height + sizeof(uint32_t) - 1) / sizeof(uint32_t))
+    {
+        SetLastError(ERROR_INVALID_DATA);
+        return false;
+    }
 
-        if (TIFF *tif = TIFFOpenW(image_file.c_str(), "wl");
-            tif != nullptr)
-        {
-            TIFFWriteBufferSetup(tif, nullptr, std::min<tmsize_t>(static_cast<size_t>(myset.file_write_buffer_size), sizeof(uint32_t) * capture.pixels.size()));
+    return true;
+}
 
-            // 256 - 259
-            TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, static_cast<uint16_t>(width));
-            TIFFSetField(tif, TIFFTAG_IMAGELENGTH, static_cast<uint16_t>(height));
-            TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, (uint16_t)8);
-            TIFFSetField(tif, TIFFTAG_COMPRESSION, (uint16_t)myset.tiff_compression_algorithm);
+bool screenshot::spill(const std::filesystem::path &directory)
+{
+    screenshot_trace::span span(state.trace, "Spill");
 
-            // 262
-            TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, (uint16_t)PHOTOMETRIC_RGB);
+    std::error_code ec{};
+    if (std::filesystem::create_directories(directory, ec), ec)
+    {
+        message = std::format("Failed to create spill directory with error code %d! '%s' \"%s\"", ec.value(), format_message(ec.value()).c_str(), directory.u8string().c_str());
+        reshade::log::message(reshade::log::level::error, message.c_str());
+        return false;
+    }
 
-            // 266
-            TIFFSetField(tif, TIFFTAG_FILLORDER, (uint16_t)FILLORDER_MSB2LSB);
+    const std::filesystem::path path = directory / std::format(L"%llu-%u.spill", static_cast<unsigned long long>(frame_time.time_since_epoch().count()), repeat_index);
 
-            // 274
-            TIFFSetField(tif, TIFFTAG_ORIENTATION, (uint16_t)ORIENTATION_TOPLEFT);
+    // Temporary files are kept in the file system cache while there is memory to spare, which unlike our own allocations the system can reclaim at any time
+    const HANDLE file = CreateFileW(path.c_str(), FILE_GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        ec = std::error_code(GetLastError(), std::system_category());
 
-            // 277 - 278
-            TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, static_cast<uint16_t>(channels));
-            TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, static_cast<uint16_t>(height));
+        message = std::format("Failed to create spill file with error code %d! '%s' \"%s\"", ec.value(), format_message(ec.value()).c_str(), path.u8string().c_str());
+        reshade::log::message(reshade::log::level::error, message.c_str());
+        return false;
+    }
 
-            // 282-284
-            TIFFSetField(tif, TIFFTAG_XRESOLUTION, (uint16_t)96);
-            TIFFSetField(tif, TIFFTAG_YRESOLUTION, (uint16_t)96);
-            TIFFSetField(tif, TIFFTAG_PLANARCONFIG, (uint16_t)PLANARCONFIG_CONTIG);
+    screenshot_spill_header header{ screenshot_spill_magic, width, height, 0 };
+    for (const screenshot_capture &capture : captures)
+        header.captures += capture.pixels.empty() ? 0 : 1;
 
-            // 296
-            TIFFSetField(tif, TIFFTAG_RESOLUTIONUNIT, (uint16_t)RESUNIT_INCH);
+    bool succeeded = write_file(file, &header, sizeof(header));
+    for (size_t i = 0; succeeded && i < captures.size(); i++)
+    {
+        const screenshot_capture &capture = captures[i];
+        if (capture.pixels.empty())
+            continue;
 
-            // 305
-            TIFFSetField(tif, TIFFTAG_SOFTWARE, "ReShade Screenshot Add-on");
+        const screenshot_spill_capture entry{ static_cast<uint32_t>(i), static_cast<uint32_t>(capture.texture_format), capture.pixels.key().width, capture.pixels.key().height, capture.pixels.size() };
+        succeeded = write_file(file, &entry, sizeof(entry)) && write_file(file, capture.pixels.data(), sizeof(uint32_t) * capture.pixels.size());
+    }
+    ec = std::error_code(succeeded ? ERROR_SUCCESS : GetLastError(), std::system_category());
 
-            // 306
-            const time_t timestamp = std::chrono::system_clock::to_time_t(frame_time);
-            if (tm utc; _gmtime64_s(&utc, &timestamp) == 0)
-                tif_ec = TIFFSetField(tif, TIFFTAG_DATETIME, std::format("%04d:%02d:%02d %02d:%02d:%02d", 1900 + utc.tm_year, 1 + utc.tm_mon, utc.tm_mday, utc.tm_hour, utc.tm_min, utc.tm_sec).c_str());
+    CloseHandle(file);
 
-            // 317
-            TIFFSetField(tif, TIFFTAG_PREDICTOR, (uint16_t)PREDICTOR_HORIZONTAL);
+    if (!succeeded)
+    {
+        DeleteFileW(path.c_str());
 
-            // 338
-            if (channels == 4)
-            {
-                uint16_t v[1] = { (uint16_t)EXTRASAMPLE_UNASSALPHA };
-                TIFFSetField(tif, TIFFTAG_EXTRASAMPLES, (uint16_t)1, v);
-            }
+        message = std::format("Failed to write spill file with error code %d! '%s' \"%s\"", ec.value(), format_message(ec.value()).c_str(), path.u8string().c_str());
+        reshade::log::message(reshade::log::level::error, message.c_str());
+        return false;
+    }
 
-            // 339
-            TIFFSetField(tif, TIFFTAG_SAMPLEFORMAT, (uint16_t)SAMPLEFORMAT_UINT);
+    for (screenshot_capture &capture : captures)
+        capture.pixels.reset();
 
-            const unsigned int row_strip_length = channels * width;
-            uint8_t *buf = reinterpret_cast<uint8_t *>(capture.pixels.data());
-            for (uint32_t row = 0; row < height; ++row, buf += row_strip_length)
-                TIFFWriteScanline(tif, buf, row, static_cast<uint16_t>(row_strip_length));
+    spill_file = path;
+    return true;
+}
+bool screenshot::restore()
+{
+    screenshot_trace::span span(state.trace, "Restore");
 
-            TIFFClose(tif);
+    // The file is only needed until it was read back once
+    const HANDLE file = CreateFileW(spill_file.c_str(), FILE_GENERIC_READ | DELETE, 0, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+    std::error_code ec = std::error_code(file == INVALID_HANDLE_VALUE ? GetLastError() : ERROR_SUCCESS, std::system_category());
 
-            enum class condition { none, open, create, blocked };
-            auto condition = condition::none;
+    bool succeeded = file != INVALID_HANDLE_VALUE;
+    if (succeeded)
+    {
+        screenshot_spill_header header{};
+        succeeded = read_file(file, &header, sizeof(header)) && header.magic == screenshot_spill_magic;
 
-            const HANDLE meta = CreateFileW(image_file.c_str(), FILE_GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_ARCHIVE | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
-            ec = std::error_code(GetLastError(), std::system_category());
+        for (uint32_t i = 0; succeeded && i < header.captures; i++)
+        {
+            screenshot_spill_capture entry{};
+            if (succeeded = read_file(file, &entry, sizeof(entry)) && entry.kind < captures.size() && is_valid_capture(entry); !succeeded)
+                break;
 
-            if (meta == INVALID_HANDLE_VALUE)
-                condition = condition::blocked;
-            else if (ec.value() == ERROR_SUCCESS)
-                condition = condition::open;
+            screenshot_capture &capture = captures[entry.kind];
+            capture.texture_format = static_cast<reshade::api::format>(entry.texture_format);
+            capture.pixels = state.buffers.acquire(entry.width, entry.height, capture.texture_format, static_cast<size_t>(entry.size));
 
-            if (condition == condition::open)
-            {
-                const uint64_t date_time = std::chrono::duration_cast<std::chrono::nanoseconds>(frame_time.time_since_epoch()).count() / 100 + 116444736000000000;
-                FILETIME ft{};
-                ft.dwLowDateTime = date_time & 0xFFFFFFFF;
-                ft.dwHighDateTime = date_time >> 32;
-                SetFileTime(meta, nullptr, nullptr, &ft);
-            }
+            succeeded = read_file(file, capture.pixels.data(), sizeof(uint32_t) * capture.pixels.size());
+        }
 
-            if (meta != INVALID_HANDLE_VALUE)
-            {
-                CloseHandle(meta);
-            }
-            else
-            {
-                message = std::format("Failed to save '%s' screenshot with error code %d! '%s' \"%s\"", get_screenshot_kind_name(kind), ec.value(), format_message(ec.value()).c_str(), image_file.u8string().c_str());
-                reshade::log::message(reshade::log::level::error, message.c_str());
+        if (!succeeded)
+            ec = std::error_code(GetLastError(), std::system_category());
 
-                result = write_error;
-            }
-        }
-        else
-        {
-            message = std::format("Failed to save '%s' screenshot to path \"%s\"!", get_screenshot_kind_name(kind), image_file.u8string().c_str());
-            reshade::log::message(reshade::log::level::error, message.c_str());
+        CloseHandle(file);
+    }
 
-            result = open_error;
-        }
+    if (!succeeded)
+    {
+        for (screenshot_capture &capture : captures)
+            capture.pixels.reset();
+
+        message = std::format("Failed to read spill file with error code %d! '%s' \"%s\"", ec.value(), format_message(ec.value()).c_str(), spill_file.u8string().c_str());
+        reshade::log::message(reshade::log::level::error, message.c_str());
     }
 
-    if (result == ok)
+    spill_file.clear();
+    return succeeded;
+}
+void screenshot::prepare()
+{
+    if (pending_downscale)
     {
-        const auto elapsed = std::chrono::system_clock::now() - begin;
-        state.last_elapsed = elapsed.count();
+        downscale();
+        pending_downscale = false;
     }
-    else
+
+    if (pending_spill)
     {
-        state.error_occurs++;
+        pending_spill = false;
 
-        if (result == write_error)
-        {
-            if (DeleteFileW(image_file.c_str()) == FALSE)
-            {
-                ec = std::error_code(GetLastError(), std::system_category());
-                reshade::log::message(reshade::log::level::error, std::format("Failed to delete '%s' screenshot with error code %d! '%s' \"%s\"", get_screenshot_kind_name(kind), ec.value(), format_message(ec.value()).c_str(), image_file.u8string().c_str()).c_str());
-            }
-        }
+        if (spill(environment.addon_private_path / L"Spill"))
+            state.spilled_frames++;
+        else
+            state.error_occurs++;
     }
-
-    return;
 }
 
-std::string screenshot::expand_macro_string(const std::string &input) const
+bool screenshot::write_raw(screenshot_kind kind, uint64_t &written_bytes)
 {
-    std::list<std::pair<std::string, std::function<std::string(std::string_view)>>> macros;
-
-    macros.emplace_back("APP", [this](std::string_view) { return environment.reshade_executable_path.stem().u8string(); });
-    macros.emplace_back("PRESET", [this](std::string_view) { return environment.reshade_preset_path.stem().u8string(); });
-    macros.emplace_back("TOTALFRAME",
-        [this](std::string_view fmt) {
-            if (fmt.empty())
-                fmt = "D1";
-            bool zeroed = false;
-            if (fmt[0] == 'D' || fmt[0] == 'd')
-                zeroed = true;
-            int digits = 1;
-            if (fmt.size() == 1 && '1' <= fmt[0] && fmt[0] <= '9')
-                digits = fmt[0] - '0';
-            if (fmt.size() == 2 && '1' <= fmt[1] && fmt[1] <= '9')
-                digits = fmt[1] - '0';
-            auto it = statistics.capture_counts.find({});
-            return std::format(zeroed ? "%0*" PRIu64 : "%*" PRIu64, digits, it != statistics.capture_counts.end() ? it->second.total_frame : 0);
-        });
-    macros.emplace_back("MYSETFRAME",
-        [this](std::string_view fmt) {
-            if (fmt.empty())
-                fmt = "D1";
-            bool zeroed = false;
-            if (fmt[0] == 'D' || fmt[0] == 'd')
-                zeroed = true;
-            int digits = 1;
-            if (fmt.size() == 1 && '1' <= fmt[0] && fmt[0] <= '9')
-                digits = fmt[0] - '0';
-            if (fmt.size() == 2 && '1' <= fmt[1] && fmt[1] <= '9')
-                digits = fmt[1] - '0';
-            auto it = statistics.capture_counts.find(myset.name);
-            return std::format(zeroed ? "%0*" PRIu64 : "%*" PRIu64, digits, it != statistics.capture_counts.end() ? it->second.total_frame : 0);
-        });
-    macros.emplace_back("TOTALTAKE",
-        [this](std::string_view fmt) {
-            if (fmt.empty())
-                fmt = "D1";
-            bool zeroed = false;
-            if (fmt[0] == 'D' || fmt[0] == 'd')
-                zeroed = true;
-            int digits = 1;
-            if (fmt.size() == 1 && '1' <= fmt[0] && fmt[0] <= '9')
-                digits = fmt[0] - '0';
-            if (fmt.size() == 2 && '1' <= fmt[1] && fmt[1] <= '9')
-                digits = fmt[1] - '0';
-            auto it = statistics.capture_counts.find({});
-            return std::format(zeroed ? "%0*" PRIu64 : "%*" PRIu64, digits, it != statistics.capture_counts.end() ? it->second.total_take : 0);
-        });
-    macros.emplace_back("MYSETTAKE",
-        [this](std::string_view fmt) {
-            if (fmt.empty())
-                fmt = "D1";
-            bool zeroed = false;
-            if (fmt[0] == 'D' || fmt[0] == 'd')
-                zeroed = true;
-            int digits = 1;
-            if (fmt.size() == 1 && '1' <= fmt[0] && fmt[0] <= '9')
-                digits = fmt[0] - '0';
-            if (fmt.size() == 2 && '1' <= fmt[1] && fmt[1] <= '9')
-                digits = fmt[1] - '0';
-            auto it = statistics.capture_counts.find(myset.name);
-            return std::format(zeroed ? "%0*" PRIu64 : "%*" PRIu64, digits, it != statistics.capture_counts.end() ? it->second.total_take : 0);
-        });
-    macros.emplace_back("INDEX",
-        [this](std::string_view fmt) {
-            if (fmt.empty())
-                fmt = "D1";
-            bool zeroed = false;
-            if (fmt[0] == 'D' || fmt[0] == 'd')
-                zeroed = true;
-            int digits = 1;
-            if (fmt.size() == 1 && '1' <= fmt[0] && fmt[0] <= '9')
-                digits = fmt[0] - '0';
-            if (fmt.size() == 2 && '1' <= fmt[1] && fmt[1] <= '9')
-                digits = fmt[1] - '0';
-            return std::format(zeroed ? "%0*u" : "%*u", digits, repeat_index);
-        });
+    const screenshot_capture &capture = captures[kind];
 
-    macros.emplace_back("DATE",
-        [this](std::string_view fmt) {
-            const std::time_t t = std::chrono::system_clock::to_time_t(frame_time);
-            struct tm tm; localtime_s(&tm, &t);
-            if (fmt.empty())
-                fmt = "%Y-%m-%d %H-%M-%S";
-            char str[128] = "";
-            const std::string tailzeroed_fmt = std::string(fmt);
-            size_t len = strftime(str, ARRAYSIZE(str), tailzeroed_fmt.c_str(), &tm);
-            return std::string(str, len);
-        });
+    std::error_code ec{};
+    screenshot_output output;
+    if (!output.open(image_file, myset.file_write_buffer_size, ec))
+    {
+        message = std::format("Failed to save '%s' screenshot with error code %d! '%s' \"%s\"", get_screenshot_kind_name(kind), ec.value(), format_message(ec.value()).c_str(), image_file.u8string().c_str());
+        reshade::log::message(reshade::log::level::error, message.c_str());
+        return false;
+    }
 
-    std::string result;
+    const screenshot_raw_header header{
+        { screenshot_raw_magic, width, height, 1 },
+        { static_cast<uint32_t>(kind), static_cast<uint32_t>(capture.texture_format), capture.pixels.key().width, capture.pixels.key().height, capture.pixels.size() },
+        std::chrono::duration_cast<std::chrono::nanoseconds>(frame_time.time_since_epoch()).count(),
+        repeat_index };
 
-    for (size_t offset = 0, macro_beg = std::string::npos, macro_end = std::string::npos;
-        offset < input.size();
-        offset = macro_end + 1)
-    {
-        macro_beg = input.find('<', offset);
-        macro_end = input.find('>', macro_beg + 1);
+    // Nothing but the pixels follows the header, so the whole image goes to disk in one pass without any seeking
+    if (!output.write(&header, sizeof(header)) || !output.write(capture.pixels.data(), sizeof(uint32_t) * capture.pixels.size()))
+        ec = output.error();
 
-        if (macro_beg == std::string::npos || macro_end == std::string::npos)
-        {
-            result += input.substr(offset);
-            break;
-        }
-        else
-        {
-            result += input.substr(offset, macro_beg - offset);
-        }
+    // Only renamed to its final name once complete, so the transcoder never picks up a partially written image
+    if (ec || !output.commit(frame_time, ec))
+    {
+        output.discard();
 
-        std::string_view replacing = std::string_view(input).substr(macro_beg + 1, macro_end - (macro_beg + 1));
-        size_t colon_pos = replacing.find(':');
+        message = std::format("Failed to save '%s' screenshot with error code %d! '%s' \"%s\"", get_screenshot_kind_name(kind), ec.value(), format_message(ec.value()).c_str(), image_file.u8string().c_str());
+        reshade::log::message(reshade::log::level::error, message.c_str());
+        return false;
+    }
 
-        std::string name;
-        if (colon_pos == std::string::npos)
-            name = replacing;
-        else
-            name = replacing.substr(0, colon_pos);
+    written_bytes = output.size();
+    return true;
+}
+screenshot_kind screenshot::read_raw(const std::filesystem::path &file)
+{
+    const HANDLE handle = CreateFileW(file.c_str(), FILE_GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    std::error_code ec(handle == INVALID_HANDLE_VALUE ? GetLastError() : ERROR_SUCCESS, std::system_category());
 
-        std::string value;
+    screenshot_raw_header header{};
+    bool succeeded = handle != INVALID_HANDLE_VALUE;
+    if (succeeded)
+    {
+        succeeded = read_file(handle, &header, sizeof(header)) &&
+            header.spill.magic == screenshot_raw_magic && header.spill.captures == 1 &&
+            header.capture.kind != screenshot_kind::unset && header.capture.kind < captures.size() && is_valid_capture(header.capture);
 
-        for (const auto &macro : macros)
+        if (succeeded)
         {
-            if (_stricmp(name.c_str(), macro.first.c_str()) == 0)
-            {
-                std::string_view fmt;
-                if (colon_pos != std::string::npos)
-                    fmt = replacing.substr(colon_pos + 1);
-                value = macro.second(fmt);
-                break;
-            }
+            screenshot_capture &capture = captures[header.capture.kind];
+            capture.texture_format = static_cast<reshade::api::format>(header.capture.texture_format);
+            capture.pixels = state.buffers.acquire(header.capture.width, header.capture.height, capture.texture_format, static_cast<size_t>(header.capture.size));
+
+            if (succeeded = read_file(handle, capture.pixels.data(), sizeof(uint32_t) * capture.pixels.size()); !succeeded)
+                capture.pixels.reset();
         }
 
-        result += value;
+        if (!succeeded)
+            ec = std::error_code(GetLastError(), std::system_category());
+
+        CloseHandle(handle);
+    }
+
+    if (!succeeded)
+    {
+        message = std::format("Failed to read raw screenshot with error code %d! '%s' \"%s\"", ec.value(), format_message(ec.value()).c_str(), file.u8string().c_str());
+        reshade::log::message(reshade::log::level::error, message.c_str());
+        return screenshot_kind::unset;
     }
 
+    width = header.spill.width;
+    height = header.spill.height;
+    frame_time = std::chrono::system_clock::time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::nanoseconds(header.frame_time)));
+    repeat_index = header.repeat_index;
+
+    return static_cast<screenshot_kind>(header.capture.kind);
+}
+
+void screenshot::expand_path(const screenshot_path_template &path_template, std::string &result) const
+{
+    screenshot_path_template::values values;
+
+    if (path_template.uses(screenshot_path_template::field::app))
+        values.app = environment.reshade_executable_path.stem().u8string();
+    if (path_template.uses(screenshot_path_template::field::preset))
+        values.preset = environment.reshade_preset_path.stem().u8string();
+
+    values.total_frame = total_counts.total_frame;
+    values.total_take = total_counts.total_take;
+    values.myset_frame = myset_counts.total_frame;
+    values.myset_take = myset_counts.total_take;
+
+    values.index = repeat_index;
+    values.time = frame_time;
+
+    path_template.expand(values, result);
+}
+std::string screenshot::expand_macro_string(const std::string &input) const
+{
+    std::string result;
+    expand_path(screenshot_path_template(input), result);
     return result;
 }
 
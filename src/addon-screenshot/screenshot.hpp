@@ -10,6 +10,7 @@
 #include <filesystem>
 #include <thread>
 #include <list>
+#include <memory>
 #include <vector>
 
 #include <errno.h>
@@ -19,6 +20,20 @@
 
 #include "res\version.h"
 #include "runtime_config.hpp"
+#include "screenshot_animation.hpp"
+#include "screenshot_archive.hpp"
+#include "screenshot_buffer.hpp"
+#include "screenshot_deflate.hpp"
+#include "screenshot_directory.hpp"
+#include "screenshot_duplicates.hpp"
+#include "screenshot_path.hpp"
+#include "screenshot_preroll.hpp"
+#include "screenshot_readback.hpp"
+#include "screenshot_statistics.hpp"
+#include "screenshot_timing.hpp"
+#include "screenshot_trace.hpp"
+#include "screenshot_transcoder.hpp"
+#include "screenshot_tuner.hpp"
 
 #include <reshade.hpp>
 #include <utf8\unchecked.h>
@@ -27,6 +42,8 @@
 #include <png.h>
 #include <zlib.h>
 
+class screenshot_worker_pool;
+
 enum screenshot_kind
 {
     unset = 0,
@@ -64,41 +81,90 @@ public:
     std::atomic<unsigned int> error_occurs;
     std::atomic<uint64_t> last_elapsed;
 
+    // Frames affected by the memory budget since the myset was activated
+    std::atomic<unsigned int> dropped_frames;
+    std::atomic<unsigned int> downscaled_frames;
+    std::atomic<unsigned int> spilled_frames;
+    // Images that were the same as one saved before in their take
+    std::atomic<unsigned int> duplicate_frames;
+
+    screenshot_buffer_pool buffers;
+    screenshot_readback_ring readback;
+    screenshot_preroll_ring preroll;
+    screenshot_directory_cache directories;
+    screenshot_timings timings;
+    screenshot_trace trace;
+    screenshot_archive_set archives;
+    screenshot_animation_set animations;
+    screenshot_duplicate_table duplicates;
+    screenshot_encoder_tuner tuner;
+    screenshot_worker_pool *workers = nullptr;
+    // Declared last, so that its thread is stopped before anything it converts with is destroyed
+    screenshot_transcoder transcoder{ *this };
+
     void reset()
     {
         error_occurs = 0;
+        dropped_frames = 0;
+        downscaled_frames = 0;
+        spilled_frames = 0;
+        duplicate_frames = 0;
+
+        // Look at the file system again once per activation, in case directories were deleted or disks filled up in the meantime
+        directories.clear();
+        timings.clear();
     }
 };
 
-struct screenshot_statistics_scoped_data
-{
-    uint64_t total_take;
-    uint64_t total_frame;
-};
-
-class screenshot_statistics
-{
-public:
-    std::unordered_map<std::string, screenshot_statistics_scoped_data> capture_counts;
-
-    void load(const ini_file &config);
-    void save(ini_file &config) const;
-};
-
 class screenshot_myset
 {
 public:
     std::string name;
 
     unsigned int image_format = 0;
+    // Format raw images are converted to once the burst is over
+    unsigned int transcode_image_format = 0;
+    // Append all PNG images of a take to one archive per kind instead of writing a file for each
+    bool archive_takes = false;
+    // What to do with an image that is exactly the same as one saved before in the same take
+    enum : unsigned int
+    {
+        duplicate_save = 0,
+        duplicate_skip,
+        duplicate_hard_link,
+        duplicate_list,
+    } duplicate_frames = duplicate_save;
     unsigned int repeat_count = 1;
     unsigned int repeat_interval = 60;
     unsigned int screenshot_key_data[4]{ 0, 0, 0, 0 };
 
     std::array<std::filesystem::path, screenshot_kind::_max> image_paths;
     std::array<uint64_t, screenshot_kind::_max> image_freelimits;
+    // Compiled from image_paths, and shared with all screenshots taken with this myset
+    std::array<std::shared_ptr<const screenshot_path_template>, screenshot_kind::_max> path_templates;
 
     unsigned int worker_threads = 0;
+    // Lower the compression during a take when saving cannot keep up with the repeat interval, without changing the settings of the myset
+    bool auto_tune_encoder = false;
+
+    unsigned int memory_budget = 0;
+    enum : unsigned int
+    {
+        backpressure_block = 0,
+        backpressure_drop_oldest,
+        backpressure_drop_newest,
+        backpressure_downscale,
+        backpressure_spill_to_disk,
+    } backpressure_policy = backpressure_block;
+
+    // Frames kept from before the shortcut key is pressed, zero to disable
+    unsigned int preroll_length = 0;
+    enum : unsigned int
+    {
+        preroll_frames = 0,
+        preroll_seconds,
+    } preroll_unit = preroll_frames;
+    bool preroll_downscale = true;
 
     std::filesystem::path playsound_path;
     enum : unsigned int
@@ -115,6 +181,14 @@ public:
     int zlib_compression_level = Z_BEST_COMPRESSION;
     int zlib_compression_strategy = Z_RLE;
     int tiff_compression_algorithm = COMPRESSION_LZW;
+    // Strips of about this many bytes, or square tiles of this many pixels when not zero, which are compressed in parallel
+    int tiff_strip_size = 1024 * 256;
+    int tiff_tile_size = 0;
+    // Compresses PNG images and Deflate compressed TIFF images with the zlib compression level above
+    screenshot_deflate_backend deflate_backend = screenshot_deflate_backend::zlib;
+
+    bool hdr_tone_mapping = false;
+    unsigned int hdr_peak_luminance = 1000;
 
     // Validating
 
@@ -139,6 +213,31 @@ public:
         else
             return image_paths[kind].empty() ? unset : kind;
     }
+    /// <summary>
+    /// Whether images of <paramref name="kind"/> go into an archive of the take. Only zlib based PNG formats are archived, depth is always saved as TIFF file.
+    /// </summary>
+    bool is_archived(screenshot_kind kind) const
+    {
+        return archive_takes && kind != screenshot_kind::depth && (image_format == 0 || image_format == 1 || image_format == 6 || image_format == 7);
+    }
+    /// <summary>
+    /// Whether images of <paramref name="kind"/> are assembled into an animated PNG per take. Depth is always saved as TIFF file.
+    /// </summary>
+    bool is_animated(screenshot_kind kind) const
+    {
+        return kind != screenshot_kind::depth && is_animated();
+    }
+    bool is_animated() const
+    {
+        return image_format == 9 || image_format == 10;
+    }
+    /// <summary>
+    /// Whether images of <paramref name="kind"/> are compared with the ones saved before. Only formats that write a file per image are, raw images are replaced by the transcoder and animations already store unchanged frames as tiny ones.
+    /// </summary>
+    bool is_deduplicated(screenshot_kind kind) const
+    {
+        return duplicate_frames != duplicate_save && image_format < 8 && !is_archived(kind);
+    }
     bool is_muted(screenshot_kind kind) const
     {
         const std::filesystem::path &path = image_paths[kind];
@@ -155,6 +254,16 @@ public:
             path = path.native().substr(1);
     }
 
+    /// <summary>
+    /// Compiles the paths that changed since the last call. Has to be called after editing <see cref="image_paths"/>.
+    /// </summary>
+    void compile_path_templates();
+    const screenshot_path_template &get_path_template(screenshot_kind kind) const
+    {
+        static const screenshot_path_template empty;
+        return path_templates[kind] != nullptr ? *path_templates[kind] : empty;
+    }
+
     void load(const ini_file &config);
     void save(ini_file &config) const;
 };
@@ -176,18 +285,13 @@ public:
         turn_on_while_myset_is_active,
         turn_on_when_activate_myset,
     } turn_on_effects = ignore;
+    bool show_stage_timings = false;
+    bool write_stage_timings = false;
 
     void load(const ini_file &config);
     void save(ini_file &config, bool header_only = false);
 };
 
-class screenshot_capture
-{
-public:
-    std::vector<uint32_t> pixels;
-    reshade::api::format texture_format;
-};
-
 class screenshot_environment
 {
 public:
@@ -198,6 +302,7 @@ public:
 
     std::filesystem::path addon_screenshot_config_path;
     std::filesystem::path addon_screenshot_statistics_path;
+    std::filesystem::path addon_screenshot_transcode_path;
 
     screenshot_environment() = default;
     screenshot_environment(const screenshot_environment &screenshot_env) = default;
@@ -213,35 +318,62 @@ public:
 
 class screenshot
 {
-public:
-    screenshot_environment environment;
-    screenshot_statistics statistics;
+    std::shared_ptr<const screenshot_environment> _environment;
+    std::shared_ptr<const screenshot_myset> _myset;
 
-    screenshot_myset myset;
+public:
+    const screenshot_environment &environment;
+    const screenshot_myset &myset;
     screenshot_state &state;
 
+    /// <summary>
+    /// Capture counts of all mysets and of this myset, as they were before this frame was counted.
+    /// </summary>
+    screenshot_statistics_scoped_data total_counts, myset_counts;
+
     std::filesystem::path image_file, preset_file;
     std::array<std::filesystem::path, screenshot_kind::_max> image_files;
 
     unsigned int repeat_index = 0;
     unsigned int height = 0, width = 0;
+    unsigned int pending_readbacks = 0;
+    bool over_budget = false;
+    /// <summary>
+    /// Captured for the pre-roll ring, and not counted or numbered until the myset is activated.
+    /// </summary>
+    bool preroll = false;
+    /// <summary>
+    /// Work the render thread left to the worker pool, which does it while the frame waits in the queue, or right before saving it.
+    /// </summary>
+    bool pending_downscale = false, pending_spill = false;
 
     std::array<screenshot_capture, screenshot_kind::_max> captures;
     std::chrono::system_clock::time_point frame_time;
 
+    screenshot_timing timing;
+    std::chrono::steady_clock::time_point capture_begin = std::chrono::steady_clock::now(), enqueue_time;
+    std::filesystem::path spill_file;
+
     std::string message;
 
     screenshot(screenshot &&screenshot) = default;
-    screenshot(const screenshot_environment &environment,
-               const screenshot_myset &myset,
+    /// <summary>
+    /// Shares the immutable <paramref name="environment"/> and <paramref name="myset"/> snapshots, so that creating a screenshot does not copy any settings.
+    /// </summary>
+    screenshot(std::shared_ptr<const screenshot_environment> environment,
+               std::shared_ptr<const screenshot_myset> myset,
                screenshot_state &state,
                std::chrono::system_clock::time_point frame_time,
-               screenshot_statistics statistics) :
-        environment(environment),
-        myset(myset),
+               screenshot_statistics_scoped_data total_counts,
+               screenshot_statistics_scoped_data myset_counts) :
+        _environment(std::move(environment)),
+        _myset(std::move(myset)),
+        environment(*_environment),
+        myset(*_myset),
         state(state),
-        frame_time(frame_time),
-        statistics(statistics)
+        total_counts(total_counts),
+        myset_counts(myset_counts),
+        frame_time(frame_time)
     {
 
     };
@@ -252,12 +384,66 @@ public:
 
     void save_image();
     void save_image(screenshot_kind kind);
+    /// <summary>
+    /// Encodes the image of <paramref name="kind"/> in the format of the myset and writes it to <see cref="image_file"/>, whose extension is replaced.
+    /// </summary>
+    /// <param name="directory">Directory the image was planned for, before it was resolved against the file system.</param>
+    bool write_image(screenshot_kind kind, const std::filesystem::path &directory, screenshot_timing &image_timing);
+    /// <summary>
+    /// Handles an image that is the same as <paramref name="original"/> as chosen in the myset, instead of encoding it again.
+    /// </summary>
+    /// <returns><see langword="false"/> if the image has to be saved normally after all, e.g. when the hard link could not be created.</returns>
+    bool write_duplicate(screenshot_kind kind, const std::filesystem::path &original, screenshot_timing &image_timing);
+
+    /// <summary>
+    /// Turns a raw copy of a high dynamic range back buffer into 16-bit RGBA, tone mapping it to sRGB when enabled in the myset.
+    /// </summary>
+    void convert_high_dynamic_range(screenshot_capture &capture);
+    /// <summary>
+    /// Turns a raw copy of an 8-bit back buffer into RGBA with an opaque alpha channel, which is what ReShade returns when capturing it directly.
+    /// </summary>
+    void convert_standard_dynamic_range(screenshot_capture &capture);
+
+    /// <summary>
+    /// Halves the resolution of all captured images with a 2x2 box filter.
+    /// </summary>
+    void downscale();
+    /// <summary>
+    /// Moves all captured images into a file in <paramref name="directory"/> and releases their pixel buffers.
+    /// </summary>
+    bool spill(const std::filesystem::path &directory);
+    /// <summary>
+    /// Reads images that were moved to disk by <see cref="spill"/> back into pixel buffers and deletes the file.
+    /// </summary>
+    bool restore();
+    /// <summary>
+    /// Does the downscaling or spilling that was marked as pending, to give memory back while the frame waits for a worker.
+    /// </summary>
+    void prepare();
+    /// <summary>
+    /// Reads an image that was written unencoded into a raw file, together with its size, frame time and index.
+    /// </summary>
+    /// <returns>Kind of the image, or <see cref="screenshot_kind::unset"/> if the file could not be read.</returns>
+    screenshot_kind read_raw(const std::filesystem::path &file);
+
+    uint64_t memory_usage() const noexcept
+    {
+        uint64_t bytes = 0;
+        for (const screenshot_capture &capture : captures)
+            bytes += sizeof(uint32_t) * capture.pixels.size();
+        return bytes;
+    }
 
+    void expand_path(const screenshot_path_template &path_template, std::string &result) const;
     std::string expand_macro_string(const std::string &input) const;
 
     [[noreturn]]
     static void user_error_fn(png_structp png_ptr, png_const_charp error_msg);
     static void user_warning_fn(png_structp png_ptr, png_const_charp warning_msg);
+
+private:
+    bool capture_image(reshade::api::effect_runtime *const runtime, screenshot_kind kind);
+    bool write_raw(screenshot_kind kind, uint64_t &written_bytes);
 };
 
 static std::string format_message(DWORD dwMessageId, DWORD dwLanguageId = 0x409) noexcept
@@ -0,0 +1,295 @@
+﻿/*
+ * SPDX-FileCopyrightText: 2018 seri14
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "screenshot.hpp"
+#include "screenshot_animation.hpp"
+#include "pixel_convert.hpp"
+
+#include <algorithm>
+
+// Frames are written in chunks of the size the PNG writer splits them into, which the buffer collects into larger writes
+constexpr size_t screenshot_animation_buffer_size = 1024 * 1024;
+
+screenshot_animation::~screenshot_animation()
+{
+    std::error_code ec{};
+    close(ec);
+}
+
+bool screenshot_animation::open(const std::filesystem::path &path, uint32_t width, uint32_t height, unsigned int channels, const screenshot_png_writer &writer, std::chrono::system_clock::time_point frame_time, std::error_code &ec)
+{
+    if (!_output.open(path, screenshot_animation_buffer_size, ec))
+        return false;
+
+    _path = path;
+    _time = frame_time;
+    _writer = writer;
+    _width = width;
+    _height = height;
+    _channels = channels;
+    _pitch = static_cast<size_t>(width) * channels * writer.bit_depth / 8;
+
+    // The number of frames is only known at the end, so start with one and write the right number over it when closing
+    if (!_writer.write_header([this](const void *data, size_t size) { return _output.write(data, size); }, width, height, channels, std::chrono::system_clock::to_time_t(frame_time), 1))
+    {
+        ec = _output.error();
+
+        _output.discard();
+        return false;
+    }
+
+    return true;
+}
+
+bool screenshot_animation::encode(frame &frame, const screenshot_buffer *previous, const screenshot_buffer &current, const screenshot_png_writer::parallel_for_fn &parallel_for) const
+{
+    const uint8_t *const pixels = reinterpret_cast<const uint8_t *>(current.data());
+    const unsigned int bytes_per_pixel = _channels * _writer.bit_depth / 8;
+
+    frame.x = 0;
+    frame.y = 0;
+    frame.width = _width;
+    frame.height = _height;
+
+    if (previous != nullptr &&
+        !pixel_convert::find_changed_rect(reinterpret_cast<const uint8_t *>(previous->data()), pixels, _width, _height, _pitch, bytes_per_pixel, frame.x, frame.y, frame.width, frame.height))
+    {
+        // Frames have to cover at least one pixel, even when nothing changed at all
+        frame.width = 1;
+        frame.height = 1;
+    }
+
+    return _writer.encode(pixels + _pitch * frame.y + static_cast<size_t>(bytes_per_pixel) * frame.x, frame.width, frame.height, _pitch, _channels, frame.parts, parallel_for);
+}
+
+bool screenshot_animation::add(uint32_t index, std::chrono::system_clock::time_point frame_time, screenshot_buffer &&pixels, const screenshot_png_writer::parallel_for_fn &parallel_for, uint64_t &written_bytes, std::error_code &ec)
+{
+    struct job
+    {
+        uint32_t index;
+        std::shared_ptr<const screenshot_buffer> previous, current;
+    };
+    std::vector<job> jobs;
+
+    {
+        std::lock_guard lock(_mutex);
+
+        if (!_output.is_open())
+        {
+            ec = std::make_error_code(std::errc::bad_file_descriptor);
+            return false;
+        }
+
+        frame &added = _frames[index];
+        added.time = frame_time;
+        added.pixels = std::make_shared<const screenshot_buffer>(std::move(pixels));
+
+        // This frame can be compared with the one before it now, and the one after it with this one
+        for (const uint32_t candidate : { index, index + 1 })
+        {
+            const auto it = _frames.find(candidate);
+            if (it == _frames.end() || it->second.encoding || it->second.encoded || it->second.pixels == nullptr)
+                continue;
+
+            if (candidate == 0)
+            {
+                jobs.push_back({ candidate, nullptr, it->second.pixels });
+            }
+            else if (const auto prev = _frames.find(candidate - 1); prev != _frames.end() && prev->second.pixels != nullptr)
+            {
+                jobs.push_back({ candidate, prev->second.pixels, it->second.pixels });
+            }
+            else
+            {
+                continue;
+            }
+
+            it->second.encoding = true;
+        }
+    }
+
+    bool succeeded = true;
+
+    for (const job &job : jobs)
+    {
+        frame encoded;
+        bool encode_succeeded = false;
+        try
+        {
+            encode_succeeded = encode(encoded, job.previous.get(), *job.current, parallel_for);
+        }
+        catch (const std::exception &)
+        {
+            // Failed like when running out of memory, so that the frame is no longer marked as being encoded and the animation does not wait for it forever
+        }
+
+        std::lock_guard lock(_mutex);
+
+        frame &frame = _frames[job.index];
+        frame.encoding = false;
+        frame.encoded = encode_succeeded;
+        frame.x = encoded.x;
+        frame.y = encoded.y;
+        frame.width = encoded.width;
+        frame.height = encoded.height;
+        frame.parts = std::move(encoded.parts);
+
+        if (!encode_succeeded)
+        {
+            ec = std::make_error_code(std::errc::not_enough_memory);
+            succeeded = false;
+            continue;
+        }
+
+        // Neither the previous frame nor this one are needed for comparing anymore once both were encoded, as well as the frames after them
+        if (const auto prev = _frames.find(job.index - 1); job.index != 0 && prev != _frames.end() && prev->second.encoded)
+            prev->second.pixels.reset();
+        if (const auto next = _frames.find(job.index + 1); next != _frames.end() && next->second.encoded)
+            frame.pixels.reset();
+    }
+
+    std::lock_guard lock(_mutex);
+
+    const uint64_t size = _output.size();
+    succeeded = write_frames(false, ec) && succeeded;
+    written_bytes = _output.size() - size;
+
+    return succeeded;
+}
+
+bool screenshot_animation::write_frames(bool closing, std::error_code &ec)
+{
+    const auto output = [this](const void *data, size_t size) { return _output.write(data, size); };
+
+    for (auto it = _frames.begin(); it != _frames.end();)
+    {
+        frame &frame = it->second;
+
+        if (!frame.written)
+        {
+            // Frames are written in order, and only once the time until the next one is known
+            const auto next = std::next(it);
+            if (!frame.encoded || (!closing && (next == _frames.end() || next->first != it->first + 1)))
+                break;
+
+            if (next != _frames.end())
+                _last_delay = static_cast<uint16_t>(std::clamp<int64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(next->second.time - frame.time).count(), 0, 0xFFFF));
+
+            if (!screenshot_png_writer::write_frame(output, _sequence, frame.x, frame.y, frame.width, frame.height, _last_delay, frame.parts))
+            {
+                ec = _output.error();
+                return false;
+            }
+
+            frame.written = true;
+            frame.parts.clear();
+            frame.parts.shrink_to_fit();
+            _written++;
+        }
+
+        if (frame.pixels == nullptr)
+            it = _frames.erase(it);
+        else
+            ++it;
+    }
+
+    return true;
+}
+
+bool screenshot_animation::close(std::error_code &ec)
+{
+    std::lock_guard lock(_mutex);
+
+    if (!_output.is_open())
+        return true;
+
+    // Frames that are still waiting for the one before them, because it was dropped or failed to save, are compared with the closest earlier frame instead
+    const screenshot_buffer *previous = nullptr;
+    for (auto &[index, frame] : _frames)
+    {
+        if (!frame.encoded && frame.pixels != nullptr)
+        {
+            // Without any frame before it, it becomes the first frame and covers the whole image
+            frame.encoded = encode(frame, previous, *frame.pixels, {});
+            if (!frame.encoded)
+                break;
+        }
+
+        previous = frame.pixels.get();
+    }
+
+    bool succeeded = write_frames(true, ec);
+
+    const auto output = [this](const void *data, size_t size) { return _output.write(data, size); };
+    if (succeeded)
+        succeeded = screenshot_png_writer::write_end(output);
+
+    if (succeeded)
+        succeeded = _output.seek(screenshot_png_writer::animation_control_offset) && screenshot_png_writer::write_animation_control(output, _written);
+
+    if (!succeeded && !ec)
+        ec = _output.error();
+
+    // An animation without any frame or one that could not be finished is deleted, instead of leaving a broken file under the final name
+    if (succeeded && _written != 0)
+        succeeded = _output.commit(_time, ec);
+    else
+        _output.discard();
+
+    _frames.clear();
+    return succeeded;
+}
+
+screenshot_animation_set::~screenshot_animation_set()
+{
+    close();
+}
+
+bool screenshot_animation_set::append(const std::string &myset, uint64_t take, unsigned int kind, const std::filesystem::path &path,
+    uint32_t index, std::chrono::system_clock::time_point frame_time, uint32_t width, uint32_t height, unsigned int channels,
+    screenshot_buffer &&pixels, const screenshot_png_writer &writer, const screenshot_png_writer::parallel_for_fn &parallel_for, uint64_t &written_bytes, std::error_code &ec)
+{
+    screenshot_animation *animation = nullptr;
+
+    {
+        std::lock_guard lock(_mutex);
+
+        const auto [it, inserted] = _animations.try_emplace(std::make_tuple(myset, take, kind));
+        if (inserted)
+        {
+            if (!it->second.open(path, width, height, channels, writer, frame_time, ec))
+            {
+                _animations.erase(it);
+                return false;
+            }
+
+            _size = _animations.size();
+        }
+        else if (!it->second.is_compatible(width, height, channels))
+        {
+            ec = std::make_error_code(std::errc::invalid_argument);
+            return false;
+        }
+
+        animation = &it->second;
+    }
+
+    // Animations stay where they are until all workers are done, so frames of the same take are encoded without holding up each other
+    return animation->add(index, frame_time, std::move(pixels), parallel_for, written_bytes, ec);
+}
+
+void screenshot_animation_set::close()
+{
+    std::lock_guard lock(_mutex);
+
+    for (auto &[key, animation] : _animations)
+    {
+        if (std::error_code ec{}; !animation.close(ec))
+            reshade::log::message(reshade::log::level::error, std::format("Failed to finish animated screenshot with error code %d! '%s' \"%s\"", ec.value(), format_message(ec.value()).c_str(), animation.path().u8string().c_str()).c_str());
+    }
+
+    _animations.clear();
+    _size = 0;
+}
@@ -0,0 +1,118 @@
+﻿/*
+ * SPDX-FileCopyrightText: 2018 seri14
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#pragma once
+
+#include "screenshot_buffer.hpp"
+#include "screenshot_output.hpp"
+#include "screenshot_png.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <tuple>
+#include <vector>
+
+/// <summary>
+/// Animated PNG that the frames of one kind of a take are assembled into, where every frame after the first only holds the rectangle that changed since the frame before.
+/// Frames arrive from the workers in any order. Each one is compared and encoded by the worker that brings the second of it and the frame before, and written once all frames in front of it were.
+/// The file only gets its final name once it was closed with all frames in it.
+/// </summary>
+class screenshot_animation
+{
+public:
+    screenshot_animation() = default;
+    screenshot_animation(const screenshot_animation &) = delete;
+    screenshot_animation &operator=(const screenshot_animation &) = delete;
+    ~screenshot_animation();
+
+    /// <summary>
+    /// Creates the file for frames with the given size, and RGB or RGBA pixels in big-endian order with the bit depth of <paramref name="writer"/>.
+    /// </summary>
+    bool open(const std::filesystem::path &path, uint32_t width, uint32_t height, unsigned int channels, const screenshot_png_writer &writer, std::chrono::system_clock::time_point frame_time, std::error_code &ec);
+    /// <summary>
+    /// Takes over the tightly packed pixels of the frame at <paramref name="index"/>, and encodes and writes all frames that can be now.
+    /// </summary>
+    /// <param name="written_bytes">Size of what was written to the file by this call, which may belong to earlier frames as well.</param>
+    bool add(uint32_t index, std::chrono::system_clock::time_point frame_time, screenshot_buffer &&pixels, const screenshot_png_writer::parallel_for_fn &parallel_for, uint64_t &written_bytes, std::error_code &ec);
+    /// <summary>
+    /// Writes the frames that are left, comparing those whose previous frame never arrived with the closest earlier one, finishes the file and renames it to its final name.
+    /// </summary>
+    bool close(std::error_code &ec);
+
+    bool is_compatible(uint32_t width, uint32_t height, unsigned int channels) const noexcept
+    {
+        return _width == width && _height == height && _channels == channels;
+    }
+
+    const std::filesystem::path &path() const noexcept { return _path; }
+
+private:
+    struct frame
+    {
+        std::chrono::system_clock::time_point time;
+        // Kept until the frame after it was compared with it
+        std::shared_ptr<const screenshot_buffer> pixels;
+        bool encoding = false;
+        bool encoded = false;
+        bool written = false;
+        uint32_t x = 0, y = 0, width = 0, height = 0;
+        std::vector<std::vector<uint8_t>> parts;
+    };
+
+    bool encode(frame &frame, const screenshot_buffer *previous, const screenshot_buffer &current, const screenshot_png_writer::parallel_for_fn &parallel_for) const;
+    bool write_frames(bool closing, std::error_code &ec);
+
+    std::mutex _mutex;
+    // Only open between opening and closing the animation
+    screenshot_output _output;
+    std::filesystem::path _path;
+    std::chrono::system_clock::time_point _time;
+
+    screenshot_png_writer _writer;
+    uint32_t _width = 0;
+    uint32_t _height = 0;
+    unsigned int _channels = 0;
+    size_t _pitch = 0;
+
+    std::map<uint32_t, frame> _frames;
+    uint32_t _written = 0;
+    uint32_t _sequence = 0;
+    uint16_t _last_delay = 0;
+};
+
+/// <summary>
+/// Animations of all takes that are still being saved, shared by the workers.
+/// </summary>
+class screenshot_animation_set
+{
+public:
+    ~screenshot_animation_set();
+
+    /// <summary>
+    /// Adds a frame to the animation of the take and kind, which is created at <paramref name="path"/> by the first frame that arrives.
+    /// <paramref name="pixels"/> are only taken over if the frame has the same size as the animation.
+    /// </summary>
+    bool append(const std::string &myset, uint64_t take, unsigned int kind, const std::filesystem::path &path,
+        uint32_t index, std::chrono::system_clock::time_point frame_time, uint32_t width, uint32_t height, unsigned int channels,
+        screenshot_buffer &&pixels, const screenshot_png_writer &writer, const screenshot_png_writer::parallel_for_fn &parallel_for, uint64_t &written_bytes, std::error_code &ec);
+    /// <summary>
+    /// Finishes all open animations. Must only be called once no frame of their takes is left to be saved, since a later one would start a new animation.
+    /// </summary>
+    void close();
+
+    size_t size() const noexcept { return _size; }
+
+private:
+    std::mutex _mutex;
+    std::map<std::tuple<std::string, uint64_t, unsigned int>, screenshot_animation> _animations;
+    std::atomic<size_t> _size = 0;
+};
@@ -0,0 +1,190 @@
+﻿/*
+ * SPDX-FileCopyrightText: 2018 seri14
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "screenshot.hpp"
+#include "screenshot_archive.hpp"
+
+#include <algorithm>
+
+// Archives start with a header, followed by one chunk per image and the index with a footer at the very end.
+// The chunks can be walked without the index as well, e.g. in the temporary file that is left when the game crashed before the archive was closed.
+struct screenshot_archive_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t kind;
+    uint32_t reserved;
+};
+// Followed by the UTF-8 file name of the image and the encoded image itself
+struct screenshot_archive_chunk
+{
+    uint32_t magic;
+    uint32_t repeat_index;
+    int64_t frame_time;
+    uint64_t size;
+    uint32_t name_size;
+    uint32_t reserved;
+};
+// Follows the index, which holds one entry with the offset of the chunk, size of the image, frame time and index per image
+struct screenshot_archive_footer
+{
+    uint64_t index_offset;
+    uint32_t count;
+    uint32_t magic;
+};
+
+constexpr uint32_t screenshot_archive_magic = 0x52415353; // "SSAR"
+constexpr uint32_t screenshot_archive_chunk_magic = 0x4B484353; // "SCHK"
+constexpr uint32_t screenshot_archive_index_magic = 0x58444953; // "SIDX"
+constexpr uint32_t screenshot_archive_version = 1;
+
+// Reserving disk space in large steps keeps a burst in few fragments, unused space is released again when the file is closed
+constexpr uint64_t screenshot_archive_allocation_step = 64 * 1024 * 1024;
+// Images are written past the buffer in whole, so it only collects the small chunk headers and names in front of them
+constexpr size_t screenshot_archive_buffer_size = 64 * 1024;
+
+screenshot_archive::~screenshot_archive()
+{
+    std::error_code ec{};
+    close(ec);
+}
+
+bool screenshot_archive::open(const std::filesystem::path &path, unsigned int kind, std::error_code &ec)
+{
+    if (!_output.open(path, screenshot_archive_buffer_size, ec))
+        return false;
+
+    const screenshot_archive_header header{ screenshot_archive_magic, screenshot_archive_version, kind, 0 };
+    if (!_output.write(&header, sizeof(header)) || !_output.flush())
+    {
+        ec = _output.error();
+
+        _output.discard();
+        return false;
+    }
+
+    _path = path;
+    _size = sizeof(header);
+    return true;
+}
+
+bool screenshot_archive::append(const std::string &name, std::chrono::system_clock::time_point frame_time, uint32_t repeat_index, const std::vector<uint8_t> &data, std::error_code &ec)
+{
+    std::lock_guard lock(_mutex);
+
+    if (!_output.is_open())
+    {
+        ec = std::make_error_code(std::errc::bad_file_descriptor);
+        return false;
+    }
+
+    const screenshot_archive_chunk chunk{
+        screenshot_archive_chunk_magic,
+        repeat_index,
+        std::chrono::duration_cast<std::chrono::nanoseconds>(frame_time.time_since_epoch()).count(),
+        data.size(),
+        static_cast<uint32_t>(name.size()) };
+    const uint64_t chunk_size = sizeof(chunk) + name.size() + data.size();
+
+    if (_size + chunk_size > _allocated)
+    {
+        _allocated = (_size + chunk_size + screenshot_archive_allocation_step - 1) / screenshot_archive_allocation_step * screenshot_archive_allocation_step;
+
+        _output.reserve(_allocated);
+    }
+
+    // Flushed after every chunk, so that a failed one never takes any of the chunks before it along
+    if (!_output.write(&chunk, sizeof(chunk)) || !_output.write(name.data(), name.size()) || !_output.write(data.data(), data.size()) || !_output.flush())
+    {
+        ec = _output.error();
+
+        // Let the next chunk overwrite what was written of this one
+        _output.truncate(_size);
+        return false;
+    }
+
+    _entries.push_back({ _size, data.size(), chunk.frame_time, repeat_index, 0 });
+    _size += chunk_size;
+    return true;
+}
+
+bool screenshot_archive::close(std::error_code &ec)
+{
+    std::lock_guard lock(_mutex);
+
+    if (!_output.is_open())
+        return true;
+
+    // Chunks are in the order the workers finished them, the index is in capture order
+    std::sort(_entries.begin(), _entries.end(), [](const entry &a, const entry &b) { return a.repeat_index < b.repeat_index; });
+
+    static_assert(sizeof(entry) == 32);
+    const screenshot_archive_footer footer{ _size, static_cast<uint32_t>(_entries.size()), screenshot_archive_index_magic };
+
+    bool succeeded = _output.write(_entries.data(), sizeof(entry) * _entries.size()) && _output.write(&footer, sizeof(footer)) && _output.flush();
+    if (!succeeded)
+    {
+        ec = _output.error();
+
+        // Keep the chunks without the index, since they can be walked without it
+        _output.truncate(_size);
+    }
+
+    if (std::error_code commit_ec; !_output.commit(std::chrono::system_clock::now(), commit_ec))
+    {
+        if (succeeded)
+            ec = commit_ec;
+        succeeded = false;
+    }
+
+    _entries.clear();
+    return succeeded;
+}
+
+screenshot_archive_set::~screenshot_archive_set()
+{
+    close();
+}
+
+bool screenshot_archive_set::append(const std::string &myset, uint64_t take, unsigned int kind, const std::filesystem::path &path,
+    const std::string &name, std::chrono::system_clock::time_point frame_time, uint32_t repeat_index, const std::vector<uint8_t> &data, std::error_code &ec)
+{
+    screenshot_archive *archive = nullptr;
+
+    {
+        std::lock_guard lock(_mutex);
+
+        const auto [it, inserted] = _archives.try_emplace(std::make_tuple(myset, take, kind));
+        if (inserted)
+        {
+            if (!it->second.open(path, kind, ec))
+            {
+                _archives.erase(it);
+                return false;
+            }
+
+            _size = _archives.size();
+        }
+
+        archive = &it->second;
+    }
+
+    // Archives stay where they are until all workers are done, so images of other takes and kinds are written without waiting for this one
+    return archive->append(name, frame_time, repeat_index, data, ec);
+}
+
+void screenshot_archive_set::close()
+{
+    std::lock_guard lock(_mutex);
+
+    for (auto &[key, archive] : _archives)
+    {
+        if (std::error_code ec{}; !archive.close(ec))
+            reshade::log::message(reshade::log::level::error, std::format("Failed to write index of screenshot archive with error code %d! '%s' \"%s\"", ec.value(), format_message(ec.value()).c_str(), archive.path().u8string().c_str()).c_str());
+    }
+
+    _archives.clear();
+    _size = 0;
+}
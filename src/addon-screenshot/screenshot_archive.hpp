@@ -0,0 +1,89 @@
+﻿/*
+ * SPDX-FileCopyrightText: 2018 seri14
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#pragma once
+
+#include "screenshot_output.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <tuple>
+#include <vector>
+
+/// <summary>
+/// Single file that collects the encoded images of one kind of a take, instead of creating a file for every frame.
+/// Each image is stored as a chunk with its file name, frame time and index in front, and an index of all chunks is appended when the archive is closed.
+/// It is written under a temporary name and only renamed to its final name once closed, so an archive under that name is always complete.
+/// The file is extended in large steps ahead of the data, so that it stays contiguous on disk while other files are written at the same time.
+/// </summary>
+class screenshot_archive
+{
+public:
+    screenshot_archive() = default;
+    screenshot_archive(const screenshot_archive &) = delete;
+    screenshot_archive &operator=(const screenshot_archive &) = delete;
+    ~screenshot_archive();
+
+    bool open(const std::filesystem::path &path, unsigned int kind, std::error_code &ec);
+    bool append(const std::string &name, std::chrono::system_clock::time_point frame_time, uint32_t repeat_index, const std::vector<uint8_t> &data, std::error_code &ec);
+    /// <summary>
+    /// Writes the index behind the last chunk, closes the file and renames it to its final name.
+    /// </summary>
+    bool close(std::error_code &ec);
+
+    const std::filesystem::path &path() const noexcept { return _path; }
+
+private:
+    struct entry
+    {
+        uint64_t offset;
+        uint64_t size;
+        int64_t frame_time;
+        uint32_t repeat_index;
+        uint32_t reserved;
+    };
+
+    // Serializes the workers appending to this archive, while those of other archives write at the same time
+    std::mutex _mutex;
+    // Only open between opening and closing the archive
+    screenshot_output _output;
+    std::filesystem::path _path;
+    uint64_t _size = 0;
+    uint64_t _allocated = 0;
+    std::vector<entry> _entries;
+};
+
+/// <summary>
+/// Archives of all takes that are still being saved, shared by the workers.
+/// </summary>
+class screenshot_archive_set
+{
+public:
+    ~screenshot_archive_set();
+
+    /// <summary>
+    /// Appends an image to the archive of the take and kind, which is created at <paramref name="path"/> by the first image that arrives.
+    /// </summary>
+    bool append(const std::string &myset, uint64_t take, unsigned int kind, const std::filesystem::path &path,
+        const std::string &name, std::chrono::system_clock::time_point frame_time, uint32_t repeat_index, const std::vector<uint8_t> &data, std::error_code &ec);
+    /// <summary>
+    /// Finishes all open archives. Must only be called once no image of their takes is left to be saved, since a later one would start a new archive.
+    /// </summary>
+    void close();
+
+    size_t size() const noexcept { return _size; }
+
+private:
+    std::mutex _mutex;
+    std::map<std::tuple<std::string, uint64_t, unsigned int>, screenshot_archive> _archives;
+    // Checked by the render thread every frame, without waiting for a worker that is writing
+    std::atomic<size_t> _size = 0;
+};
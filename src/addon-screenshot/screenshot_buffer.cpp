@@ -0,0 +1,151 @@
+﻿/*
+ * SPDX-FileCopyrightText: 2018 seri14
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "screenshot_buffer.hpp"
+
+#include <algorithm>
+#include <iterator>
+
+screenshot_buffer::screenshot_buffer(screenshot_buffer &&other) noexcept :
+    _pool(other._pool),
+    _key(other._key),
+    _data(std::move(other._data)),
+    _size(other._size)
+{
+    other._pool = nullptr;
+    other._size = 0;
+}
+screenshot_buffer &screenshot_buffer::operator=(screenshot_buffer &&other) noexcept
+{
+    if (this != &other)
+    {
+        reset();
+
+        _pool = other._pool;
+        _key = other._key;
+        _data = std::move(other._data);
+        _size = other._size;
+
+        other._pool = nullptr;
+        other._size = 0;
+    }
+    return *this;
+}
+screenshot_buffer::~screenshot_buffer()
+{
+    reset();
+}
+
+void screenshot_buffer::reset() noexcept
+{
+    if (_pool != nullptr && _data != nullptr)
+        _pool->release(*this);
+
+    _pool = nullptr;
+    _key = {};
+    _data.reset();
+    _size = 0;
+}
+
+screenshot_buffer_pool::screenshot_buffer_pool()
+{
+    // Enough room for a couple of bursts worth of buffers, so that the list rarely has to grow
+    _free.reserve(256);
+}
+
+screenshot_buffer screenshot_buffer_pool::acquire(uint32_t width, uint32_t height, reshade::api::format format, size_t size)
+{
+    const screenshot_buffer_key key{ width, height, format };
+
+    screenshot_buffer buffer;
+    buffer._pool = this;
+    buffer._key = key;
+    buffer._size = size;
+
+    {
+        std::lock_guard lock(_mutex);
+
+        // Search from the back, since that is where the most recently released (and therefore most likely still cached) buffers are
+        for (auto it = _free.rbegin(); it != _free.rend(); ++it)
+        {
+            if (it->key == key && it->size == size)
+            {
+                buffer._data = std::move(it->data);
+                _cached_bytes -= sizeof(uint32_t) * it->size;
+                _free.erase(std::next(it).base());
+                break;
+            }
+        }
+    }
+
+    if (buffer._data == nullptr)
+    {
+        // Default-initialize, so that the storage is not zero-filled before being overwritten by the capture anyway
+        // The buffer is only counted once it exists, so that a failed allocation leaves the pool as it was
+        std::unique_ptr<uint32_t[]> data(new uint32_t[size]);
+
+        {
+            std::lock_guard lock(_mutex);
+
+            // Every buffer comes back to the list when released, so make room for it here, where allocating may throw, instead of there
+            if (_free.capacity() <= _buffers)
+                _free.reserve(std::max(2 * _free.capacity(), _buffers + 1));
+            _buffers++;
+        }
+
+        buffer._data = std::move(data);
+        _allocations++;
+    }
+
+    _used_bytes += sizeof(uint32_t) * size;
+
+    return buffer;
+}
+
+void screenshot_buffer_pool::trim(uint64_t max_cached_bytes)
+{
+    std::vector<entry> freeing;
+    {
+        std::lock_guard lock(_mutex);
+
+        // Oldest entries are at the front
+        size_t count = 0;
+        for (uint64_t cached_bytes = _cached_bytes; count < _free.size() && cached_bytes > max_cached_bytes; count++)
+            cached_bytes -= sizeof(uint32_t) * _free[count].size;
+
+        freeing.reserve(count);
+        std::move(_free.begin(), _free.begin() + count, std::back_inserter(freeing));
+        _free.erase(_free.begin(), _free.begin() + count);
+        _buffers -= count;
+
+        for (const entry &entry : freeing)
+            _cached_bytes -= sizeof(uint32_t) * entry.size;
+    }
+
+    // Buffers are freed outside the lock
+}
+
+bool screenshot_buffer_pool::wait_for_release(uint64_t max_used_bytes, std::chrono::milliseconds timeout)
+{
+    std::unique_lock lock(_mutex);
+
+    // Handed out bytes only ever go down under the lock, so no release can be missed between the check and the wait
+    return _released.wait_for(lock, timeout, [this, max_used_bytes]() { return _used_bytes <= max_used_bytes; });
+}
+
+void screenshot_buffer_pool::release(screenshot_buffer &buffer) noexcept
+{
+    const uint64_t bytes = sizeof(uint32_t) * buffer._size;
+
+    {
+        std::lock_guard lock(_mutex);
+
+        _used_bytes -= bytes;
+        _cached_bytes += bytes;
+        _free.push_back({ buffer._key, std::move(buffer._data), buffer._size });
+    }
+
+    _released.notify_all();
+}
@@ -0,0 +1,122 @@
+﻿/*
+ * SPDX-FileCopyrightText: 2018 seri14
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#pragma once
+
+#include <reshade.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class screenshot_buffer_pool;
+
+struct screenshot_buffer_key
+{
+    uint32_t width = 0;
+    uint32_t height = 0;
+    reshade::api::format format = reshade::api::format::unknown;
+
+    bool operator==(const screenshot_buffer_key &other) const noexcept
+    {
+        return width == other.width && height == other.height && format == other.format;
+    }
+};
+
+/// <summary>
+/// Uninitialized pixel storage handed out by a <see cref="screenshot_buffer_pool"/>.
+/// The storage goes back to the pool it came from when the buffer is reset or destroyed.
+/// </summary>
+class screenshot_buffer
+{
+public:
+    screenshot_buffer() = default;
+    screenshot_buffer(const screenshot_buffer &) = delete;
+    screenshot_buffer(screenshot_buffer &&other) noexcept;
+    screenshot_buffer &operator=(const screenshot_buffer &) = delete;
+    screenshot_buffer &operator=(screenshot_buffer &&other) noexcept;
+    ~screenshot_buffer();
+
+    uint32_t *data() noexcept { return _data.get(); }
+    const uint32_t *data() const noexcept { return _data.get(); }
+    /// <summary>
+    /// Number of 32-bit elements in the buffer.
+    /// </summary>
+    size_t size() const noexcept { return _size; }
+    bool empty() const noexcept { return _size == 0; }
+    const screenshot_buffer_key &key() const noexcept { return _key; }
+
+    void reset() noexcept;
+
+private:
+    friend class screenshot_buffer_pool;
+
+    screenshot_buffer_pool *_pool = nullptr;
+    screenshot_buffer_key _key;
+    std::unique_ptr<uint32_t[]> _data;
+    size_t _size = 0;
+};
+
+/// <summary>
+/// Recycles pixel buffers between captures, grouped by resolution and format, so that a running burst does not allocate on the render thread.
+/// </summary>
+class screenshot_buffer_pool
+{
+public:
+    screenshot_buffer_pool();
+    screenshot_buffer_pool(const screenshot_buffer_pool &) = delete;
+    screenshot_buffer_pool &operator=(const screenshot_buffer_pool &) = delete;
+
+    /// <summary>
+    /// Hands out a buffer of <paramref name="size"/> 32-bit elements, reusing a released one of the same class when available.
+    /// </summary>
+    screenshot_buffer acquire(uint32_t width, uint32_t height, reshade::api::format format, size_t size);
+    /// <summary>
+    /// Frees cached buffers until at most <paramref name="max_cached_bytes"/> remain.
+    /// </summary>
+    void trim(uint64_t max_cached_bytes = 0);
+    /// <summary>
+    /// Blocks until enough buffers were released that at most <paramref name="max_used_bytes"/> remain handed out, or the timeout elapsed.
+    /// </summary>
+    /// <returns><see langword="true"/> if the condition was met.</returns>
+    bool wait_for_release(uint64_t max_used_bytes, std::chrono::milliseconds timeout);
+
+    /// <summary>
+    /// Bytes held by buffers that are currently handed out.
+    /// </summary>
+    uint64_t used_bytes() const noexcept { return _used_bytes; }
+    /// <summary>
+    /// Bytes held by released buffers that wait to be reused.
+    /// </summary>
+    uint64_t cached_bytes() const noexcept { return _cached_bytes; }
+    /// <summary>
+    /// Number of times a new buffer had to be allocated.
+    /// </summary>
+    uint64_t allocations() const noexcept { return _allocations; }
+
+private:
+    friend class screenshot_buffer;
+
+    struct entry
+    {
+        screenshot_buffer_key key;
+        std::unique_ptr<uint32_t[]> data;
+        size_t size;
+    };
+
+    void release(screenshot_buffer &buffer) noexcept;
+
+    std::mutex _mutex;
+    std::condition_variable _released;
+    std::vector<entry> _free;
+    // Buffers allocated and not freed yet, whether handed out or cached, which all fit into the capacity of the free list
+    size_t _buffers = 0;
+    std::atomic<uint64_t> _used_bytes = 0;
+    std::atomic<uint64_t> _cached_bytes = 0;
+    std::atomic<uint64_t> _allocations = 0;
+};
@@ -0,0 +1,146 @@
+﻿/*
+ * SPDX-FileCopyrightText: 2018 seri14
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "screenshot_deflate.hpp"
+
+#ifdef SCREENSHOT_HAVE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+#include <zlib.h>
+
+#include <algorithm>
+
+#ifdef SCREENSHOT_HAVE_LIBDEFLATE
+/// <summary>
+/// Compressors of a thread for each level, which libdeflate lets compress any number of buffers one after another.
+/// </summary>
+class libdeflate_compressors
+{
+public:
+    ~libdeflate_compressors()
+    {
+        for (libdeflate_compressor *compressor : _compressors)
+            if (compressor != nullptr)
+                libdeflate_free_compressor(compressor);
+    }
+
+    libdeflate_compressor *get(int level)
+    {
+        libdeflate_compressor *&compressor = _compressors[level];
+        if (compressor == nullptr)
+            compressor = libdeflate_alloc_compressor(level);
+        return compressor;
+    }
+
+private:
+    libdeflate_compressor *_compressors[10] = {};
+};
+#endif
+
+screenshot_deflate_stream::screenshot_deflate_stream() : _strm(std::make_unique<z_stream>())
+{
+}
+screenshot_deflate_stream::~screenshot_deflate_stream()
+{
+    if (_initialized)
+        deflateEnd(_strm.get());
+}
+
+z_stream *screenshot_deflate_stream::reset(int level, int strategy, int window_bits)
+{
+    if (_initialized && level == _level && strategy == _strategy && window_bits == _window_bits)
+        return deflateReset(_strm.get()) == Z_OK ? _strm.get() : nullptr;
+
+    if (_initialized)
+        deflateEnd(_strm.get());
+
+    *_strm = {};
+    _initialized = deflateInit2(_strm.get(), level, Z_DEFLATED, window_bits, MAX_MEM_LEVEL, strategy) == Z_OK;
+    _level = level;
+    _strategy = strategy;
+    _window_bits = window_bits;
+
+    return _initialized ? _strm.get() : nullptr;
+}
+
+bool screenshot_deflate::is_available(screenshot_deflate_backend backend)
+{
+    switch (backend)
+    {
+        case screenshot_deflate_backend::zlib:
+            return true;
+        case screenshot_deflate_backend::libdeflate:
+#ifdef SCREENSHOT_HAVE_LIBDEFLATE
+            return true;
+#else
+            return false;
+#endif
+        default:
+            return false;
+    }
+}
+
+const char *screenshot_deflate::get_backend_name(screenshot_deflate_backend backend)
+{
+    switch (backend)
+    {
+        case screenshot_deflate_backend::zlib:
+            return "zlib";
+        case screenshot_deflate_backend::libdeflate:
+            return "libdeflate";
+        default:
+            return "unknown";
+    }
+}
+
+bool screenshot_deflate::compress_libdeflate([[maybe_unused]] const uint8_t *input, [[maybe_unused]] size_t size, [[maybe_unused]] int level, [[maybe_unused]] std::vector<uint8_t> &output)
+{
+#ifdef SCREENSHOT_HAVE_LIBDEFLATE
+    // Workers compress many images in a row, so keep the compressors around between them
+    static thread_local libdeflate_compressors compressors;
+
+    // Levels above 9 exist as well, but are far too slow for captures
+    libdeflate_compressor *const compressor = compressors.get(level < 0 ? 6 : std::min(level, 9));
+    if (compressor == nullptr)
+        return false;
+
+    const size_t offset = output.size();
+    output.resize(offset + libdeflate_zlib_compress_bound(compressor, size));
+
+    const size_t compressed_size = libdeflate_zlib_compress(compressor, input, size, output.data() + offset, output.size() - offset);
+    output.resize(offset + compressed_size);
+
+    return compressed_size != 0;
+#else
+    return false;
+#endif
+}
+
+bool screenshot_deflate::compress(screenshot_deflate_backend backend, const uint8_t *input, size_t size, int level, int strategy, std::vector<uint8_t> &output)
+{
+    if (backend == screenshot_deflate_backend::libdeflate && is_available(backend))
+        return compress_libdeflate(input, size, level, output);
+
+    // Workers compress many buffers in a row, so keep the stream around between them
+    static thread_local screenshot_deflate_stream stream;
+
+    z_stream *const strm = stream.reset(level, strategy, MAX_WBITS);
+    if (strm == nullptr)
+        return false;
+
+    const size_t offset = output.size();
+    output.resize(offset + deflateBound(strm, static_cast<uLong>(size)));
+
+    strm->next_in = const_cast<Bytef *>(input);
+    strm->avail_in = static_cast<uInt>(size);
+    strm->next_out = output.data() + offset;
+    strm->avail_out = static_cast<uInt>(output.size() - offset);
+
+    // The bound holds the whole stream, so a single call finishes it
+    const int status = deflate(strm, Z_FINISH);
+    output.resize(output.size() - strm->avail_out);
+
+    return status == Z_STREAM_END;
+}
@@ -0,0 +1,66 @@
+﻿/*
+ * SPDX-FileCopyrightText: 2018 seri14
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+struct z_stream_s;
+
+/// <summary>
+/// Implementation that compresses PNG image data and Deflate compressed TIFF strips, using the same zlib compression level either way.
+/// </summary>
+enum class screenshot_deflate_backend : unsigned int
+{
+    zlib,
+    /// <summary>
+    /// libdeflate, which finds matches and computes checksums with SIMD instructions. It only compresses whole buffers and has no equivalent of the zlib strategies.
+    /// </summary>
+    libdeflate,
+};
+
+/// <summary>
+/// zlib stream that is reset for the next buffer instead of allocating and initializing its state again, so that a thread can keep one around.
+/// </summary>
+class screenshot_deflate_stream
+{
+public:
+    screenshot_deflate_stream();
+    ~screenshot_deflate_stream();
+
+    /// <param name="window_bits">As for deflateInit2, negative for a raw deflate stream without zlib header and checksum.</param>
+    /// <returns>The stream ready to deflate the next buffer, or <see langword="nullptr"/> if it could not be initialized.</returns>
+    z_stream_s *reset(int level, int strategy, int window_bits);
+
+private:
+    std::unique_ptr<z_stream_s> _strm;
+    bool _initialized = false;
+    int _level = 0;
+    int _strategy = 0;
+    int _window_bits = 0;
+};
+
+namespace screenshot_deflate
+{
+    /// <summary>
+    /// Whether the add-on was built with <paramref name="backend"/>. Writers fall back to zlib for one that is not.
+    /// </summary>
+    bool is_available(screenshot_deflate_backend backend);
+    const char *get_backend_name(screenshot_deflate_backend backend);
+
+    /// <summary>
+    /// Compresses <paramref name="size"/> bytes into a complete zlib stream with libdeflate, appending it to <paramref name="output"/>.
+    /// </summary>
+    /// <param name="level">Compression level as for zlib, where -1 is the default of 6.</param>
+    bool compress_libdeflate(const uint8_t *input, size_t size, int level, std::vector<uint8_t> &output);
+    /// <summary>
+    /// Compresses <paramref name="size"/> bytes into a complete zlib stream with <paramref name="backend"/>, or with zlib if that is not available, appending it to <paramref name="output"/>.
+    /// </summary>
+    /// <param name="strategy">zlib strategy, which libdeflate ignores.</param>
+    bool compress(screenshot_deflate_backend backend, const uint8_t *input, size_t size, int level, int strategy, std::vector<uint8_t> &output);
+}
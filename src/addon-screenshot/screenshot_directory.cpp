@@ -0,0 +1,105 @@
+﻿/*
+ * SPDX-FileCopyrightText: 2018 seri14
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "screenshot_directory.hpp"
+
+#include <Windows.h>
+
+#include <algorithm>
+
+std::filesystem::path screenshot_directory_cache::create_directories(const std::filesystem::path &directory, std::error_code &ec)
+{
+    ec.clear();
+
+    const auto now = std::chrono::steady_clock::now();
+    {
+        const std::lock_guard<std::mutex> lock(_mutex);
+
+        if (const auto it = _directories.find(directory.native()); it != _directories.end() && now - it->second.checked < refresh_interval)
+            return it->second.resolved;
+    }
+
+    // Failures are not cached, so that the next image tries again
+    if (std::filesystem::create_directories(directory, ec), ec)
+        return directory;
+
+    std::error_code canonical_ec;
+    std::filesystem::path resolved = std::filesystem::weakly_canonical(directory, canonical_ec);
+    if (canonical_ec)
+        resolved = directory;
+
+    WCHAR volume[MAX_PATH] = L"";
+    if (!GetVolumePathNameW(resolved.c_str(), volume, ARRAYSIZE(volume)))
+        volume[resolved.root_path().native().copy(volume, ARRAYSIZE(volume) - 1)] = L'\0';
+
+    const std::lock_guard<std::mutex> lock(_mutex);
+
+    directory_entry &entry = _directories[directory.native()];
+    entry.resolved = resolved;
+    entry.volume = volume;
+    entry.checked = now;
+
+    return resolved;
+}
+
+std::wstring screenshot_directory_cache::find_volume(const std::filesystem::path &directory)
+{
+    if (const auto it = _directories.find(directory.native()); it != _directories.end())
+        return it->second.volume;
+    else
+        return directory.root_path().native();
+}
+
+bool screenshot_directory_cache::get_free_space(const std::filesystem::path &directory, uint64_t &free_bytes, uint64_t &total_bytes)
+{
+    const auto now = std::chrono::steady_clock::now();
+
+    std::wstring volume;
+    {
+        const std::lock_guard<std::mutex> lock(_mutex);
+
+        volume = find_volume(directory);
+
+        if (const auto it = _volumes.find(volume); it != _volumes.end() && now - it->second.checked < refresh_interval)
+        {
+            free_bytes = it->second.free_bytes - std::min(it->second.free_bytes, it->second.written_bytes);
+            total_bytes = it->second.total_bytes;
+            return true;
+        }
+    }
+
+    ULARGE_INTEGER disk_bytes{}, free_disk_bytes{};
+    if (!GetDiskFreeSpaceExW(volume.c_str(), &free_disk_bytes, &disk_bytes, nullptr))
+        return false;
+
+    free_bytes = free_disk_bytes.QuadPart;
+    total_bytes = disk_bytes.QuadPart;
+
+    const std::lock_guard<std::mutex> lock(_mutex);
+
+    volume_entry &entry = _volumes[volume];
+    entry.free_bytes = free_bytes;
+    entry.total_bytes = total_bytes;
+    entry.written_bytes = 0;
+    entry.checked = now;
+
+    return true;
+}
+
+void screenshot_directory_cache::add_written_bytes(const std::filesystem::path &directory, uint64_t bytes)
+{
+    const std::lock_guard<std::mutex> lock(_mutex);
+
+    if (const auto it = _volumes.find(find_volume(directory)); it != _volumes.end())
+        it->second.written_bytes += bytes;
+}
+
+void screenshot_directory_cache::clear()
+{
+    const std::lock_guard<std::mutex> lock(_mutex);
+
+    _directories.clear();
+    _volumes.clear();
+}
@@ -0,0 +1,64 @@
+﻿/*
+ * SPDX-FileCopyrightText: 2018 seri14
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+
+/// <summary>
+/// Remembers output directories that were already created and the free space of the volumes they are on, so that saving an image does not have to ask the file system every time.
+/// Free space is refreshed periodically, and bytes written in between are subtracted from the last known value.
+/// </summary>
+class screenshot_directory_cache
+{
+public:
+    /// <summary>
+    /// How long a created directory and the free space of a volume are trusted before they are checked again.
+    /// </summary>
+    std::chrono::steady_clock::duration refresh_interval = std::chrono::seconds(2);
+
+    /// <summary>
+    /// Creates <paramref name="directory"/> and its parents if necessary, like <see cref="std::filesystem::create_directories"/>.
+    /// </summary>
+    /// <returns>The directory resolved to its canonical form.</returns>
+    std::filesystem::path create_directories(const std::filesystem::path &directory, std::error_code &ec);
+    /// <summary>
+    /// Gets the free and total space of the volume <paramref name="directory"/> is on, which should have been passed to <see cref="create_directories"/> before.
+    /// </summary>
+    bool get_free_space(const std::filesystem::path &directory, uint64_t &free_bytes, uint64_t &total_bytes);
+    /// <summary>
+    /// Accounts for a file written to <paramref name="directory"/> until the free space of its volume is refreshed.
+    /// </summary>
+    void add_written_bytes(const std::filesystem::path &directory, uint64_t bytes);
+
+    void clear();
+
+private:
+    struct directory_entry
+    {
+        std::filesystem::path resolved;
+        std::wstring volume;
+        std::chrono::steady_clock::time_point checked;
+    };
+    struct volume_entry
+    {
+        uint64_t free_bytes = 0;
+        uint64_t total_bytes = 0;
+        uint64_t written_bytes = 0;
+        std::chrono::steady_clock::time_point checked;
+    };
+
+    std::wstring find_volume(const std::filesystem::path &directory);
+
+    std::mutex _mutex;
+    std::unordered_map<std::filesystem::path::string_type, directory_entry> _directories;
+    std::unordered_map<std::wstring, volume_entry> _volumes;
+};
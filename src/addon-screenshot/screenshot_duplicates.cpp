@@ -0,0 +1,82 @@
+﻿/*
+ * SPDX-FileCopyrightText: 2018 seri14
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "screenshot_duplicates.hpp"
+#include "screenshot_platform.hpp"
+
+#include <cerrno>
+
+screenshot_duplicate_table::~screenshot_duplicate_table()
+{
+    clear();
+}
+
+bool screenshot_duplicate_table::find(const std::string &myset, uint64_t take, uint64_t hash, std::filesystem::path &original)
+{
+    std::lock_guard lock(_mutex);
+
+    if (const auto it = _takes.find(std::make_pair(myset, take)); it != _takes.end())
+    {
+        if (const auto image = it->second.images.find(hash); image != it->second.images.end())
+        {
+            original = image->second;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void screenshot_duplicate_table::add(const std::string &myset, uint64_t take, uint64_t hash, const std::filesystem::path &file)
+{
+    std::lock_guard lock(_mutex);
+
+    _takes[std::make_pair(myset, take)].images.insert_or_assign(hash, file);
+    _size = _takes.size();
+}
+
+bool screenshot_duplicate_table::record(const std::string &myset, uint64_t take, const std::filesystem::path &duplicate, const std::filesystem::path &original, std::error_code &ec)
+{
+    std::lock_guard lock(_mutex);
+
+    take_images &entry = _takes[std::make_pair(myset, take)];
+    _size = _takes.size();
+
+    if (entry.list == nullptr)
+    {
+        std::filesystem::path list_file = duplicate.parent_path() / duplicate.stem();
+        list_file += " duplicates.txt";
+
+        if (entry.list = screenshot_platform::open_file(list_file, "ab"); entry.list == nullptr)
+        {
+            ec = std::error_code(errno, std::generic_category());
+            return false;
+        }
+    }
+
+    // One tab separated pair per line, so that the list can be read back with any spreadsheet or script
+    const std::string line = duplicate.u8string() + '\t' + original.u8string() + '\n';
+    if (fwrite(line.data(), 1, line.size(), entry.list) != line.size() || fflush(entry.list) != 0)
+    {
+        ec = std::error_code(errno, std::generic_category());
+        return false;
+    }
+
+    return true;
+}
+
+void screenshot_duplicate_table::clear()
+{
+    std::lock_guard lock(_mutex);
+
+    for (auto &[key, entry] : _takes)
+    {
+        if (entry.list != nullptr)
+            fclose(entry.list);
+    }
+
+    _takes.clear();
+    _size = 0;
+}
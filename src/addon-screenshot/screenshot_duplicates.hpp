@@ -0,0 +1,58 @@
+﻿/*
+ * SPDX-FileCopyrightText: 2018 seri14
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+
+/// <summary>
+/// Content hashes of the images saved during each take, to recognize frames that are exactly the same as one saved before, e.g. while the game is paused or in a menu, or before and after when no effect is active.
+/// Images are only added once they were written, so a duplicate always refers to a complete file.
+/// </summary>
+class screenshot_duplicate_table
+{
+public:
+    ~screenshot_duplicate_table();
+
+    /// <summary>
+    /// Looks up an image with the same hash that was saved in the same take, of any kind.
+    /// </summary>
+    bool find(const std::string &myset, uint64_t take, uint64_t hash, std::filesystem::path &original);
+    /// <summary>
+    /// Adds an image that was saved, replacing an earlier one with the same hash so that later duplicates refer to the most recent file.
+    /// </summary>
+    void add(const std::string &myset, uint64_t take, uint64_t hash, const std::filesystem::path &file);
+    /// <summary>
+    /// Appends a line with the file a duplicate would have been saved as and the image it is the same as to the list of the take, which is created next to the first duplicate.
+    /// </summary>
+    bool record(const std::string &myset, uint64_t take, const std::filesystem::path &duplicate, const std::filesystem::path &original, std::error_code &ec);
+    /// <summary>
+    /// Forgets all takes and closes their lists. Must only be called once no image of their takes is left to be saved.
+    /// </summary>
+    void clear();
+
+    size_t size() const noexcept { return _size; }
+
+private:
+    struct take_images
+    {
+        std::unordered_map<uint64_t, std::filesystem::path> images;
+        FILE *list = nullptr;
+    };
+
+    std::mutex _mutex;
+    std::map<std::pair<std::string, uint64_t>, take_images> _takes;
+    // Checked by the render thread every frame, without waiting for a worker that is looking up an image
+    std::atomic<size_t> _size = 0;
+};
@@ -0,0 +1,348 @@
+﻿/*
+ * SPDX-FileCopyrightText: 2018 seri14
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "screenshot_encoder.hpp"
+#include "screenshot_output.hpp"
+#include "screenshot_platform.hpp"
+#include "pixel_convert.hpp"
+#include "std_string_ext.hpp"
+
+#include <setjmp.h>
+
+#include <fpng.h>
+#include <png.h>
+#include <tiffio.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+/// <summary>
+/// Memory of libpng and its zlib stream that stays with a thread. libpng allocates the same blocks for every image, so the next image reuses those of the previous one instead of allocating and faulting in hundreds of KiB of compressor state again.
+/// </summary>
+class png_block_cache
+{
+public:
+    ~png_block_cache()
+    {
+        for (void *block : _free_blocks)
+            std::free(block);
+    }
+
+    static png_voidp PNGCBAPI allocate(png_structp png_ptr, png_alloc_size_t size)
+    {
+        png_block_cache &cache = *static_cast<png_block_cache *>(png_get_mem_ptr(png_ptr));
+
+        for (size_t i = 0; i < cache._free_blocks.size(); i++)
+        {
+            if (void *const block = cache._free_blocks[i]; *static_cast<size_t *>(block) == size)
+            {
+                cache._free_blocks.erase(cache._free_blocks.begin() + i);
+                return static_cast<uint8_t *>(block) + header_size;
+            }
+        }
+
+        void *const block = std::malloc(header_size + size);
+        if (block == nullptr)
+            return nullptr;
+
+        *static_cast<size_t *>(block) = size;
+        return static_cast<uint8_t *>(block) + header_size;
+    }
+    static void PNGCBAPI release(png_structp png_ptr, png_voidp ptr)
+    {
+        if (ptr == nullptr)
+            return;
+
+        png_block_cache &cache = *static_cast<png_block_cache *>(png_get_mem_ptr(png_ptr));
+        void *const block = static_cast<uint8_t *>(ptr) - header_size;
+
+        if (cache._free_blocks.size() < max_free_blocks)
+            cache._free_blocks.push_back(block);
+        else
+            std::free(block);
+    }
+
+private:
+    // Size of a block in front of it, with the alignment malloc would give it
+    static constexpr size_t header_size = alignof(std::max_align_t);
+    // libpng needs less than a dozen blocks per image
+    static constexpr size_t max_free_blocks = 32;
+
+    std::vector<void *> _free_blocks;
+};
+
+static void set_tiff_datetime(TIFF *tif, time_t mod_time)
+{
+    // 306
+    if (tm utc; screenshot_platform::to_utc_time(mod_time, utc))
+        TIFFSetField(tif, TIFFTAG_DATETIME, std::format("%04d:%02d:%02d %02d:%02d:%02d", 1900 + utc.tm_year, 1 + utc.tm_mon, utc.tm_mday, utc.tm_hour, utc.tm_min, utc.tm_sec).c_str());
+}
+
+static screenshot_tiff_writer make_tiff_writer(const screenshot_encoder &encoder)
+{
+    screenshot_tiff_writer writer;
+    writer.compression = encoder.tiff_compression;
+    writer.compression_level = encoder.compression_level;
+    writer.compression_strategy = encoder.compression_strategy;
+    writer.deflate_backend = encoder.deflate_backend;
+    writer.strip_size = encoder.tiff_strip_size;
+    writer.tile_size = encoder.tiff_tile_size;
+    return writer;
+}
+
+static TIFF *open_tiff(screenshot_output &output, const screenshot_tiff_writer &writer, uint32_t width, uint32_t height, unsigned int channels, unsigned int bit_depth)
+{
+    // Strips are written as they are, so the file has to be in the byte order of the processor, which is little-endian wherever ReShade runs
+    return output.open_tiff(writer.needs_bigtiff(width, height, channels, bit_depth) ? "w8l" : "wl");
+}
+
+bool screenshot_encoder::write_png(screenshot_output &output, const uint8_t *pixels, uint32_t width, uint32_t height, unsigned int channels, unsigned int bit_depth, time_t mod_time) const
+{
+    if (deflate_backend != screenshot_deflate_backend::zlib && screenshot_deflate::is_available(deflate_backend))
+    {
+        // The writer expects big-endian samples, which must not be swapped in the buffer of the caller
+        std::vector<uint8_t> swapped;
+        if (bit_depth == 16)
+        {
+            swapped.assign(pixels, pixels + static_cast<size_t>(width) * height * channels * 2);
+            pixel_convert::byte_swap16(reinterpret_cast<uint16_t *>(swapped.data()), swapped.size() / 2);
+            pixels = swapped.data();
+        }
+
+        screenshot_png_writer writer;
+        writer.filters = png_filters;
+        writer.compression_level = compression_level;
+        writer.compression_strategy = compression_strategy;
+        writer.bit_depth = bit_depth;
+        writer.deflate_backend = deflate_backend;
+
+        return writer.write([&output](const void *data, size_t size) { return output.write(data, size); }, pixels, width, height, channels, mod_time, {});
+    }
+
+    bool result = false;
+
+    // Workers encode many images in a row, so keep the memory of libpng and the row pointers around between them
+    static thread_local png_block_cache block_cache;
+    static thread_local std::vector<png_bytep> rows;
+
+    png_structp write_ptr = nullptr;
+    png_infop info_ptr = nullptr;
+
+    if (write_ptr = png_create_write_struct_2(PNG_LIBPNG_VER_STRING, png_message_context, png_error_fn, png_warning_fn, &block_cache, png_block_cache::allocate, png_block_cache::release);
+        write_ptr != nullptr)
+    {
+#ifdef _MSC_VER
+#pragma warning(disable:4611)
+#endif
+        if (setjmp(*png_set_longjmp_fn(write_ptr, longjmp, sizeof(jmp_buf))) == 0)
+        {
+#ifdef _MSC_VER
+#pragma warning(default:4611)
+#endif
+            png_set_write_fn(write_ptr, &output,
+                [](png_structp png_ptr, png_bytep data, size_t length) {
+                    if (!static_cast<screenshot_output *>(png_get_io_ptr(png_ptr))->write(data, length))
+                        png_error(png_ptr, "Write Error");
+                },
+                // Without a flush function libpng would flush the output as FILE
+                [](png_structp) {});
+            png_set_filter(write_ptr, PNG_FILTER_TYPE_BASE, png_filters);
+
+            png_set_compression_mem_level(write_ptr, MAX_MEM_LEVEL);
+            png_set_compression_buffer_size(write_ptr, 65536);
+
+            png_set_compression_level(write_ptr, compression_level);
+            png_set_compression_strategy(write_ptr, compression_strategy);
+
+            if (info_ptr = png_create_info_struct(write_ptr);
+                info_ptr != nullptr)
+            {
+                png_set_IHDR(write_ptr, info_ptr, width, height, bit_depth, channels == 3 ? PNG_COLOR_TYPE_RGB : PNG_COLOR_TYPE_RGBA, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+
+                png_time time{};
+                png_convert_from_time_t(&time, mod_time);
+                png_set_tIME(write_ptr, info_ptr, &time);
+
+                png_write_info(write_ptr, info_ptr);
+
+                // PNG stores 16-bit samples in big-endian order
+                if (bit_depth == 16)
+                    png_set_swap(write_ptr);
+
+                rows.resize(height);
+                for (size_t y = 0; y < height; y++)
+                    rows[y] = const_cast<png_bytep>(pixels) + static_cast<size_t>(channels) * (bit_depth / 8) * width * y;
+
+                png_write_image(write_ptr, rows.data());
+
+                png_write_end(write_ptr, info_ptr);
+
+                result = true;
+            }
+        }
+
+        png_destroy_info_struct(write_ptr, &info_ptr);
+        png_destroy_write_struct(&write_ptr, &info_ptr);
+    }
+
+    return result && !output.error();
+}
+
+bool screenshot_encoder::write_parallel_png(screenshot_output &output, uint8_t *pixels, uint32_t width, uint32_t height, unsigned int channels, unsigned int bit_depth, time_t mod_time, const parallel_for_fn &parallel_for) const
+{
+    if (bit_depth == 16)
+        pixel_convert::byte_swap16(reinterpret_cast<uint16_t *>(pixels), static_cast<size_t>(width) * height * channels);
+
+    screenshot_png_writer writer;
+    writer.filters = png_filters;
+    writer.compression_level = compression_level;
+    writer.compression_strategy = compression_strategy;
+    writer.bit_depth = bit_depth;
+    writer.deflate_backend = deflate_backend;
+
+    return writer.write([&output](const void *data, size_t size) { return output.write(data, size); }, pixels, width, height, channels, mod_time, parallel_for);
+}
+
+bool screenshot_encoder::write_fpng(screenshot_output &output, const uint8_t *pixels, uint32_t width, uint32_t height, unsigned int channels)
+{
+    // fpng encodes into memory, so the whole file is written at once, and workers encode many images in a row, so keep the buffer around between them
+    static thread_local std::vector<uint8_t> encoded_pixels;
+    encoded_pixels.clear();
+    if (!fpng::fpng_encode_image_to_memory(pixels, width, height, channels, encoded_pixels))
+        return false;
+
+    return output.write(encoded_pixels.data(), encoded_pixels.size());
+}
+
+bool screenshot_encoder::write_tiff(screenshot_output &output, const uint8_t *pixels, uint32_t width, uint32_t height, unsigned int channels, unsigned int bit_depth, time_t mod_time, const parallel_for_fn &parallel_for) const
+{
+    const screenshot_tiff_writer writer = make_tiff_writer(*this);
+
+    TIFF *const tif = open_tiff(output, writer, width, height, channels, bit_depth);
+    if (tif == nullptr)
+        return false;
+
+    // 256 - 258
+    TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, width);
+    TIFFSetField(tif, TIFFTAG_IMAGELENGTH, height);
+    TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, static_cast<uint16_t>(bit_depth));
+
+    // 262
+    TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, (uint16_t)PHOTOMETRIC_RGB);
+
+    // 266
+    TIFFSetField(tif, TIFFTAG_FILLORDER, (uint16_t)FILLORDER_MSB2LSB);
+
+    // 274
+    TIFFSetField(tif, TIFFTAG_ORIENTATION, (uint16_t)ORIENTATION_TOPLEFT);
+
+    // 277
+    TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, static_cast<uint16_t>(channels));
+
+    // 282-284
+    TIFFSetField(tif, TIFFTAG_XRESOLUTION, (uint16_t)96);
+    TIFFSetField(tif, TIFFTAG_YRESOLUTION, (uint16_t)96);
+    TIFFSetField(tif, TIFFTAG_PLANARCONFIG, (uint16_t)PLANARCONFIG_CONTIG);
+
+    // 296
+    TIFFSetField(tif, TIFFTAG_RESOLUTIONUNIT, (uint16_t)RESUNIT_INCH);
+
+    // 305
+    TIFFSetField(tif, TIFFTAG_SOFTWARE, "ReShade Screenshot Add-on");
+
+    set_tiff_datetime(tif, mod_time);
+
+    // 338
+    if (channels == 4)
+    {
+        uint16_t v[1] = { (uint16_t)EXTRASAMPLE_UNASSALPHA };
+        TIFFSetField(tif, TIFFTAG_EXTRASAMPLES, (uint16_t)1, v);
+    }
+
+    // 339
+    TIFFSetField(tif, TIFFTAG_SAMPLEFORMAT, (uint16_t)SAMPLEFORMAT_UINT);
+
+    // Compression, layout and predictor
+    bool result = false;
+    try
+    {
+        result = writer.write(tif, pixels, width, height, channels, bit_depth, false, parallel_for);
+    }
+    catch (...)
+    {
+        // Strips are compressed by the worker threads, which pass on what they throw
+        TIFFClose(tif);
+        throw;
+    }
+
+    TIFFClose(tif);
+
+    return result && !output.error();
+}
+
+bool screenshot_encoder::write_depth_tiff(screenshot_output &output, const float *depth, uint32_t width, uint32_t height, time_t mod_time, const parallel_for_fn &parallel_for) const
+{
+    const screenshot_tiff_writer writer = make_tiff_writer(*this);
+
+    TIFF *const tif = open_tiff(output, writer, width, height, 1, 32);
+    if (tif == nullptr)
+        return false;
+
+    // 256 - 258
+    TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, width);
+    TIFFSetField(tif, TIFFTAG_IMAGELENGTH, height);
+    TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, (uint16_t)32);
+
+    // 262
+    TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, (uint16_t)PHOTOMETRIC_MINISBLACK);
+
+    // 263
+    TIFFSetField(tif, TIFFTAG_THRESHHOLDING, (uint16_t)THRESHHOLD_BILEVEL);
+
+    // 266
+    TIFFSetField(tif, TIFFTAG_FILLORDER, (uint16_t)FILLORDER_MSB2LSB);
+
+    // 274
+    TIFFSetField(tif, TIFFTAG_ORIENTATION, (uint16_t)ORIENTATION_TOPLEFT);
+
+    // 277
+    TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, (uint16_t)1);
+
+    // 282-284
+    TIFFSetField(tif, TIFFTAG_XRESOLUTION, (uint16_t)96);
+    TIFFSetField(tif, TIFFTAG_YRESOLUTION, (uint16_t)96);
+    TIFFSetField(tif, TIFFTAG_PLANARCONFIG, (uint16_t)PLANARCONFIG_CONTIG);
+
+    // 296
+    TIFFSetField(tif, TIFFTAG_RESOLUTIONUNIT, (uint16_t)RESUNIT_INCH);
+
+    // 305
+    TIFFSetField(tif, TIFFTAG_SOFTWARE, "ReShade Screenshot Add-on");
+
+    set_tiff_datetime(tif, mod_time);
+
+    // 339
+    TIFFSetField(tif, TIFFTAG_SAMPLEFORMAT, (uint16_t)SAMPLEFORMAT_IEEEFP);
+
+    // Compression, layout and predictor
+    bool result = false;
+    try
+    {
+        result = writer.write(tif, reinterpret_cast<const uint8_t *>(depth), width, height, 1, 32, true, parallel_for);
+    }
+    catch (...)
+    {
+        TIFFClose(tif);
+        throw;
+    }
+
+    TIFFClose(tif);
+
+    return result && !output.error();
+}
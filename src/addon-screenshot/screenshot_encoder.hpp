@@ -0,0 +1,78 @@
+﻿/*
+ * SPDX-FileCopyrightText: 2018 seri14
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#pragma once
+
+#include "screenshot_png.hpp"
+#include "screenshot_tiff.hpp"
+
+#include <cstdint>
+#include <ctime>
+
+class screenshot_output;
+struct png_struct_def;
+
+/// <summary>
+/// Writes a converted image in one of the file formats into a <see cref="screenshot_output"/>, without knowing where the pixels came from.
+/// </summary>
+class screenshot_encoder
+{
+public:
+    using parallel_for_fn = screenshot_png_writer::parallel_for_fn;
+    using png_message_fn = void (*)(png_struct_def *png_ptr, const char *message);
+
+    /// <summary>
+    /// Combination of PNG_FILTER_* flags.
+    /// </summary>
+    int png_filters = 0;
+    int compression_level = -1;
+    int compression_strategy = 0;
+    /// <summary>
+    /// Implementation of the compression of PNG files and of Deflate compressed TIFF files, with the same compression level.
+    /// </summary>
+    screenshot_deflate_backend deflate_backend = screenshot_deflate_backend::zlib;
+    /// <summary>
+    /// One of the COMPRESSION_* values of libtiff, which defaults to COMPRESSION_NONE.
+    /// </summary>
+    int tiff_compression = 1;
+    /// <summary>
+    /// Target amount of uncompressed data per TIFF strip, see <see cref="screenshot_tiff_writer::strip_size"/>.
+    /// </summary>
+    size_t tiff_strip_size = 256 * 1024;
+    /// <summary>
+    /// Size of square TIFF tiles to write instead of strips, or zero for strips.
+    /// </summary>
+    uint32_t tiff_tile_size = 0;
+
+    /// <summary>
+    /// Handlers for errors and warnings of libpng, which are called with <see cref="png_message_context"/> as error pointer. An error handler has to call png_longjmp.
+    /// </summary>
+    void *png_message_context = nullptr;
+    png_message_fn png_error_fn = nullptr;
+    png_message_fn png_warning_fn = nullptr;
+
+    /// <summary>
+    /// Writes RGB or RGBA pixels with a tightly packed row pitch as PNG file with libpng. 16-bit samples are in the byte order of the processor.
+    /// libpng always compresses with zlib, so with another <see cref="deflate_backend"/> the file is written with <see cref="screenshot_png_writer"/> on the calling thread instead.
+    /// </summary>
+    bool write_png(screenshot_output &output, const uint8_t *pixels, uint32_t width, uint32_t height, unsigned int channels, unsigned int bit_depth, time_t mod_time) const;
+    /// <summary>
+    /// Writes the PNG file with <see cref="screenshot_png_writer"/> instead, which encodes bands of rows concurrently.
+    /// 16-bit samples are in the byte order of the processor as well, and are swapped to big-endian order in place.
+    /// </summary>
+    bool write_parallel_png(screenshot_output &output, uint8_t *pixels, uint32_t width, uint32_t height, unsigned int channels, unsigned int bit_depth, time_t mod_time, const parallel_for_fn &parallel_for) const;
+    /// <summary>
+    /// Writes 8-bit RGB or RGBA pixels as PNG file with fpng, which ignores the compression settings.
+    /// </summary>
+    static bool write_fpng(screenshot_output &output, const uint8_t *pixels, uint32_t width, uint32_t height, unsigned int channels);
+    /// <summary>
+    /// Writes RGB or RGBA pixels with 8 or 16 bits per channel as TIFF file with <see cref="screenshot_tiff_writer"/>, which compresses strips concurrently. Images too large for 32-bit offsets are written as BigTIFF.
+    /// </summary>
+    bool write_tiff(screenshot_output &output, const uint8_t *pixels, uint32_t width, uint32_t height, unsigned int channels, unsigned int bit_depth, time_t mod_time, const parallel_for_fn &parallel_for) const;
+    /// <summary>
+    /// Writes one 32-bit floating-point value per pixel as grayscale TIFF file the same way.
+    /// </summary>
+    bool write_depth_tiff(screenshot_output &output, const float *depth, uint32_t width, uint32_t height, time_t mod_time, const parallel_for_fn &parallel_for) const;
+};
@@ -0,0 +1,399 @@
+﻿/*
+ * SPDX-FileCopyrightText: 2018 seri14
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "screenshot_output.hpp"
+
+#include <tiffio.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+static uint32_t get_process_id() { return GetCurrentProcessId(); }
+static std::error_code last_error() { return std::error_code(GetLastError(), std::system_category()); }
+#else
+static uint32_t get_process_id() { return static_cast<uint32_t>(getpid()); }
+static std::error_code last_error() { return std::error_code(errno, std::system_category()); }
+#endif
+
+screenshot_output::~screenshot_output()
+{
+    discard();
+}
+
+bool screenshot_output::open(const std::filesystem::path &path, size_t buffer_size, std::error_code &ec)
+{
+    discard();
+
+    _path = path;
+    _error.clear();
+    _position = 0;
+    _size = 0;
+
+    // Unique among the workers of this and other processes, so that two images that are saved under the same name at once do not write into the same file
+    static std::atomic<uint32_t> s_counter = 0;
+
+    for (int attempt = 0; attempt < 8; attempt++)
+    {
+        _temp_path = path;
+        _temp_path += "." + std::to_string(get_process_id()) + "-" + std::to_string(s_counter++) + ".tmp";
+
+#ifdef _WIN32
+        const HANDLE file = CreateFileW(_temp_path.c_str(), GENERIC_READ | GENERIC_WRITE | DELETE, FILE_SHARE_READ, nullptr, CREATE_NEW, FILE_ATTRIBUTE_ARCHIVE | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file != INVALID_HANDLE_VALUE)
+        {
+            _file = file;
+            break;
+        }
+        if (ec = last_error(); ec.value() != ERROR_FILE_EXISTS)
+            return false;
+#else
+        if (_file = ::open(_temp_path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644); _file >= 0)
+            break;
+        if (ec = last_error(); ec.value() != EEXIST)
+            return false;
+#endif
+    }
+
+    if (!is_open())
+        return false;
+
+    buffer_size = std::max<size_t>((buffer_size + page_size - 1) & ~(page_size - 1), page_size);
+    if (_buffer == nullptr || _buffer_capacity != buffer_size)
+    {
+        _buffer.reset(static_cast<uint8_t *>(::operator new[](buffer_size, std::align_val_t(page_size))));
+        _buffer_capacity = buffer_size;
+    }
+    _buffer_used = 0;
+
+    ec.clear();
+    return true;
+}
+
+bool screenshot_output::is_open() const noexcept
+{
+#ifdef _WIN32
+    return _file != nullptr;
+#else
+    return _file >= 0;
+#endif
+}
+
+bool screenshot_output::write(const void *data, size_t size)
+{
+    if (_error)
+        return false;
+
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+    const uint64_t end = _position + size;
+
+    while (size != 0)
+    {
+        // Large writes skip the copy once the buffer is empty, but still only in whole buffers so that the system gets the same sizes
+        if (_buffer_used == 0 && size >= _buffer_capacity)
+        {
+            const size_t direct_size = size - size % _buffer_capacity;
+            if (!write_file(p, direct_size))
+                return fail();
+
+            p += direct_size;
+            size -= direct_size;
+            continue;
+        }
+
+        const size_t copy_size = std::min(size, _buffer_capacity - _buffer_used);
+        std::memcpy(_buffer.get() + _buffer_used, p, copy_size);
+        _buffer_used += copy_size;
+        p += copy_size;
+        size -= copy_size;
+
+        if (_buffer_used == _buffer_capacity && !flush())
+            return false;
+    }
+
+    _position = end;
+    _size = std::max(_size, _position);
+    return true;
+}
+
+bool screenshot_output::read(void *data, size_t size, size_t &read_size)
+{
+    read_size = 0;
+
+    if (_error || !flush())
+        return false;
+
+#ifdef _WIN32
+    for (uint8_t *p = static_cast<uint8_t *>(data); read_size < size;)
+    {
+        DWORD chunk_size = 0;
+        if (ReadFile(_file, p + read_size, static_cast<DWORD>(std::min<size_t>(size - read_size, 1u << 30)), &chunk_size, nullptr) == FALSE)
+            return fail();
+        if (chunk_size == 0)
+            break;
+        read_size += chunk_size;
+    }
+#else
+    for (uint8_t *p = static_cast<uint8_t *>(data); read_size < size;)
+    {
+        const ssize_t chunk_size = ::read(_file, p + read_size, size - read_size);
+        if (chunk_size < 0 && errno == EINTR)
+            continue;
+        if (chunk_size < 0)
+            return fail();
+        if (chunk_size == 0)
+            break;
+        read_size += static_cast<size_t>(chunk_size);
+    }
+#endif
+
+    _position += read_size;
+    return true;
+}
+
+bool screenshot_output::seek(uint64_t offset)
+{
+    if (_error || !flush())
+        return false;
+
+#ifdef _WIN32
+    LARGE_INTEGER distance{};
+    distance.QuadPart = static_cast<LONGLONG>(offset);
+    if (SetFilePointerEx(_file, distance, nullptr, FILE_BEGIN) == FALSE)
+        return fail();
+#else
+    if (lseek(_file, static_cast<off_t>(offset), SEEK_SET) < 0)
+        return fail();
+#endif
+
+    _position = offset;
+    return true;
+}
+
+bool screenshot_output::flush()
+{
+    if (_buffer_used == 0)
+        return true;
+
+    const bool written = write_file(_buffer.get(), _buffer_used);
+    _buffer_used = 0;
+    return written || fail();
+}
+
+bool screenshot_output::truncate(uint64_t size)
+{
+    // A failed flush already dropped the buffer, otherwise it holds the start of the record that is dropped now
+    _buffer_used = 0;
+    _error.clear();
+
+    if (!seek(size))
+        return false;
+
+#ifdef _WIN32
+    if (SetEndOfFile(_file) == FALSE)
+        return fail();
+#else
+    if (ftruncate(_file, static_cast<off_t>(size)) != 0)
+        return fail();
+#endif
+
+    _size = size;
+    return true;
+}
+
+void screenshot_output::reserve([[maybe_unused]] uint64_t size)
+{
+#ifdef _WIN32
+    // Only a hint, writing works the same without it
+    FILE_ALLOCATION_INFO allocation_info{};
+    allocation_info.AllocationSize.QuadPart = static_cast<LONGLONG>(size);
+    SetFileInformationByHandle(_file, FileAllocationInfo, &allocation_info, sizeof(allocation_info));
+#else
+    // Reserving space would change the size of the file here, so the file just grows with the writes
+#endif
+}
+
+bool screenshot_output::write_file(const void *data, size_t size)
+{
+    const uint8_t *p = static_cast<const uint8_t *>(data);
+
+#ifdef _WIN32
+    while (size != 0)
+    {
+        DWORD written_size = 0;
+        if (WriteFile(_file, p, static_cast<DWORD>(std::min<size_t>(size, 1u << 30)), &written_size, nullptr) == FALSE)
+            return false;
+        p += written_size;
+        size -= written_size;
+    }
+#else
+    while (size != 0)
+    {
+        const ssize_t written_size = ::write(_file, p, size);
+        if (written_size < 0 && errno == EINTR)
+            continue;
+        if (written_size < 0)
+            return false;
+        p += written_size;
+        size -= static_cast<size_t>(written_size);
+    }
+#endif
+
+    return true;
+}
+
+bool screenshot_output::fail()
+{
+    if (!_error)
+        _error = last_error();
+    return false;
+}
+
+bool screenshot_output::commit(std::chrono::system_clock::time_point modification_time, std::error_code &ec)
+{
+    if (!is_open())
+    {
+        ec = std::make_error_code(std::errc::bad_file_descriptor);
+        return false;
+    }
+
+    if (!flush())
+    {
+        ec = _error;
+        discard();
+        return false;
+    }
+
+#ifdef _WIN32
+    const uint64_t date_time = std::chrono::duration_cast<std::chrono::nanoseconds>(modification_time.time_since_epoch()).count() / 100 + 116444736000000000;
+    FILETIME ft{};
+    ft.dwLowDateTime = date_time & 0xFFFFFFFF;
+    ft.dwHighDateTime = date_time >> 32;
+    SetFileTime(_file, nullptr, nullptr, &ft);
+
+    // Renaming through the handle that wrote the file, so nothing else can open it in between
+    const std::wstring &target = _path.native();
+    std::vector<uint8_t> rename_info_data(sizeof(FILE_RENAME_INFO) + target.size() * sizeof(wchar_t));
+    FILE_RENAME_INFO &rename_info = *reinterpret_cast<FILE_RENAME_INFO *>(rename_info_data.data());
+    rename_info.ReplaceIfExists = TRUE;
+    rename_info.RootDirectory = nullptr;
+    rename_info.FileNameLength = static_cast<DWORD>(target.size() * sizeof(wchar_t));
+    std::memcpy(rename_info.FileName, target.c_str(), (target.size() + 1) * sizeof(wchar_t));
+
+    if (SetFileInformationByHandle(_file, FileRenameInfo, &rename_info, static_cast<DWORD>(rename_info_data.size())) == FALSE)
+    {
+        ec = last_error();
+        discard();
+        return false;
+    }
+
+    CloseHandle(_file);
+    _file = nullptr;
+#else
+    const auto since_epoch = modification_time.time_since_epoch();
+    const auto seconds = std::chrono::duration_cast<std::chrono::seconds>(since_epoch);
+    struct timespec times[2]{};
+    times[0].tv_nsec = UTIME_OMIT;
+    times[1].tv_sec = static_cast<time_t>(seconds.count());
+    times[1].tv_nsec = static_cast<long>(std::chrono::duration_cast<std::chrono::nanoseconds>(since_epoch - seconds).count());
+    futimens(_file, times);
+
+    if (rename(_temp_path.c_str(), _path.c_str()) != 0)
+    {
+        ec = last_error();
+        discard();
+        return false;
+    }
+
+    ::close(_file);
+    _file = -1;
+#endif
+
+    ec.clear();
+    return true;
+}
+
+void screenshot_output::discard()
+{
+    if (!is_open())
+        return;
+
+#ifdef _WIN32
+    // Deleted once the handle is closed, which also works while a virus scanner has the file open
+    FILE_DISPOSITION_INFO disposition_info{ TRUE };
+    if (SetFileInformationByHandle(_file, FileDispositionInfo, &disposition_info, sizeof(disposition_info)) != FALSE)
+    {
+        CloseHandle(_file);
+    }
+    else
+    {
+        CloseHandle(_file);
+        DeleteFileW(_temp_path.c_str());
+    }
+    _file = nullptr;
+#else
+    ::close(_file);
+    unlink(_temp_path.c_str());
+    _file = -1;
+#endif
+
+    _buffer_used = 0;
+}
+
+// libtiff calls these with the output as client data
+
+static tmsize_t tiff_read(thandle_t handle, void *data, tmsize_t size)
+{
+    size_t read_size = 0;
+    return static_cast<screenshot_output *>(handle)->read(data, static_cast<size_t>(size), read_size) ? static_cast<tmsize_t>(read_size) : -1;
+}
+static tmsize_t tiff_write(thandle_t handle, void *data, tmsize_t size)
+{
+    return static_cast<screenshot_output *>(handle)->write(data, static_cast<size_t>(size)) ? size : -1;
+}
+static toff_t tiff_seek(thandle_t handle, toff_t offset, int whence)
+{
+    screenshot_output &output = *static_cast<screenshot_output *>(handle);
+
+    uint64_t position = offset;
+    if (whence == SEEK_CUR)
+        position += output.tell();
+    else if (whence == SEEK_END)
+        position += output.size();
+
+    return output.seek(position) ? position : static_cast<toff_t>(-1);
+}
+static int tiff_close(thandle_t)
+{
+    return 0;
+}
+static toff_t tiff_size(thandle_t handle)
+{
+    return static_cast<screenshot_output *>(handle)->size();
+}
+static int tiff_map(thandle_t, void **, toff_t *)
+{
+    return 0;
+}
+static void tiff_unmap(thandle_t, void *, toff_t)
+{
+}
+
+tiff *screenshot_output::open_tiff(const char *mode)
+{
+    return TIFFClientOpen(_path.u8string().c_str(), mode, this, tiff_read, tiff_write, tiff_seek, tiff_close, tiff_size, tiff_map, tiff_unmap);
+}
@@ -0,0 +1,110 @@
+﻿/*
+ * SPDX-FileCopyrightText: 2018 seri14
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <new>
+#include <system_error>
+
+struct tiff;
+
+/// <summary>
+/// File an encoder writes one image, animation or archive to through a single handle. The file is created under a temporary name next to the final one, and only once everything was written is its time set and it is renamed over the final name through the same handle.
+/// Readers never see a partially written image, and an image that failed is deleted without touching an older file of the same name.
+/// Writes are collected in a page aligned buffer and handed to the system in large blocks.
+/// </summary>
+class screenshot_output
+{
+public:
+    screenshot_output() = default;
+    ~screenshot_output();
+
+    screenshot_output(const screenshot_output &) = delete;
+    screenshot_output &operator=(const screenshot_output &) = delete;
+
+    /// <summary>
+    /// Creates the temporary file for <paramref name="path"/>.
+    /// </summary>
+    /// <param name="buffer_size">Size of the write buffer, which is rounded up to whole pages.</param>
+    bool open(const std::filesystem::path &path, size_t buffer_size, std::error_code &ec);
+    bool is_open() const noexcept;
+
+    bool write(const void *data, size_t size);
+    bool read(void *data, size_t size, size_t &read_size);
+    /// <summary>
+    /// Moves the position of the next write or read, e.g. for libtiff to fill in offsets once it knows them.
+    /// </summary>
+    bool seek(uint64_t offset);
+    uint64_t tell() const noexcept { return _position; }
+    uint64_t size() const noexcept { return _size; }
+
+    /// <summary>
+    /// Hands what is in the buffer to the system, so that a later failed write cannot take it along.
+    /// </summary>
+    bool flush();
+    /// <summary>
+    /// Cuts the file at <paramref name="size"/> and continues writing there, which also clears the error of a failed write, e.g. to drop a record that was only written in part.
+    /// Everything in front of <paramref name="size"/> has to be flushed before the write that failed.
+    /// </summary>
+    bool truncate(uint64_t size);
+    /// <summary>
+    /// Hints the file system to reserve space for a file of <paramref name="size"/> bytes, so that it stays contiguous while growing. Space that is not used is released again when the file is closed.
+    /// </summary>
+    void reserve(uint64_t size);
+
+    /// <summary>
+    /// Opens a libtiff handle that writes through this output. TIFFClose only finishes the TIFF, the output is still committed or discarded afterwards.
+    /// </summary>
+    tiff *open_tiff(const char *mode);
+
+    /// <summary>
+    /// Writes what is left in the buffer, sets the modification time and renames the file to its final name, replacing an existing file.
+    /// The temporary file is deleted if any of that or an earlier write failed.
+    /// </summary>
+    bool commit(std::chrono::system_clock::time_point modification_time, std::error_code &ec);
+    /// <summary>
+    /// Closes and deletes the temporary file.
+    /// </summary>
+    void discard();
+
+    /// <summary>
+    /// Error of the first write, read or seek that failed, after which all others fail as well.
+    /// </summary>
+    const std::error_code &error() const noexcept { return _error; }
+
+private:
+    static constexpr size_t page_size = 4096;
+
+    struct aligned_delete
+    {
+        void operator()(uint8_t *p) const { ::operator delete[](p, std::align_val_t(page_size)); }
+    };
+
+    bool write_file(const void *data, size_t size);
+    bool fail();
+
+    std::filesystem::path _path;
+    std::filesystem::path _temp_path;
+#ifdef _WIN32
+    void *_file = nullptr;
+#else
+    int _file = -1;
+#endif
+
+    std::unique_ptr<uint8_t[], aligned_delete> _buffer;
+    size_t _buffer_capacity = 0;
+    size_t _buffer_used = 0;
+
+    // Position of the next write including what is still in the buffer, and the end of the file
+    uint64_t _position = 0;
+    uint64_t _size = 0;
+
+    std::error_code _error;
+};
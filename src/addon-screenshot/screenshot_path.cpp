@@ -0,0 +1,177 @@
+﻿/*
+ * SPDX-FileCopyrightText: 2018 seri14
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "screenshot_path.hpp"
+#include "screenshot_platform.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <ctime>
+#include <iterator>
+#include <utility>
+
+static bool equals_ignore_case(std::string_view a, std::string_view b)
+{
+    if (a.size() != b.size())
+        return false;
+
+    for (size_t i = 0; i < a.size(); i++)
+    {
+        const char x = 'a' <= a[i] && a[i] <= 'z' ? a[i] - ('a' - 'A') : a[i];
+        const char y = 'a' <= b[i] && b[i] <= 'z' ? b[i] - ('a' - 'A') : b[i];
+        if (x != y)
+            return false;
+    }
+
+    return true;
+}
+
+screenshot_path_template::screenshot_path_template(std::string_view source) :
+    _source(source)
+{
+    static constexpr std::pair<std::string_view, field> macros[] = {
+        { "APP", field::app },
+        { "PRESET", field::preset },
+        { "TOTALFRAME", field::total_frame },
+        { "MYSETFRAME", field::myset_frame },
+        { "TOTALTAKE", field::total_take },
+        { "MYSETTAKE", field::myset_take },
+        { "INDEX", field::index },
+        { "DATE", field::date },
+    };
+
+    const auto add_literal = [this](std::string_view text) {
+        if (text.empty())
+            return;
+
+        // Join with the previous literal when a macro in between expanded to nothing
+        if (!_tokens.empty() && _tokens.back().type == field::literal)
+        {
+            _tokens.back().length += static_cast<uint32_t>(text.size());
+        }
+        else
+        {
+            _tokens.push_back({ field::literal, false, 0, static_cast<uint32_t>(_text.size()), static_cast<uint32_t>(text.size()) });
+            _fields |= 1u << static_cast<unsigned int>(field::literal);
+        }
+
+        _text += text;
+    };
+
+    // Same syntax as before paths were compiled: a macro runs from '<' to the next '>', and unknown macros are removed
+    for (size_t offset = 0; offset < source.size();)
+    {
+        const size_t macro_beg = source.find('<', offset);
+        const size_t macro_end = macro_beg == std::string_view::npos ? std::string_view::npos : source.find('>', macro_beg + 1);
+
+        if (macro_end == std::string_view::npos)
+        {
+            add_literal(source.substr(offset));
+            break;
+        }
+
+        add_literal(source.substr(offset, macro_beg - offset));
+        offset = macro_end + 1;
+
+        const std::string_view replacing = source.substr(macro_beg + 1, macro_end - (macro_beg + 1));
+        const size_t colon_pos = replacing.find(':');
+        const std::string_view name = replacing.substr(0, colon_pos);
+        std::string_view fmt = colon_pos == std::string_view::npos ? std::string_view() : replacing.substr(colon_pos + 1);
+
+        const auto macro = std::find_if(std::begin(macros), std::end(macros), [name](const auto &macro) { return equals_ignore_case(name, macro.first); });
+        if (macro == std::end(macros))
+            continue;
+
+        token token = { macro->second, false, 0, 0, 0 };
+
+        switch (token.type)
+        {
+            case field::date:
+                if (fmt.empty())
+                    fmt = "%Y-%m-%d %H-%M-%S";
+                token.offset = static_cast<uint32_t>(_text.size());
+                token.length = static_cast<uint32_t>(fmt.size());
+                _text += fmt;
+                _text += '\0';
+                break;
+            case field::app:
+            case field::preset:
+                break;
+            default:
+                // "D" pads with zeros instead of spaces, followed by the minimum number of digits
+                if (fmt.empty())
+                    fmt = "D1";
+                token.zero_padded = fmt[0] == 'D' || fmt[0] == 'd';
+                token.width = 1;
+                if (fmt.size() == 1 && '1' <= fmt[0] && fmt[0] <= '9')
+                    token.width = static_cast<uint8_t>(fmt[0] - '0');
+                if (fmt.size() == 2 && '1' <= fmt[1] && fmt[1] <= '9')
+                    token.width = static_cast<uint8_t>(fmt[1] - '0');
+                break;
+        }
+
+        _tokens.push_back(token);
+        _fields |= 1u << static_cast<unsigned int>(token.type);
+    }
+}
+
+void screenshot_path_template::expand(const values &values, std::string &result) const
+{
+    result.clear();
+
+    // Only convert the time once, no matter how many date macros there are
+    struct tm tm = {};
+    if (uses(field::date))
+    {
+        const std::time_t t = std::chrono::system_clock::to_time_t(values.time);
+        screenshot_platform::to_local_time(t, tm);
+    }
+
+    for (const token &token : _tokens)
+    {
+        uint64_t number = 0;
+
+        switch (token.type)
+        {
+            case field::literal:
+                result.append(_text, token.offset, token.length);
+                continue;
+            case field::app:
+                result += values.app;
+                continue;
+            case field::preset:
+                result += values.preset;
+                continue;
+            case field::date:
+            {
+                char str[128];
+                result.append(str, strftime(str, sizeof(str), _text.c_str() + token.offset, &tm));
+                continue;
+            }
+            case field::total_frame:
+                number = values.total_frame;
+                break;
+            case field::myset_frame:
+                number = values.myset_frame;
+                break;
+            case field::total_take:
+                number = values.total_take;
+                break;
+            case field::myset_take:
+                number = values.myset_take;
+                break;
+            case field::index:
+                number = values.index;
+                break;
+        }
+
+        char digits[20];
+        const size_t length = static_cast<size_t>(std::to_chars(digits, digits + sizeof(digits), number).ptr - digits);
+        if (length < token.width)
+            result.append(token.width - length, token.zero_padded ? '0' : ' ');
+        result.append(digits, length);
+    }
+}
@@ -0,0 +1,75 @@
+﻿/*
+ * SPDX-FileCopyrightText: 2018 seri14
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/// <summary>
+/// Screenshot path with &lt;MACRO[:format]&gt; placeholders, parsed once into a list of tokens so that expanding it for every image only has to format the values.
+/// </summary>
+class screenshot_path_template
+{
+public:
+    enum class field : uint8_t
+    {
+        literal,
+        app,
+        preset,
+        total_frame,
+        myset_frame,
+        total_take,
+        myset_take,
+        index,
+        date,
+    };
+
+    struct values
+    {
+        std::string app;
+        std::string preset;
+        uint64_t total_frame = 0;
+        uint64_t myset_frame = 0;
+        uint64_t total_take = 0;
+        uint64_t myset_take = 0;
+        unsigned int index = 0;
+        std::chrono::system_clock::time_point time;
+    };
+
+    screenshot_path_template() = default;
+    explicit screenshot_path_template(std::string_view source);
+
+    const std::string &source() const noexcept { return _source; }
+
+    /// <summary>
+    /// Checks whether the path contains a placeholder for <paramref name="field"/>, so that values which are expensive to look up can be skipped otherwise.
+    /// </summary>
+    bool uses(field field) const noexcept { return (_fields & (1u << static_cast<unsigned int>(field))) != 0; }
+
+    /// <summary>
+    /// Replaces the contents of <paramref name="result"/> with the path, keeping its capacity for the next call.
+    /// </summary>
+    void expand(const values &values, std::string &result) const;
+
+private:
+    struct token
+    {
+        field type;
+        bool zero_padded;
+        uint8_t width;
+        // Range in _text with the literal or the null-terminated date format
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    std::string _source;
+    std::string _text;
+    std::vector<token> _tokens;
+    uint32_t _fields = 0;
+};
@@ -0,0 +1,63 @@
+﻿/*
+ * SPDX-FileCopyrightText: 2018 seri14
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "screenshot_platform.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <iterator>
+#include <type_traits>
+
+FILE *screenshot_platform::open_file(const std::filesystem::path &path, const char *mode)
+{
+#ifdef _WIN32
+    wchar_t wide_mode[8]{};
+    for (size_t i = 0; i + 1 < std::size(wide_mode) && mode[i] != '\0'; i++)
+        wide_mode[i] = static_cast<wchar_t>(mode[i]);
+
+    FILE *file = nullptr;
+    if (const errno_t error = _wfopen_s(&file, path.c_str(), wide_mode); error != 0)
+    {
+        errno = error;
+        return nullptr;
+    }
+    return file;
+#else
+    return fopen(path.c_str(), mode);
+#endif
+}
+
+bool screenshot_platform::to_local_time(std::time_t time, std::tm &result)
+{
+#ifdef _WIN32
+    return localtime_s(&result, &time) == 0;
+#else
+    return localtime_r(&time, &result) != nullptr;
+#endif
+}
+bool screenshot_platform::to_utc_time(std::time_t time, std::tm &result)
+{
+#ifdef _WIN32
+    return gmtime_s(&result, &time) == 0;
+#else
+    return gmtime_r(&time, &result) != nullptr;
+#endif
+}
+
+std::string screenshot_platform::error_string(int error)
+{
+    char buffer[256] = "";
+#ifdef _WIN32
+    strerror_s(buffer, error);
+    return buffer;
+#else
+    // The GNU variant returns the message instead of always filling in the buffer
+    const auto message = strerror_r(error, buffer, sizeof(buffer));
+    if constexpr (std::is_same_v<decltype(message), char *const>)
+        return message;
+    else
+        return buffer;
+#endif
+}
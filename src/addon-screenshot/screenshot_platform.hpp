@@ -0,0 +1,31 @@
+﻿/*
+ * SPDX-FileCopyrightText: 2018 seri14
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#pragma once
+
+#include <cstdio>
+#include <ctime>
+#include <filesystem>
+#include <string>
+
+/// <summary>
+/// The few C runtime functions the portable part of the add-on needs that only exist under different names on Windows and other systems.
+/// </summary>
+namespace screenshot_platform
+{
+    /// <summary>
+    /// Opens a file with a path that may contain any Unicode characters, using a mode like fopen.
+    /// Sets errno when the file could not be opened.
+    /// </summary>
+    FILE *open_file(const std::filesystem::path &path, const char *mode);
+
+    bool to_local_time(std::time_t time, std::tm &result);
+    bool to_utc_time(std::time_t time, std::tm &result);
+
+    /// <summary>
+    /// Describes an errno value.
+    /// </summary>
+    std::string error_string(int error);
+}
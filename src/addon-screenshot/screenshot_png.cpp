@@ -0,0 +1,399 @@
+﻿/*
+ * SPDX-FileCopyrightText: 2018 seri14
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "screenshot_png.hpp"
+
+#include <png.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <initializer_list>
+#include <utility>
+#include <vector>
+
+static void store_be16(uint8_t *p, uint16_t value)
+{
+    p[0] = static_cast<uint8_t>(value >> 8);
+    p[1] = static_cast<uint8_t>(value);
+}
+static void store_be32(uint8_t *p, uint32_t value)
+{
+    p[0] = static_cast<uint8_t>(value >> 24);
+    p[1] = static_cast<uint8_t>(value >> 16);
+    p[2] = static_cast<uint8_t>(value >> 8);
+    p[3] = static_cast<uint8_t>(value);
+}
+
+static bool write_chunk(const screenshot_png_writer::output_fn &output, const char type[4], std::initializer_list<std::pair<const void *, size_t>> parts)
+{
+    size_t length = 0;
+    for (const auto &part : parts)
+        length += part.second;
+
+    uint8_t header[8];
+    store_be32(header, static_cast<uint32_t>(length));
+    std::memcpy(header + 4, type, 4);
+
+    uLong crc = crc32(0L, header + 4, 4);
+    bool succeeded = output(header, sizeof(header));
+
+    for (const auto &part : parts)
+    {
+        if (part.second == 0)
+            continue;
+
+        crc = crc32(crc, static_cast<const Bytef *>(part.first), static_cast<uInt>(part.second));
+        succeeded = succeeded && output(part.first, part.second);
+    }
+
+    uint8_t trailer[4];
+    store_be32(trailer, static_cast<uint32_t>(crc));
+    return succeeded && output(trailer, sizeof(trailer));
+}
+
+static void apply_filter(unsigned int type, const uint8_t *row, const uint8_t *prior, size_t row_size, unsigned int bpp, uint8_t *out)
+{
+    out[0] = static_cast<uint8_t>(type);
+    uint8_t *const dst = out + 1;
+
+    switch (type)
+    {
+        default:
+        case PNG_FILTER_VALUE_NONE:
+            std::memcpy(dst, row, row_size);
+            break;
+        case PNG_FILTER_VALUE_SUB:
+            for (size_t i = 0; i < bpp; i++)
+                dst[i] = row[i];
+            for (size_t i = bpp; i < row_size; i++)
+                dst[i] = static_cast<uint8_t>(row[i] - row[i - bpp]);
+            break;
+        case PNG_FILTER_VALUE_UP:
+            for (size_t i = 0; i < row_size; i++)
+                dst[i] = static_cast<uint8_t>(row[i] - prior[i]);
+            break;
+        case PNG_FILTER_VALUE_AVG:
+            for (size_t i = 0; i < bpp; i++)
+                dst[i] = static_cast<uint8_t>(row[i] - (prior[i] >> 1));
+            for (size_t i = bpp; i < row_size; i++)
+                dst[i] = static_cast<uint8_t>(row[i] - ((row[i - bpp] + prior[i]) >> 1));
+            break;
+        case PNG_FILTER_VALUE_PAETH:
+            for (size_t i = 0; i < bpp; i++)
+                dst[i] = static_cast<uint8_t>(row[i] - prior[i]);
+            for (size_t i = bpp; i < row_size; i++)
+            {
+                const int a = row[i - bpp], b = prior[i], c = prior[i - bpp];
+                const int p = b - c, q = a - c;
+                const int pa = std::abs(p), pb = std::abs(q), pc = std::abs(p + q);
+                dst[i] = static_cast<uint8_t>(row[i] - (pa <= pb && pa <= pc ? a : pb <= pc ? b : c));
+            }
+            break;
+    }
+}
+
+static uint64_t filter_cost(const uint8_t *out, size_t row_size)
+{
+    // Minimum sum of absolute differences, which is the heuristic libpng uses as well
+    uint64_t cost = 0;
+    for (size_t i = 1; i <= row_size; i++)
+        cost += std::abs(static_cast<int8_t>(out[i]));
+    return cost;
+}
+
+void screenshot_png_writer::filter_row(const uint8_t *row, const uint8_t *prior, size_t row_size, unsigned int bpp, uint8_t *out, uint8_t *scratch) const
+{
+    const int choices = filters != 0 ? filters : PNG_ALL_FILTERS;
+
+    unsigned int candidates[5];
+    size_t count = 0;
+    if (choices & PNG_FILTER_NONE)
+        candidates[count++] = PNG_FILTER_VALUE_NONE;
+    if (choices & PNG_FILTER_SUB)
+        candidates[count++] = PNG_FILTER_VALUE_SUB;
+    if (choices & PNG_FILTER_UP)
+        candidates[count++] = PNG_FILTER_VALUE_UP;
+    if (choices & PNG_FILTER_AVG)
+        candidates[count++] = PNG_FILTER_VALUE_AVG;
+    if (choices & PNG_FILTER_PAETH)
+        candidates[count++] = PNG_FILTER_VALUE_PAETH;
+    if (count == 0)
+        candidates[count++] = PNG_FILTER_VALUE_NONE;
+
+    apply_filter(candidates[0], row, prior, row_size, bpp, out);
+    if (count == 1)
+        return;
+
+    uint64_t best_cost = filter_cost(out, row_size);
+    for (size_t i = 1; i < count; i++)
+    {
+        apply_filter(candidates[i], row, prior, row_size, bpp, scratch);
+
+        if (const uint64_t cost = filter_cost(scratch, row_size); cost < best_cost)
+        {
+            best_cost = cost;
+            std::memcpy(out, scratch, row_size + 1);
+        }
+    }
+}
+
+bool screenshot_png_writer::write(FILE *file, const uint8_t *pixels, uint32_t width, uint32_t height, unsigned int channels, time_t mod_time, const parallel_for_fn &parallel_for) const
+{
+    if (file == nullptr)
+        return false;
+
+    return write([file](const void *data, size_t size) { return fwrite(data, 1, size, file) == size; }, pixels, width, height, channels, mod_time, parallel_for);
+}
+
+bool screenshot_png_writer::write(std::vector<uint8_t> &output, const uint8_t *pixels, uint32_t width, uint32_t height, unsigned int channels, time_t mod_time, const parallel_for_fn &parallel_for) const
+{
+    return write([&output](const void *data, size_t size) { output.insert(output.end(), static_cast<const uint8_t *>(data), static_cast<const uint8_t *>(data) + size); return true; }, pixels, width, height, channels, mod_time, parallel_for);
+}
+
+bool screenshot_png_writer::write(const output_fn &output, const uint8_t *pixels, uint32_t width, uint32_t height, unsigned int channels, time_t mod_time, const parallel_for_fn &parallel_for) const
+{
+    if (!output)
+        return false;
+
+    std::vector<std::vector<uint8_t>> parts;
+    if (!encode(pixels, width, height, static_cast<size_t>(width) * channels * bit_depth / 8, channels, parts, parallel_for))
+        return false;
+
+    bool succeeded = write_header(output, width, height, channels, mod_time);
+
+    // One IDAT per band
+    for (size_t i = 0; i < parts.size() && succeeded; i++)
+        succeeded = write_chunk(output, "IDAT", { { parts[i].data(), parts[i].size() } });
+
+    return succeeded && write_end(output);
+}
+
+bool screenshot_png_writer::encode(const uint8_t *pixels, uint32_t width, uint32_t height, size_t pitch, unsigned int channels, std::vector<std::vector<uint8_t>> &parts, const parallel_for_fn &parallel_for) const
+{
+    if (width == 0 || height == 0 || (channels != 3 && channels != 4) || (bit_depth != 8 && bit_depth != 16))
+        return false;
+
+    constexpr size_t window_size = 32768;
+
+    // Filters work on bytes, with the distance to the previous pixel as offset
+    const unsigned int bpp = channels * bit_depth / 8;
+    const size_t row_size = static_cast<size_t>(width) * bpp;
+    const size_t filtered_row_size = row_size + 1;
+    const uint32_t rows_per_band = static_cast<uint32_t>(std::clamp<size_t>(band_size / filtered_row_size, 1, height));
+    const size_t band_count = (static_cast<size_t>(height) + rows_per_band - 1) / rows_per_band;
+
+    // Number of rows in front of a band that need to be filtered again to fill its deflate window
+    const uint32_t dictionary_rows = static_cast<uint32_t>((window_size + filtered_row_size - 1) / filtered_row_size);
+
+    const std::vector<uint8_t> zero_row(row_size);
+
+    if (deflate_backend == screenshot_deflate_backend::libdeflate && screenshot_deflate::is_available(deflate_backend))
+    {
+        std::vector<uint8_t> filtered(filtered_row_size * height);
+
+        const auto filter_band = [&](size_t index) {
+            const uint32_t first_row = static_cast<uint32_t>(index * rows_per_band);
+            const uint32_t last_row = std::min(first_row + rows_per_band, height);
+
+            std::vector<uint8_t> scratch(filtered_row_size);
+            for (uint32_t y = first_row; y < last_row; y++)
+                filter_row(pixels + pitch * y, y == 0 ? zero_row.data() : pixels + pitch * (y - 1), row_size, bpp, filtered.data() + filtered_row_size * y, scratch.data());
+        };
+
+        if (parallel_for)
+            parallel_for(band_count, filter_band);
+        else
+            for (size_t i = 0; i < band_count; i++)
+                filter_band(i);
+
+        // A single part with the complete zlib stream, header and checksum included
+        parts.assign(1, {});
+        return screenshot_deflate::compress_libdeflate(filtered.data(), filtered.size(), compression_level, parts.front());
+    }
+
+    struct band
+    {
+        std::vector<uint8_t> data;
+        uLong adler = 0;
+        uLong length = 0;
+        bool succeeded = false;
+    };
+    std::vector<band> bands(band_count);
+
+    const auto encode_band = [&](size_t index) {
+        band &band = bands[index];
+
+        const uint32_t first_row = static_cast<uint32_t>(index * rows_per_band);
+        const uint32_t last_row = std::min(first_row + rows_per_band, height);
+        const uint32_t prime_row = first_row - std::min(first_row, dictionary_rows);
+
+        // Workers encode many bands in a row, so keep the buffers and the compressor state around between them
+        static thread_local std::vector<uint8_t> filtered, scratch;
+        static thread_local screenshot_deflate_stream stream;
+
+        // Filter choice only depends on the pixels, so the rows before the band come out exactly as the previous band writes them
+        filtered.resize(filtered_row_size * (last_row - prime_row));
+        scratch.resize(filtered_row_size);
+        for (uint32_t y = prime_row; y < last_row; y++)
+            filter_row(pixels + pitch * y, y == 0 ? zero_row.data() : pixels + pitch * (y - 1), row_size, bpp, filtered.data() + filtered_row_size * (y - prime_row), scratch.data());
+
+        const uint8_t *const input = filtered.data() + filtered_row_size * (first_row - prime_row);
+        const size_t input_size = filtered_row_size * (last_row - first_row);
+        const size_t dictionary_size = std::min(window_size, static_cast<size_t>(input - filtered.data()));
+
+        band.adler = adler32(adler32(0L, Z_NULL, 0), input, static_cast<uInt>(input_size));
+        band.length = static_cast<uLong>(input_size);
+
+        z_stream *const strm = stream.reset(compression_level, compression_strategy, -MAX_WBITS);
+        if (strm == nullptr)
+            return;
+
+        if (dictionary_size != 0)
+            deflateSetDictionary(strm, input - dictionary_size, static_cast<uInt>(dictionary_size));
+
+        band.data.resize(deflateBound(strm, static_cast<uLong>(input_size)) + 16);
+
+        strm->next_in = const_cast<Bytef *>(input);
+        strm->avail_in = static_cast<uInt>(input_size);
+        strm->next_out = band.data.data();
+        strm->avail_out = static_cast<uInt>(band.data.size());
+
+        // All but the last band end on a byte boundary without setting the final block bit, so that the outputs can simply be concatenated
+        const int flush = index + 1 == band_count ? Z_FINISH : Z_SYNC_FLUSH;
+
+        int status;
+        do
+        {
+            if (strm->avail_out == 0)
+            {
+                const size_t used = band.data.size();
+                band.data.resize(used * 2);
+                strm->next_out = band.data.data() + used;
+                strm->avail_out = static_cast<uInt>(band.data.size() - used);
+            }
+
+            status = deflate(strm, flush);
+        } while (status == Z_OK && (flush == Z_FINISH || strm->avail_out == 0));
+
+        band.succeeded = flush == Z_FINISH ? status == Z_STREAM_END : status == Z_OK;
+        band.data.resize(strm->total_out);
+    };
+
+    if (parallel_for)
+        parallel_for(band_count, encode_band);
+    else
+        for (size_t i = 0; i < band_count; i++)
+            encode_band(i);
+
+    uLong adler = adler32(0L, Z_NULL, 0);
+    for (const band &band : bands)
+    {
+        if (!band.succeeded)
+            return false;
+
+        adler = adler32_combine(adler, band.adler, static_cast<z_off_t>(band.length));
+    }
+
+    // Same compression level hint that deflate itself would put into the header
+    unsigned int level_flags = 2;
+    if (compression_strategy >= Z_HUFFMAN_ONLY || (compression_level >= 0 && compression_level < 2))
+        level_flags = 0;
+    else if (compression_level >= 0 && compression_level < 6)
+        level_flags = 1;
+    else if (compression_level > 6)
+        level_flags = 3;
+
+    uint8_t zlib_header[2] = { 0x78, static_cast<uint8_t>(level_flags << 6) };
+    zlib_header[1] |= 31 - ((zlib_header[0] << 8) + zlib_header[1]) % 31;
+
+    uint8_t zlib_trailer[4];
+    store_be32(zlib_trailer, static_cast<uint32_t>(adler));
+
+    // Zlib header in front of the first band and the checksum behind the last, so that the parts can go into separate chunks as they are
+    parts.resize(band_count);
+    for (size_t i = 0; i < band_count; i++)
+        parts[i] = std::move(bands[i].data);
+
+    parts.front().insert(parts.front().begin(), zlib_header, zlib_header + sizeof(zlib_header));
+    parts.back().insert(parts.back().end(), zlib_trailer, zlib_trailer + sizeof(zlib_trailer));
+
+    return true;
+}
+
+bool screenshot_png_writer::write_header(const output_fn &output, uint32_t width, uint32_t height, unsigned int channels, time_t mod_time, uint32_t frames) const
+{
+    static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    bool succeeded = output(signature, sizeof(signature));
+
+    uint8_t ihdr[13];
+    store_be32(ihdr + 0, width);
+    store_be32(ihdr + 4, height);
+    ihdr[8] = static_cast<uint8_t>(bit_depth);
+    ihdr[9] = channels == 3 ? PNG_COLOR_TYPE_RGB : PNG_COLOR_TYPE_RGBA;
+    ihdr[10] = PNG_COMPRESSION_TYPE_BASE;
+    ihdr[11] = PNG_FILTER_TYPE_BASE;
+    ihdr[12] = PNG_INTERLACE_NONE;
+    succeeded = succeeded && write_chunk(output, "IHDR", { { ihdr, sizeof(ihdr) } });
+
+    if (frames != 0)
+        succeeded = succeeded && write_animation_control(output, frames);
+
+    png_time time{};
+    png_convert_from_time_t(&time, mod_time);
+    const uint8_t time_data[7] = { static_cast<uint8_t>(time.year >> 8), static_cast<uint8_t>(time.year), time.month, time.day, time.hour, time.minute, time.second };
+    succeeded = succeeded && write_chunk(output, "tIME", { { time_data, sizeof(time_data) } });
+
+    return succeeded;
+}
+
+bool screenshot_png_writer::write_animation_control(const output_fn &output, uint32_t frames)
+{
+    // Number of frames, and zero to loop forever
+    uint8_t actl[8];
+    store_be32(actl + 0, frames);
+    store_be32(actl + 4, 0);
+    return write_chunk(output, "acTL", { { actl, sizeof(actl) } });
+}
+
+bool screenshot_png_writer::write_frame(const output_fn &output, uint32_t &sequence, uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint16_t delay, const std::vector<std::vector<uint8_t>> &parts)
+{
+    // The first frame is the default image as well, so that viewers without support for animations still show it
+    const bool first = sequence == 0;
+
+    uint8_t fctl[26];
+    store_be32(fctl + 0, sequence++);
+    store_be32(fctl + 4, width);
+    store_be32(fctl + 8, height);
+    store_be32(fctl + 12, x);
+    store_be32(fctl + 16, y);
+    store_be16(fctl + 20, delay);
+    store_be16(fctl + 22, 1000);
+    fctl[24] = 0; // APNG_DISPOSE_OP_NONE, the next frame only replaces what changed
+    fctl[25] = 0; // APNG_BLEND_OP_SOURCE
+    bool succeeded = write_chunk(output, "fcTL", { { fctl, sizeof(fctl) } });
+
+    for (size_t i = 0; i < parts.size() && succeeded; i++)
+    {
+        if (first)
+        {
+            succeeded = write_chunk(output, "IDAT", { { parts[i].data(), parts[i].size() } });
+        }
+        else
+        {
+            uint8_t sequence_number[4];
+            store_be32(sequence_number, sequence++);
+            succeeded = write_chunk(output, "fdAT", { { sequence_number, sizeof(sequence_number) }, { parts[i].data(), parts[i].size() } });
+        }
+    }
+
+    return succeeded;
+}
+
+bool screenshot_png_writer::write_end(const output_fn &output)
+{
+    return write_chunk(output, "IEND", {});
+}
@@ -0,0 +1,84 @@
+﻿/*
+ * SPDX-FileCopyrightText: 2018 seri14
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#pragma once
+
+#include "screenshot_deflate.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <functional>
+#include <vector>
+
+/// <summary>
+/// PNG encoder that splits the image into bands of rows, which are filtered and deflated concurrently and then joined into a single zlib stream.
+/// Each band is primed with the last 32 KiB of the data before it, so the compression ratio stays close to that of a single stream.
+/// </summary>
+class screenshot_png_writer
+{
+public:
+    using parallel_for_fn = std::function<void(size_t count, const std::function<void(size_t)> &fn)>;
+    using output_fn = std::function<bool(const void *data, size_t size)>;
+
+    /// <summary>
+    /// Combination of PNG_FILTER_* flags to choose from for each row, using the same heuristic as libpng when more than one is set.
+    /// Like with libpng, zero chooses from all of them.
+    /// </summary>
+    int filters = 0;
+    int compression_level = -1;
+    int compression_strategy = 0;
+    /// <summary>
+    /// Target amount of filtered data per band. Smaller bands spread better across threads, larger ones compress slightly better.
+    /// </summary>
+    size_t band_size = 1024 * 1024;
+    /// <summary>
+    /// Bits per channel, either 8 or 16. 16-bit samples have to be in big-endian order already.
+    /// </summary>
+    unsigned int bit_depth = 8;
+    /// <summary>
+    /// With libdeflate only the filtering is split into bands, and the whole image is then compressed at once, since libdeflate cannot continue a stream.
+    /// </summary>
+    screenshot_deflate_backend deflate_backend = screenshot_deflate_backend::zlib;
+
+    /// <summary>
+    /// Writes RGB or RGBA pixels with a tightly packed row pitch as PNG file.
+    /// </summary>
+    /// <param name="parallel_for">Runs the band encoding, or serially on the calling thread when empty.</param>
+    bool write(FILE *file, const uint8_t *pixels, uint32_t width, uint32_t height, unsigned int channels, time_t mod_time, const parallel_for_fn &parallel_for) const;
+    /// <summary>
+    /// Appends the PNG file to <paramref name="output"/> instead, e.g. to store it in an archive.
+    /// </summary>
+    bool write(std::vector<uint8_t> &output, const uint8_t *pixels, uint32_t width, uint32_t height, unsigned int channels, time_t mod_time, const parallel_for_fn &parallel_for) const;
+    bool write(const output_fn &output, const uint8_t *pixels, uint32_t width, uint32_t height, unsigned int channels, time_t mod_time, const parallel_for_fn &parallel_for) const;
+
+    /// <summary>
+    /// Filters and deflates RGB or RGBA pixels with rows <paramref name="pitch"/> bytes apart into a zlib stream, split into the bands that were encoded concurrently.
+    /// </summary>
+    bool encode(const uint8_t *pixels, uint32_t width, uint32_t height, size_t pitch, unsigned int channels, std::vector<std::vector<uint8_t>> &parts, const parallel_for_fn &parallel_for) const;
+
+    /// <summary>
+    /// Writes everything in front of the image data. With a non-zero number of <paramref name="frames"/> the file becomes an animated PNG, whose frames are then written with <see cref="write_frame"/>.
+    /// </summary>
+    bool write_header(const output_fn &output, uint32_t width, uint32_t height, unsigned int channels, time_t mod_time, uint32_t frames = 0) const;
+    /// <summary>
+    /// Writes the animation control chunk, which has to be written again over the one from <see cref="write_header"/> when the number of frames was not known in advance.
+    /// </summary>
+    static bool write_animation_control(const output_fn &output, uint32_t frames);
+    /// <summary>
+    /// Offset of the animation control chunk from the start of the file.
+    /// </summary>
+    static constexpr size_t animation_control_offset = 8 + 12 + 13;
+    /// <summary>
+    /// Writes a frame of an animated PNG covering the given rectangle of the image. The first frame has to cover the whole image.
+    /// </summary>
+    /// <param name="sequence">Sequence number of the next chunk, which starts at zero and is advanced past the chunks of this frame.</param>
+    /// <param name="delay">Time to show the frame for, in milliseconds.</param>
+    static bool write_frame(const output_fn &output, uint32_t &sequence, uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint16_t delay, const std::vector<std::vector<uint8_t>> &parts);
+    static bool write_end(const output_fn &output);
+
+private:
+    void filter_row(const uint8_t *row, const uint8_t *prior, size_t row_size, unsigned int bpp, uint8_t *out, uint8_t *scratch) const;
+};
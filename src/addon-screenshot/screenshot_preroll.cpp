@@ -0,0 +1,172 @@
+﻿/*
+ * SPDX-FileCopyrightText: 2018 seri14
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "screenshot.hpp"
+#include "screenshot_preroll.hpp"
+
+#include <algorithm>
+
+screenshot_preroll_ring::screenshot_preroll_ring()
+{
+}
+screenshot_preroll_ring::~screenshot_preroll_ring()
+{
+    if (_thread.joinable())
+    {
+        {
+            std::lock_guard lock(_mutex);
+            _stopping = true;
+        }
+        _frames_available.notify_one();
+
+        _thread.join();
+    }
+}
+
+void screenshot_preroll_ring::configure(size_t max_frames, std::chrono::system_clock::duration max_duration, uint64_t max_bytes)
+{
+    std::list<screenshot> dropped;
+    {
+        std::lock_guard lock(_mutex);
+
+        _max_frames = max_frames;
+        _max_duration = max_duration;
+        _max_bytes = max_bytes;
+
+        trim(dropped);
+    }
+}
+
+void screenshot_preroll_ring::push(std::list<screenshot> &screenshots)
+{
+    if (screenshots.empty())
+        return;
+
+    bool downscale = false;
+    for (const screenshot &screenshot : screenshots)
+        downscale |= screenshot.pending_downscale;
+
+    std::list<screenshot> dropped;
+    {
+        std::lock_guard lock(_mutex);
+
+        for (const screenshot &screenshot : screenshots)
+            _bytes += screenshot.memory_usage();
+
+        screenshots.reverse();
+        _frames.splice(_frames.end(), screenshots);
+
+        trim(dropped);
+
+        if (downscale && !_thread.joinable())
+            _thread = std::thread(&screenshot_preroll_ring::downscale_main, this);
+    }
+
+    if (downscale)
+        _frames_available.notify_one();
+
+    // Pixel buffers of dropped frames go back to the pool outside the lock
+}
+
+void screenshot_preroll_ring::take(std::list<screenshot> &screenshots)
+{
+    std::unique_lock lock(_mutex);
+
+    // The frame that is downscaled right now is newer than all others that were downscaled already, so it has to be back in its place first
+    _idle.wait(lock, [this]() { return !_busy; });
+
+    _frames.reverse();
+    screenshots.splice(screenshots.begin(), _frames);
+    _bytes = 0;
+}
+
+void screenshot_preroll_ring::clear()
+{
+    std::list<screenshot> dropped;
+    take(dropped);
+}
+
+size_t screenshot_preroll_ring::size() const noexcept
+{
+    std::lock_guard lock(_mutex);
+
+    return _frames.size() + (_busy ? 1 : 0);
+}
+uint64_t screenshot_preroll_ring::memory_usage() const noexcept
+{
+    std::lock_guard lock(_mutex);
+
+    return _bytes;
+}
+
+void screenshot_preroll_ring::trim(std::list<screenshot> &dropped)
+{
+    // Only frames that were downscaled already are older than the one downscaled right now, all others have to wait until it is back in the ring
+    const auto can_drop_oldest = [this]() {
+        return !_frames.empty() && !(_busy && _frames.front().pending_downscale);
+        };
+    const auto drop_oldest = [this, &dropped]() {
+        _bytes -= _frames.front().memory_usage();
+        dropped.splice(dropped.end(), _frames, _frames.begin());
+        };
+
+    while (_max_frames != 0 && _frames.size() + (_busy ? 1 : 0) > _max_frames && can_drop_oldest())
+        drop_oldest();
+
+    while (_max_duration != std::chrono::system_clock::duration::zero() && can_drop_oldest() && _frames.back().frame_time - _frames.front().frame_time > _max_duration)
+        drop_oldest();
+
+    // Always keep the newest frame, even if it alone exceeds the limit
+    while (_max_bytes != 0 && _bytes > _max_bytes && _frames.size() > 1 && can_drop_oldest())
+        drop_oldest();
+}
+
+void screenshot_preroll_ring::downscale_main()
+{
+    std::unique_lock lock(_mutex);
+
+    while (true)
+    {
+        auto it = _frames.end();
+        _frames_available.wait(lock, [this, &it]() {
+            it = std::find_if(_frames.begin(), _frames.end(), [](const screenshot &screenshot) { return screenshot.pending_downscale; });
+            return it != _frames.end() || _stopping;
+            });
+
+        if (_stopping)
+            break;
+
+        // Take the frame out of the ring while it is downscaled, so that trimming and taking frames does not have to wait for it
+        std::list<screenshot> frame;
+        frame.splice(frame.end(), _frames, it);
+        _busy = true;
+
+        lock.unlock();
+
+        const uint64_t previous_bytes = frame.front().memory_usage();
+        frame.front().downscale();
+        frame.front().pending_downscale = false;
+        const uint64_t bytes = frame.front().memory_usage();
+
+        lock.lock();
+
+        // Frames are downscaled in the order they were pushed, so this one belongs in front of all others that still wait for it
+        _frames.splice(std::find_if(_frames.begin(), _frames.end(), [](const screenshot &screenshot) { return screenshot.pending_downscale; }), frame);
+        _bytes = _bytes - previous_bytes + bytes;
+        _busy = false;
+
+        std::list<screenshot> dropped;
+        trim(dropped);
+
+        _idle.notify_all();
+
+        if (!dropped.empty())
+        {
+            lock.unlock();
+            dropped.clear();
+            lock.lock();
+        }
+    }
+}
@@ -0,0 +1,68 @@
+﻿/*
+ * SPDX-FileCopyrightText: 2018 seri14
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <thread>
+
+class screenshot;
+
+/// <summary>
+/// Most recent frames captured while a myset with a pre-roll waits for its shortcut key, so that pressing it a moment too late still saves what happened before.
+/// The render thread pushes frames once their readbacks finished and takes them out again when the myset is activated.
+/// Frames that should be kept at a lower resolution are downscaled by a background thread, so that neither the render thread nor the workers spend time on frames that may never be saved.
+/// </summary>
+class screenshot_preroll_ring
+{
+public:
+    screenshot_preroll_ring();
+    screenshot_preroll_ring(const screenshot_preroll_ring &) = delete;
+    screenshot_preroll_ring &operator=(const screenshot_preroll_ring &) = delete;
+    ~screenshot_preroll_ring();
+
+    /// <summary>
+    /// Sets the limits the ring is kept within by dropping its oldest frames. Zero disables a limit.
+    /// </summary>
+    /// <param name="max_duration">Maximum time between the oldest and the newest frame.</param>
+    void configure(size_t max_frames, std::chrono::system_clock::duration max_duration, uint64_t max_bytes);
+    /// <summary>
+    /// Moves all screenshots from the list, which has the newest screenshot in front, to the end of the ring.
+    /// </summary>
+    void push(std::list<screenshot> &screenshots);
+    /// <summary>
+    /// Moves all frames of the ring into the list with the newest screenshot in front, after waiting for the frame that is downscaled right now.
+    /// </summary>
+    void take(std::list<screenshot> &screenshots);
+    /// <summary>
+    /// Discards all frames of the ring.
+    /// </summary>
+    void clear();
+
+    size_t size() const noexcept;
+    uint64_t memory_usage() const noexcept;
+
+private:
+    void trim(std::list<screenshot> &dropped);
+    void downscale_main();
+
+    mutable std::mutex _mutex;
+    std::condition_variable _frames_available;
+    std::condition_variable _idle;
+    // Oldest frame in front, with frames that still have to be downscaled at the end
+    std::list<screenshot> _frames;
+    uint64_t _bytes = 0;
+    bool _busy = false;
+    bool _stopping = false;
+    std::thread _thread;
+
+    size_t _max_frames = 0;
+    std::chrono::system_clock::duration _max_duration = std::chrono::system_clock::duration::zero();
+    uint64_t _max_bytes = 0;
+};
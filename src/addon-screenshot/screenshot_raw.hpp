@@ -0,0 +1,41 @@
+﻿/*
+ * SPDX-FileCopyrightText: 2018 seri14
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#pragma once
+
+#include <cstdint>
+
+struct screenshot_spill_header
+{
+    uint32_t magic;
+    uint32_t width;
+    uint32_t height;
+    uint32_t captures;
+};
+struct screenshot_spill_capture
+{
+    uint32_t kind;
+    /// <summary>
+    /// Value of reshade::api::format. Raw images are written after the conversion, so theirs is r8g8b8a8_unorm or r16g16b16a16_unorm, or the float format of depth.
+    /// </summary>
+    uint32_t texture_format;
+    uint32_t width;
+    uint32_t height;
+    uint64_t size;
+};
+
+constexpr uint32_t screenshot_spill_magic = 0x4C505353; // "SSPL"
+
+// Raw images are laid out like a spill file with a single capture, followed by what is needed to name and date the transcoded image
+struct screenshot_raw_header
+{
+    screenshot_spill_header spill;
+    screenshot_spill_capture capture;
+    int64_t frame_time;
+    uint32_t repeat_index;
+    uint32_t reserved;
+};
+
+constexpr uint32_t screenshot_raw_magic = 0x57415253; // "SRAW"
@@ -0,0 +1,212 @@
+﻿/*
+ * SPDX-FileCopyrightText: 2018 seri14
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "screenshot_readback.hpp"
+
+#include <cstring>
+
+bool screenshot_readback_ring::enqueue(reshade::api::device *device, reshade::api::command_queue *queue, reshade::api::resource resource, reshade::api::resource_usage usage, screenshot_capture &target, unsigned int &pending, screenshot_buffer_pool &buffers)
+{
+    if (_slots.empty())
+        return false;
+
+    size_t index = _slots.size();
+    for (size_t i = 0; i < _slots.size(); i++)
+    {
+        if (_slots[(_next + i) % _slots.size()].target == nullptr)
+        {
+            index = (_next + i) % _slots.size();
+            break;
+        }
+    }
+
+    // All staging textures are still in flight, so have to stall once and reuse the oldest one
+    if (index == _slots.size())
+    {
+        index = _next;
+
+        queue->wait_idle();
+        resolve(device, _slots[index]);
+    }
+
+    slot &slot = _slots[index];
+
+    const reshade::api::resource_desc desc = device->get_resource_desc(resource);
+    const reshade::api::format format = reshade::api::format_to_default_typed(desc.texture.format, 0);
+
+    if (slot.staging.handle == 0 ||
+        slot.desc.texture.width != desc.texture.width ||
+        slot.desc.texture.height != desc.texture.height ||
+        slot.desc.texture.format != format)
+    {
+        if (slot.staging.handle != 0)
+            device->destroy_resource(slot.staging);
+
+        slot.staging = { 0 };
+        slot.desc = reshade::api::resource_desc(desc.texture.width, desc.texture.height, 1, 1, format, 1, reshade::api::memory_heap::gpu_to_cpu, reshade::api::resource_usage::copy_dest);
+
+        if (!device->create_resource(slot.desc, nullptr, reshade::api::resource_usage::copy_dest, &slot.staging))
+        {
+            slot.staging = { 0 };
+            reshade::log::message(reshade::log::level::error, "Failed to create system memory texture for screenshot capture!");
+            return false;
+        }
+
+        device->set_resource_name(slot.staging, "ReShade Screenshot Add-on Texture");
+    }
+
+    reshade::api::command_list *const cmd_list = queue->get_immediate_command_list();
+    cmd_list->barrier(resource, usage, reshade::api::resource_usage::copy_source);
+    cmd_list->copy_texture_region(resource, 0, nullptr, slot.staging, 0, nullptr);
+    cmd_list->barrier(resource, reshade::api::resource_usage::copy_source, usage);
+
+    // D3D12 and Vulkan do not wait for the copy when mapping, and the application may queue more frames than the latency, so completion is tracked with a fence wherever there is one
+    if (_fence.handle == 0 && !_fence_unsupported && !device->create_fence(0, reshade::api::fence_flags::none, &_fence))
+    {
+        _fence = { 0 };
+        _fence_unsupported = true;
+    }
+
+    slot.fence_value = 0;
+    if (_fence.handle != 0)
+    {
+        queue->flush_immediate_command_list();
+
+        if (queue->signal(_fence, _fence_value + 1))
+            slot.fence_value = ++_fence_value;
+        else
+            queue->wait_idle();
+    }
+
+    _queue = queue;
+
+    slot.frame = _frame;
+    slot.target = &target;
+    slot.pending = &pending;
+    slot.buffers = &buffers;
+
+    pending++;
+    _next = (index + 1) % _slots.size();
+
+    return true;
+}
+
+void screenshot_readback_ring::resolve(reshade::api::device *device, bool force)
+{
+    _frame++;
+
+    // Copies still in flight have to be finished before they can be mapped
+    if (force && _queue != nullptr && pending() != 0)
+        _queue->wait_idle();
+
+    // Resolve in the order the copies were recorded, starting with the oldest one
+    for (size_t i = 0; i < _slots.size(); i++)
+    {
+        if (slot &slot = _slots[(_next + i) % _slots.size()];
+            slot.target != nullptr && (force || is_finished(device, slot)))
+            resolve(device, slot);
+    }
+}
+bool screenshot_readback_ring::is_finished(reshade::api::device *device, const slot &slot) const
+{
+    if (slot.fence_value != 0)
+        return device->get_completed_fence_value(_fence) >= slot.fence_value;
+
+    return _frame - slot.frame >= _latency;
+}
+void screenshot_readback_ring::resolve(reshade::api::device *device, slot &slot)
+{
+    if (slot.target == nullptr)
+        return;
+
+    screenshot_capture &capture = *slot.target;
+
+    const uint32_t width = slot.desc.texture.width;
+    const uint32_t height = slot.desc.texture.height;
+    const size_t bytes_row_pitch = reshade::api::format_row_pitch(slot.desc.texture.format, width);
+
+    if (reshade::api::subresource_data mapped_data = {};
+        bytes_row_pitch != 0 && device->map_texture_region(slot.staging, 0, nullptr, reshade::api::map_access::read_only, &mapped_data))
+    {
+        capture.pixels = slot.buffers->acquire(width, height, slot.desc.texture.format, (bytes_row_pitch * height + sizeof(uint32_t) - 1) / sizeof(uint32_t));
+
+        const uint8_t *mapped_pixels = static_cast<const uint8_t *>(mapped_data.data);
+        uint8_t *pixels = reinterpret_cast<uint8_t *>(capture.pixels.data());
+        if (bytes_row_pitch == mapped_data.row_pitch)
+        {
+            std::memcpy(pixels, mapped_pixels, bytes_row_pitch * height);
+        }
+        else
+        {
+            for (uint32_t y = 0; y < height; ++y, pixels += bytes_row_pitch, mapped_pixels += mapped_data.row_pitch)
+                std::memcpy(pixels, mapped_pixels, bytes_row_pitch);
+        }
+
+        device->unmap_texture_region(slot.staging, 0);
+    }
+    else
+    {
+        reshade::log::message(reshade::log::level::error, "Failed to map system memory texture for screenshot capture!");
+
+        // The frame still goes to the workers with the other images, which report this one as failed
+        capture.pixels.reset();
+        capture.failed = true;
+    }
+
+    (*slot.pending)--;
+
+    slot.target = nullptr;
+    slot.pending = nullptr;
+    slot.buffers = nullptr;
+}
+
+void screenshot_readback_ring::cancel(const screenshot_capture &target)
+{
+    for (slot &slot : _slots)
+    {
+        if (slot.target == &target)
+        {
+            (*slot.pending)--;
+
+            slot.target = nullptr;
+            slot.pending = nullptr;
+            slot.buffers = nullptr;
+        }
+    }
+}
+
+void screenshot_readback_ring::destroy(reshade::api::device *device)
+{
+    for (slot &slot : _slots)
+    {
+        if (slot.staging.handle != 0)
+            device->destroy_resource(slot.staging);
+
+        slot = {};
+    }
+
+    if (_fence.handle != 0)
+        device->destroy_fence(_fence);
+
+    _fence = { 0 };
+    _fence_value = 0;
+    _queue = nullptr;
+    _next = 0;
+}
+
+void screenshot_readback_ring::reserve(size_t size)
+{
+    // New slots start out without a staging texture, which is created on first use
+    if (_slots.size() < size)
+        _slots.resize(size);
+}
+
+size_t screenshot_readback_ring::pending() const noexcept
+{
+    size_t count = 0;
+    for (const slot &slot : _slots)
+        count += slot.target != nullptr;
+    return count;
+}
@@ -0,0 +1,93 @@
+﻿/*
+ * SPDX-FileCopyrightText: 2018 seri14
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#pragma once
+
+#include "screenshot_buffer.hpp"
+
+#include <reshade.hpp>
+
+#include <vector>
+
+class screenshot_capture
+{
+public:
+    screenshot_buffer pixels;
+    reshade::api::format texture_format;
+    /// <summary>
+    /// Set when the readback of the image failed, in which case there are no pixels.
+    /// </summary>
+    bool failed = false;
+};
+
+/// <summary>
+/// Ring of persistent system memory textures used to read back GPU resources without stalling the pipeline.
+/// A copy is mapped once the fence signaled after it was reached. Where the device has no fences, it is mapped in frame N + latency instead, which is safe there because mapping waits for the GPU by itself.
+/// Only accessed from the render thread and only depends on the device and command queue interfaces.
+/// </summary>
+class screenshot_readback_ring
+{
+public:
+    explicit screenshot_readback_ring(size_t size = 4, uint64_t latency = 3) :
+        _slots(size),
+        _latency(latency)
+    {
+    }
+    screenshot_readback_ring(const screenshot_readback_ring &) = delete;
+    screenshot_readback_ring &operator=(const screenshot_readback_ring &) = delete;
+
+    /// <summary>
+    /// Records a copy of <paramref name="resource"/> into the next free staging texture.
+    /// The data is written to <paramref name="target"/> during a later <see cref="resolve"/> and <paramref name="pending"/> is decremented at that point.
+    /// </summary>
+    /// <param name="pending">Counter of outstanding readbacks of the screenshot owning <paramref name="target"/>, which is incremented on success.</param>
+    bool enqueue(reshade::api::device *device, reshade::api::command_queue *queue, reshade::api::resource resource, reshade::api::resource_usage usage, screenshot_capture &target, unsigned int &pending, screenshot_buffer_pool &buffers);
+    /// <summary>
+    /// Advances the frame counter and copies all readbacks the GPU has finished into their targets.
+    /// A readback that fails to map leaves its target empty and marks it as failed.
+    /// </summary>
+    /// <param name="force">Set to <see langword="true"/> to wait for the GPU and resolve all outstanding readbacks.</param>
+    void resolve(reshade::api::device *device, bool force = false);
+    /// <summary>
+    /// Forgets all outstanding readbacks into <paramref name="target"/>, e.g. because the screenshot it belongs to was discarded.
+    /// </summary>
+    void cancel(const screenshot_capture &target);
+    /// <summary>
+    /// Destroys all staging textures and the fence. Outstanding readbacks are dropped.
+    /// </summary>
+    void destroy(reshade::api::device *device);
+    /// <summary>
+    /// Adds staging textures until there are at least <paramref name="size"/>, so that capturing several images every frame does not have to stall.
+    /// </summary>
+    void reserve(size_t size);
+
+    size_t pending() const noexcept;
+    uint64_t latency() const noexcept { return _latency; }
+
+private:
+    struct slot
+    {
+        reshade::api::resource staging = { 0 };
+        reshade::api::resource_desc desc;
+        uint64_t frame = 0;
+        uint64_t fence_value = 0;
+        screenshot_capture *target = nullptr;
+        unsigned int *pending = nullptr;
+        screenshot_buffer_pool *buffers = nullptr;
+    };
+
+    void resolve(reshade::api::device *device, slot &slot);
+    bool is_finished(reshade::api::device *device, const slot &slot) const;
+
+    std::vector<slot> _slots;
+    size_t _next = 0;
+    uint64_t _frame = 0;
+    uint64_t _latency;
+
+    reshade::api::command_queue *_queue = nullptr;
+    reshade::api::fence _fence = { 0 };
+    uint64_t _fence_value = 0;
+    bool _fence_unsupported = false;
+};
@@ -0,0 +1,262 @@
+﻿/*
+ * SPDX-FileCopyrightText: 2018 seri14
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "screenshot_statistics.hpp"
+#include "screenshot_platform.hpp"
+#include "runtime_config.hpp"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+static const std::string s_section = "COUNT";
+
+// Each journal record holds the absolute counts of one myset, so that replaying them only needs to keep the largest value
+// uint32_t checksum, uint16_t name size, name, uint64_t total take, uint64_t total frame
+static constexpr size_t s_record_overhead = sizeof(uint32_t) + sizeof(uint16_t) + sizeof(uint64_t) * 2;
+
+static void append_record(std::vector<uint8_t> &buffer, const std::string &name, const screenshot_statistics_scoped_data &data)
+{
+    const uint16_t name_size = static_cast<uint16_t>(std::min<size_t>(name.size(), UINT16_MAX));
+    const uint64_t values[2] = { data.total_take, data.total_frame };
+
+    const size_t offset = buffer.size();
+    buffer.resize(offset + s_record_overhead + name_size);
+
+    uint8_t *const record = buffer.data() + offset;
+    std::memcpy(record + sizeof(uint32_t), &name_size, sizeof(name_size));
+    std::memcpy(record + sizeof(uint32_t) + sizeof(uint16_t), name.data(), name_size);
+    std::memcpy(record + sizeof(uint32_t) + sizeof(uint16_t) + name_size, values, sizeof(values));
+
+    const uint32_t checksum = static_cast<uint32_t>(crc32(0L, record + sizeof(uint32_t), static_cast<uInt>(s_record_overhead - sizeof(uint32_t) + name_size)));
+    std::memcpy(record, &checksum, sizeof(checksum));
+}
+
+screenshot_statistics::screenshot_statistics()
+{
+    _total = _counters.try_emplace({}, std::make_unique<screenshot_statistics_counter>()).first->second.get();
+}
+screenshot_statistics::~screenshot_statistics()
+{
+    if (_flusher.joinable())
+    {
+        {
+            std::lock_guard lock(_mutex);
+            _stopping = true;
+        }
+        _changed.notify_one();
+
+        _flusher.join();
+    }
+
+    if (_journal != nullptr)
+        fclose(_journal);
+}
+
+void screenshot_statistics::load(const std::filesystem::path &path)
+{
+    _path = path;
+    _journal_path = path;
+    _journal_path += ".journal";
+
+    {
+        // Use a separate instance instead of the cache, since the flusher thread writes this file while the cache is flushed on the render thread
+        const ini_file config(_path);
+
+        ini_data::keys keys;
+        config.get(s_section, keys);
+
+        for (const auto &key : keys)
+        {
+            if (uint64_t value[2]{}; config.get(s_section, key, value))
+            {
+                screenshot_statistics_counter &counter = get_counter(key);
+                counter.total_take = value[0];
+                counter.total_frame = value[1];
+            }
+        }
+    }
+
+    // Replay the journal up to the first incomplete record, which is where the game crashed while appending to it
+    if (FILE *file = screenshot_platform::open_file(_journal_path, "rb"); file != nullptr)
+    {
+        std::vector<uint8_t> record;
+        uint32_t checksum = 0;
+        uint16_t name_size = 0;
+
+        while (fread(&checksum, sizeof(checksum), 1, file) == 1 && fread(&name_size, sizeof(name_size), 1, file) == 1)
+        {
+            record.resize(sizeof(name_size) + name_size + sizeof(uint64_t) * 2);
+            std::memcpy(record.data(), &name_size, sizeof(name_size));
+
+            if (fread(record.data() + sizeof(name_size), record.size() - sizeof(name_size), 1, file) != 1 ||
+                static_cast<uint32_t>(crc32(0L, record.data(), static_cast<uInt>(record.size()))) != checksum)
+                break;
+
+            uint64_t values[2];
+            std::memcpy(values, record.data() + sizeof(name_size) + name_size, sizeof(values));
+
+            screenshot_statistics_counter &counter = get_counter(std::string(reinterpret_cast<const char *>(record.data() + sizeof(name_size)), name_size));
+            counter.total_take = std::max(counter.total_take.load(), values[0]);
+            counter.total_frame = std::max(counter.total_frame.load(), values[1]);
+        }
+
+        fclose(file);
+    }
+
+    for (const auto &counter : _counters)
+        counter.second->_persisted = counter.second->load();
+
+    // Start with an empty journal, which also drops a partially written record at its end
+    if (!compact())
+        open_journal("ab");
+
+    _flusher = std::thread(&screenshot_statistics::flusher_main, this);
+}
+
+screenshot_statistics_counter &screenshot_statistics::get_counter(const std::string &name)
+{
+    std::lock_guard lock(_mutex);
+
+    std::unique_ptr<screenshot_statistics_counter> &counter = _counters[name];
+    if (counter == nullptr)
+        counter = std::make_unique<screenshot_statistics_counter>();
+    return *counter;
+}
+screenshot_statistics_scoped_data screenshot_statistics::get(const std::string &name) const
+{
+    std::lock_guard lock(_mutex);
+
+    if (const auto it = _counters.find(name); it != _counters.end())
+        return it->second->load();
+
+    return {};
+}
+
+void screenshot_statistics::add_take(screenshot_statistics_counter &counter)
+{
+    _total->total_take.fetch_add(1, std::memory_order_relaxed);
+    if (&counter != _total)
+        counter.total_take.fetch_add(1, std::memory_order_relaxed);
+
+    notify();
+}
+void screenshot_statistics::add_frame(screenshot_statistics_counter &counter)
+{
+    _total->total_frame.fetch_add(1, std::memory_order_relaxed);
+    if (&counter != _total)
+        counter.total_frame.fetch_add(1, std::memory_order_relaxed);
+
+    notify();
+}
+
+void screenshot_statistics::notify()
+{
+    // Only the first change since the last flush has to take the lock, to not miss the flusher going to sleep
+    if (!_pending.exchange(true))
+    {
+        std::lock_guard lock(_mutex);
+    }
+
+    _changed.notify_one();
+}
+
+void screenshot_statistics::flusher_main()
+{
+    std::unique_lock lock(_mutex);
+
+    while (true)
+    {
+        _changed.wait(lock, [this]() { return _pending || _stopping; });
+
+        const bool stopping = _stopping;
+        _pending = false;
+
+        lock.unlock();
+
+        // Counts keep changing while they are written, which is picked up by the next round
+        if (const bool appended = append_journal(); stopping || (appended && _journal_size >= compaction_size))
+            compact();
+
+        lock.lock();
+
+        if (stopping)
+            break;
+    }
+}
+
+bool screenshot_statistics::append_journal()
+{
+    if (_journal == nullptr)
+        return false;
+
+    std::vector<uint8_t> buffer;
+    std::vector<std::pair<screenshot_statistics_counter *, screenshot_statistics_scoped_data>> written;
+    {
+        std::lock_guard lock(_mutex);
+
+        for (const auto &counter : _counters)
+        {
+            if (const screenshot_statistics_scoped_data data = counter.second->load();
+                data.total_take != counter.second->_persisted.total_take || data.total_frame != counter.second->_persisted.total_frame)
+            {
+                append_record(buffer, counter.first, data);
+                written.emplace_back(counter.second.get(), data);
+            }
+        }
+    }
+
+    if (buffer.empty())
+        return true;
+
+    // Flushing hands the data to the system, which is all that is needed for it to survive the game crashing
+    if (fwrite(buffer.data(), 1, buffer.size(), _journal) != buffer.size() || fflush(_journal) != 0)
+        return false;
+
+    _journal_size += buffer.size();
+
+    for (const auto &[counter, data] : written)
+        counter->_persisted = data;
+
+    return true;
+}
+
+bool screenshot_statistics::compact()
+{
+    ini_file config(_path);
+    config.erase(s_section);
+
+    {
+        std::lock_guard lock(_mutex);
+
+        for (const auto &counter : _counters)
+        {
+            const screenshot_statistics_scoped_data data = counter.second->load();
+            const uint64_t value[2]{ data.total_take, data.total_frame };
+            config.set(s_section, counter.first, value);
+        }
+    }
+
+    // The journal may only be emptied once the statistics file holds all counts in it
+    if (!config.save())
+        return false;
+
+    return open_journal("wb");
+}
+
+bool screenshot_statistics::open_journal(const char *mode)
+{
+    if (_journal != nullptr)
+        fclose(_journal);
+
+    _journal = screenshot_platform::open_file(_journal_path, mode);
+
+    std::error_code ec;
+    _journal_size = _journal != nullptr ? std::filesystem::file_size(_journal_path, ec) : 0;
+
+    return _journal != nullptr;
+}
@@ -0,0 +1,105 @@
+﻿/*
+ * SPDX-FileCopyrightText: 2018 seri14
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+struct screenshot_statistics_scoped_data
+{
+    uint64_t total_take = 0;
+    uint64_t total_frame = 0;
+};
+
+/// <summary>
+/// Capture counts of a single myset, which are incremented on the render thread without locking.
+/// </summary>
+class screenshot_statistics_counter
+{
+public:
+    std::atomic<uint64_t> total_take = 0;
+    std::atomic<uint64_t> total_frame = 0;
+
+    screenshot_statistics_scoped_data load() const noexcept
+    {
+        return { total_take.load(std::memory_order_relaxed), total_frame.load(std::memory_order_relaxed) };
+    }
+
+private:
+    friend class screenshot_statistics;
+
+    // Counts last written to the journal, only accessed by the flusher thread
+    screenshot_statistics_scoped_data _persisted;
+};
+
+/// <summary>
+/// Capture counts of all mysets, with the sum of them under an empty name.
+/// A background thread appends every change to a journal next to the statistics file right away, so that counts survive the game crashing, and folds the journal back into the statistics file once it grew large.
+/// </summary>
+class screenshot_statistics
+{
+public:
+    /// <summary>
+    /// Size of the journal at which it is folded into the statistics file.
+    /// </summary>
+    static constexpr uint64_t compaction_size = 256 * 1024;
+
+    screenshot_statistics();
+    screenshot_statistics(const screenshot_statistics &) = delete;
+    screenshot_statistics &operator=(const screenshot_statistics &) = delete;
+    ~screenshot_statistics();
+
+    /// <summary>
+    /// Reads the counts from the statistics file at <paramref name="path"/> and its journal, and starts persisting changes.
+    /// </summary>
+    void load(const std::filesystem::path &path);
+
+    /// <summary>
+    /// Gets the counter of the myset called <paramref name="name"/>, creating it when necessary. The reference stays valid as long as this object.
+    /// </summary>
+    screenshot_statistics_counter &get_counter(const std::string &name);
+    screenshot_statistics_counter &get_total_counter() noexcept { return *_total; }
+    /// <summary>
+    /// Capture counts of the myset called <paramref name="name"/>, or of all mysets with an empty name.
+    /// </summary>
+    screenshot_statistics_scoped_data get(const std::string &name) const;
+
+    /// <summary>
+    /// Counts an activation of the myset with the <paramref name="counter"/> and of all mysets.
+    /// </summary>
+    void add_take(screenshot_statistics_counter &counter);
+    /// <summary>
+    /// Counts a frame captured with the myset with the <paramref name="counter"/> and with all mysets.
+    /// </summary>
+    void add_frame(screenshot_statistics_counter &counter);
+
+private:
+    void notify();
+    void flusher_main();
+    bool append_journal();
+    bool compact();
+    bool open_journal(const char *mode);
+
+    mutable std::mutex _mutex;
+    std::condition_variable _changed;
+    std::unordered_map<std::string, std::unique_ptr<screenshot_statistics_counter>> _counters;
+    screenshot_statistics_counter *_total = nullptr;
+    std::atomic<bool> _pending = false;
+    bool _stopping = false;
+    std::thread _flusher;
+
+    std::filesystem::path _path, _journal_path;
+    FILE *_journal = nullptr;
+    uint64_t _journal_size = 0;
+};
@@ -0,0 +1,294 @@
+﻿/*
+ * SPDX-FileCopyrightText: 2018 seri14
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "screenshot_tiff.hpp"
+
+#include <tiffio.h>
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+/// <summary>
+/// Compresses with the LZW variant of TIFF, which packs codes from the most significant bit on and widens them one code early, appending to <paramref name="output"/>.
+/// </summary>
+static void compress_lzw(const uint8_t *input, size_t size, std::vector<uint8_t> &output)
+{
+    constexpr unsigned int clear_code = 256;
+    constexpr unsigned int end_code = 257;
+    constexpr unsigned int first_code = 258;
+    constexpr unsigned int min_bits = 9;
+    // The table starts over before it would need codes wider than 12 bits
+    constexpr unsigned int last_code = (1u << 12) - 2;
+    constexpr unsigned int hash_bits = 13;
+    constexpr size_t hash_size = size_t(1) << hash_bits;
+
+    // Workers compress many strips in a row, so keep the table around between them
+    // It maps a string in the table, as its code and the byte that follows it, to the code of the longer string
+    static thread_local std::vector<uint32_t> keys;
+    static thread_local std::vector<uint16_t> codes;
+    keys.assign(hash_size, 0);
+    codes.resize(hash_size);
+
+    output.reserve(output.size() + size + size / 2 + 16);
+
+    uint32_t bit_buffer = 0;
+    unsigned int bit_count = 0;
+    unsigned int bits = min_bits;
+    unsigned int next_code = first_code;
+
+    const auto put = [&](unsigned int code) {
+        bit_buffer = (bit_buffer << bits) | code;
+        for (bit_count += bits; bit_count >= 8; bit_count -= 8)
+            output.push_back(static_cast<uint8_t>(bit_buffer >> (bit_count - 8)));
+        bit_buffer &= (1u << bit_count) - 1;
+    };
+    // The decoder adds an entry for each code after the first, and widens its codes as soon as the next entry does not fit anymore, so the encoder has to do the same
+    const auto add_code = [&]() {
+        if (++next_code == last_code)
+        {
+            put(clear_code);
+            keys.assign(hash_size, 0);
+            next_code = first_code;
+            bits = min_bits;
+        }
+        else if (next_code >= (1u << bits))
+        {
+            bits++;
+        }
+    };
+
+    put(clear_code);
+
+    if (size != 0)
+    {
+        unsigned int prefix = input[0];
+        for (size_t i = 1; i < size; i++)
+        {
+            const uint32_t key = ((static_cast<uint32_t>(input[i]) << 12) | prefix) + 1;
+
+            size_t slot = (key * 2654435761u) >> (32 - hash_bits);
+            while (keys[slot] != 0 && keys[slot] != key)
+                slot = (slot + 1) & (hash_size - 1);
+
+            if (keys[slot] == key)
+            {
+                prefix = codes[slot];
+                continue;
+            }
+
+            put(prefix);
+
+            keys[slot] = key;
+            codes[slot] = static_cast<uint16_t>(next_code);
+            prefix = input[i];
+            add_code();
+        }
+
+        put(prefix);
+        add_code();
+    }
+
+    put(end_code);
+
+    if (bit_count != 0)
+        output.push_back(static_cast<uint8_t>(bit_buffer << (8 - bit_count)));
+}
+
+/// <summary>
+/// Replaces each sample of a row by its difference to the same sample of the pixel before it, as PREDICTOR_HORIZONTAL.
+/// </summary>
+template <typename T>
+static void predict_horizontal(uint8_t *row, size_t row_size, unsigned int channels)
+{
+    T *const samples = reinterpret_cast<T *>(row);
+    for (size_t i = row_size / sizeof(T); i-- > channels;)
+        samples[i] = static_cast<T>(samples[i] - samples[i - channels]);
+}
+
+/// <summary>
+/// Splits the little-endian 32-bit floating-point samples of a row into planes of their bytes, from the most significant one on, and then replaces each byte by its difference to the same byte of the pixel before it, as PREDICTOR_FLOATINGPOINT.
+/// </summary>
+static void predict_floating_point(uint8_t *row, size_t row_size, unsigned int channels, uint8_t *scratch)
+{
+    const size_t count = row_size / 4;
+    for (size_t i = 0; i < count; i++)
+        for (size_t b = 0; b < 4; b++)
+            scratch[(3 - b) * count + i] = row[4 * i + b];
+
+    for (size_t i = row_size; i-- > channels;)
+        row[i] = static_cast<uint8_t>(scratch[i] - scratch[i - channels]);
+    std::memcpy(row, scratch, std::min<size_t>(channels, row_size));
+}
+
+uint32_t screenshot_tiff_writer::get_tile_size() const
+{
+    return (tile_size + 15) & ~15u;
+}
+
+bool screenshot_tiff_writer::needs_bigtiff(uint32_t width, uint32_t height, unsigned int channels, unsigned int bit_depth) const
+{
+    // Tiles are padded to full size at the right and bottom edge
+    const uint64_t padded_width = tile_size != 0 ? (width + get_tile_size() - 1) / get_tile_size() * uint64_t(get_tile_size()) : width;
+    const uint64_t padded_height = tile_size != 0 ? (height + get_tile_size() - 1) / get_tile_size() * uint64_t(get_tile_size()) : height;
+    const uint64_t image_size = padded_width * padded_height * channels * (bit_depth / 8);
+
+    // LZW makes noise up to half again as large, and the offsets of the strips and the tags come after the image data
+    return image_size + image_size / 2 + 64 * 1024 * 1024 > 0xFFFFFFFFull;
+}
+
+bool screenshot_tiff_writer::write(tiff *tif, const uint8_t *pixels, uint32_t width, uint32_t height, unsigned int channels, unsigned int bit_depth, bool floating_point, const parallel_for_fn &parallel_for) const
+{
+    const int scheme = compression == COMPRESSION_LZW || compression == COMPRESSION_ADOBE_DEFLATE ? compression : COMPRESSION_NONE;
+
+    const size_t pixel_size = channels * (bit_depth / 8);
+    const size_t row_size = pixel_size * width;
+
+    // Strips span the whole width, tiles are square
+    const bool tiled = tile_size != 0;
+    const uint32_t chunk_width = tiled ? get_tile_size() : width;
+    const uint32_t chunk_height = tiled ? chunk_width : static_cast<uint32_t>(std::clamp<size_t>(strip_size / row_size, 1, height));
+    const size_t chunk_row_size = pixel_size * chunk_width;
+
+    const uint32_t chunks_across = (width + chunk_width - 1) / chunk_width;
+    const uint32_t chunks_down = (height + chunk_height - 1) / chunk_height;
+    const size_t chunk_count = static_cast<size_t>(chunks_across) * chunks_down;
+
+    // 259
+    TIFFSetField(tif, TIFFTAG_COMPRESSION, static_cast<uint16_t>(scheme));
+
+    // 278 or 322 - 323
+    if (tiled)
+    {
+        TIFFSetField(tif, TIFFTAG_TILEWIDTH, chunk_width);
+        TIFFSetField(tif, TIFFTAG_TILELENGTH, chunk_height);
+    }
+    else
+    {
+        TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, chunk_height);
+    }
+
+    // 317
+    if (scheme != COMPRESSION_NONE)
+        TIFFSetField(tif, TIFFTAG_PREDICTOR, static_cast<uint16_t>(floating_point ? PREDICTOR_FLOATINGPOINT : PREDICTOR_HORIZONTAL));
+
+    struct chunk
+    {
+        std::vector<uint8_t> data;
+        const uint8_t *encoded = nullptr;
+        size_t size = 0;
+        bool succeeded = false;
+    };
+
+    const auto encode_chunk = [&](size_t index, chunk &chunk) {
+        const uint32_t x = static_cast<uint32_t>(index % chunks_across) * chunk_width;
+        const uint32_t y = static_cast<uint32_t>(index / chunks_across) * chunk_height;
+        const uint32_t rows = tiled ? chunk_height : std::min(chunk_height, height - y);
+        const size_t size = chunk_row_size * rows;
+
+        chunk.data.clear();
+        chunk.succeeded = false;
+
+        // Uncompressed strips are written straight from the pixels
+        if (!tiled && scheme == COMPRESSION_NONE)
+        {
+            chunk.encoded = pixels + row_size * y;
+            chunk.size = size;
+            chunk.succeeded = true;
+            return;
+        }
+
+        // Workers encode many chunks in a row, so keep the buffers around between them
+        static thread_local std::vector<uint8_t> buffer, scratch;
+
+        // The predictor changes the samples, so they are always copied first
+        std::vector<uint8_t> &gathered = scheme == COMPRESSION_NONE ? chunk.data : buffer;
+        gathered.resize(size);
+
+        if (tiled)
+        {
+            const size_t copy_size = pixel_size * std::min(chunk_width, width - x);
+            for (uint32_t row = 0; row < rows; row++)
+            {
+                uint8_t *const dst = gathered.data() + chunk_row_size * row;
+                if (y + row < height)
+                {
+                    std::memcpy(dst, pixels + row_size * (y + row) + pixel_size * x, copy_size);
+                    std::memset(dst + copy_size, 0, chunk_row_size - copy_size);
+                }
+                else
+                {
+                    std::memset(dst, 0, chunk_row_size);
+                }
+            }
+        }
+        else
+        {
+            std::memcpy(gathered.data(), pixels + row_size * y, size);
+        }
+
+        if (scheme == COMPRESSION_NONE)
+        {
+            chunk.encoded = chunk.data.data();
+            chunk.size = size;
+            chunk.succeeded = true;
+            return;
+        }
+
+        scratch.resize(chunk_row_size);
+        for (uint32_t row = 0; row < rows; row++)
+        {
+            uint8_t *const samples = buffer.data() + chunk_row_size * row;
+            if (floating_point)
+                predict_floating_point(samples, chunk_row_size, channels, scratch.data());
+            else if (bit_depth == 16)
+                predict_horizontal<uint16_t>(samples, chunk_row_size, channels);
+            else
+                predict_horizontal<uint8_t>(samples, chunk_row_size, channels);
+        }
+
+        if (scheme == COMPRESSION_LZW)
+        {
+            compress_lzw(buffer.data(), size, chunk.data);
+            chunk.succeeded = true;
+        }
+        else
+        {
+            chunk.succeeded = screenshot_deflate::compress(deflate_backend, buffer.data(), size, compression_level, compression_strategy, chunk.data);
+        }
+
+        chunk.encoded = chunk.data.data();
+        chunk.size = chunk.data.size();
+    };
+
+    // Chunks are encoded a batch at a time and written in order in between, so that a huge image is never held compressed in memory as a whole
+    std::vector<chunk> batch(std::min<size_t>(64, chunk_count));
+
+    for (size_t first = 0; first < chunk_count; first += batch.size())
+    {
+        const size_t count = std::min(batch.size(), chunk_count - first);
+
+        const auto encode_batch_chunk = [&](size_t i) { encode_chunk(first + i, batch[i]); };
+        if (parallel_for)
+            parallel_for(count, encode_batch_chunk);
+        else
+            for (size_t i = 0; i < count; i++)
+                encode_batch_chunk(i);
+
+        for (size_t i = 0; i < count; i++)
+        {
+            const chunk &chunk = batch[i];
+            if (!chunk.succeeded)
+                return false;
+
+            const uint32_t index = static_cast<uint32_t>(first + i);
+            void *const data = const_cast<uint8_t *>(chunk.encoded);
+            if ((tiled ? TIFFWriteRawTile(tif, index, data, static_cast<tmsize_t>(chunk.size)) : TIFFWriteRawStrip(tif, index, data, static_cast<tmsize_t>(chunk.size))) == -1)
+                return false;
+        }
+    }
+
+    return true;
+}
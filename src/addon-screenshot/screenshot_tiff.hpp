@@ -0,0 +1,53 @@
+﻿/*
+ * SPDX-FileCopyrightText: 2018 seri14
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#pragma once
+
+#include "screenshot_deflate.hpp"
+
+#include <cstdint>
+#include <functional>
+
+struct tiff;
+
+/// <summary>
+/// TIFF writer that splits the image into strips or tiles, which are run through the predictor and compressed concurrently and then written in order as raw data with libtiff.
+/// </summary>
+class screenshot_tiff_writer
+{
+public:
+    using parallel_for_fn = std::function<void(size_t count, const std::function<void(size_t)> &fn)>;
+
+    /// <summary>
+    /// One of COMPRESSION_NONE, COMPRESSION_LZW and COMPRESSION_ADOBE_DEFLATE. Other schemes are written uncompressed.
+    /// </summary>
+    int compression = 1;
+    int compression_level = -1;
+    int compression_strategy = 0;
+    screenshot_deflate_backend deflate_backend = screenshot_deflate_backend::zlib;
+    /// <summary>
+    /// Target amount of uncompressed data per strip. Smaller strips spread better across threads, larger ones compress slightly better.
+    /// </summary>
+    size_t strip_size = 256 * 1024;
+    /// <summary>
+    /// Width and height of square tiles to write instead of strips, or zero for strips. Rounded up to a multiple of 16, which TIFF requires.
+    /// </summary>
+    uint32_t tile_size = 0;
+
+    /// <summary>
+    /// Whether the image has to be written to a file opened as BigTIFF, since its strips could end past 4 GiB, even when compression makes them larger.
+    /// </summary>
+    bool needs_bigtiff(uint32_t width, uint32_t height, unsigned int channels, unsigned int bit_depth) const;
+
+    /// <summary>
+    /// Sets the layout, compression and predictor tags and writes the image data to a TIFF whose other tags are already set.
+    /// Samples are unsigned integers, or floating-point values when <paramref name="floating_point"/> is set, in the byte order of the processor, which the file has to be opened with as well.
+    /// </summary>
+    /// <param name="parallel_for">Runs the strip encoding, or serially on the calling thread when empty.</param>
+    bool write(tiff *tif, const uint8_t *pixels, uint32_t width, uint32_t height, unsigned int channels, unsigned int bit_depth, bool floating_point, const parallel_for_fn &parallel_for) const;
+
+private:
+    uint32_t get_tile_size() const;
+};
@@ -0,0 +1,136 @@
+﻿/*
+ * SPDX-FileCopyrightText: 2018 seri14
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "screenshot_timing.hpp"
+#include "screenshot_platform.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cinttypes>
+#include <initializer_list>
+
+void screenshot_histogram::add(std::chrono::steady_clock::duration duration) noexcept
+{
+    const auto microseconds = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+
+    _buckets[bucket_index(microseconds > 0 ? static_cast<uint64_t>(microseconds) : 0)].fetch_add(1, std::memory_order_relaxed);
+    _count.fetch_add(1, std::memory_order_relaxed);
+}
+void screenshot_histogram::clear() noexcept
+{
+    for (std::atomic<uint32_t> &bucket : _buckets)
+        bucket.store(0, std::memory_order_relaxed);
+    _count = 0;
+}
+
+std::chrono::microseconds screenshot_histogram::percentile(double fraction) const noexcept
+{
+    // Buckets may be filled while walking them, so only rely on what was counted in the buckets themselves
+    uint64_t total = 0;
+    for (const std::atomic<uint32_t> &bucket : _buckets)
+        total += bucket.load(std::memory_order_relaxed);
+    if (total == 0)
+        return std::chrono::microseconds(0);
+
+    const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(std::clamp(fraction, 0.0, 1.0) * total)));
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < bucket_count; i++)
+    {
+        if (seen += _buckets[i].load(std::memory_order_relaxed); seen >= rank)
+            return std::chrono::microseconds(bucket_middle(i));
+    }
+
+    return std::chrono::microseconds(bucket_middle(bucket_count - 1));
+}
+
+size_t screenshot_histogram::bucket_index(uint64_t microseconds) noexcept
+{
+    // Small values get a bucket each, larger ones are split into 2^sub_bucket_bits buckets per power of two
+    if (microseconds < linear_buckets)
+        return static_cast<size_t>(microseconds);
+
+    microseconds = std::min(microseconds, (uint64_t(1) << (max_exponent + 1)) - 1);
+
+    unsigned int exponent = 0;
+    while ((microseconds >> exponent) > 1)
+        exponent++;
+
+    const uint64_t mantissa = (microseconds >> (exponent - sub_bucket_bits)) & ((uint64_t(1) << sub_bucket_bits) - 1);
+    return linear_buckets + (exponent - sub_bucket_bits - 1) * (size_t(1) << sub_bucket_bits) + static_cast<size_t>(mantissa);
+}
+uint64_t screenshot_histogram::bucket_middle(size_t index) noexcept
+{
+    if (index < linear_buckets)
+        return index;
+
+    const unsigned int exponent = static_cast<unsigned int>((index - linear_buckets) >> sub_bucket_bits) + sub_bucket_bits + 1;
+    const uint64_t mantissa = (uint64_t(1) << sub_bucket_bits) | ((index - linear_buckets) & ((size_t(1) << sub_bucket_bits) - 1));
+    const uint64_t width = uint64_t(1) << (exponent - sub_bucket_bits);
+
+    return mantissa * width + width / 2;
+}
+
+screenshot_timings::~screenshot_timings()
+{
+    close_log();
+}
+
+void screenshot_timings::record_frame(const screenshot_timing &timing)
+{
+    for (const screenshot_stage stage : { screenshot_stage::capture, screenshot_stage::readback, screenshot_stage::queue })
+        _histograms[static_cast<size_t>(stage)].add(timing[stage]);
+}
+void screenshot_timings::record(const screenshot_timing &timing, const char *kind, unsigned int repeat_index, uint64_t written_bytes)
+{
+    for (const screenshot_stage stage : { screenshot_stage::convert, screenshot_stage::encode, screenshot_stage::write, screenshot_stage::metadata })
+        _histograms[static_cast<size_t>(stage)].add(timing[stage]);
+
+    std::lock_guard lock(_log_mutex);
+
+    if (_log == nullptr)
+        return;
+
+    fprintf(_log, "%u,%s,%" PRIu64, repeat_index, kind, written_bytes);
+    for (const std::chrono::steady_clock::duration &duration : timing.durations)
+        fprintf(_log, ",%lld", static_cast<long long>(std::chrono::duration_cast<std::chrono::microseconds>(duration).count()));
+    fputc('\n', _log);
+}
+void screenshot_timings::clear()
+{
+    for (screenshot_histogram &histogram : _histograms)
+        histogram.clear();
+}
+
+bool screenshot_timings::open_log(const std::filesystem::path &file)
+{
+    std::error_code ec;
+    std::filesystem::create_directories(file.parent_path(), ec);
+
+    FILE *const log = screenshot_platform::open_file(file, "w");
+    if (log == nullptr)
+        return false;
+
+    fputs("repeat_index,kind,bytes", log);
+    for (size_t stage = 0; stage < static_cast<size_t>(screenshot_stage::_max); stage++)
+        fprintf(log, ",%s_us", get_screenshot_stage_name(static_cast<screenshot_stage>(stage)));
+    fputc('\n', log);
+
+    std::lock_guard lock(_log_mutex);
+
+    if (_log != nullptr)
+        fclose(_log);
+    _log = log;
+
+    return true;
+}
+void screenshot_timings::close_log()
+{
+    std::lock_guard lock(_log_mutex);
+
+    if (_log != nullptr)
+        fclose(_log);
+    _log = nullptr;
+}
@@ -0,0 +1,141 @@
+﻿/*
+ * SPDX-FileCopyrightText: 2018 seri14
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <mutex>
+
+enum class screenshot_stage
+{
+    /// <summary>Copying the images on the render thread, including the submission of readbacks.</summary>
+    capture = 0,
+    /// <summary>Waiting for readbacks until the screenshot is handed to the workers, including downscaling and spilling.</summary>
+    readback,
+    /// <summary>Waiting in the worker queue.</summary>
+    queue,
+    /// <summary>Pixel format conversions before encoding.</summary>
+    convert,
+    /// <summary>Compression, including writes into the file buffer for encoders that stream their output.</summary>
+    encode,
+    /// <summary>Flushing and closing the file.</summary>
+    write,
+    /// <summary>Creating directories, checking free space, opening files and setting their time stamps.</summary>
+    metadata,
+    _max,
+};
+
+constexpr const char *get_screenshot_stage_name(screenshot_stage stage)
+{
+    switch (stage)
+    {
+        case screenshot_stage::capture:
+            return "Capture";
+        case screenshot_stage::readback:
+            return "Readback";
+        case screenshot_stage::queue:
+            return "Queue";
+        case screenshot_stage::convert:
+            return "Convert";
+        case screenshot_stage::encode:
+            return "Encode";
+        case screenshot_stage::write:
+            return "Write";
+        case screenshot_stage::metadata:
+            return "Metadata";
+        default:
+            return "Unknown";
+    }
+}
+
+/// <summary>
+/// Time spent in each stage, measured by taking laps between them.
+/// </summary>
+struct screenshot_timing
+{
+    std::array<std::chrono::steady_clock::duration, static_cast<size_t>(screenshot_stage::_max)> durations{};
+    std::chrono::steady_clock::time_point last = std::chrono::steady_clock::now();
+
+    std::chrono::steady_clock::duration &operator[](screenshot_stage stage) { return durations[static_cast<size_t>(stage)]; }
+    std::chrono::steady_clock::duration operator[](screenshot_stage stage) const { return durations[static_cast<size_t>(stage)]; }
+
+    /// <summary>
+    /// Adds the time since the previous lap to <paramref name="stage"/>.
+    /// </summary>
+    void lap(screenshot_stage stage)
+    {
+        const auto now = std::chrono::steady_clock::now();
+        (*this)[stage] += now - last;
+        last = now;
+    }
+};
+
+/// <summary>
+/// Histogram of durations with logarithmic buckets, each about 12% wide, which can be filled from multiple threads without locking.
+/// </summary>
+class screenshot_histogram
+{
+public:
+    void add(std::chrono::steady_clock::duration duration) noexcept;
+    void clear() noexcept;
+
+    uint64_t count() const noexcept { return _count; }
+    /// <summary>
+    /// Gets the duration below which <paramref name="fraction"/> of all added durations are, e.g. 0.95 for the 95th percentile.
+    /// </summary>
+    std::chrono::microseconds percentile(double fraction) const noexcept;
+
+private:
+    static constexpr unsigned int sub_bucket_bits = 3;
+    static constexpr unsigned int max_exponent = 36;
+    static constexpr size_t linear_buckets = size_t(2) << sub_bucket_bits;
+    static constexpr size_t bucket_count = linear_buckets + (max_exponent - sub_bucket_bits) * (size_t(1) << sub_bucket_bits);
+
+    static size_t bucket_index(uint64_t microseconds) noexcept;
+    static uint64_t bucket_middle(size_t index) noexcept;
+
+    std::array<std::atomic<uint32_t>, bucket_count> _buckets{};
+    std::atomic<uint64_t> _count = 0;
+};
+
+/// <summary>
+/// Collects the stage timings of all saved images for the overlay and optionally writes them to a CSV file, one line per image.
+/// </summary>
+class screenshot_timings
+{
+public:
+    screenshot_timings() = default;
+    screenshot_timings(const screenshot_timings &) = delete;
+    screenshot_timings &operator=(const screenshot_timings &) = delete;
+    ~screenshot_timings();
+
+    /// <summary>
+    /// Adds the stages a frame passes before its images are saved, i.e. capture, readback and queue.
+    /// </summary>
+    void record_frame(const screenshot_timing &timing);
+    /// <summary>
+    /// Adds the stages of a saved image and writes all stages including those of its frame to the log.
+    /// </summary>
+    void record(const screenshot_timing &timing, const char *kind, unsigned int repeat_index, uint64_t written_bytes);
+    void clear();
+
+    const screenshot_histogram &histogram(screenshot_stage stage) const { return _histograms[static_cast<size_t>(stage)]; }
+
+    /// <summary>
+    /// Starts writing all following records to <paramref name="file"/>, replacing a previously opened one.
+    /// </summary>
+    bool open_log(const std::filesystem::path &file);
+    void close_log();
+
+private:
+    std::array<screenshot_histogram, static_cast<size_t>(screenshot_stage::_max)> _histograms;
+    std::mutex _log_mutex;
+    FILE *_log = nullptr;
+};
@@ -0,0 +1,139 @@
+﻿/*
+ * SPDX-FileCopyrightText: 2018 seri14
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "screenshot_trace.hpp"
+
+#include <Windows.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <system_error>
+
+static std::atomic<uint64_t> s_next_trace_id = 1;
+
+screenshot_trace::screenshot_trace() :
+    _id(s_next_trace_id++)
+{
+}
+screenshot_trace::~screenshot_trace()
+{
+    stop();
+}
+
+void screenshot_trace::start(const std::filesystem::path &file)
+{
+    std::lock_guard lock(_rings_mutex);
+
+    // Rings stay registered with their threads and are only ever written by them, so skip what they recorded before instead of clearing them
+    for (const std::unique_ptr<ring> &ring : _rings)
+        ring->first = ring->head.load(std::memory_order_acquire);
+
+    _file = file;
+    _start = std::chrono::steady_clock::now();
+    _recording.store(true, std::memory_order_release);
+}
+
+bool screenshot_trace::stop()
+{
+    if (!_recording.exchange(false))
+        return false;
+
+    std::lock_guard lock(_rings_mutex);
+
+    std::error_code ec;
+    std::filesystem::create_directories(_file.parent_path(), ec);
+
+    FILE *file = nullptr;
+    if (_wfopen_s(&file, _file.c_str(), L"w") != 0 || file == nullptr)
+        return false;
+
+    const unsigned long process_id = GetCurrentProcessId();
+
+    fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", file);
+    fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%lu,\"tid\":0,\"args\":{\"name\":\"ReShade Screenshot Add-on\"}}", process_id);
+
+    for (const std::unique_ptr<ring> &ring : _rings)
+    {
+        const uint64_t head = ring->head.load(std::memory_order_acquire);
+        if (head == ring->first)
+            continue;
+
+        if (const char *const thread_name = ring->thread_name.load(std::memory_order_relaxed); thread_name != nullptr)
+            fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%lu,\"tid\":%u,\"args\":{\"name\":\"%s\"}}", process_id, ring->thread_id, thread_name);
+
+        // A thread may still be finishing an event it started before recording stopped, so leave out the slot it could be overwriting
+        const uint64_t first = std::max(ring->first, head > ring_capacity - 1 ? head - (ring_capacity - 1) : 0);
+
+        for (uint64_t i = first; i < head; i++)
+        {
+            const event &event = ring->events[i % ring_capacity];
+            if (event.begin < 0)
+                continue;
+
+            fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"screenshot\",\"ph\":\"X\",\"pid\":%lu,\"tid\":%u,\"ts\":%lld.%03lld,\"dur\":%lld.%03lld",
+                event.name, process_id, ring->thread_id,
+                static_cast<long long>(event.begin / 1000), static_cast<long long>(event.begin % 1000),
+                static_cast<long long>(event.duration / 1000), static_cast<long long>(event.duration % 1000));
+            if (event.detail != nullptr)
+                fprintf(file, ",\"args\":{\"detail\":\"%s\"}", event.detail);
+            fputc('}', file);
+        }
+    }
+
+    fputs("\n]}\n", file);
+
+    return fclose(file) == 0;
+}
+
+void screenshot_trace::set_thread_name(const char *name)
+{
+    get_thread_ring().thread_name.store(name, std::memory_order_relaxed);
+}
+
+void screenshot_trace::add(const char *name, const char *detail, std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::time_point end)
+{
+    ring &ring = get_thread_ring();
+
+    // Only the owning thread writes to its ring, so a plain increment is enough and readers pick up complete events through the release store
+    const uint64_t head = ring.head.load(std::memory_order_relaxed);
+
+    event &event = ring.events[head % ring_capacity];
+    event.name = name;
+    event.detail = detail;
+    event.begin = std::chrono::duration_cast<std::chrono::nanoseconds>(begin - _start).count();
+    event.duration = std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count());
+
+    ring.head.store(head + 1, std::memory_order_release);
+}
+
+screenshot_trace::ring &screenshot_trace::get_thread_ring()
+{
+    // Each thread remembers its ring of the trace it used last, which is identified by an id so that a new trace at the same address is not mistaken for an old one
+    thread_local uint64_t cached_id = 0;
+    thread_local ring *cached_ring = nullptr;
+
+    if (cached_id == _id)
+        return *cached_ring;
+
+    const uint32_t thread_id = GetCurrentThreadId();
+
+    std::lock_guard lock(_rings_mutex);
+
+    const auto it = std::find_if(_rings.begin(), _rings.end(), [thread_id](const std::unique_ptr<ring> &ring) { return ring->thread_id == thread_id; });
+    if (it != _rings.end())
+    {
+        cached_ring = it->get();
+    }
+    else
+    {
+        std::unique_ptr<ring> &ring = _rings.emplace_back(std::make_unique<screenshot_trace::ring>());
+        ring->thread_id = thread_id;
+        ring->events = std::make_unique<event[]>(ring_capacity);
+        cached_ring = ring.get();
+    }
+
+    cached_id = _id;
+    return *cached_ring;
+}
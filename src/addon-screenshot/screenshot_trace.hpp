@@ -0,0 +1,106 @@
+﻿/*
+ * SPDX-FileCopyrightText: 2018 seri14
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/// <summary>
+/// Records what the render thread and the workers are doing as a trace in the Chrome trace event format, which can be opened in Perfetto or chrome://tracing.
+/// Every thread writes into its own fixed-size ring without locking, so that recording barely affects the timings it measures. Only the newest events of each thread are kept.
+/// </summary>
+class screenshot_trace
+{
+public:
+    static constexpr size_t ring_capacity = 16384;
+
+    /// <summary>
+    /// Records the time from its construction to its destruction as an event on the calling thread, if recording was active when it was constructed.
+    /// </summary>
+    class span
+    {
+    public:
+        /// <param name="name">Name of the event, which has to stay valid until the trace is written, e.g. a string literal.</param>
+        /// <param name="detail">Optional argument shown with the event, with the same lifetime requirement as the name.</param>
+        span(screenshot_trace &trace, const char *name, const char *detail = nullptr) :
+            _trace(trace.is_recording() ? &trace : nullptr),
+            _name(name),
+            _detail(detail)
+        {
+            if (_trace != nullptr)
+                _begin = std::chrono::steady_clock::now();
+        }
+        span(const span &) = delete;
+        span &operator=(const span &) = delete;
+        ~span()
+        {
+            if (_trace != nullptr)
+                _trace->add(_name, _detail, _begin, std::chrono::steady_clock::now());
+        }
+
+    private:
+        screenshot_trace *const _trace;
+        const char *const _name;
+        const char *const _detail;
+        std::chrono::steady_clock::time_point _begin;
+    };
+
+    screenshot_trace();
+    screenshot_trace(const screenshot_trace &) = delete;
+    screenshot_trace &operator=(const screenshot_trace &) = delete;
+    ~screenshot_trace();
+
+    bool is_recording() const noexcept { return _recording.load(std::memory_order_acquire); }
+
+    /// <summary>
+    /// Discards all previously recorded events and starts recording a trace that is written to <paramref name="file"/> by <see cref="stop"/>.
+    /// </summary>
+    void start(const std::filesystem::path &file);
+    /// <summary>
+    /// Stops recording and writes the trace.
+    /// </summary>
+    /// <returns><see langword="false"/> if nothing was recording or the file could not be written.</returns>
+    bool stop();
+
+    const std::filesystem::path &file() const noexcept { return _file; }
+
+    /// <summary>
+    /// Names the track of the calling thread in the trace. The name has to stay valid until the trace is written.
+    /// </summary>
+    void set_thread_name(const char *name);
+    void add(const char *name, const char *detail, std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::time_point end);
+
+private:
+    struct event
+    {
+        const char *name;
+        const char *detail;
+        int64_t begin;
+        int64_t duration;
+    };
+    struct ring
+    {
+        uint32_t thread_id;
+        std::atomic<const char *> thread_name = nullptr;
+        std::atomic<uint64_t> head = 0;
+        uint64_t first = 0;
+        std::unique_ptr<event[]> events;
+    };
+
+    ring &get_thread_ring();
+
+    const uint64_t _id;
+    std::atomic<bool> _recording = false;
+    std::chrono::steady_clock::time_point _start;
+    std::filesystem::path _file;
+    std::mutex _rings_mutex;
+    std::vector<std::unique_ptr<ring>> _rings;
+};
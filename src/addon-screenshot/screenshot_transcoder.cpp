@@ -0,0 +1,319 @@
+﻿/*
+ * SPDX-FileCopyrightText: 2018 seri14
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "screenshot.hpp"
+#include "screenshot_output.hpp"
+#include "screenshot_platform.hpp"
+#include "screenshot_transcoder.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+
+// Each line of the backlog queues the raw image at a path with the name of its myset and the number of failed attempts so far, separated by tabs, or takes it off the queue again when it only holds the path
+static std::string backlog_record(const std::string &name, const std::filesystem::path &file, unsigned int failures, bool done)
+{
+    if (done)
+        return std::format("%s\n", file.u8string().c_str());
+    else if (failures == 0)
+        return std::format("%s\t%s\n", name.c_str(), file.u8string().c_str());
+    else
+        return std::format("%s\t%s\t%u\n", name.c_str(), file.u8string().c_str(), failures);
+}
+
+screenshot_transcoder::screenshot_transcoder(screenshot_state &state) :
+    _state(state)
+{
+}
+screenshot_transcoder::~screenshot_transcoder()
+{
+    stop();
+
+    std::lock_guard lock(_mutex);
+
+    save_backlog();
+}
+
+void screenshot_transcoder::load(const std::filesystem::path &path, const std::list<screenshot_myset> &mysets)
+{
+    std::lock_guard lock(_mutex);
+
+    _backlog_path = path;
+
+    struct entry
+    {
+        std::string name;
+        unsigned int failures;
+        size_t order;
+    };
+
+    // Replay the records up to the first incomplete line, which is where the game crashed while appending to the backlog
+    std::map<std::string, entry> entries;
+    if (FILE *const file = screenshot_platform::open_file(path, "rb"); file != nullptr)
+    {
+        size_t order = 0;
+        for (char line[4096]; fgets(line, sizeof(line), file) != nullptr; order++)
+        {
+            char *end = line + std::strlen(line);
+            if (end == line || end[-1] != '\n')
+                break;
+            while (end != line && (end[-1] == '\n' || end[-1] == '\r'))
+                *--end = '\0';
+
+            char *const separator = std::strchr(line, '\t');
+            if (separator == nullptr)
+            {
+                entries.erase(line);
+                continue;
+            }
+            *separator = '\0';
+
+            unsigned int failures = 0;
+            if (char *const count = std::strchr(separator + 1, '\t'); count != nullptr)
+            {
+                *count = '\0';
+                failures = static_cast<unsigned int>(std::strtoul(count + 1, nullptr, 10));
+            }
+
+            // An image that failed is queued again at the end, so it takes the place of its last record
+            entries[separator + 1] = { line, failures, order };
+        }
+
+        fclose(file);
+    }
+
+    std::vector<std::pair<const std::string, entry> *> ordered;
+    ordered.reserve(entries.size());
+    for (auto &record : entries)
+        ordered.push_back(&record);
+    std::sort(ordered.begin(), ordered.end(), [](const auto *a, const auto *b) { return a->second.order < b->second.order; });
+
+    for (const auto *record : ordered)
+    {
+        std::error_code ec{};
+        job job{ std::filesystem::u8path(record->first) };
+        if (job.bytes = std::filesystem::file_size(job.file, ec); ec)
+            continue;
+        job.failures = record->second.failures;
+
+        // Fall back to the default settings when the myset was deleted in the meantime
+        const std::string &name = record->second.name;
+        if (const auto it = std::find_if(mysets.begin(), mysets.end(), [&name](const screenshot_myset &myset) { return myset.name == name; }); it != mysets.end())
+            job.myset = std::make_shared<const screenshot_myset>(*it);
+        else
+            job.myset = std::make_shared<const screenshot_myset>();
+
+        _remaining_bytes += job.bytes;
+        _jobs.push_back(std::move(job));
+    }
+
+    // Start over with one record per image, which also drops the ones that were done and a partially written line at the end
+    save_backlog();
+
+    if (!_jobs.empty())
+        start();
+}
+
+void screenshot_transcoder::enqueue(const std::filesystem::path &file, std::shared_ptr<const screenshot_myset> myset, uint64_t bytes)
+{
+    {
+        std::lock_guard lock(_mutex);
+
+        _jobs.push_back({ file, std::move(myset), bytes });
+        _remaining_bytes += bytes;
+
+        append_backlog(_jobs.back(), false);
+
+        start();
+    }
+
+    _changed.notify_one();
+}
+
+void screenshot_transcoder::pause(bool paused)
+{
+    {
+        std::lock_guard lock(_mutex);
+
+        if (_paused == paused)
+            return;
+
+        _paused = paused;
+    }
+
+    _changed.notify_one();
+}
+
+void screenshot_transcoder::stop()
+{
+    {
+        std::lock_guard lock(_mutex);
+        _stopping = true;
+    }
+    _changed.notify_one();
+
+    if (_thread.joinable())
+        _thread.join();
+}
+
+size_t screenshot_transcoder::remaining() const noexcept
+{
+    std::lock_guard lock(_mutex);
+
+    return _jobs.size();
+}
+uint64_t screenshot_transcoder::remaining_bytes() const noexcept
+{
+    std::lock_guard lock(_mutex);
+
+    return _remaining_bytes;
+}
+
+void screenshot_transcoder::start()
+{
+    if (!_thread.joinable() && !_stopping)
+        _thread = std::thread(&screenshot_transcoder::transcoder_main, this);
+}
+
+void screenshot_transcoder::transcoder_main()
+{
+    // Lowers the disk and memory priority as well, so that the game and the workers always come first
+    SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+
+    std::unique_lock lock(_mutex);
+
+    while (true)
+    {
+        _changed.wait(lock, [this]() { return _stopping || (!_paused && !_jobs.empty()); });
+
+        if (_stopping)
+            break;
+
+        job job = _jobs.front();
+
+        lock.unlock();
+
+        const bool transcoded = transcode(job);
+
+        lock.lock();
+
+        _jobs.pop_front();
+
+        // Queue a failed image again at the end, so that the others are not held up by it, until it failed too often to expect it to ever work
+        if (!transcoded && ++job.failures < max_attempts)
+        {
+            reshade::log::message(reshade::log::level::warning, std::format("Failed to transcode raw screenshot, trying again later (attempt %u of %u)! \"%s\"", job.failures, max_attempts, job.file.u8string().c_str()).c_str());
+
+            append_backlog(job, false);
+            _jobs.push_back(std::move(job));
+            continue;
+        }
+
+        if (transcoded)
+            _completed++;
+        else
+            reshade::log::message(reshade::log::level::error, std::format("Failed to transcode raw screenshot %u times, leaving it as raw image! \"%s\"", job.failures, job.file.u8string().c_str()).c_str());
+
+        _remaining_bytes -= job.bytes;
+
+        if (_jobs.empty())
+            save_backlog();
+        else
+            append_backlog(job, true);
+    }
+}
+
+bool screenshot_transcoder::transcode(const job &job)
+{
+    if (_state.trace.is_recording())
+        _state.trace.set_thread_name("Screenshot transcoder");
+    screenshot_trace::span span(_state.trace, "Transcode");
+
+    // Encode with all settings of the myset, only in the format that was put off during the burst
+    if (_source_myset != job.myset)
+    {
+        const std::shared_ptr<screenshot_myset> target = std::make_shared<screenshot_myset>(*job.myset);
+        target->image_format = target->transcode_image_format;
+        // Takes are long over, so their archives were closed already
+        target->archive_takes = false;
+
+        _source_myset = job.myset;
+        _target_myset = target;
+    }
+
+    // Paths were expanded when the raw image was written, so the environment is not needed anymore
+    static const std::shared_ptr<const screenshot_environment> environment = std::make_shared<const screenshot_environment>();
+
+    screenshot screenshot(environment, _target_myset, _state, std::chrono::system_clock::time_point(), screenshot_statistics_scoped_data{}, screenshot_statistics_scoped_data{});
+
+    const screenshot_kind kind = screenshot.read_raw(job.file);
+    if (kind == screenshot_kind::unset)
+    {
+        _state.error_occurs++;
+        return false;
+    }
+
+    screenshot_timing timing;
+    screenshot.image_file = job.file;
+    if (!screenshot.write_image(kind, job.file.parent_path(), timing))
+        return false;
+
+    if (DeleteFileW(job.file.c_str()) == FALSE)
+    {
+        const std::error_code ec(GetLastError(), std::system_category());
+        reshade::log::message(reshade::log::level::warning, std::format("Failed to delete raw screenshot with error code %d! '%s' \"%s\"", ec.value(), format_message(ec.value()).c_str(), job.file.u8string().c_str()).c_str());
+    }
+
+    return true;
+}
+
+void screenshot_transcoder::append_backlog(const job &job, bool done)
+{
+    if (_backlog_path.empty())
+        return;
+
+    if (_backlog == nullptr && (_backlog = screenshot_platform::open_file(_backlog_path, "ab")) == nullptr)
+    {
+        reshade::log::message(reshade::log::level::error, std::format("Failed to open transcode backlog \"%s\"!", _backlog_path.u8string().c_str()).c_str());
+        return;
+    }
+
+    // Flushing hands the record to the system, which is all that is needed for it to survive the game crashing
+    const std::string record = backlog_record(job.myset->name, job.file, job.failures, done);
+    if (fwrite(record.data(), 1, record.size(), _backlog) != record.size() || fflush(_backlog) != 0)
+        reshade::log::message(reshade::log::level::error, std::format("Failed to write transcode backlog \"%s\"!", _backlog_path.u8string().c_str()).c_str());
+}
+
+void screenshot_transcoder::save_backlog()
+{
+    if (_backlog != nullptr)
+    {
+        fclose(_backlog);
+        _backlog = nullptr;
+    }
+
+    if (_backlog_path.empty())
+        return;
+
+    std::error_code ec{};
+    if (_jobs.empty())
+    {
+        std::filesystem::remove(_backlog_path, ec);
+        return;
+    }
+
+    // Goes through a temporary file, so that the previous records are still there if the game crashes meanwhile
+    screenshot_output output;
+    bool written = output.open(_backlog_path, 64 * 1024, ec);
+    for (auto it = _jobs.begin(); written && it != _jobs.end(); ++it)
+    {
+        const std::string record = backlog_record(it->myset->name, it->file, it->failures, false);
+        written = output.write(record.data(), record.size());
+    }
+
+    if (!written || !output.commit(std::chrono::system_clock::now(), ec))
+        reshade::log::message(reshade::log::level::error, std::format("Failed to write transcode backlog \"%s\"!", _backlog_path.u8string().c_str()).c_str());
+}
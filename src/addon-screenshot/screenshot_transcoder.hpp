@@ -0,0 +1,96 @@
+﻿/*
+ * SPDX-FileCopyrightText: 2018 seri14
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+class screenshot_myset;
+class screenshot_state;
+
+/// <summary>
+/// Converts raw images written during a burst into the format chosen in their myset, with the same encoder settings as saving them directly.
+/// Runs on a background priority thread and only while <see cref="pause"/> is not set, so that it does not compete with capturing and saving for processor time and the disk.
+/// Queued images are recorded in a backlog file as they come and go, so that the ones left when the game exits or crashes are picked up again on the next start.
+/// An image that fails to convert is tried again later, up to <see cref="max_attempts"/> times, after which it is left as raw image.
+/// </summary>
+class screenshot_transcoder
+{
+public:
+    explicit screenshot_transcoder(screenshot_state &state);
+    screenshot_transcoder(const screenshot_transcoder &) = delete;
+    screenshot_transcoder &operator=(const screenshot_transcoder &) = delete;
+    ~screenshot_transcoder();
+
+    /// <summary>
+    /// Queues the images listed in the backlog file at <paramref name="path"/>, which records all images queued from now on.
+    /// </summary>
+    /// <param name="mysets">Mysets to look up the settings of the listed images by name.</param>
+    void load(const std::filesystem::path &path, const std::list<screenshot_myset> &mysets);
+    /// <summary>
+    /// Queues the raw image at <paramref name="file"/> to be converted with the settings of <paramref name="myset"/>.
+    /// </summary>
+    void enqueue(const std::filesystem::path &file, std::shared_ptr<const screenshot_myset> myset, uint64_t bytes);
+    /// <summary>
+    /// Stops converting after the current image while <paramref name="paused"/> is set, e.g. while a myset is active.
+    /// </summary>
+    void pause(bool paused);
+    /// <summary>
+    /// Waits for the image that is converted right now and stops the thread for good. The images left stay queued for the backlog file.
+    /// Has to be called before anything the conversion uses is destroyed, e.g. the worker pool.
+    /// </summary>
+    void stop();
+
+    size_t remaining() const noexcept;
+    uint64_t remaining_bytes() const noexcept;
+    uint64_t completed() const noexcept { return _completed; }
+
+    /// <summary>
+    /// Number of times an image is tried to convert, in this and following runs, before it is left as raw image.
+    /// </summary>
+    static constexpr unsigned int max_attempts = 3;
+
+private:
+    struct job
+    {
+        std::filesystem::path file;
+        std::shared_ptr<const screenshot_myset> myset;
+        uint64_t bytes;
+        unsigned int failures = 0;
+    };
+
+    void start();
+    void transcoder_main();
+    bool transcode(const job &job);
+    void append_backlog(const job &job, bool done);
+    void save_backlog();
+
+    screenshot_state &_state;
+
+    mutable std::mutex _mutex;
+    std::condition_variable _changed;
+    // The image that is converted right now stays in front until it is done, so that it is still part of the backlog if the game exits meanwhile
+    std::deque<job> _jobs;
+    uint64_t _remaining_bytes = 0;
+    bool _paused = false;
+    bool _stopping = false;
+    std::thread _thread;
+    std::atomic<uint64_t> _completed = 0;
+
+    std::filesystem::path _backlog_path;
+    // Opened for appending on the first record after the backlog was written as a whole, protected by the mutex like the queue
+    FILE *_backlog = nullptr;
+
+    // Copy of the last myset with the format to convert to, only accessed by the transcoder thread
+    std::shared_ptr<const screenshot_myset> _source_myset, _target_myset;
+};
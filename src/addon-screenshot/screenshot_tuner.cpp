@@ -0,0 +1,188 @@
+﻿/*
+ * SPDX-FileCopyrightText: 2018 seri14
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "screenshot_tuner.hpp"
+#include "std_string_ext.hpp"
+
+#include <png.h>
+#include <zlib.h>
+
+#include <algorithm>
+
+// Frames that have to be saved with the same settings before they are judged, in addition to one for each worker
+constexpr size_t min_samples = 4;
+
+static bool is_zlib_format(unsigned int image_format)
+{
+    return image_format == 0 || image_format == 1 || image_format == 6 || image_format == 7 || image_format == 9 || image_format == 10;
+}
+
+static const char *get_strategy_name(int strategy)
+{
+    switch (strategy)
+    {
+        case Z_DEFAULT_STRATEGY:
+            return "default";
+        case Z_FILTERED:
+            return "filtered";
+        case Z_HUFFMAN_ONLY:
+            return "Huffman only";
+        case Z_RLE:
+            return "RLE";
+        case Z_FIXED:
+            return "fixed";
+        default:
+            return "unknown";
+    }
+}
+
+bool screenshot_encoder_tuner::is_tunable(const settings &settings)
+{
+    return is_zlib_format(settings.image_format);
+}
+
+std::string screenshot_encoder_tuner::describe(const settings &settings)
+{
+    switch (settings.image_format)
+    {
+        case 0:
+        case 1:
+        case 6:
+        case 7:
+        case 9:
+        case 10:
+            return std::format("%s with zlib level %d, %s strategy and PNG filters 0x%02X",
+                settings.image_format == 6 || settings.image_format == 7 ? "parallel libpng" : settings.image_format >= 9 ? "animated PNG" : "libpng",
+                settings.compression_level, get_strategy_name(settings.compression_strategy), settings.png_filters);
+        case 2:
+        case 3:
+            return "fpng";
+        default:
+            return std::format("image format %u", settings.image_format);
+    }
+}
+
+void screenshot_encoder_tuner::reset(const settings &initial, const void *key)
+{
+    std::lock_guard lock(_mutex);
+
+    _initial = initial;
+    _key = key;
+    _elapsed_total = {};
+    _samples = 0;
+    _interval_total = {};
+    _intervals = 0;
+    _changes = 0;
+}
+
+void screenshot_encoder_tuner::track(const void *key)
+{
+    std::lock_guard lock(_mutex);
+
+    _key = key;
+    _elapsed_total = {};
+    _samples = 0;
+    _interval_total = {};
+    _intervals = 0;
+}
+
+void screenshot_encoder_tuner::add_sample(const void *key, std::chrono::nanoseconds elapsed)
+{
+    std::lock_guard lock(_mutex);
+
+    if (key != _key)
+        return;
+
+    _elapsed_total += elapsed;
+    _samples++;
+}
+
+bool screenshot_encoder_tuner::update(std::chrono::nanoseconds capture_interval, size_t concurrency, settings &current, const void *key, std::string &change)
+{
+    std::lock_guard lock(_mutex);
+
+    if (key != _key)
+        return false;
+
+    _interval_total += capture_interval;
+    _intervals++;
+
+    concurrency = std::max<size_t>(1, concurrency);
+    if (_samples < min_samples + concurrency)
+        return false;
+
+    const std::chrono::nanoseconds elapsed = _elapsed_total / _samples;
+    const std::chrono::nanoseconds interval = _interval_total / _intervals;
+
+    _elapsed_total = {};
+    _samples = 0;
+    _interval_total = {};
+    _intervals = 0;
+
+    // Same comparison as the warning in the overlay, but over many frames instead of only the last one
+    if (elapsed / concurrency <= interval)
+        return false;
+
+    const std::string previous = describe(current);
+    if (std::string step; step_down(current, step))
+    {
+        change = std::format("Saving took %.1f ms per frame on %zu workers while frames were captured every %.1f ms, so %s (was %s).",
+            elapsed.count() / 1e6, concurrency, interval.count() / 1e6, step.c_str(), previous.c_str());
+
+        // Frames still saved with the old settings are not counted anymore
+        _key = nullptr;
+        _changes++;
+        return true;
+    }
+
+    return false;
+}
+
+bool screenshot_encoder_tuner::step_down(settings &settings, std::string &change)
+{
+    if (!is_zlib_format(settings.image_format))
+        return false;
+
+    // Searching for matches is what makes the high levels slow, RLE and Huffman only do not search at all, but libdeflate ignores the strategy
+    const bool searches_matches = settings.deflate_backend == screenshot_deflate_backend::libdeflate || (settings.compression_strategy != Z_RLE && settings.compression_strategy != Z_HUFFMAN_ONLY);
+    if (searches_matches && (settings.compression_level == Z_DEFAULT_COMPRESSION || settings.compression_level > 3))
+    {
+        settings.compression_level = 3;
+        change = "lowering the zlib level to 3";
+        return true;
+    }
+    if (searches_matches && settings.compression_level > Z_BEST_SPEED)
+    {
+        settings.compression_level = Z_BEST_SPEED;
+        change = "lowering the zlib level to 1";
+        return true;
+    }
+    // libdeflate has no strategies, so the level is all there is to lower
+    if (searches_matches && settings.deflate_backend != screenshot_deflate_backend::libdeflate)
+    {
+        settings.compression_strategy = Z_RLE;
+        change = "switching to the RLE strategy";
+        return true;
+    }
+
+    // All writers try every filter when none are chosen, like libpng
+    const int filters = settings.png_filters == PNG_NO_FILTERS ? PNG_ALL_FILTERS : settings.png_filters;
+    if ((filters & (filters - 1)) != 0)
+    {
+        // Each additional filter is tried on every row, and SUB alone compresses almost as well as all of them at a fraction of the cost
+        settings.png_filters = PNG_FILTER_SUB;
+        change = "using only the SUB PNG filter";
+        return true;
+    }
+
+    if (settings.allow_fpng && settings.image_format <= 7)
+    {
+        settings.image_format = settings.image_format % 2 == 0 ? 2 : 3;
+        change = "switching to fpng";
+        return true;
+    }
+
+    return false;
+}
@@ -0,0 +1,85 @@
+﻿/*
+ * SPDX-FileCopyrightText: 2018 seri14
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#pragma once
+
+#include "screenshot_deflate.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+/// <summary>
+/// Lowers the encoder settings of a take one step at a time while saving frames takes longer than capturing them, e.g. the zlib level, then the PNG filters and finally the encoder itself.
+/// Only frames saved with the current settings are measured, so that frames still queued from before a change do not cause another one.
+/// </summary>
+class screenshot_encoder_tuner
+{
+public:
+    struct settings
+    {
+        unsigned int image_format = 0;
+        int png_filters = 0;
+        int compression_level = -1;
+        int compression_strategy = 0;
+        /// <summary>
+        /// Backend that actually compresses, which is zlib if the one of the myset is not available.
+        /// </summary>
+        screenshot_deflate_backend deflate_backend = screenshot_deflate_backend::zlib;
+        /// <summary>
+        /// Whether the tuner may switch from zlib based PNG to fpng, which archived takes cannot.
+        /// </summary>
+        bool allow_fpng = true;
+    };
+
+    /// <summary>
+    /// Whether any step is possible with <paramref name="settings"/> at all, which is only the case for the zlib based PNG formats.
+    /// </summary>
+    static bool is_tunable(const settings &settings);
+    static std::string describe(const settings &settings);
+
+    /// <summary>
+    /// Starts a take with the settings of its myset. <paramref name="key"/> identifies the frames saved with them, e.g. the snapshot of the myset they hold on to.
+    /// </summary>
+    void reset(const settings &initial, const void *key);
+    /// <summary>
+    /// Measures the frames identified by <paramref name="key"/> from now on, after <see cref="update"/> changed the settings.
+    /// </summary>
+    void track(const void *key);
+    /// <summary>
+    /// Records how long it took to save all images of a frame, which is ignored unless it was saved with the current settings.
+    /// </summary>
+    void add_sample(const void *key, std::chrono::nanoseconds elapsed);
+    /// <summary>
+    /// Called for each captured frame with the time since the previous one. Lowers <paramref name="current"/> by a step once enough frames were saved too slowly.
+    /// The caller then has to save the following frames with the new settings and pass their key to <see cref="track"/>.
+    /// </summary>
+    /// <param name="change">Receives why and what was changed, to be written to the log.</param>
+    bool update(std::chrono::nanoseconds capture_interval, size_t concurrency, settings &current, const void *key, std::string &change);
+
+    /// <summary>
+    /// Number of steps taken since the take started.
+    /// </summary>
+    unsigned int changes() const noexcept { return _changes; }
+    const settings &initial() const noexcept { return _initial; }
+
+private:
+    static bool step_down(settings &settings, std::string &change);
+
+    std::mutex _mutex;
+    settings _initial;
+    const void *_key = nullptr;
+
+    // Totals since the last decision
+    std::chrono::nanoseconds _elapsed_total{};
+    size_t _samples = 0;
+    std::chrono::nanoseconds _interval_total{};
+    size_t _intervals = 0;
+
+    // Read by the render thread for the overlay
+    std::atomic<unsigned int> _changes = 0;
+};
@@ -0,0 +1,372 @@
+﻿/*
+ * SPDX-FileCopyrightText: 2018 seri14
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "screenshot_worker.hpp"
+
+#include <algorithm>
+
+screenshot_worker_pool::~screenshot_worker_pool()
+{
+    shutdown();
+}
+
+void screenshot_worker_pool::resize(size_t concurrency)
+{
+    if (concurrency == 0)
+        concurrency = std::max(1u, std::thread::hardware_concurrency());
+
+    std::lock_guard lock(_mutex);
+
+    if (_stopping)
+        return;
+
+    _concurrency = concurrency;
+
+    while (_threads.size() < _concurrency)
+        _threads.emplace_back(&screenshot_worker_pool::worker_main, this);
+
+    _jobs_available.notify_all();
+}
+
+void screenshot_worker_pool::submit(std::list<screenshot> &screenshots)
+{
+    if (screenshots.empty())
+        return;
+
+    const auto now = std::chrono::steady_clock::now();
+
+    uint64_t bytes = 0;
+    bool prepare = false;
+    for (screenshot &screenshot : screenshots)
+    {
+        bytes += screenshot.memory_usage();
+        prepare |= screenshot.pending_downscale || screenshot.pending_spill;
+        screenshot.enqueue_time = now;
+    }
+
+    const size_t count = screenshots.size();
+
+    std::lock_guard lock(_mutex);
+
+    if (prepare && !_stopping)
+    {
+        if (!_prepare_thread.joinable())
+            _prepare_thread = std::thread(&screenshot_worker_pool::prepare_main, this);
+
+        _prepare_available.notify_one();
+    }
+
+    // The list is filled front to back with the newest screenshot in front, so append in reverse to keep the queue in capture order
+    screenshots.reverse();
+    _jobs.splice(_jobs.end(), screenshots);
+    _queued_bytes += bytes;
+
+    for (size_t i = 0; i < count; i++)
+        _jobs_available.notify_one();
+}
+
+void screenshot_worker_pool::submit(std::function<void()> task)
+{
+    std::lock_guard lock(_mutex);
+
+    _tasks.push_back(std::move(task));
+    _jobs_available.notify_one();
+}
+
+bool screenshot_worker_pool::drop_oldest()
+{
+    std::list<screenshot> dropped;
+    {
+        std::lock_guard lock(_mutex);
+
+        // Screenshots that were spilled to disk do not take up any memory, so dropping them would not help
+        const auto it = std::find_if(_jobs.begin(), _jobs.end(), [this](const screenshot &screenshot) { return screenshot.memory_usage() != 0 && &screenshot != _preparing; });
+        if (it == _jobs.end())
+            return false;
+
+        dropped.splice(dropped.end(), _jobs, it);
+        _queued_bytes -= dropped.front().memory_usage();
+    }
+
+    // Pixel buffers go back to the pool outside the lock
+    return true;
+}
+
+void screenshot_worker_pool::parallel_for(size_t count, const std::function<void(size_t)> &fn)
+{
+    if (count == 0)
+        return;
+
+    batch batch{ &fn, count };
+
+    std::unique_lock lock(_mutex);
+
+    _batches.push_back(&batch);
+    _jobs_available.notify_all();
+
+    // When fn throws on this thread, the rest of the batch is no longer handed out, and the parts workers already run are waited for, since they still use the batch on this stack
+    struct batch_guard
+    {
+        screenshot_worker_pool &pool;
+        struct batch &target;
+        std::unique_lock<std::mutex> &lock;
+
+        ~batch_guard()
+        {
+            // The lock is only released while fn runs, so it is not held only when that threw
+            if (lock.owns_lock())
+                return;
+
+            lock.lock();
+
+            pool._batches.remove(&target);
+            target.count = target.next;
+            target.finished++;
+
+            pool._batch_finished.wait(lock, [this]() { return target.finished == target.count; });
+        }
+    } guard{ *this, batch, lock };
+
+    // The calling thread takes part as well, so that this completes even when no worker is idle
+    while (batch.next < batch.count)
+    {
+        const size_t index = claim(batch);
+
+        lock.unlock();
+        fn(index);
+        lock.lock();
+
+        batch.finished++;
+    }
+
+    _batch_finished.wait(lock, [&batch]() { return batch.finished == batch.count; });
+
+    // A part that threw on a worker is reported here, where the caller can handle it
+    if (batch.error)
+        std::rethrow_exception(batch.error);
+}
+
+size_t screenshot_worker_pool::claim(batch &batch)
+{
+    const size_t index = batch.next++;
+
+    // Nothing left to hand out, so stop offering it to other threads
+    if (batch.next == batch.count)
+        _batches.remove(&batch);
+
+    return index;
+}
+
+void screenshot_worker_pool::fail(batch &batch, std::exception_ptr error)
+{
+    if (!batch.error)
+        batch.error = std::move(error);
+
+    // Parts that were not handed out yet are skipped, so only the ones still running are waited for
+    _batches.remove(&batch);
+    batch.count = batch.next;
+}
+
+void screenshot_worker_pool::shutdown()
+{
+    std::vector<std::thread> threads;
+    {
+        std::lock_guard lock(_mutex);
+
+        _stopping = true;
+        _jobs_available.notify_all();
+        _prepare_available.notify_all();
+
+        threads.swap(_threads);
+
+        if (_prepare_thread.joinable())
+            threads.push_back(std::move(_prepare_thread));
+    }
+
+    for (std::thread &thread : threads)
+    {
+        if (thread.joinable())
+            thread.join();
+    }
+}
+
+size_t screenshot_worker_pool::threads() const noexcept
+{
+    std::lock_guard lock(_mutex);
+
+    return _threads.size();
+}
+size_t screenshot_worker_pool::concurrency() const noexcept
+{
+    std::lock_guard lock(_mutex);
+
+    return _concurrency;
+}
+size_t screenshot_worker_pool::active() const noexcept
+{
+    std::lock_guard lock(_mutex);
+
+    return _active;
+}
+size_t screenshot_worker_pool::queued() const noexcept
+{
+    std::lock_guard lock(_mutex);
+
+    return _jobs.size() + _tasks.size();
+}
+uint64_t screenshot_worker_pool::queued_bytes() const noexcept
+{
+    std::lock_guard lock(_mutex);
+
+    return _queued_bytes;
+}
+
+void screenshot_worker_pool::worker_main()
+{
+    std::unique_lock lock(_mutex);
+
+    while (true)
+    {
+        // Remaining jobs are still finished after a shutdown was requested, so that no captured frame is lost
+        // The screenshot that is prepared right now stays in the queue, but is left alone until that is done
+        const auto available = [this]() { return !_tasks.empty() || _jobs.size() > (_preparing != nullptr ? 1u : 0u); };
+        _jobs_available.wait(lock, [this, &available]() { return !_batches.empty() || (available() && (_active < _concurrency || _stopping)) || (_stopping && _jobs.empty() && _tasks.empty()); });
+
+        // Help finishing a screenshot that is already being saved before starting on the next one
+        if (!_batches.empty())
+        {
+            batch &batch = *_batches.front();
+            const size_t index = claim(batch);
+
+            lock.unlock();
+            std::exception_ptr error;
+            try
+            {
+                (*batch.fn)(index);
+            }
+            catch (...)
+            {
+                error = std::current_exception();
+            }
+            lock.lock();
+
+            if (error)
+                fail(batch, std::move(error));
+
+            if (++batch.finished == batch.count)
+                _batch_finished.notify_all();
+            continue;
+        }
+
+        if (_jobs.empty() && _tasks.empty())
+            break;
+        if (!available())
+            continue;
+
+        if (!_tasks.empty())
+        {
+            const std::function<void()> task = std::move(_tasks.front());
+            _tasks.pop_front();
+
+            _active++;
+
+            lock.unlock();
+            try
+            {
+                task();
+            }
+            catch (const std::exception &e)
+            {
+                reshade::log::message(reshade::log::level::error, std::format("Screenshot worker task failed with exception '%s'!", e.what()).c_str());
+            }
+            catch (...)
+            {
+                reshade::log::message(reshade::log::level::error, "Screenshot worker task failed with an unknown exception!");
+            }
+            lock.lock();
+
+            _active--;
+
+            _jobs_available.notify_one();
+            continue;
+        }
+
+        std::list<screenshot> job;
+        job.splice(job.end(), _jobs, &_jobs.front() != _preparing ? _jobs.begin() : std::next(_jobs.begin()));
+
+        _active++;
+        _queued_bytes -= job.front().memory_usage();
+
+        lock.unlock();
+
+        // Images that failed on their own were already reported, this only catches what went wrong around them, so that it does not take the application down with it
+        try
+        {
+            job.front().save_image();
+        }
+        catch (const std::exception &e)
+        {
+            job.front().state.error_occurs++;
+            reshade::log::message(reshade::log::level::error, std::format("Failed to save screenshot with exception '%s'!", e.what()).c_str());
+        }
+        catch (...)
+        {
+            job.front().state.error_occurs++;
+            reshade::log::message(reshade::log::level::error, "Failed to save screenshot with an unknown exception!");
+        }
+        job.clear();
+
+        lock.lock();
+
+        _active--;
+        _completed++;
+
+        _jobs_available.notify_one();
+    }
+}
+void screenshot_worker_pool::prepare_main()
+{
+    std::unique_lock lock(_mutex);
+
+    while (true)
+    {
+        auto it = _jobs.end();
+        _prepare_available.wait(lock, [this, &it]() {
+            it = std::find_if(_jobs.begin(), _jobs.end(), [](const screenshot &screenshot) { return screenshot.pending_downscale || screenshot.pending_spill; });
+            return it != _jobs.end() || _stopping;
+        });
+
+        // Whatever is left is downscaled by the workers right before saving, and no longer spilled
+        if (_stopping)
+            break;
+
+        screenshot &screenshot = *it;
+        const uint64_t bytes = screenshot.memory_usage();
+        _preparing = &screenshot;
+
+        lock.unlock();
+        try
+        {
+            screenshot.prepare();
+        }
+        catch (const std::exception &e)
+        {
+            reshade::log::message(reshade::log::level::error, std::format("Failed to prepare screenshot with exception '%s'!", e.what()).c_str());
+        }
+        catch (...)
+        {
+            reshade::log::message(reshade::log::level::error, "Failed to prepare screenshot with an unknown exception!");
+        }
+        // Whatever failed is not tried again, the screenshot is saved as it is
+        screenshot.pending_downscale = false;
+        screenshot.pending_spill = false;
+        lock.lock();
+
+        _preparing = nullptr;
+        _queued_bytes -= bytes - screenshot.memory_usage();
+
+        _jobs_available.notify_all();
+    }
+}
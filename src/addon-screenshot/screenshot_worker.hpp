@@ -0,0 +1,102 @@
+﻿/*
+ * SPDX-FileCopyrightText: 2018 seri14
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#pragma once
+
+#include "screenshot.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// <summary>
+/// Persistent set of threads that encode queued screenshots.
+/// Threads are created on demand and kept alive until <see cref="shutdown"/>, while the number of screenshots encoded at the same time is bounded by the concurrency.
+/// Queued screenshots that were marked for downscaling or spilling are prepared by a separate background thread while they wait.
+/// </summary>
+class screenshot_worker_pool
+{
+public:
+    screenshot_worker_pool() = default;
+    screenshot_worker_pool(const screenshot_worker_pool &) = delete;
+    screenshot_worker_pool &operator=(const screenshot_worker_pool &) = delete;
+    ~screenshot_worker_pool();
+
+    /// <summary>
+    /// Sets the maximum number of screenshots that are encoded at the same time and starts additional threads when required.
+    /// </summary>
+    /// <param name="concurrency">Number of workers, or zero to use one per hardware thread.</param>
+    void resize(size_t concurrency);
+    /// <summary>
+    /// Moves all screenshots from the list to the end of the job queue.
+    /// </summary>
+    void submit(std::list<screenshot> &screenshots);
+    /// <summary>
+    /// Queues a task that is run by the next idle worker, ahead of any queued screenshot.
+    /// Used for finishing work that would otherwise stall the render thread, and counted as queued and active like a screenshot.
+    /// </summary>
+    void submit(std::function<void()> task);
+    /// <summary>
+    /// Discards the oldest queued screenshot that still holds pixel data in memory.
+    /// </summary>
+    /// <returns><see langword="true"/> if a screenshot was discarded.</returns>
+    bool drop_oldest();
+    /// <summary>
+    /// Calls <paramref name="fn"/> for every index below <paramref name="count"/>, spread across the calling thread and all idle workers, and returns once all calls finished.
+    /// Used to split a single large screenshot into parts that are encoded concurrently.
+    /// When a call throws, no further parts are started and the first exception is rethrown on the calling thread once the running ones finished.
+    /// </summary>
+    void parallel_for(size_t count, const std::function<void(size_t)> &fn);
+    /// <summary>
+    /// Finishes all queued screenshots and joins the threads.
+    /// </summary>
+    void shutdown();
+
+    size_t threads() const noexcept;
+    size_t concurrency() const noexcept;
+    size_t active() const noexcept;
+    size_t queued() const noexcept;
+    uint64_t queued_bytes() const noexcept;
+    uint64_t completed() const noexcept { return _completed; }
+
+private:
+    struct batch
+    {
+        const std::function<void(size_t)> *fn;
+        size_t count;
+        size_t next = 0;
+        size_t finished = 0;
+        std::exception_ptr error = nullptr;
+    };
+
+    void worker_main();
+    void prepare_main();
+    size_t claim(batch &batch);
+    void fail(batch &batch, std::exception_ptr error);
+
+    mutable std::mutex _mutex;
+    std::condition_variable _jobs_available;
+    std::condition_variable _batch_finished;
+    std::condition_variable _prepare_available;
+    std::list<screenshot> _jobs;
+    std::list<std::function<void()>> _tasks;
+    std::list<batch *> _batches;
+    std::vector<std::thread> _threads;
+    std::thread _prepare_thread;
+    /// <summary>
+    /// Queued screenshot that is prepared right now, which stays in the queue but is not taken by a worker until it is done.
+    /// </summary>
+    const screenshot *_preparing = nullptr;
+    size_t _concurrency = 0;
+    size_t _active = 0;
+    uint64_t _queued_bytes = 0;
+    bool _stopping = false;
+    std::atomic<uint64_t> _completed = 0;
+};
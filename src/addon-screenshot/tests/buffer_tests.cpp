@@ -0,0 +1,60 @@
+﻿/*
+ * SPDX-FileCopyrightText: 2018 seri14
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "screenshot_tests.hpp"
+#include "screenshot_buffer.hpp"
+
+#include <cstdint>
+#include <new>
+
+using reshade::api::format;
+
+SCREENSHOT_TEST(buffer, reuse)
+{
+    screenshot_buffer_pool pool;
+
+    screenshot_buffer buffer = pool.acquire(16, 8, format::r8g8b8a8_unorm, 16 * 8);
+    const uint32_t *const data = buffer.data();
+    SCREENSHOT_CHECK(pool.used_bytes() == 16 * 8 * 4 && pool.cached_bytes() == 0, "Handed out %llu bytes and cached %llu instead of 512 and 0", static_cast<unsigned long long>(pool.used_bytes()), static_cast<unsigned long long>(pool.cached_bytes()));
+
+    buffer.reset();
+    SCREENSHOT_CHECK(pool.used_bytes() == 0 && pool.cached_bytes() == 16 * 8 * 4, "Released buffer was not cached");
+
+    // A different format is a different class of buffer, even with the same size
+    screenshot_buffer other = pool.acquire(16, 8, format::b8g8r8a8_unorm, 16 * 8);
+    buffer = pool.acquire(16, 8, format::r8g8b8a8_unorm, 16 * 8);
+    SCREENSHOT_CHECK(buffer.data() == data && pool.allocations() == 2, "Released buffer was not reused, %llu allocations", static_cast<unsigned long long>(pool.allocations()));
+
+    buffer.reset();
+    other.reset();
+    pool.trim();
+    SCREENSHOT_CHECK(pool.cached_bytes() == 0, "Trimming kept %llu bytes", static_cast<unsigned long long>(pool.cached_bytes()));
+}
+
+SCREENSHOT_TEST(buffer, failed_allocation)
+{
+    screenshot_buffer_pool pool;
+
+    screenshot_buffer kept = pool.acquire(16, 8, format::r8g8b8a8_unorm, 16 * 8);
+
+    // Larger than any allocation can be, so that it throws without touching memory
+    bool thrown = false;
+    try
+    {
+        pool.acquire(16, 8, format::r8g8b8a8_unorm, SIZE_MAX / 2);
+    }
+    catch (const std::bad_alloc &)
+    {
+        thrown = true;
+    }
+
+    SCREENSHOT_CHECK(thrown, "Impossible allocation did not throw");
+    SCREENSHOT_CHECK(pool.used_bytes() == 16 * 8 * 4 && pool.cached_bytes() == 0 && pool.allocations() == 1, "Failed allocation changed the pool");
+
+    // The pool still hands out and takes back buffers afterwards
+    kept.reset();
+    screenshot_buffer buffer = pool.acquire(16, 8, format::r8g8b8a8_unorm, 16 * 8);
+    SCREENSHOT_CHECK(!buffer.empty() && pool.allocations() == 1, "Pool did not reuse its buffer after a failed allocation");
+}
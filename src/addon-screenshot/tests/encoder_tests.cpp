@@ -0,0 +1,291 @@
+﻿/*
+ * SPDX-FileCopyrightText: 2018 seri14
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+// Writes images with the encoders and decodes them again with libpng and libtiff, which have to give back exactly the pixels that went in.
+
+#include "screenshot_tests.hpp"
+#include "screenshot_encoder.hpp"
+#include "screenshot_output.hpp"
+#include "screenshot_platform.hpp"
+
+#include <png.h>
+#include <tiffio.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <csetjmp>
+#include <cstring>
+#include <filesystem>
+#include <thread>
+
+// Odd sizes, so that neither bands, strips nor tiles divide the image evenly
+constexpr uint32_t image_width = 333;
+constexpr uint32_t image_height = 211;
+
+static std::filesystem::path get_output_path(const char *file_name)
+{
+    const std::filesystem::path directory = std::filesystem::temp_directory_path() / "screenshot_tests";
+    std::filesystem::create_directories(directory);
+    return directory / file_name;
+}
+
+/// <summary>
+/// Runs a parallel_for on a new set of threads each time, which is all the encoders need of the worker pool.
+/// </summary>
+static screenshot_encoder::parallel_for_fn make_parallel_for(unsigned int threads)
+{
+    if (threads <= 1)
+        return {};
+
+    return [threads](size_t count, const std::function<void(size_t)> &fn) {
+        std::atomic<size_t> next = 0;
+        const auto run = [&next, count, &fn]() {
+            for (size_t index; (index = next.fetch_add(1)) < count;)
+                fn(index);
+        };
+
+        std::vector<std::thread> pool;
+        for (unsigned int i = 1; i < threads; i++)
+            pool.emplace_back(run);
+        run();
+        for (std::thread &thread : pool)
+            thread.join();
+    };
+}
+
+/// <summary>
+/// Builds pixels with flat areas, gradients and noise, so that every PNG filter and the matcher of each compressor get something to do.
+/// </summary>
+static std::vector<uint8_t> make_pixels(size_t pixel_size, uint32_t seed)
+{
+    screenshot_tests::random random(seed);
+
+    std::vector<uint8_t> pixels(pixel_size * image_width * image_height);
+    for (size_t i = 0; i < pixels.size(); i++)
+        pixels[i] = i % 7 == 0 ? static_cast<uint8_t>(random.next()) : static_cast<uint8_t>(i / 97);
+    return pixels;
+}
+
+static std::vector<uint8_t> make_depth(uint32_t seed)
+{
+    screenshot_tests::random random(seed);
+
+    std::vector<uint8_t> pixels(sizeof(float) * image_width * image_height);
+    for (size_t i = 0; i < pixels.size() / sizeof(float); i++)
+    {
+        const float depth = i % 11 == 0 ? static_cast<float>(random.next()) / 4e9f : 0.25f + (i % image_width) * 1e-3f;
+        std::memcpy(pixels.data() + sizeof(float) * i, &depth, sizeof(depth));
+    }
+    return pixels;
+}
+
+static bool read_png(const std::filesystem::path &path, unsigned int channels, unsigned int bit_depth, std::vector<uint8_t> &pixels)
+{
+    FILE *const file = screenshot_platform::open_file(path, "rb");
+    if (file == nullptr)
+        return false;
+
+    png_structp png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+    png_infop info_ptr = png_create_info_struct(png_ptr);
+
+    std::vector<png_bytep> rows;
+
+    bool succeeded = false;
+    if (setjmp(png_jmpbuf(png_ptr)) == 0)
+    {
+        png_init_io(png_ptr, file);
+        png_read_info(png_ptr, info_ptr);
+
+        if (png_get_image_width(png_ptr, info_ptr) == image_width && png_get_image_height(png_ptr, info_ptr) == image_height &&
+            png_get_channels(png_ptr, info_ptr) == channels && png_get_bit_depth(png_ptr, info_ptr) == bit_depth)
+        {
+            // The encoders take 16-bit samples in the byte order of the processor
+            if (const uint16_t one = 1; bit_depth == 16 && *reinterpret_cast<const uint8_t *>(&one) == 1)
+                png_set_swap(png_ptr);
+
+            const size_t row_size = static_cast<size_t>(image_width) * channels * bit_depth / 8;
+            pixels.assign(row_size * image_height, 0);
+            for (uint32_t y = 0; y < image_height; y++)
+                rows.push_back(pixels.data() + row_size * y);
+
+            png_read_image(png_ptr, rows.data());
+            png_read_end(png_ptr, nullptr);
+            succeeded = true;
+        }
+    }
+
+    png_destroy_read_struct(&png_ptr, &info_ptr, nullptr);
+    fclose(file);
+    return succeeded;
+}
+
+static bool read_tiff(const std::filesystem::path &path, size_t pixel_size, std::vector<uint8_t> &pixels)
+{
+    TIFF *const tif = TIFFOpen(path.u8string().c_str(), "r");
+    if (tif == nullptr)
+        return false;
+
+    uint32_t width = 0, height = 0;
+    TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &width);
+    TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &height);
+
+    bool succeeded = width == image_width && height == image_height;
+    if (succeeded)
+        pixels.assign(pixel_size * width * height, 0);
+
+    if (succeeded && TIFFIsTiled(tif))
+    {
+        uint32_t tile_width = 0, tile_height = 0;
+        TIFFGetField(tif, TIFFTAG_TILEWIDTH, &tile_width);
+        TIFFGetField(tif, TIFFTAG_TILELENGTH, &tile_height);
+
+        std::vector<uint8_t> tile(pixel_size * tile_width * tile_height);
+        const uint32_t tiles_across = (width + tile_width - 1) / tile_width;
+
+        // Tiles along the right and bottom edge are padded to the full size
+        for (uint32_t i = 0; succeeded && i < TIFFNumberOfTiles(tif); i++)
+        {
+            succeeded = TIFFReadEncodedTile(tif, i, tile.data(), static_cast<tmsize_t>(tile.size())) == static_cast<tmsize_t>(tile.size());
+
+            const uint32_t x = i % tiles_across * tile_width, y = i / tiles_across * tile_height;
+            for (uint32_t row = 0; succeeded && row < tile_height && y + row < height; row++)
+                std::memcpy(pixels.data() + pixel_size * (static_cast<size_t>(y + row) * width + x), tile.data() + pixel_size * tile_width * row, pixel_size * std::min(tile_width, width - x));
+        }
+    }
+    else if (succeeded)
+    {
+        size_t offset = 0;
+        for (uint32_t i = 0; succeeded && i < TIFFNumberOfStrips(tif); i++)
+        {
+            const tmsize_t size = TIFFReadEncodedStrip(tif, i, pixels.data() + offset, static_cast<tmsize_t>(pixels.size() - offset));
+            succeeded = size > 0;
+            offset += static_cast<size_t>(size);
+        }
+
+        succeeded = succeeded && offset == pixels.size();
+    }
+
+    TIFFClose(tif);
+    return succeeded;
+}
+
+static std::vector<screenshot_deflate_backend> get_deflate_backends()
+{
+    std::vector<screenshot_deflate_backend> backends = { screenshot_deflate_backend::zlib };
+    if (screenshot_deflate::is_available(screenshot_deflate_backend::libdeflate))
+        backends.push_back(screenshot_deflate_backend::libdeflate);
+    return backends;
+}
+
+SCREENSHOT_TEST(png, round_trip)
+{
+    const std::filesystem::path path = get_output_path("round_trip.png");
+
+    for (const unsigned int channels : { 3u, 4u })
+    {
+        for (const unsigned int bit_depth : { 8u, 16u })
+        {
+            const std::vector<uint8_t> expected = make_pixels(channels * bit_depth / 8, channels * bit_depth);
+
+            for (const screenshot_deflate_backend backend : get_deflate_backends())
+            {
+                for (const int png_filters : { PNG_NO_FILTERS, PNG_FILTER_SUB, PNG_FILTER_PAETH, PNG_ALL_FILTERS })
+                {
+                    for (const bool parallel : { false, true })
+                    {
+                        screenshot_encoder encoder;
+                        encoder.deflate_backend = backend;
+                        encoder.png_filters = png_filters;
+                        encoder.compression_level = 6;
+                        encoder.compression_strategy = Z_RLE;
+
+                        // The parallel writer swaps 16-bit samples in place
+                        std::vector<uint8_t> pixels = expected;
+
+                        std::error_code ec;
+                        screenshot_output output;
+                        bool succeeded = output.open(path, 64 * 1024, ec);
+                        succeeded = succeeded && (parallel ?
+                            encoder.write_parallel_png(output, pixels.data(), image_width, image_height, channels, bit_depth, 0, make_parallel_for(3)) :
+                            encoder.write_png(output, pixels.data(), image_width, image_height, channels, bit_depth, 0));
+                        succeeded = succeeded && output.commit(std::chrono::system_clock::now(), ec);
+
+                        std::vector<uint8_t> actual;
+                        SCREENSHOT_CHECK(succeeded && read_png(path, channels, bit_depth, actual) && actual == expected,
+                            "%s PNG with %u channels of %u bits, %s and filters 0x%02X did not decode to the same pixels",
+                            parallel ? "Parallel" : "libpng", channels, bit_depth, screenshot_deflate::get_backend_name(backend), png_filters);
+                    }
+                }
+            }
+        }
+    }
+
+    std::filesystem::remove(path);
+}
+
+SCREENSHOT_TEST(tiff, round_trip)
+{
+    const std::filesystem::path path = get_output_path("round_trip.tiff");
+
+    struct layout
+    {
+        unsigned int channels;
+        unsigned int bit_depth;
+    };
+
+    for (const layout layout : { layout{ 3, 8 }, layout{ 4, 8 }, layout{ 3, 16 }, layout{ 4, 16 }, layout{ 1, 32 } })
+    {
+        const size_t pixel_size = layout.channels * layout.bit_depth / 8;
+        const std::vector<uint8_t> expected = layout.bit_depth == 32 ? make_depth(1) : make_pixels(pixel_size, layout.channels * layout.bit_depth);
+
+        for (const int compression : { COMPRESSION_NONE, COMPRESSION_LZW, COMPRESSION_ADOBE_DEFLATE })
+        {
+            for (const screenshot_deflate_backend backend : get_deflate_backends())
+            {
+                if (compression != COMPRESSION_ADOBE_DEFLATE && backend != screenshot_deflate_backend::zlib)
+                    continue;
+
+                // A single row per strip, a few rows, the default, everything in one strip, and tiles that do or do not divide the image
+                struct chunking
+                {
+                    size_t strip_size;
+                    uint32_t tile_size;
+                } const chunkings[] = { { 1, 0 }, { 4096, 0 }, { 256 * 1024, 0 }, { size_t(1) << 30, 0 }, { 0, 16 }, { 0, 100 } };
+
+                for (const chunking chunking : chunkings)
+                {
+                    for (const unsigned int threads : { 1u, 3u })
+                    {
+                        screenshot_encoder encoder;
+                        encoder.deflate_backend = backend;
+                        encoder.tiff_compression = compression;
+                        encoder.compression_level = 6;
+                        encoder.tiff_strip_size = chunking.strip_size != 0 ? chunking.strip_size : encoder.tiff_strip_size;
+                        encoder.tiff_tile_size = chunking.tile_size;
+
+                        // Neither writer may change the pixels it was given
+                        const std::vector<uint8_t> pixels = expected;
+
+                        std::error_code ec;
+                        screenshot_output output;
+                        bool succeeded = output.open(path, 64 * 1024, ec);
+                        succeeded = succeeded && (layout.bit_depth == 32 ?
+                            encoder.write_depth_tiff(output, reinterpret_cast<const float *>(pixels.data()), image_width, image_height, 0, make_parallel_for(threads)) :
+                            encoder.write_tiff(output, pixels.data(), image_width, image_height, layout.channels, layout.bit_depth, 0, make_parallel_for(threads)));
+                        succeeded = succeeded && output.commit(std::chrono::system_clock::now(), ec);
+
+                        std::vector<uint8_t> actual;
+                        SCREENSHOT_CHECK(succeeded && pixels == expected && read_tiff(path, pixel_size, actual) && actual == expected,
+                            "TIFF with %u channels of %u bits, compression %d with %s, strips of %zu bytes, tiles of %u and %u threads did not decode to the same pixels",
+                            layout.channels, layout.bit_depth, compression, screenshot_deflate::get_backend_name(backend), encoder.tiff_strip_size, chunking.tile_size, threads);
+                    }
+                }
+            }
+        }
+    }
+
+    std::filesystem::remove(path);
+}
@@ -0,0 +1,183 @@
+﻿/*
+ * SPDX-FileCopyrightText: 2018 seri14
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "screenshot_tests.hpp"
+#include "screenshot_path.hpp"
+#include "screenshot_platform.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cinttypes>
+#include <ctime>
+#include <functional>
+#include <iterator>
+#include <list>
+
+static bool equals_ignore_case(const std::string &a, const std::string &b)
+{
+    return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) { return std::toupper(static_cast<unsigned char>(x)) == std::toupper(static_cast<unsigned char>(y)); });
+}
+
+/// <summary>
+/// Expander that paths were resolved with before they were compiled into templates, kept as the reference the templates have to match.
+/// Only the values come from <see cref="screenshot_path_template::values"/> instead of the screenshot and the statistics.
+/// </summary>
+static std::string expand_macro_string(const screenshot_path_template::values &values, const std::string &input)
+{
+    std::list<std::pair<std::string, std::function<std::string(std::string_view)>>> macros;
+
+    const auto number = [](std::string_view fmt, uint64_t value) {
+        if (fmt.empty())
+            fmt = "D1";
+        bool zeroed = false;
+        if (fmt[0] == 'D' || fmt[0] == 'd')
+            zeroed = true;
+        int digits = 1;
+        if (fmt.size() == 1 && '1' <= fmt[0] && fmt[0] <= '9')
+            digits = fmt[0] - '0';
+        if (fmt.size() == 2 && '1' <= fmt[1] && fmt[1] <= '9')
+            digits = fmt[1] - '0';
+        return std::format(zeroed ? "%0*" PRIu64 : "%*" PRIu64, digits, value);
+    };
+
+    macros.emplace_back("APP", [&values](std::string_view) { return values.app; });
+    macros.emplace_back("PRESET", [&values](std::string_view) { return values.preset; });
+    macros.emplace_back("TOTALFRAME", [&values, &number](std::string_view fmt) { return number(fmt, values.total_frame); });
+    macros.emplace_back("MYSETFRAME", [&values, &number](std::string_view fmt) { return number(fmt, values.myset_frame); });
+    macros.emplace_back("TOTALTAKE", [&values, &number](std::string_view fmt) { return number(fmt, values.total_take); });
+    macros.emplace_back("MYSETTAKE", [&values, &number](std::string_view fmt) { return number(fmt, values.myset_take); });
+    macros.emplace_back("INDEX", [&values, &number](std::string_view fmt) { return number(fmt, values.index); });
+    macros.emplace_back("DATE",
+        [&values](std::string_view fmt) {
+            const std::time_t t = std::chrono::system_clock::to_time_t(values.time);
+            struct tm tm = {};
+            screenshot_platform::to_local_time(t, tm);
+            if (fmt.empty())
+                fmt = "%Y-%m-%d %H-%M-%S";
+            char str[128] = "";
+            const std::string tailzeroed_fmt = std::string(fmt);
+            size_t len = strftime(str, std::size(str), tailzeroed_fmt.c_str(), &tm);
+            return std::string(str, len);
+        });
+
+    std::string result;
+
+    for (size_t offset = 0, macro_beg = std::string::npos, macro_end = std::string::npos;
+        offset < input.size();
+        offset = macro_end + 1)
+    {
+        macro_beg = input.find('<', offset);
+        macro_end = input.find('>', macro_beg + 1);
+
+        if (macro_beg == std::string::npos || macro_end == std::string::npos)
+        {
+            result += input.substr(offset);
+            break;
+        }
+        else
+        {
+            result += input.substr(offset, macro_beg - offset);
+        }
+
+        std::string_view replacing = std::string_view(input).substr(macro_beg + 1, macro_end - (macro_beg + 1));
+        size_t colon_pos = replacing.find(':');
+
+        std::string name;
+        if (colon_pos == std::string::npos)
+            name = replacing;
+        else
+            name = replacing.substr(0, colon_pos);
+
+        std::string value;
+
+        for (const auto &macro : macros)
+        {
+            if (equals_ignore_case(name, macro.first))
+            {
+                std::string_view fmt;
+                if (colon_pos != std::string::npos)
+                    fmt = replacing.substr(colon_pos + 1);
+                value = macro.second(fmt);
+                break;
+            }
+        }
+
+        result += value;
+    }
+
+    return result;
+}
+
+static screenshot_path_template::values make_values()
+{
+    screenshot_path_template::values values;
+    values.app = "Game";
+    values.preset = "MyPreset";
+    values.total_frame = 12345;
+    values.myset_frame = 42;
+    values.total_take = 7;
+    values.myset_take = 3;
+    values.index = 5;
+    // A fixed time, so that a date macro cannot expand differently for the two calls when the second changes in between
+    values.time = std::chrono::system_clock::from_time_t(1700000000);
+    return values;
+}
+
+SCREENSHOT_TEST(path, default_paths)
+{
+    const screenshot_path_template::values values = make_values();
+
+    const char *const paths[] = {
+        "",
+        "Screenshots/<APP> <DATE>.png",
+        "Screenshots/<APP>/<DATE:%Y-%m-%d>/<APP> <DATE> <MYSETFRAME:D6>_<INDEX:D3> original.png",
+        "<PRESET>_<TOTALFRAME:5>_<TOTALTAKE:d2>_<MYSETTAKE>_<index:D9>.ini",
+    };
+
+    std::string actual;
+    for (const char *path : paths)
+    {
+        screenshot_path_template(path).expand(values, actual);
+
+        const std::string expected = expand_macro_string(values, path);
+        SCREENSHOT_CHECK(actual == expected, "'%s' expanded to '%s' instead of '%s'", path, actual.c_str(), expected.c_str());
+    }
+}
+
+SCREENSHOT_TEST(path, random_paths)
+{
+    const screenshot_path_template::values values = make_values();
+
+    // Pieces that form valid, malformed, unknown and nested macros when put together at random
+    const char *const pieces[] = {
+        "<", ">", ":", "a", "/", "APP", "preset", "TOTALFRAME", "MysetFrame", "TOTALTAKE", "MYSETTAKE", "INDEX", "DATE",
+        "D", "d5", "7", "D12", "%Y", "%H-%M", " ", "<DATE:%Y>", "<INDEX:D3>", "<x>", "\xE3\x81\x82" };
+
+    screenshot_tests::random random(15);
+
+    std::string path, actual;
+    for (int i = 0; i < 100000; i++)
+    {
+        path.clear();
+        for (unsigned int count = random.next() % 12; count != 0; count--)
+            path += pieces[random.next() % std::size(pieces)];
+
+        screenshot_path_template(path).expand(values, actual);
+
+        const std::string expected = expand_macro_string(values, path);
+        SCREENSHOT_CHECK(actual == expected, "'%s' expanded to '%s' instead of '%s'", path.c_str(), actual.c_str(), expected.c_str());
+    }
+}
+
+SCREENSHOT_TEST(path, uses)
+{
+    const screenshot_path_template path("<APP>/<date:%Y> <MYSETFRAME:D6>");
+
+    SCREENSHOT_CHECK(path.uses(screenshot_path_template::field::app), "APP macro was not found");
+    SCREENSHOT_CHECK(path.uses(screenshot_path_template::field::date), "DATE macro was not found");
+    SCREENSHOT_CHECK(path.uses(screenshot_path_template::field::myset_frame), "MYSETFRAME macro was not found");
+    SCREENSHOT_CHECK(!path.uses(screenshot_path_template::field::preset), "PRESET macro was found");
+    SCREENSHOT_CHECK(!path.uses(screenshot_path_template::field::index), "INDEX macro was found");
+}
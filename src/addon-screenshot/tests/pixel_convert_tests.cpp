@@ -0,0 +1,259 @@
+﻿/*
+ * SPDX-FileCopyrightText: 2018 seri14
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#include "screenshot_tests.hpp"
+#include "pixel_convert.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+using pixel_convert::instruction_set;
+
+// Odd counts leave a remainder behind every vector width, so that the scalar tail of each kernel is covered as well
+static const size_t pixel_counts[] = { 0, 1, 2, 3, 5, 7, 15, 17, 31, 33, 63, 65, 127, 129, 1001 };
+static const instruction_set vector_sets[] = { instruction_set::sse2, instruction_set::avx2, instruction_set::neon };
+
+// Bytes written behind the output, which no kernel may touch
+constexpr size_t guard_size = 64;
+constexpr uint8_t guard_value = 0xCD;
+
+template <typename T>
+static std::vector<uint8_t> to_bytes(const std::vector<T> &values)
+{
+    std::vector<uint8_t> bytes(sizeof(T) * values.size());
+    std::memcpy(bytes.data(), values.data(), bytes.size());
+    return bytes;
+}
+
+template <typename T>
+static std::vector<T> make_input(size_t count, uint32_t seed)
+{
+    std::vector<T> values(count);
+    screenshot_tests::random(seed).fill(values.data(), sizeof(T) * values.size());
+    return values;
+}
+
+template <typename T>
+static std::vector<T> make_output(size_t count)
+{
+    std::vector<T> values(count + guard_size / sizeof(T));
+    std::memset(values.data(), guard_value, sizeof(T) * values.size());
+    return values;
+}
+
+/// <summary>
+/// Runs <paramref name="convert"/> with the scalar kernels and then with every other instruction set the processor supports, which all have to produce the same bytes.
+/// <paramref name="convert"/> has to generate the same input for the same pixel count every time it is called.
+/// </summary>
+template <typename F>
+static void compare_with_scalar(const char *kernel, F convert)
+{
+    const instruction_set previous = pixel_convert::current_instruction_set();
+
+    for (const size_t count : pixel_counts)
+    {
+        pixel_convert::select_instruction_set(instruction_set::scalar);
+        const std::vector<uint8_t> expected = convert(count);
+
+        for (const instruction_set set : vector_sets)
+        {
+            if (!pixel_convert::select_instruction_set(set))
+                continue;
+
+            const std::vector<uint8_t> actual = convert(count);
+
+            const size_t mismatch = static_cast<size_t>(std::mismatch(expected.begin(), expected.end(), actual.begin(), actual.end()).first - expected.begin());
+            SCREENSHOT_CHECK(actual == expected, "%s with %s differs from scalar for %zu pixels at byte %zu", kernel, pixel_convert::get_instruction_set_name(set), count, mismatch);
+        }
+    }
+
+    pixel_convert::select_instruction_set(previous);
+}
+
+SCREENSHOT_TEST(pixel_convert, rgba_to_rgb)
+{
+    compare_with_scalar("rgba_to_rgb", [](size_t count) {
+        const std::vector<uint8_t> src = make_input<uint8_t>(count * 4, 1);
+        std::vector<uint8_t> dst = make_output<uint8_t>(count * 3);
+        pixel_convert::rgba_to_rgb(dst.data(), src.data(), count);
+        return dst;
+    });
+    compare_with_scalar("rgba_to_rgb in place", [](size_t count) {
+        std::vector<uint8_t> pixels = make_input<uint8_t>(count * 4, 2);
+        pixel_convert::rgba_to_rgb(pixels.data(), pixels.data(), count);
+        pixels.resize(count * 3);
+        return pixels;
+    });
+}
+
+SCREENSHOT_TEST(pixel_convert, swap_red_blue)
+{
+    compare_with_scalar("swap_red_blue", [](size_t count) {
+        std::vector<uint32_t> pixels = make_input<uint32_t>(count, 3);
+        pixel_convert::swap_red_blue(pixels.data(), count);
+        return to_bytes(pixels);
+    });
+}
+
+SCREENSHOT_TEST(pixel_convert, force_opaque)
+{
+    compare_with_scalar("force_opaque", [](size_t count) {
+        std::vector<uint32_t> pixels = make_input<uint32_t>(count, 4);
+        pixel_convert::force_opaque(pixels.data(), count);
+        return to_bytes(pixels);
+    });
+}
+
+SCREENSHOT_TEST(pixel_convert, r10g10b10a2_to_rgba16)
+{
+    for (const bool bgra : { false, true })
+    {
+        for (const pixel_convert::transfer_function transfer : { pixel_convert::transfer_function::none, pixel_convert::transfer_function::pq })
+        {
+            compare_with_scalar(bgra ? "r10g10b10a2_to_rgba16 from BGRA" : "r10g10b10a2_to_rgba16", [bgra, transfer](size_t count) {
+                const std::vector<uint32_t> src = make_input<uint32_t>(count, 5);
+                std::vector<uint16_t> dst = make_output<uint16_t>(count * 4);
+                pixel_convert::r10g10b10a2_to_rgba16(dst.data(), src.data(), count, bgra, transfer, 400.0f);
+                return to_bytes(dst);
+            });
+        }
+    }
+}
+
+SCREENSHOT_TEST(pixel_convert, rgba16f_to_rgba16)
+{
+    // Random bits include infinities, NaNs and denormals, which have to come out the same as well
+    for (const pixel_convert::transfer_function transfer : { pixel_convert::transfer_function::none, pixel_convert::transfer_function::scrgb })
+    {
+        compare_with_scalar("rgba16f_to_rgba16", [transfer](size_t count) {
+            const std::vector<uint16_t> src = make_input<uint16_t>(count * 4, 6);
+            std::vector<uint16_t> dst = make_output<uint16_t>(count * 4);
+            pixel_convert::rgba16f_to_rgba16(dst.data(), src.data(), count, transfer, 1000.0f);
+            return to_bytes(dst);
+        });
+        compare_with_scalar("rgba16f_to_rgba16 in place", [transfer](size_t count) {
+            std::vector<uint16_t> pixels = make_input<uint16_t>(count * 4, 7);
+            pixel_convert::rgba16f_to_rgba16(pixels.data(), pixels.data(), count, transfer, 600.0f);
+            return to_bytes(pixels);
+        });
+    }
+}
+
+SCREENSHOT_TEST(pixel_convert, rgba16_to_rgb16)
+{
+    compare_with_scalar("rgba16_to_rgb16", [](size_t count) {
+        const std::vector<uint16_t> src = make_input<uint16_t>(count * 4, 8);
+        std::vector<uint16_t> dst = make_output<uint16_t>(count * 3);
+        pixel_convert::rgba16_to_rgb16(dst.data(), src.data(), count);
+        return to_bytes(dst);
+    });
+    compare_with_scalar("rgba16_to_rgb16 in place", [](size_t count) {
+        std::vector<uint16_t> pixels = make_input<uint16_t>(count * 4, 9);
+        pixel_convert::rgba16_to_rgb16(pixels.data(), pixels.data(), count);
+        pixels.resize(count * 3);
+        return to_bytes(pixels);
+    });
+}
+
+SCREENSHOT_TEST(pixel_convert, rgba16_to_rgba8)
+{
+    compare_with_scalar("rgba16_to_rgba8", [](size_t count) {
+        const std::vector<uint16_t> src = make_input<uint16_t>(count * 4, 10);
+        std::vector<uint8_t> dst = make_output<uint8_t>(count * 4);
+        pixel_convert::rgba16_to_rgba8(dst.data(), src.data(), count);
+        return dst;
+    });
+    compare_with_scalar("rgba16_to_rgba8 in place", [](size_t count) {
+        std::vector<uint16_t> pixels = make_input<uint16_t>(count * 4, 11);
+        pixel_convert::rgba16_to_rgba8(reinterpret_cast<uint8_t *>(pixels.data()), pixels.data(), count);
+        std::vector<uint8_t> bytes = to_bytes(pixels);
+        bytes.resize(count * 4);
+        return bytes;
+    });
+}
+
+SCREENSHOT_TEST(pixel_convert, byte_swap16)
+{
+    compare_with_scalar("byte_swap16", [](size_t count) {
+        std::vector<uint16_t> values = make_input<uint16_t>(count * 4, 12);
+        pixel_convert::byte_swap16(values.data(), values.size());
+        return to_bytes(values);
+    });
+}
+
+SCREENSHOT_TEST(pixel_convert, hash)
+{
+    compare_with_scalar("hash", [](size_t count) {
+        // Starts one byte into the buffer, so that the data is not aligned and its size no multiple of any block size
+        const std::vector<uint8_t> data = make_input<uint8_t>(count * 4 + 1, 13);
+        const uint64_t hashes[] = { pixel_convert::hash(data.data(), data.size(), 0), pixel_convert::hash(data.data() + 1, data.size() - 1, 7) };
+        return to_bytes(std::vector<uint64_t>(std::begin(hashes), std::end(hashes)));
+    });
+}
+
+SCREENSHOT_TEST(pixel_convert, find_changed_rect)
+{
+    const instruction_set previous = pixel_convert::current_instruction_set();
+
+    screenshot_tests::random random(14);
+
+    for (int iteration = 0; iteration < 2000; iteration++)
+    {
+        const uint32_t width = 1 + random.next() % 70, height = 1 + random.next() % 20;
+        const unsigned int bytes_per_pixel = random.next() % 4 == 0 ? 8 : random.next() % 2 == 0 ? 3 : 4;
+        const size_t row_size = static_cast<size_t>(width) * bytes_per_pixel;
+        const size_t pitch = row_size + (random.next() % 3) * 4;
+
+        std::vector<uint8_t> a(pitch * height);
+        random.fill(a.data(), a.size());
+        std::vector<uint8_t> b = a;
+
+        bool changed = false;
+        uint32_t min_x = width, min_y = height, max_x = 0, max_y = 0;
+        for (unsigned int change = random.next() % 4; change != 0; change--)
+        {
+            const uint32_t x = random.next() % width, y = random.next() % height;
+            b[pitch * y + static_cast<size_t>(bytes_per_pixel) * x + random.next() % bytes_per_pixel] ^= static_cast<uint8_t>(1 + random.next() % 255);
+
+            changed = true;
+            min_x = std::min(min_x, x);
+            min_y = std::min(min_y, y);
+            max_x = std::max(max_x, x);
+            max_y = std::max(max_y, y);
+        }
+
+        // Padding between rows is not part of the image
+        if (pitch != row_size)
+            b[pitch * (random.next() % height) + row_size] ^= 0xFF;
+
+        for (const instruction_set set : { instruction_set::scalar, instruction_set::sse2, instruction_set::avx2, instruction_set::neon })
+        {
+            if (!pixel_convert::select_instruction_set(set))
+                continue;
+
+            uint32_t x = 0, y = 0, rect_width = 0, rect_height = 0;
+            const bool found = pixel_convert::find_changed_rect(a.data(), b.data(), width, height, pitch, bytes_per_pixel, x, y, rect_width, rect_height);
+
+            SCREENSHOT_CHECK(found == changed, "find_changed_rect with %s %s a change in %ux%u pixels of %u bytes", pixel_convert::get_instruction_set_name(set), found ? "found" : "missed", width, height, bytes_per_pixel);
+            SCREENSHOT_CHECK(!found || !changed || (x == min_x && y == min_y && rect_width == max_x - min_x + 1 && rect_height == max_y - min_y + 1),
+                "find_changed_rect with %s returned %u,%u %ux%u instead of %u,%u %ux%u", pixel_convert::get_instruction_set_name(set), x, y, rect_width, rect_height, min_x, min_y, max_x - min_x + 1, max_y - min_y + 1);
+        }
+    }
+
+    pixel_convert::select_instruction_set(previous);
+}
+
+SCREENSHOT_TEST(pixel_convert, half_round_trip)
+{
+    for (uint32_t value = 0; value <= 0xFFFF; value++)
+    {
+        const float f = pixel_convert::half_to_float(static_cast<uint16_t>(value));
+        if (f != f)
+            continue;
+
+        const uint16_t half = pixel_convert::float_to_half(f);
+        SCREENSHOT_CHECK(half == value, "half 0x%04X came back as 0x%04X", value, half);
+    }
+}
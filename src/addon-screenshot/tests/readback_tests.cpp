@@ -0,0 +1,409 @@
+﻿/*
+ * SPDX-FileCopyrightText: 2018 seri14
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+// Runs the readback ring against a device that only pretends to be a GPU, which executes submitted commands when the test says so.
+
+#include "screenshot_tests.hpp"
+#include "screenshot_readback.hpp"
+
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <map>
+
+using namespace reshade::api;
+
+/// <summary>
+/// Device with textures in system memory. Copies only happen once the queue executes them, like on a GPU, and mapping a texture waits for that only where there are no fences, like in D3D11.
+/// </summary>
+class test_device : public device
+{
+public:
+    struct texture
+    {
+        resource_desc desc;
+        resource_usage state;
+        uint32_t row_pitch;
+        std::vector<uint8_t> data;
+        bool mapped = false;
+    };
+
+    bool supports_fences = true;
+    bool fail_map = false;
+
+    std::map<uint64_t, texture> textures;
+    bool fence_alive = false;
+    uint64_t completed_fence_value = 0;
+    unsigned int resources_created = 0;
+    // Set by the queue, so that mapping can wait for it without fences
+    std::function<void()> wait_idle;
+
+    /// <summary>
+    /// Adds a texture the application rendered to, filled with pixels that are different for every <paramref name="seed"/>.
+    /// </summary>
+    resource add_texture(uint32_t width, uint32_t height, format format, uint32_t seed)
+    {
+        texture &t = textures[_next_handle];
+        t.desc = resource_desc(width, height, 1, 1, format, 1, memory_heap::gpu_only, resource_usage::render_target);
+        t.state = resource_usage::render_target;
+        t.row_pitch = format_row_pitch(format, width);
+        t.data.resize(static_cast<size_t>(t.row_pitch) * height);
+        screenshot_tests::random(seed).fill(t.data.data(), t.data.size());
+        return { _next_handle++ };
+    }
+
+    bool create_resource(const resource_desc &desc, const subresource_data *, resource_usage initial_state, resource *out_resource, void ** = nullptr) override
+    {
+        texture &t = textures[_next_handle];
+        t.desc = desc;
+        t.state = initial_state;
+        // Rows of staging textures are aligned like in D3D12, so that odd widths are mapped with a larger pitch than the image has
+        t.row_pitch = (format_row_pitch(desc.texture.format, desc.texture.width) + 255) & ~255u;
+        t.data.assign(static_cast<size_t>(t.row_pitch) * desc.texture.height, 0);
+
+        resources_created++;
+        *out_resource = { _next_handle++ };
+        return true;
+    }
+    void destroy_resource(resource resource) override
+    {
+        SCREENSHOT_CHECK(textures.count(resource.handle) != 0 && !textures[resource.handle].mapped, "Destroyed resource %llu, which does not exist or is still mapped", static_cast<unsigned long long>(resource.handle));
+        textures.erase(resource.handle);
+    }
+    resource_desc get_resource_desc(resource resource) const override
+    {
+        return textures.at(resource.handle).desc;
+    }
+    void set_resource_name(resource, const char *) override
+    {
+    }
+    bool map_texture_region(resource resource, uint32_t, const subresource_box *, map_access, subresource_data *out_data) override
+    {
+        if (fail_map)
+            return false;
+
+        if (!supports_fences)
+            wait_idle();
+
+        texture &t = textures.at(resource.handle);
+        SCREENSHOT_CHECK(!t.mapped, "Mapped resource %llu twice", static_cast<unsigned long long>(resource.handle));
+        t.mapped = true;
+
+        out_data->data = t.data.data();
+        out_data->row_pitch = t.row_pitch;
+        out_data->slice_pitch = static_cast<uint32_t>(t.data.size());
+        return true;
+    }
+    void unmap_texture_region(resource resource, uint32_t) override
+    {
+        textures.at(resource.handle).mapped = false;
+    }
+    bool create_fence(uint64_t initial_value, fence_flags, fence *out_fence, void ** = nullptr) override
+    {
+        if (!supports_fences)
+            return false;
+
+        SCREENSHOT_CHECK(!fence_alive, "Created a second fence");
+        fence_alive = true;
+        completed_fence_value = initial_value;
+        *out_fence = { 1 };
+        return true;
+    }
+    void destroy_fence(fence) override
+    {
+        fence_alive = false;
+    }
+    uint64_t get_completed_fence_value(fence) const override
+    {
+        return completed_fence_value;
+    }
+
+private:
+    uint64_t _next_handle = 1;
+};
+
+/// <summary>
+/// Queue that collects commands in its immediate command list and only executes the submitted ones when <see cref="execute"/> or <see cref="wait_idle"/> is called.
+/// </summary>
+class test_queue : public command_queue, public command_list
+{
+public:
+    bool fail_signal = false;
+    mutable unsigned int waits = 0;
+
+    explicit test_queue(test_device &device) : _device(device)
+    {
+        _device.wait_idle = [this]() { wait_idle(); };
+    }
+
+    /// <summary>
+    /// Lets the GPU catch up with everything submitted so far.
+    /// </summary>
+    void execute() const
+    {
+        for (const std::function<void()> &command : _submitted)
+            command();
+        _submitted.clear();
+    }
+
+    command_list *get_immediate_command_list() override
+    {
+        return this;
+    }
+    void flush_immediate_command_list() const override
+    {
+        _submitted.insert(_submitted.end(), _recorded.begin(), _recorded.end());
+        _recorded.clear();
+    }
+    void wait_idle() const override
+    {
+        waits++;
+        flush_immediate_command_list();
+        execute();
+    }
+    bool signal(fence, uint64_t value) override
+    {
+        if (fail_signal)
+            return false;
+
+        _submitted.push_back([this, value]() { _device.completed_fence_value = value; });
+        return true;
+    }
+
+    void barrier(resource resource, resource_usage old_state, resource_usage new_state) override
+    {
+        test_device::texture &t = _device.textures.at(resource.handle);
+        SCREENSHOT_CHECK(t.state == old_state, "Barrier expected resource %llu in state 0x%X, but it is in 0x%X", static_cast<unsigned long long>(resource.handle), old_state, t.state);
+        t.state = new_state;
+    }
+    void copy_texture_region(resource source, uint32_t, const subresource_box *, resource dest, uint32_t, const subresource_box *) override
+    {
+        SCREENSHOT_CHECK(_device.textures.at(source.handle).state == resource_usage::copy_source, "Copied from resource %llu without a barrier", static_cast<unsigned long long>(source.handle));
+
+        _recorded.push_back([this, source, dest]() {
+            const test_device::texture &src = _device.textures.at(source.handle);
+            test_device::texture &dst = _device.textures.at(dest.handle);
+            for (uint32_t y = 0; y < src.desc.texture.height; y++)
+                std::memcpy(dst.data.data() + static_cast<size_t>(dst.row_pitch) * y, src.data.data() + static_cast<size_t>(src.row_pitch) * y, src.row_pitch);
+        });
+    }
+
+private:
+    test_device &_device;
+    mutable std::vector<std::function<void()>> _recorded, _submitted;
+};
+
+/// <summary>
+/// Checks that <paramref name="capture"/> holds the pixels of <paramref name="source"/> without the padding of the staging texture.
+/// </summary>
+static bool has_pixels_of(const screenshot_capture &capture, const test_device &device, resource source)
+{
+    const test_device::texture &t = device.textures.at(source.handle);
+    const format typed_format = format_to_default_typed(t.desc.texture.format);
+
+    return !capture.failed && !capture.pixels.empty() &&
+        capture.pixels.key() == screenshot_buffer_key { t.desc.texture.width, t.desc.texture.height, typed_format } &&
+        capture.pixels.size() * sizeof(uint32_t) >= t.data.size() &&
+        std::memcmp(capture.pixels.data(), t.data.data(), t.data.size()) == 0;
+}
+
+SCREENSHOT_TEST(readback, fence)
+{
+    struct texture
+    {
+        uint32_t width;
+        uint32_t height;
+        format texture_format;
+    };
+
+    // A width that fills the aligned rows, one that does not, and formats that are copied as they are or typed first
+    for (const texture texture : { texture{ 64, 9, format::r8g8b8a8_unorm }, texture{ 33, 17, format::r8g8b8a8_typeless }, texture{ 7, 5, format::r16g16b16a16_float } })
+    {
+        test_device device;
+        test_queue queue(device);
+        screenshot_buffer_pool buffers;
+        screenshot_readback_ring ring;
+
+        const resource source = device.add_texture(texture.width, texture.height, texture.texture_format, texture.width);
+
+        screenshot_capture capture;
+        unsigned int pending = 0;
+        SCREENSHOT_CHECK(ring.enqueue(&device, &queue, source, resource_usage::render_target, capture, pending, buffers) && pending == 1, "Readback of %ux%u was not enqueued", texture.width, texture.height);
+        SCREENSHOT_CHECK(device.textures.at(source.handle).state == resource_usage::render_target, "Resource was not transitioned back to its state");
+
+        // The GPU is behind by more frames than the latency, so only the fence can tell when the copy is done
+        for (uint64_t i = 0; i < 2 * ring.latency(); i++)
+            ring.resolve(&device);
+
+        SCREENSHOT_CHECK(pending == 1 && capture.pixels.empty(), "Readback of %ux%u was resolved before the fence signaled", texture.width, texture.height);
+
+        queue.execute();
+        ring.resolve(&device);
+
+        SCREENSHOT_CHECK(pending == 0 && ring.pending() == 0, "Readback of %ux%u was not resolved after the fence signaled", texture.width, texture.height);
+        SCREENSHOT_CHECK(has_pixels_of(capture, device, source), "Readback of %ux%u did not return the pixels of the texture", texture.width, texture.height);
+        SCREENSHOT_CHECK(queue.waits == 0, "Readback stalled %u times", queue.waits);
+
+        ring.destroy(&device);
+    }
+}
+
+SCREENSHOT_TEST(readback, latency)
+{
+    // Without fences, and with a fence that cannot be signaled, the ring falls back to waiting for a number of frames
+    for (const bool supports_fences : { false, true })
+    {
+        test_device device;
+        device.supports_fences = supports_fences;
+        test_queue queue(device);
+        queue.fail_signal = supports_fences;
+        screenshot_buffer_pool buffers;
+        screenshot_readback_ring ring;
+
+        const resource source = device.add_texture(33, 17, format::b8g8r8a8_unorm, 1);
+
+        screenshot_capture capture;
+        unsigned int pending = 0;
+        ring.enqueue(&device, &queue, source, resource_usage::render_target, capture, pending, buffers);
+
+        for (uint64_t i = 1; i < ring.latency(); i++)
+            ring.resolve(&device);
+
+        SCREENSHOT_CHECK(pending == 1, "Readback was resolved before the latency %s fences", supports_fences ? "with" : "without");
+
+        ring.resolve(&device);
+
+        SCREENSHOT_CHECK(pending == 0 && has_pixels_of(capture, device, source), "Readback was not resolved after the latency %s fences", supports_fences ? "with" : "without");
+
+        ring.destroy(&device);
+    }
+}
+
+SCREENSHOT_TEST(readback, map_failure)
+{
+    test_device device;
+    device.fail_map = true;
+    test_queue queue(device);
+    screenshot_buffer_pool buffers;
+    screenshot_readback_ring ring;
+
+    const resource source = device.add_texture(16, 16, format::r8g8b8a8_unorm, 2);
+
+    screenshot_capture capture;
+    unsigned int pending = 0;
+    ring.enqueue(&device, &queue, source, resource_usage::render_target, capture, pending, buffers);
+    queue.execute();
+    ring.resolve(&device);
+
+    SCREENSHOT_CHECK(pending == 0 && ring.pending() == 0, "Readback that failed to map was not resolved");
+    SCREENSHOT_CHECK(capture.failed && capture.pixels.empty(), "Readback that failed to map was not marked as failed");
+    SCREENSHOT_CHECK(buffers.used_bytes() == 0, "Readback that failed to map kept a buffer");
+
+    ring.destroy(&device);
+}
+
+SCREENSHOT_TEST(readback, cancel)
+{
+    test_device device;
+    test_queue queue(device);
+    screenshot_buffer_pool buffers;
+    screenshot_readback_ring ring;
+
+    const resource source = device.add_texture(16, 16, format::r8g8b8a8_unorm, 3);
+
+    screenshot_capture discarded, kept;
+    unsigned int discarded_pending = 0, kept_pending = 0;
+    ring.enqueue(&device, &queue, source, resource_usage::render_target, discarded, discarded_pending, buffers);
+    ring.enqueue(&device, &queue, source, resource_usage::render_target, kept, kept_pending, buffers);
+
+    ring.cancel(discarded);
+
+    SCREENSHOT_CHECK(discarded_pending == 0 && ring.pending() == 1, "Cancelled readback is still pending");
+
+    queue.execute();
+    ring.resolve(&device);
+
+    SCREENSHOT_CHECK(discarded.pixels.empty() && !discarded.failed, "Cancelled readback was written to its target");
+    SCREENSHOT_CHECK(kept_pending == 0 && has_pixels_of(kept, device, source), "Readback next to a cancelled one did not return the pixels of the texture");
+
+    ring.destroy(&device);
+}
+
+SCREENSHOT_TEST(readback, full_ring)
+{
+    test_device device;
+    test_queue queue(device);
+    screenshot_buffer_pool buffers;
+    screenshot_readback_ring ring(2);
+
+    resource sources[3];
+    screenshot_capture captures[3];
+    unsigned int pending = 0;
+
+    for (uint32_t i = 0; i < 3; i++)
+    {
+        sources[i] = device.add_texture(20 + i, 10, format::r8g8b8a8_unorm, 4 + i);
+        ring.enqueue(&device, &queue, sources[i], resource_usage::render_target, captures[i], pending, buffers);
+    }
+
+    // The third readback has to wait for the first, which frees its staging texture
+    SCREENSHOT_CHECK(queue.waits == 1 && pending == 2 && has_pixels_of(captures[0], device, sources[0]), "Readback into a full ring did not resolve the oldest one first");
+
+    queue.execute();
+    ring.resolve(&device);
+
+    for (uint32_t i = 0; i < 3; i++)
+        SCREENSHOT_CHECK(has_pixels_of(captures[i], device, sources[i]), "Readback %u did not return the pixels of its texture", i);
+    SCREENSHOT_CHECK(pending == 0, "%u readbacks are still pending", pending);
+
+    ring.destroy(&device);
+}
+
+SCREENSHOT_TEST(readback, force)
+{
+    test_device device;
+    test_queue queue(device);
+    screenshot_buffer_pool buffers;
+    screenshot_readback_ring ring;
+
+    const resource source = device.add_texture(16, 16, format::r10g10b10a2_unorm, 7);
+
+    screenshot_capture capture;
+    unsigned int pending = 0;
+    ring.enqueue(&device, &queue, source, resource_usage::render_target, capture, pending, buffers);
+    ring.resolve(&device, true);
+
+    SCREENSHOT_CHECK(pending == 0 && has_pixels_of(capture, device, source), "Forced resolve did not wait for the readback");
+
+    ring.destroy(&device);
+}
+
+SCREENSHOT_TEST(readback, destroy)
+{
+    test_device device;
+    test_queue queue(device);
+    screenshot_buffer_pool buffers;
+    screenshot_readback_ring ring(2);
+
+    const resource small = device.add_texture(16, 16, format::r8g8b8a8_unorm, 8);
+    const resource large = device.add_texture(32, 16, format::r8g8b8a8_unorm, 9);
+
+    // Staging textures are kept for the same size and format and replaced otherwise
+    const resource sources[] = { small, small, small, large };
+    screenshot_capture captures[std::size(sources)];
+    unsigned int pending = 0;
+
+    for (size_t i = 0; i < std::size(sources); i++)
+    {
+        ring.enqueue(&device, &queue, sources[i], resource_usage::render_target, captures[i], pending, buffers);
+        ring.resolve(&device, true);
+    }
+
+    SCREENSHOT_CHECK(device.resources_created == 3, "Created %u staging textures instead of 3", device.resources_created);
+
+    ring.destroy(&device);
+
+    SCREENSHOT_CHECK(device.textures.size() == 2 && !device.fence_alive, "Staging textures or the fence were not destroyed");
+}
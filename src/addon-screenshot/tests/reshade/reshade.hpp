@@ -0,0 +1,177 @@
+﻿/*
+ * SPDX-FileCopyrightText: 2018 seri14
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#pragma once
+
+// Stand-in for the parts of the ReShade API that the buffer pool and the readback ring use, so that they can be tested without a graphics device.
+// Declarations follow the ones in reshade_api_device.hpp, but every interface function is a plain virtual function the tests implement.
+
+#include <cstdint>
+
+namespace reshade::api
+{
+    enum class format : uint32_t
+    {
+        unknown = 0,
+        r16g16b16a16_typeless = 9,
+        r16g16b16a16_float = 10,
+        r10g10b10a2_typeless = 23,
+        r10g10b10a2_unorm = 24,
+        r8g8b8a8_typeless = 27,
+        r8g8b8a8_unorm = 28,
+        b8g8r8a8_unorm = 87,
+    };
+
+    inline uint32_t format_row_pitch(format format, uint32_t width)
+    {
+        switch (format)
+        {
+        case format::r16g16b16a16_typeless:
+        case format::r16g16b16a16_float:
+            return 8 * width;
+        case format::r10g10b10a2_typeless:
+        case format::r10g10b10a2_unorm:
+        case format::r8g8b8a8_typeless:
+        case format::r8g8b8a8_unorm:
+        case format::b8g8r8a8_unorm:
+            return 4 * width;
+        default:
+            return 0;
+        }
+    }
+
+    inline format format_to_default_typed(format format, int srgb_variant = 0)
+    {
+        (void)srgb_variant;
+
+        switch (format)
+        {
+        case format::r16g16b16a16_typeless:
+            return format::r16g16b16a16_float;
+        case format::r10g10b10a2_typeless:
+            return format::r10g10b10a2_unorm;
+        case format::r8g8b8a8_typeless:
+            return format::r8g8b8a8_unorm;
+        default:
+            return format;
+        }
+    }
+
+    enum class memory_heap : uint32_t
+    {
+        unknown,
+        gpu_only,
+        cpu_to_gpu,
+        gpu_to_cpu,
+        cpu_only,
+    };
+
+    enum class resource_usage : uint32_t
+    {
+        undefined = 0,
+        shader_resource = 0x40 | 0x80,
+        render_target = 0x4,
+        copy_dest = 0x400,
+        copy_source = 0x800,
+    };
+
+    enum class map_access
+    {
+        read_only,
+        write_only,
+        read_write,
+        write_discard,
+    };
+
+    enum class fence_flags : uint32_t
+    {
+        none = 0,
+    };
+
+    struct resource { uint64_t handle; };
+    struct fence { uint64_t handle; };
+
+    struct subresource_box
+    {
+        int32_t left, top, front, right, bottom, back;
+    };
+
+    struct subresource_data
+    {
+        void *data = nullptr;
+        uint32_t row_pitch = 0;
+        uint32_t slice_pitch = 0;
+    };
+
+    struct resource_desc
+    {
+        resource_desc() = default;
+        resource_desc(uint32_t width, uint32_t height, uint16_t layers, uint16_t levels, format format, uint16_t samples, memory_heap heap, resource_usage usage) :
+            texture { width, height, layers, levels, format, samples }, heap(heap), usage(usage)
+        {
+        }
+
+        struct
+        {
+            uint32_t width = 0;
+            uint32_t height = 0;
+            uint16_t depth_or_layers = 0;
+            uint16_t levels = 0;
+            reshade::api::format format = format::unknown;
+            uint16_t samples = 0;
+        } texture;
+
+        memory_heap heap = memory_heap::unknown;
+        resource_usage usage = resource_usage::undefined;
+    };
+
+    class command_list
+    {
+    public:
+        virtual void barrier(resource resource, resource_usage old_state, resource_usage new_state) = 0;
+        virtual void copy_texture_region(resource source, uint32_t source_subresource, const subresource_box *source_box, resource dest, uint32_t dest_subresource, const subresource_box *dest_box) = 0;
+    };
+
+    class command_queue
+    {
+    public:
+        virtual command_list *get_immediate_command_list() = 0;
+        virtual void flush_immediate_command_list() const = 0;
+        virtual void wait_idle() const = 0;
+        virtual bool signal(fence fence, uint64_t value) = 0;
+    };
+
+    class device
+    {
+    public:
+        virtual bool create_resource(const resource_desc &desc, const subresource_data *initial_data, resource_usage initial_state, resource *out_resource, void **shared_handle = nullptr) = 0;
+        virtual void destroy_resource(resource resource) = 0;
+        virtual resource_desc get_resource_desc(resource resource) const = 0;
+        virtual void set_resource_name(resource resource, const char *name) = 0;
+        virtual bool map_texture_region(resource resource, uint32_t subresource, const subresource_box *box, map_access access, subresource_data *out_data) = 0;
+        virtual void unmap_texture_region(resource resource, uint32_t subresource) = 0;
+        virtual bool create_fence(uint64_t initial_value, fence_flags flags, fence *out_fence, void **shared_handle = nullptr) = 0;
+        virtual void destroy_fence(fence fence) = 0;
+        virtual uint64_t get_completed_fence_value(fence fence) const = 0;
+    };
+}
+
+namespace reshade::log
+{
+    enum class level
+    {
+        error = 1,
+        warning = 2,
+        info = 3,
+        debug = 4,
+    };
+
+    // Errors are expected in tests that make the device fail, so they are dropped
+    inline void message(level level, const char *message)
+    {
+        (void)level;
+        (void)message;
+    }
+}
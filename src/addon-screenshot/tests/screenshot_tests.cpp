@@ -0,0 +1,61 @@
+﻿/*
+ * SPDX-FileCopyrightText: 2018 seri14
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+// Runs the tests of one suite, or of all suites without an argument, and fails if any check failed.
+// Usage: screenshot_tests [SUITE]
+
+#include "screenshot_tests.hpp"
+
+#include <cstdio>
+#include <cstring>
+
+static const screenshot_tests::test_case *current_test = nullptr;
+static unsigned int current_failures = 0;
+
+std::vector<screenshot_tests::test_case> &screenshot_tests::registry()
+{
+    // Filled by the registrars of all test files during static initialization, so it has to exist before the first of them
+    static std::vector<test_case> tests;
+    return tests;
+}
+
+void screenshot_tests::fail(const char *file, int line, const std::string &message)
+{
+    // Only the first few failures of a test are of any use, the rest usually follow from them
+    if (current_failures++ < 10)
+        std::fprintf(stderr, "%s(%d): %s.%s failed: %s\n", file, line, current_test->suite, current_test->name, message.c_str());
+}
+
+int main(int argc, char *argv[])
+{
+    const char *const suite = argc > 1 ? argv[1] : nullptr;
+
+    unsigned int run = 0, failed = 0;
+    for (const screenshot_tests::test_case &test : screenshot_tests::registry())
+    {
+        if (suite != nullptr && std::strcmp(suite, test.suite) != 0)
+            continue;
+
+        current_test = &test;
+        current_failures = 0;
+
+        test.fn();
+
+        std::printf("%s %s.%s\n", current_failures == 0 ? "passed" : "FAILED", test.suite, test.name);
+
+        run++;
+        if (current_failures != 0)
+            failed++;
+    }
+
+    if (run == 0)
+    {
+        std::fprintf(stderr, "No tests in suite '%s'.\n", suite != nullptr ? suite : "");
+        return 1;
+    }
+
+    std::printf("%u of %u tests passed\n", run - failed, run);
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,73 @@
+﻿/*
+ * SPDX-FileCopyrightText: 2018 seri14
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+#pragma once
+
+#include "std_string_ext.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/// <summary>
+/// Just enough of a test framework to run the tests of the core library with ctest, without another dependency.
+/// Tests are grouped into suites, each of which ctest runs as a separate test by passing its name on the command line.
+/// </summary>
+namespace screenshot_tests
+{
+    struct test_case
+    {
+        const char *suite;
+        const char *name;
+        void (*fn)();
+    };
+
+    std::vector<test_case> &registry();
+
+    /// <summary>
+    /// Reports a failed check and marks the test that is running as failed, which keeps running to report further checks.
+    /// </summary>
+    void fail(const char *file, int line, const std::string &message);
+
+    struct registrar
+    {
+        registrar(const char *suite, const char *name, void (*fn)()) { registry().push_back({ suite, name, fn }); }
+    };
+
+    /// <summary>
+    /// Pseudo-random numbers that are the same on every run and platform, so that a failure can be reproduced.
+    /// </summary>
+    class random
+    {
+    public:
+        explicit random(uint32_t seed) : _state(seed != 0 ? seed : 0x9E3779B9) {}
+
+        uint32_t next()
+        {
+            _state ^= _state << 13;
+            _state ^= _state >> 17;
+            _state ^= _state << 5;
+            return _state;
+        }
+
+        void fill(void *data, size_t size)
+        {
+            for (size_t i = 0; i < size; i++)
+                static_cast<uint8_t *>(data)[i] = static_cast<uint8_t>(next() >> 24);
+        }
+
+    private:
+        uint32_t _state;
+    };
+}
+
+#define SCREENSHOT_TEST(suite, name) \
+    static void suite##_##name(); \
+    static const screenshot_tests::registrar suite##_##name##_registrar(#suite, #name, &suite##_##name); \
+    static void suite##_##name()
+
+// Arguments after the condition are a printf style format and its values, describing the case that failed
+#define SCREENSHOT_CHECK(condition, ...) \
+    ((condition) ? (void)0 : screenshot_tests::fail(__FILE__, __LINE__, std::format(__VA_ARGS__)))
@@ -7,7 +7,11 @@
 #include "runtime_config.hpp"
 
 #include <execution>
+#ifdef _WIN32
 #include <Windows.h>
+#else
+#include <cstdio>
+#endif
 
 std::unordered_map<std::filesystem::path, ini_file> g_ini_cache;
 std::recursive_mutex ini_file::_static_mutex;
@@ -26,6 +30,7 @@ void ini_file::load() noexcept
 {
     std::lock_guard lock(_mutex);
 
+#ifdef _WIN32
     enum class condition { none, open, not_found, blocked };
     condition condition = condition::none;
 
@@ -68,6 +73,29 @@ void ini_file::load() noexcept
 
     // No longer need to have a handle open to the file, since all data was read, so can safely close it
     CloseHandle(file);
+#else
+    size_t file_size = 0;
+    std::unique_ptr<char[]> mem;
+
+    std::error_code ec;
+    if (const std::filesystem::file_time_type modified_at = std::filesystem::last_write_time(_path, ec);
+        !ec && _modified_at < modified_at)
+    {
+        if (FILE *const file = fopen(_path.c_str(), "rb"); file != nullptr)
+        {
+            _modified_at = modified_at;
+
+            // Reservating memory (limit to 150KB)
+            file_size = static_cast<size_t>(std::min<uintmax_t>(150 * 1024, std::filesystem::file_size(_path, ec)));
+
+            // Read file contents into memory
+            if (mem = std::make_unique<char[]>(file_size); fread(mem.get(), 1, file_size, file) != file_size)
+                mem = {};
+
+            fclose(file);
+        }
+    }
+#endif
 
     if (!mem)
         return;
@@ -77,9 +105,9 @@ void ini_file::load() noexcept
 
     // Remove BOM (0xefbbbf means 0xfeff)
     if (file_size >= 3 &&
-        mem[0] == 0xef &&
-        mem[1] == 0xbb &&
-        mem[2] == 0xbf)
+        static_cast<unsigned char>(mem[0]) == 0xef &&
+        static_cast<unsigned char>(mem[1]) == 0xbb &&
+        static_cast<unsigned char>(mem[2]) == 0xbf)
         mem[0] = '\n',
         mem[1] = '\n',
         mem[2] = '\n';
@@ -138,6 +166,7 @@ bool ini_file::save() noexcept
     if (!_modified)
         return true;
 
+#ifdef _WIN32
     enum class condition { none, open, create, blocked };
     auto condition = condition::none;
 
@@ -152,6 +181,11 @@ bool ini_file::save() noexcept
 
     if (condition == condition::blocked)
         return false;
+#else
+    FILE *const file = fopen(_path.c_str(), "wb");
+    if (file == nullptr)
+        return false;
+#endif
 
     std::string str; str.reserve(20 * 1024);
     std::vector<std::string> section_names, key_names;
@@ -206,6 +240,7 @@ bool ini_file::save() noexcept
         key_names.clear();
     }
 
+#ifdef _WIN32
     if (DWORD _; WriteFile(file, str.data(), static_cast<DWORD>(str.size()), &_, NULL) != 0)
         SetEndOfFile(file), _modified = false;
 
@@ -216,6 +251,15 @@ bool ini_file::save() noexcept
     SetFileTime(file, nullptr, nullptr, &ft);
 
     CloseHandle(file);
+#else
+    if (fwrite(str.data(), 1, str.size(), file) == str.size())
+        _modified = false;
+
+    fclose(file);
+
+    std::error_code ec;
+    std::filesystem::last_write_time(_path, _modified_at, ec);
+#endif
 
     return true;
 }
@@ -182,22 +182,6 @@ public:
         else
             set(section, key, std::to_string(value));
     }
-    template <>
-    void set(const std::string &section, const std::string &key, const bool &value) noexcept
-    {
-        set<std::string>(section, key, value ? "1" : "0");
-    }
-    template <>
-    void set(const std::string &section, const std::string &key, const std::string &value) noexcept
-    {
-        std::lock_guard lock(_mutex);
-
-        auto &v = _sections[section][key];
-        v.assign(1, value);
-
-        _modified_at = std::filesystem::file_time_type::clock::now();
-        _modified = true;
-    }
     void set(const std::string &section, const std::string &key, std::string &&value) noexcept
     {
         std::lock_guard lock(_mutex);
@@ -209,11 +193,6 @@ public:
         _modified_at = std::filesystem::file_time_type::clock::now();
         _modified = true;
     }
-    template <>
-    void set(const std::string &section, const std::string &key, const std::filesystem::path &value) noexcept
-    {
-        set(section, key, value.u8string());
-    }
     template <size_t SIZE>
     void set(const std::string &section, const std::string &key, const std::string(&values)[SIZE], const size_t size = SIZE) noexcept
     {
@@ -253,23 +232,12 @@ public:
 
         auto &v = _sections[section];
         v.clear();
-        for (const entry &entry : table)
+        for (const auto &entry : table)
             v[entry.first] = entry.second;
 
         _modified_at = std::filesystem::file_time_type::clock::now();
         _modified = true;
     }
-    template <>
-    void set(const std::string &section, const std::string &key, const elements &values) noexcept
-    {
-        std::lock_guard lock(_mutex);
-
-        auto &v = _sections[section][key];
-        v = values;
-
-        _modified_at = std::filesystem::file_time_type::clock::now();
-        _modified = true;
-    }
     void set(const std::string &section, const std::string &key, elements &&values) noexcept
     {
         std::lock_guard lock(_mutex);
@@ -280,18 +248,6 @@ public:
         _modified_at = std::filesystem::file_time_type::clock::now();
         _modified = true;
     }
-    template <>
-    void set(const std::string &section, const std::string &key, const std::vector<std::filesystem::path> &values) noexcept
-    {
-        std::lock_guard lock(_mutex);
-
-        auto &v = _sections[section][key];
-        v.resize(values.size());
-        for (size_t i = 0; i < values.size(); ++i)
-            v[i] = values[i].u8string();
-        _modified = true;
-        _modified_at = std::filesystem::file_time_type::clock::now();
-    }
 
     bool erase(const std::string &section) noexcept
     {
@@ -338,30 +294,77 @@ public:
         T v{};
         return i < values.size() && !values[i].empty() ? std::from_chars(values[i].data(), values[i].data() + values[i].size() + 1, v), v : v;
     }
-    template <>
-    static bool convert(const elements &values, size_t i) noexcept
-    {
-        return i < values.size() && !values[i].empty() && (values[i][0] == 't' || values[i][0] == 'T' || convert<long long>(values, i) != 0ll);
-    }
-    template <>
-    static std::string convert(const elements &values, size_t i) noexcept
-    {
-        return i < values.size() && !values[i].empty() ? values[i] : std::string{};
-    }
-    template <>
-    static std::filesystem::path convert(const elements &values, size_t i) noexcept
-    {
-        return i < values.size() && !values[i].empty() ? std::filesystem::u8path(values[i]) : std::filesystem::path{};
-    }
 
 protected:
 
     bool _modified = false;
-    std::filesystem::file_time_type _modified_at;
+    // Times before the epoch of the clock are negative with some standard libraries, so start at the earliest time instead of zero
+    std::filesystem::file_time_type _modified_at = std::filesystem::file_time_type::min();
     std::unordered_map<std::string, table> _sections;
     std::recursive_mutex _mutex;
 };
 
+// Explicit specializations of member templates have to be at namespace scope for compilers other than MSVC
+template <>
+inline void ini_data::set(const std::string &section, const std::string &key, const std::string &value) noexcept
+{
+    std::lock_guard lock(_mutex);
+
+    auto &v = _sections[section][key];
+    v.assign(1, value);
+
+    _modified_at = std::filesystem::file_time_type::clock::now();
+    _modified = true;
+}
+template <>
+inline void ini_data::set(const std::string &section, const std::string &key, const bool &value) noexcept
+{
+    set<std::string>(section, key, value ? "1" : "0");
+}
+template <>
+inline void ini_data::set(const std::string &section, const std::string &key, const std::filesystem::path &value) noexcept
+{
+    set(section, key, value.u8string());
+}
+template <>
+inline void ini_data::set(const std::string &section, const std::string &key, const elements &values) noexcept
+{
+    std::lock_guard lock(_mutex);
+
+    auto &v = _sections[section][key];
+    v = values;
+
+    _modified_at = std::filesystem::file_time_type::clock::now();
+    _modified = true;
+}
+template <>
+inline void ini_data::set(const std::string &section, const std::string &key, const std::vector<std::filesystem::path> &values) noexcept
+{
+    std::lock_guard lock(_mutex);
+
+    auto &v = _sections[section][key];
+    v.resize(values.size());
+    for (size_t i = 0; i < values.size(); ++i)
+        v[i] = values[i].u8string();
+    _modified = true;
+    _modified_at = std::filesystem::file_time_type::clock::now();
+}
+template <>
+inline bool ini_data::convert(const elements &values, size_t i) noexcept
+{
+    return i < values.size() && !values[i].empty() && (values[i][0] == 't' || values[i][0] == 'T' || convert<long long>(values, i) != 0ll);
+}
+template <>
+inline std::string ini_data::convert(const elements &values, size_t i) noexcept
+{
+    return i < values.size() && !values[i].empty() ? values[i] : std::string{};
+}
+template <>
+inline std::filesystem::path ini_data::convert(const elements &values, size_t i) noexcept
+{
+    return i < values.size() && !values[i].empty() ? std::filesystem::u8path(values[i]) : std::filesystem::path{};
+}
+
 class ini_file : public ini_data
 {
 public:
@@ -5,18 +5,32 @@
 
 #pragma once
 
+#include <cstdio>
+#include <cwchar>
 #include <string>
 
 namespace std
 {
 	template<class... Args>
 	std::string format(string_view fmt, const Args &... args) noexcept {
-		std::string s(static_cast<size_t>(::_scprintf(fmt.data(), args...)), '\0');
+		std::string s(static_cast<size_t>(::snprintf(nullptr, 0, fmt.data(), args...)), '\0');
 		return ::snprintf(s.data(), s.size() + 1, fmt.data(), args...), s;
 	}
+#ifdef _WIN32
 	template<class... Args>
 	std::wstring format(wstring_view fmt, const Args &... args) noexcept {
 		std::wstring s(static_cast<size_t>(::_scwprintf(fmt.data(), args...)), L'\0');
 		return ::swprintf(s.data(), s.size() + 1, fmt.data(), args...), s;
 	}
+#else
+	template<class... Args>
+	std::wstring format(wstring_view fmt, const Args &... args) noexcept {
+		// swprintf only reports that the buffer was too small, not the size it needs
+		std::wstring s(fmt.size() * 2 + 64, L'\0');
+		int size;
+		while ((size = ::swprintf(s.data(), s.size() + 1, fmt.data(), args...)) < 0 && s.size() < 1024 * 1024)
+			s.resize(s.size() * 2);
+		return s.resize(size < 0 ? 0 : static_cast<size_t>(size)), s;
+	}
+#endif
 }
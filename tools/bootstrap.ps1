@@ -18,21 +18,21 @@ Push-Location deps\vcpkg
 # --------------------------------------
 # [vcpkg] 依存関係を用意
 
-# 32-bit [tiff, libpng, efsw] (.lib /MT /MTd)
-.\vcpkg install --recurse tiff[core]:x86-windows-static
-.\vcpkg install libpng:x86-windows-static efsw:x86-windows-static
+# 32-bit [tiff, libpng, libdeflate, efsw] (.lib /MT /MTd)
+.\vcpkg install --recurse tiff[core,zip,libdeflate]:x86-windows-static
+.\vcpkg install libpng:x86-windows-static libdeflate:x86-windows-static efsw:x86-windows-static
 
-# 32-bit [tiff, libpng, efsw] (.lib /MD /MDd)
-.\vcpkg install --recurse tiff[core]:x86-windows-static-md
-.\vcpkg install libpng:x86-windows-static-md efsw:x86-windows-static-md
+# 32-bit [tiff, libpng, libdeflate, efsw] (.lib /MD /MDd)
+.\vcpkg install --recurse tiff[core,zip,libdeflate]:x86-windows-static-md
+.\vcpkg install libpng:x86-windows-static-md libdeflate:x86-windows-static-md efsw:x86-windows-static-md
 
-# 64-bit [tiff, libpng, efsw] (.lib /MT /MTd)
-.\vcpkg install --recurse tiff[core]:x64-windows-static
-.\vcpkg install libpng:x64-windows-static efsw:x64-windows-static
+# 64-bit [tiff, libpng, libdeflate, efsw] (.lib /MT /MTd)
+.\vcpkg install --recurse tiff[core,zip,libdeflate]:x64-windows-static
+.\vcpkg install libpng:x64-windows-static libdeflate:x64-windows-static efsw:x64-windows-static
 
-# 64-bit [tiff, libpng, efsw] (.lib /MD /MDd)
-.\vcpkg install --recurse tiff[core]:x64-windows-static-md
-.\vcpkg install libpng:x64-windows-static-md efsw:x64-windows-static-md
+# 64-bit [tiff, libpng, libdeflate, efsw] (.lib /MD /MDd)
+.\vcpkg install --recurse tiff[core,zip,libdeflate]:x64-windows-static-md
+.\vcpkg install libpng:x64-windows-static-md libdeflate:x64-windows-static-md efsw:x64-windows-static-md
 
 # --------------------------------------
 # 結果: 成功
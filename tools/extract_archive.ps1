@@ -0,0 +1,138 @@
+﻿#Requires -version 7.2
+
+using namespace System.IO
+
+# Extracts the PNG images from a screenshot archive (.ssar), which the screenshot add-on writes when "Archive takes" is enabled.
+#
+#   extract_archive.ps1 -Path "Screenshot 0.ssar" -List
+#   extract_archive.ps1 -Path "Screenshot 0.ssar" -Destination .\Take -Index 0, 10, 20
+
+Param(
+	[Parameter(Mandatory)]
+	[string]
+	$Path,
+	# Directory to write the images to, next to the archive and named after it by default
+	[string]
+	$Destination,
+	# Repeat indices of the images to extract, all by default
+	[int[]]
+	$Index,
+	# Only print the images in the archive
+	[switch]
+	$List
+)
+
+$ErrorActionPreference = 'Stop'
+
+# These have to match the structures in screenshot_archive.cpp
+$ArchiveMagic = 0x52415353 # "SSAR"
+$ChunkMagic = 0x4B484353 # "SCHK"
+$IndexMagic = 0x58444953 # "SIDX"
+$HeaderSize = 16
+$ChunkSize = 32
+$EntrySize = 32
+$FooterSize = 16
+
+$file = [FileInfo]::new((Resolve-Path -LiteralPath $Path).Path)
+$reader = [BinaryReader]::new($file.OpenRead())
+
+try {
+	if ($reader.BaseStream.Length -lt $HeaderSize -or $reader.ReadUInt32() -ne $ArchiveMagic) {
+		Write-Error "'$($file.FullName)' is not a screenshot archive."
+	}
+
+	$entries = [System.Collections.Generic.List[object]]::new()
+
+	# Use the index at the end when the archive was closed properly
+	$length = $reader.BaseStream.Length
+	if ($length -ge $HeaderSize + $FooterSize) {
+		$reader.BaseStream.Position = $length - $FooterSize
+		$index_offset = $reader.ReadUInt64()
+		$count = $reader.ReadUInt32()
+
+		if ($reader.ReadUInt32() -eq $IndexMagic -and $index_offset + $count * $EntrySize + $FooterSize -eq $length) {
+			$reader.BaseStream.Position = $index_offset
+			for ($i = 0; $i -lt $count; $i++) {
+				$offset = $reader.ReadUInt64()
+				$reader.ReadUInt64() | Out-Null # Size of the image, which is in the chunk as well
+				$reader.ReadInt64() | Out-Null # Frame time
+				$repeat_index = $reader.ReadUInt32()
+				$reader.ReadUInt32() | Out-Null
+				$entries.Add(@{ Offset = $offset; RepeatIndex = $repeat_index })
+			}
+		}
+	}
+
+	# Otherwise the game exited before it was closed, so walk the chunks from the start
+	if ($entries.Count -eq 0) {
+		Write-Warning "'$($file.Name)' has no index, reading the images that were written completely."
+
+		$offset = $HeaderSize
+		while ($offset + $ChunkSize -le $length) {
+			$reader.BaseStream.Position = $offset
+			if ($reader.ReadUInt32() -ne $ChunkMagic) {
+				break
+			}
+			$repeat_index = $reader.ReadUInt32()
+			$reader.ReadInt64() | Out-Null
+			$size = $reader.ReadUInt64()
+			$name_size = $reader.ReadUInt32()
+
+			$next = $offset + $ChunkSize + $name_size + $size
+			if ($next -gt $length) {
+				break
+			}
+
+			$entries.Add(@{ Offset = $offset; RepeatIndex = $repeat_index })
+			$offset = $next
+		}
+
+		$entries = $entries | Sort-Object { $_.RepeatIndex }
+	}
+
+	if ($Index) {
+		$entries = $entries | Where-Object { $Index -contains $_.RepeatIndex }
+	}
+
+	if (-not $List) {
+		if (-not $Destination) {
+			$Destination = Join-Path $file.DirectoryName $file.BaseName
+		}
+		New-Item -ItemType Directory -Force -Path $Destination | Out-Null
+	}
+
+	$names = [System.Collections.Generic.HashSet[string]]::new([System.StringComparer]::OrdinalIgnoreCase)
+
+	foreach ($entry in $entries) {
+		$reader.BaseStream.Position = $entry.Offset
+		if ($reader.ReadUInt32() -ne $ChunkMagic) {
+			Write-Error "Chunk at offset $($entry.Offset) in '$($file.Name)' is damaged."
+		}
+		$repeat_index = $reader.ReadUInt32()
+		$frame_time = [DateTimeOffset]::FromUnixTimeMilliseconds([long]($reader.ReadInt64() / 1000000)).LocalDateTime
+		$size = $reader.ReadUInt64()
+		$name_size = $reader.ReadUInt32()
+		$reader.ReadUInt32() | Out-Null
+		$name = [System.Text.Encoding]::UTF8.GetString($reader.ReadBytes($name_size))
+
+		if ($List) {
+			[PSCustomObject]@{ Index = $repeat_index; Time = $frame_time; Size = $size; Name = $name }
+			continue
+		}
+
+		# Paths without a frame number give every image the same name, which are told apart by their index then
+		if (-not $names.Add($name)) {
+			$name = "$([Path]::GetFileNameWithoutExtension($name)) $repeat_index$([Path]::GetExtension($name))"
+			$names.Add($name) | Out-Null
+		}
+
+		$target = Join-Path $Destination $name
+		[File]::WriteAllBytes($target, $reader.ReadBytes($size))
+		[File]::SetLastWriteTime($target, $frame_time)
+
+		Write-Output $target
+	}
+}
+finally {
+	$reader.Dispose()
+}